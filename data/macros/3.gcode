@@ -0,0 +1,16 @@
+; Probe Z, the program of button 3
+; The probing moves are only sent once grbl has accepted the previous line. This needs a host
+; that passes grbl's ok and error answers back to the wheel on the serial link; with a host
+; that does not, the first line times out after MACRO_ACK_TIMEOUT_MS and the program fails.
+; Remove "@ack on" to stream the lines without waiting.
+@ack on
+@set fast 80
+@set slow 10
+@msg Probing Z
+G4 P3
+G21G91G38.2Z-30F{fast}
+G0Z1
+G38.2Z-2F{slow}
+G92 Z0
+G0Z5
+M30
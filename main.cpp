@@ -25,6 +25,13 @@
 #include "src/logging/SerialLogger.h"
 #include "src/display/display_wheel.h"
 #include "src/wheel/wheel.h"
+#include "src/diagnostics/diagnostics.h"
+#include "src/diagnostics/boot_profiler.h"
+#include "src/journal/event_journal.h"
+#include "src/config/live_state.h"
+#include "src/macro/macro_engine.h"
+#include "src/serial/serial_tx.h"
+#include "src/tasks/task_plan.h"
 
 #define TELEMETRY_FREQUENCY_MILLISECS 120000
 #define AP_ENABLE_PIN 0
@@ -65,40 +72,9 @@
 
 static Config config;
 Wheel *wheel = NULL;
-TaskHandle_t wifi_task = NULL;
 static bool has_wifi = true;
 static bool config_mode = false;
 
-/**
- * @brief Task runner for a one time task connecting to Wifi.
- * @param args - Task arguments 
- */
-void connect_WiFi(void* args)
-{
-  int wifi_try_counter = 0;
-  bool connected = false;
-
-  if(wheel != NULL) 
-    wheel->write_status_message(F("Attempting to connect to Wifi %s"), config.ssid);
-  while (true)
-  {
-    connected = config.Connect_Wifi();
-    if(connected) break;
-    if(wifi_try_counter++ > 5) break;
-  }
-  if(connected) 
-  {
-    if(wheel != NULL) wheel->write_status_message(F("Wifi connected to %s: %s"), config.ssid, WiFi.localIP().toString());
-    config.InitializeTime();
-  }
-  else
-  {
-    if(wheel != NULL) wheel->write_status_message(F("Wifi failed to connect to %s"), config.ssid);
-  }
-  vTaskDelete(wifi_task);
-  wifi_task=NULL;
-}
-
 #ifdef SET_LOOP_TASK_STACK_SIZE
 SET_LOOP_TASK_STACK_SIZE(16384);
   //
@@ -107,27 +83,11 @@ SET_LOOP_TASK_STACK_SIZE(16384);
 #endif
 
 /**
- * @brief Performs system setup activities, including connecting to WIFI, setting time, obtaining the IoTHub info 
- * from DPS if necessary and connecting the IoTHub. Use this method to also register various delegates and command
- * handlers.
- * 
+ * @brief Prints the configuration and starts the configuration access point if it is enabled
  */
-void setup()
+void start_access_point()
 {
-  //
-  // Initialize configuration data from EEPROM
-  //
-  config.Initialize(false);
-  Logger.SetSpeed(config.baud_rate);
-
-  Logger.Info_f(F("Copyright 2024, Thor Schueler, Firmware Version: %s"), "0.00.00");
-  Logger.Info_f(F("Loop task stack size: %i"), getArduinoLoopTaskStackSize());
-  Logger.Info_f(F("Loop task stack high water mark: %i"), uxTaskGetStackHighWaterMark(NULL));
-  Logger.Info_f(F("Total heap: %d"), ESP.getHeapSize()); 
-  Logger.Info_f(F("Free heap: %d"), ESP.getFreeHeap()); 
-  Logger.Info_f(F("Total PSRAM: %d"), ESP.getPsramSize()); 
-  Logger.Info_f(F("Free PSRAM: %d"), ESP.getFreePsram());
-  Logger.Info(F("... Startup"));
+  int64_t start = Boot.Now();
   config.Print();
 
   // 
@@ -153,24 +113,163 @@ void setup()
       Logger.Info_f(F("Config AP disabled. Do not pull GPIO%i low to enable the Config AP."), AP_ENABLE_PIN);  
     }
   }
-  wheel = new Wheel();
-  xTaskCreatePinnedToCore(connect_WiFi, "wificonnector", 2048, NULL, 1, &wifi_task, 0);
+  Boot.Phase("access point", start);
+}
+
+/**
+ * @brief Task runner for the startup work deferred until the wheel is live: the configuration 
+ * access point, the WiFi connection and persisting the display bus clocks once the display task 
+ * has calibrated them.
+ * @param args - Task arguments 
+ */
+void deferred_startup(void* args)
+{
+#if !BOOT_SEQUENTIAL
+  start_access_point();
+#endif
+  int64_t start = Boot.Now();
+  config.Connect_Wifi();
+  Boot.Phase("network", start);
+
+  wheel->wait_for_display();
+  config.SetDisplayBusFrequency(wheel->get_display_write_frequency(), wheel->get_display_read_frequency());
+  Boot.Milestone("startup done");
+  Boot.Report();
   if(config_mode)
-  {
     Logger.Info_f(F("Device is in config mode. Do not pull GPIO %i low to enter normal operations"), AP_ENABLE_PIN);
-    return;
-  }  
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief Performs system setup activities. The serial link and the wheel come up first, so the 
+ * wheel can jog as early as possible. The access point, WiFi and the display initialization are 
+ * deferred to background tasks. Use this method to also register various delegates and command
+ * handlers.
+ * 
+ */
+void setup()
+{
+  //
+  // Initialize configuration data from NVS
+  //
+  int64_t start = Boot.Now();
+  config.Initialize(false);
+  Boot.Phase("config", start);
+  start = Boot.Now();
+  Logger.Configure(config.log_sinks, config.log_level, config.log_binary);
+  Logger.SetTimestampFields(config.log_timestamp);
+  Tasks.Select(config.task_profile);
+  Logger.Flush();
+  Serial.flush();
+  Serial.end();
+  Serial.begin(config.baud_rate);
+    // opened through uartBegin, which carries the clock source fix described above. Nothing
+    // reopens the port once the transmit task owns it
+  Tx.Begin(Serial);
+  Boot.Phase("serial link", start);
+  Diag.Register("log", "Log lines buffered in memory", [](Print &out, const String &args) {
+    Logger.DumpRam(out);
+  });
+  Diag.Register("logfile", "Log file on the flash file system", [](Print &out, const String &args) {
+    Logger.DumpFile(out);
+  });
+  Journal.Begin();
+  Diag.Register("journal", "Persistent event journal, '<n>' for the last n records, 'clear' to erase", [](Print &out, const String &args) {
+    if(args == "clear")
+    {
+      Journal.Clear();
+      out.println(F("Journal cleared"));
+    }
+    else Journal.Dump(out, args.toInt());
+  });
+  Diag.Register("config", "Configuration as JSON, import it with PUT " CONFIG_API_IMPORT_URI, [](Print &out, const String &args) {
+    config.ExportJson(out);
+    out.println();
+  });
+  Diag.Register("serial", "Serial link queue depth and latency, 'reset' to clear", [](Print &out, const String &args) {
+    if(args == "reset") 
+    {
+      Tx.Reset();
+      out.println(F("Serial link statistics reset"));
+    }
+    else Tx.Print(out);
+  });
+  Diag.Register("boot", "Boot phases with microsecond timestamps", [](Print &out, const String &args) {
+    Boot.Print(out);
+  });
+  Diag.Register("tasks", "Task placement of the active profile and stack use", [](Print &out, const String &args) {
+    Tasks.Print(out);
+  });
+  Diag.Register("bench", "Task wakeup latency in every profile, '[ms] [load]' per run and with a busy display task", [](Print &out, const String &args) {
+    uint32_t ms = args.toInt();
+    Tasks.Bench(out, ms > 0 ? ms : 1000, args.indexOf("load") >= 0);
+  }, true);
+    // blocks for six runs, too long for the web server task
+
+  Logger.Info_f(F("Copyright 2024, Thor Schueler, Firmware Version: %s"), "0.00.00");
+  Logger.Info_f(F("Loop task stack size: %i"), getArduinoLoopTaskStackSize());
+  Logger.Info_f(F("Loop task stack high water mark: %i"), uxTaskGetStackHighWaterMark(NULL));
+  Logger.Info_f(F("Total heap: %d"), ESP.getHeapSize()); 
+  Logger.Info_f(F("Free heap: %d"), ESP.getFreeHeap()); 
+  Logger.Info_f(F("Total PSRAM: %d"), ESP.getPsramSize()); 
+  Logger.Info_f(F("Free PSRAM: %d"), ESP.getFreePsram());
+  Logger.Info(F("... Startup"));
+
+#if BOOT_SEQUENTIAL
+  start_access_point();
+#endif
+  start = Boot.Now();
+  wheel = new Wheel(config.spi_write_frequency, config.spi_read_frequency);
+  Boot.Phase("wheel", start);
+  Live.Begin(wheel);
+  Macros.Begin(wheel);
+  Diag.OnLine([](const char *line) { Macros.OnHostLine(line); });
+  Diag.Register("macro", "Button programs, 'stop' to cancel, 'refresh' to rescan", [](Print &out, const String &args) {
+    if(args == "stop") 
+    {
+      Macros.Cancel();
+      out.println(F("Program cancelled"));
+    }
+    else
+    {
+      if(args == "refresh") Macros.Refresh();
+      Macros.Print(out);
+    }
+  });
+  Diag.Register("run", "Starts a button program, <n>[_alt|_long|+<m>]", [](Print &out, const String &args) {
+    bool started = Macros.Run(MacroEngine::Program(args.c_str(), args.length()));
+    out.println(started ? F("Program started") : F("No such program, another program is running or the emergency stop is engaged"));
+  }, true);
+    // moves the machine, so a request to the web server must not be able to start it
+
+  Network.OnChange([](network_event_t event) {
+    switch(event)
+    {
+      case NETWORK_EVENT_CONNECTING: wheel->write_status_message(F("Attempting to connect to Wifi %s"), Network.SSID()); break;
+      case NETWORK_EVENT_CONNECTED: wheel->write_status_message(F("Wifi connected to %s: %s"), Network.SSID(), WiFi.localIP().toString().c_str()); break;
+      case NETWORK_EVENT_DISCONNECTED: wheel->write_status_message(F("Wifi failed to connect to %s"), Network.SSID()); break;
+      default: break;
+    }
+  });
+  Diag.Register("network", "WiFi connection and clock state", [](Print &out, const String &args) {
+    Network.Print(out);
+  });
+  Tasks.Create(TASK_STARTUP, deferred_startup, NULL);
   
   Logger.Info(F("... Init done"));
   Logger.Info_f(F("Free heap: %d"), ESP.getFreeHeap()); 
 }
 
 /**
- * @brief Main loop. Use this loop to execute recurring tasks. In this sample, we will periodically send telemetry
- * and query and update the device twin.  
+ * @brief Main loop. Use this loop to execute recurring tasks. Currently it applies pending configuration
+ * changes and services diagnostic queries received over the serial link.  
  * 
  */
 void loop()
 {
-  vTaskDelay(1000);
+  config.Poll();
+  static SerialTxPrint diag_out;
+  Diag.Poll(Serial, diag_out);
+  diag_out.flush();
+  vTaskDelay(50);
 }
@@ -0,0 +1,297 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * JSON REST interface of the config server.
+ *
+ *   GET  /api/config          the configuration, without the WiFi password
+ *   PUT  /api/config          updates the values present in the document
+ *   GET  /api/commands/<n>    command slot n, 1 to 12
+ *   PUT  /api/commands/<n>    updates the fields of command slot n present in the document
+ *   GET  /api/macros/<n>      the program of button n, ?alt for the alternate program; <n> may 
+ *                             also name a long press or chord program, such as 3_long or 3+5
+ *   PUT  /api/macros/<n>      stores the request body as the program of button n
+ *   DELETE /api/macros/<n>    removes the program of button n
+ *   PUT  /api/import          replaces the configuration with an export document, missing values
+ *                             take their defaults
+ *
+ * Documents use the keys of the configuration export (see Config::ExportJson).
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <AsyncJson.h>
+#include <SPIFFS.h>
+#include "config_page.h"
+#include "live_state.h"
+#include "../macro/macro_engine.h"
+#include "../logging/SerialLogger.h"
+
+/**
+ * @brief Gets the command slot addressed by a request
+ * 
+ * @param request - the request
+ * @return the zero based slot, -1 if the url does not address a slot
+ */
+static int command_slot(AsyncWebServerRequest *request)
+{
+  String n = request->url().substring(strlen(CONFIG_API_COMMANDS_URI) + 1);
+  int slot = n.toInt();
+  if(slot < 1 || slot > COMMAND_COUNT || String(slot) != n) return -1;
+  return slot - 1;
+}
+
+/**
+ * @brief Gets the path of the program addressed by a request
+ * 
+ * @param request - the request
+ * @param path - receives the path, MACRO_PATH_SIZE bytes
+ * @return true if the url addresses a program, false otherwise
+ */
+static bool macro_path(AsyncWebServerRequest *request, char *path)
+{
+  String n = request->url().substring(strlen(CONFIG_API_MACROS_URI) + 1);
+  n.replace(' ', MACRO_CHORD_SEPARATOR);
+    // the url is decoded with + turned into a space
+  if(request->hasParam("alt")) n += MACRO_ALT_SUFFIX;
+  int program = MacroEngine::Program(n.c_str(), n.length());
+  if(program < 0) return false;
+  MacroEngine::Path(program, path);
+  return true;
+}
+
+/**
+ * @brief Checks that a JSON object only holds the string fields of a command
+ * 
+ * @param command - the object
+ * @return true if the object is valid, false otherwise
+ */
+static bool valid_command(JsonObjectConst command)
+{
+  for(JsonPairConst kv : command)
+  {
+    const char *key = kv.key().c_str();
+    if(strcmp(key, "c") != 0 && strcmp(key, "cn") != 0 && strcmp(key, "ca") != 0 && strcmp(key, "cna") != 0) return false;
+    if(!kv.value().is<const char *>()) return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Sends a JSON document
+ * 
+ * @param request - the request
+ * @param document - the document
+ */
+static void send_json(AsyncWebServerRequest *request, const JsonDocument &document)
+{
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  serializeJson(document, *response);
+  request->send(response);
+}
+
+#pragma region private methods
+/**
+ * @brief Registers the REST routes and the live state WebSocket with the web server
+ * 
+ */
+void Config::attach_api()
+{
+  server.on(CONFIG_API_URI, HTTP_GET, [=](AsyncWebServerRequest *request) {
+    DynamicJsonDocument d = DynamicJsonDocument(EEPROM_SIZE);
+    d["ssid"] = this->ssid;
+    d["speed"] = this->baud_rate;
+    d["spiw"] = this->spi_write_frequency;
+    d["spir"] = this->spi_read_frequency;
+    d["logs"] = this->log_sinks;
+    d["logl"] = this->log_level;
+    d["logb"] = this->log_binary;
+    d["logt"] = this->log_timestamp;
+    d["tasks"] = this->task_profile;
+    JsonArray commands = d["commands"].to<JsonArray>();
+    for(int i=0; i<COMMAND_COUNT; i++) this->command_to_json(i, commands.createNestedObject());
+    send_json(request, d);
+  });
+
+  server.on(CONFIG_API_COMMANDS_URI, HTTP_GET, [=](AsyncWebServerRequest *request) {
+    int slot = command_slot(request);
+    if(slot < 0)
+    {
+      request->send(404, "text/plain", "Unknown command slot");
+      return;
+    }
+    DynamicJsonDocument d = DynamicJsonDocument(1024);
+    this->command_to_json(slot, d.to<JsonObject>());
+    send_json(request, d);
+  });
+
+  AsyncCallbackJsonWebHandler *config_handler = new AsyncCallbackJsonWebHandler(CONFIG_API_URI, [=](AsyncWebServerRequest *request, JsonVariant &json) {
+    if(!json.is<JsonObject>() || !this->update_from_json(json.as<JsonObjectConst>()))
+    {
+      request->send(400, "text/plain", "Invalid configuration document");
+      return;
+    }
+    this->write_values();
+    this->apply_values();
+    request->send(204);
+  });
+  config_handler->setMethod(HTTP_PUT | HTTP_POST);
+  server.addHandler(config_handler);
+
+  AsyncCallbackJsonWebHandler *command_handler = new AsyncCallbackJsonWebHandler(CONFIG_API_COMMANDS_URI, [=](AsyncWebServerRequest *request, JsonVariant &json) {
+    int slot = command_slot(request);
+    if(slot < 0)
+    {
+      request->send(404, "text/plain", "Unknown command slot");
+      return;
+    }
+    if(!json.is<JsonObject>() || !this->command_from_json(slot, json.as<JsonObjectConst>()))
+    {
+      request->send(400, "text/plain", "Invalid command document");
+      return;
+    }
+    this->write_values();
+    this->apply_values();
+    request->send(204);
+  });
+  command_handler->setMethod(HTTP_PUT | HTTP_POST);
+  server.addHandler(command_handler);
+
+  server.on(CONFIG_API_IMPORT_URI, HTTP_PUT | HTTP_POST, [=](AsyncWebServerRequest *request) {
+    if(request->contentLength() == 0) request->send(400, "text/plain", "Empty configuration document");
+    else if(request->contentLength() > EEPROM_SIZE) request->send(413, "text/plain", "Configuration document too large");
+    else if(request->_tempObject == nullptr) request->send(500, "text/plain", "Unable to buffer the configuration document");
+    else if(!this->ImportJson(String((const char *)request->_tempObject))) request->send(400, "text/plain", "Invalid configuration document");
+    else request->send(204);
+  }, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    // the body arrives in chunks and is collected in the request's buffer, which the request frees
+    if(total > EEPROM_SIZE) return;
+    if(index == 0) request->_tempObject = calloc(1, total + 1);
+    if(request->_tempObject == nullptr || index + len > total) return;
+    memcpy((uint8_t *)request->_tempObject + index, data, len);
+  });
+
+  server.on(CONFIG_API_MACROS_URI, HTTP_GET, [](AsyncWebServerRequest *request) {
+    char path[MACRO_PATH_SIZE];
+    if(!macro_path(request, path) || !SPIFFS.exists(path)) request->send(404, "text/plain", "No such program");
+    else request->send(SPIFFS, path, "text/plain");
+  });
+
+  server.on(CONFIG_API_MACROS_URI, HTTP_DELETE, [](AsyncWebServerRequest *request) {
+    char path[MACRO_PATH_SIZE];
+    if(Macros.IsRunning())
+    {
+      request->send(409, "text/plain", "A program is running");
+      return;
+    }
+    if(!macro_path(request, path) || !SPIFFS.remove(path))
+    {
+      request->send(404, "text/plain", "No such program");
+      return;
+    }
+    Macros.Refresh();
+    request->send(204);
+  });
+
+  server.on(CONFIG_API_MACROS_URI, HTTP_PUT, [](AsyncWebServerRequest *request) {
+    char path[MACRO_PATH_SIZE];
+    if(!macro_path(request, path)) request->send(404, "text/plain", "Unknown button");
+    else if(request->contentLength() == 0) request->send(400, "text/plain", "Empty program");
+    else if(request->contentLength() > CONFIG_API_MACRO_SIZE) request->send(413, "text/plain", "Program too large");
+    else if(Macros.IsRunning()) request->send(409, "text/plain", "A program is running");
+    else if((SPIFFS.exists(path) && !SPIFFS.remove(path)) || !SPIFFS.rename(MACRO_DIRECTORY "/upload.tmp", path)) request->send(500, "text/plain", "Unable to store the program");
+    else
+    {
+      Macros.Refresh();
+      request->send(204);
+    }
+  }, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    // the body is streamed to a temporary file in chunks and renamed once complete, so a
+    // running program is never replaced by a partial upload
+    if(total > CONFIG_API_MACRO_SIZE) return;
+    File file = SPIFFS.open(MACRO_DIRECTORY "/upload.tmp", index == 0 ? FILE_WRITE : FILE_APPEND);
+    if(file) 
+    {
+      file.write(data, len);
+      file.close();
+    }
+  });
+
+  Live.Attach(server);
+}
+
+/**
+ * @brief Updates the configuration values present in a JSON document. The document is validated
+ * before any value is changed.
+ * 
+ * @param d - the document
+ * @return true if the document is valid, false otherwise
+ */
+bool Config::update_from_json(JsonObjectConst d)
+{
+  for(JsonPairConst kv : d)
+  {
+    const char *key = kv.key().c_str();
+    JsonVariantConst v = kv.value();
+    if(strcmp(key, "ssid") == 0 || strcmp(key, "pwd") == 0) { if(!v.is<const char *>()) return false; }
+    else if(strcmp(key, "speed") == 0) { if(!v.is<uint32_t>() || v.as<uint32_t>() == 0) return false; }
+    else if(strcmp(key, "logs") == 0 || strcmp(key, "logt") == 0) { if(!v.is<uint8_t>()) return false; }
+    else if(strcmp(key, "logl") == 0) { if(!v.is<uint8_t>() || v.as<uint8_t>() > LOG_LEVEL_NONE) return false; }
+    else if(strcmp(key, "logb") == 0) { if(!v.is<bool>()) return false; }
+    else if(strcmp(key, "tasks") == 0) { if(!v.is<uint8_t>() || v.as<uint8_t>() >= TASK_PROFILE_COUNT) return false; }
+    else if(strcmp(key, "commands") == 0) 
+    { 
+      if(!v.is<JsonArrayConst>() || v.size() > COMMAND_COUNT) return false; 
+      for(JsonVariantConst command : v.as<JsonArrayConst>()) if(!command.is<JsonObjectConst>() || !valid_command(command)) return false;
+    }
+    else return false;
+      // the bus clocks are calibrated by the device and not settable
+  }
+  uint8_t sinks = d["logs"].is<uint8_t>() ? d["logs"].as<uint8_t>() : this->log_sinks;
+  bool binary = d["logb"].is<bool>() ? d["logb"].as<bool>() : this->log_binary;
+  if(binary && (sinks & LOG_SINK_PRIMARY_UART)) return false;
+    // binary records would interleave with the GRBL replies on the link
+  if(d["ssid"].is<const char *>()) this->ssid = d["ssid"].as<const char *>();
+  if(d["pwd"].is<const char *>()) this->password = d["pwd"].as<const char *>();
+  if(d["speed"].is<uint32_t>()) this->baud_rate = d["speed"];
+  if(d["logs"].is<uint8_t>()) this->log_sinks = d["logs"];
+  if(d["logl"].is<uint8_t>()) this->log_level = d["logl"];
+  if(d["logb"].is<bool>()) this->log_binary = d["logb"];
+  if(d["logt"].is<uint8_t>()) this->log_timestamp = d["logt"];
+  if(d["tasks"].is<uint8_t>()) this->task_profile = d["tasks"];
+  int idx = 0;
+  for(JsonVariantConst command : d["commands"].as<JsonArrayConst>()) this->command_from_json(idx++, command.as<JsonObjectConst>());
+  return true;
+}
+
+/**
+ * @brief Writes a command slot to a JSON object
+ * 
+ * @param idx - the zero based slot
+ * @param command - the object to write to
+ */
+void Config::command_to_json(int idx, JsonObject command)
+{
+  command["c"] = this->Commands[idx].command_on;
+  command["cn"] = this->Commands[idx].name_on;
+  command["ca"] = this->Commands[idx].command_off;
+  command["cna"] = this->Commands[idx].name_off;
+}
+
+/**
+ * @brief Updates the fields of a command slot present in a JSON object
+ * 
+ * @param idx - the zero based slot
+ * @param command - the object
+ * @return true if the object is valid, false otherwise
+ */
+bool Config::command_from_json(int idx, JsonObjectConst command)
+{
+  if(!valid_command(command)) return false;
+  if(command["c"].is<const char *>()) copy_field(this->Commands[idx].command_on, COMMAND_SIZE, command["c"].as<const char *>());
+  if(command["cn"].is<const char *>()) copy_field(this->Commands[idx].name_on, COMMAND_NAME_SIZE, command["cn"].as<const char *>());
+  if(command["ca"].is<const char *>()) copy_field(this->Commands[idx].command_off, COMMAND_SIZE, command["ca"].as<const char *>());
+  if(command["cna"].is<const char *>()) copy_field(this->Commands[idx].name_off, COMMAND_NAME_SIZE, command["cna"].as<const char *>());
+  return true;
+}
+#pragma endregion
@@ -1,15 +1,153 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <EEPROM.h>
-#include <regex>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
 #include "config_page.h"
+#include "gzip.h"
 #include "../logging/SerialLogger.h"
+#include "../diagnostics/diagnostics.h"
+#include "../journal/event_journal.h"
+#include "../serial/serial_tx.h"
 
 const char *assid = ACCESS_POINT_NAME;
 const char *asecret = ACCESS_POINT_PWD;
 const char *PARAM_INPUT_ssid = "SSID";
 const char *PARAM_INPUT_psw = "psw";
 
+/**
+ * @brief Tokens of the config page template and fields of the config form
+ * 
+ */
+typedef enum : uint8_t
+{
+  TOKEN_UNKNOWN = 0,
+  TOKEN_SUCCESSFULLY_CONNECTED,
+  TOKEN_PLEASE_RESTART,
+  TOKEN_SSID,
+  TOKEN_PWD,
+  TOKEN_BAUDRATE,
+  TOKEN_LOG_UART,
+  TOKEN_LOG_UART2,
+  TOKEN_LOG_RAM,
+  TOKEN_LOG_FILE,
+  TOKEN_LOG_BINARY,
+  TOKEN_LOG_TS_MS,
+  TOKEN_LOG_TS_US,
+  TOKEN_LOGLEVEL,
+  TOKEN_LOGLEVEL_INFO,
+  TOKEN_LOGLEVEL_ERROR,
+  TOKEN_LOGLEVEL_NONE,
+  TOKEN_COMMAND_ON,       // N_CMD
+  TOKEN_COMMAND_OFF,      // N_CMD_ALT
+  TOKEN_NAME_ON,          // N_CMD_NAME
+  TOKEN_NAME_OFF          // N_CMD_NAME_ALT
+} config_token_t;
+
+/**
+ * @brief FNV-1a hash of a token name, usable as a case label
+ * 
+ * @param s - the token name
+ * @param h - the hash of the preceding characters
+ * @return the hash
+ */
+static constexpr uint32_t token_hash(const char *s, uint32_t h = 2166136261u)
+{
+  return *s == '\0' ? h : token_hash(s + 1, (h ^ (uint8_t)*s) * 16777619u);
+}
+
+/**
+ * @brief Identifies a template token or form field
+ * 
+ * @param name - the token or field name
+ * @param index - receives the zero based command slot for command tokens
+ * @return the token, TOKEN_UNKNOWN if the name is not recognized
+ */
+static config_token_t lookup_token(const char *name, int *index)
+{
+  config_token_t token = TOKEN_UNKNOWN;
+  const char *literal = nullptr;
+
+  if(*name >= '0' && *name <= '9')
+  {
+    // command tokens: N_CMD[_NAME][_ALT]
+    int n = 0;
+    while(*name >= '0' && *name <= '9') n = n * 10 + (*name++ - '0');
+    if(n < 1 || n > COMMAND_COUNT || strncmp(name, "_CMD", 4) != 0) return TOKEN_UNKNOWN;
+    name += 4;
+    *index = n - 1;
+    if(*name == '\0') return TOKEN_COMMAND_ON;
+    if(strcmp(name, "_ALT") == 0) return TOKEN_COMMAND_OFF;
+    if(strcmp(name, "_NAME") == 0) return TOKEN_NAME_ON;
+    if(strcmp(name, "_NAME_ALT") == 0) return TOKEN_NAME_OFF;
+    return TOKEN_UNKNOWN;
+  }
+
+  switch(token_hash(name))
+  {
+    #define TOKEN_CASE(id, text) case token_hash(text): token = id; literal = text; break;
+    TOKEN_CASE(TOKEN_SUCCESSFULLY_CONNECTED, "SUCCESSFULLY_CONNECTED")
+    TOKEN_CASE(TOKEN_PLEASE_RESTART, "PLEASE_RESTART")
+    TOKEN_CASE(TOKEN_SSID, "SSID")
+    TOKEN_CASE(TOKEN_PWD, "PWD")
+    TOKEN_CASE(TOKEN_PWD, "psw")
+      // the password field is posted as psw, but rendered with the PWD token
+    TOKEN_CASE(TOKEN_BAUDRATE, "BAUDRATE")
+    TOKEN_CASE(TOKEN_LOG_UART, "LOG_UART")
+    TOKEN_CASE(TOKEN_LOG_UART2, "LOG_UART2")
+    TOKEN_CASE(TOKEN_LOG_RAM, "LOG_RAM")
+    TOKEN_CASE(TOKEN_LOG_FILE, "LOG_FILE")
+    TOKEN_CASE(TOKEN_LOG_BINARY, "LOG_BINARY")
+    TOKEN_CASE(TOKEN_LOG_TS_MS, "LOG_TS_MS")
+    TOKEN_CASE(TOKEN_LOG_TS_US, "LOG_TS_US")
+    TOKEN_CASE(TOKEN_LOGLEVEL, "LOGLEVEL")
+    TOKEN_CASE(TOKEN_LOGLEVEL_INFO, "LOGLEVEL_INFO")
+    TOKEN_CASE(TOKEN_LOGLEVEL_ERROR, "LOGLEVEL_ERROR")
+    TOKEN_CASE(TOKEN_LOGLEVEL_NONE, "LOGLEVEL_NONE")
+    #undef TOKEN_CASE
+  }
+  // the hash only selects the candidate, unrelated names may share it
+  if(literal == nullptr || strcmp(name, literal) != 0) return TOKEN_UNKNOWN;
+  return token;
+}
+
+/**
+ * @brief Checks whether the client takes gzip compressed responses
+ * 
+ * @param request - the request
+ * @return true if the request accepts gzip, false otherwise
+ */
+static bool accepts_gzip(AsyncWebServerRequest *request)
+{
+  return request->hasHeader("Accept-Encoding") && strstr(request->header("Accept-Encoding").c_str(), "gzip") != nullptr;
+}
+
+/**
+ * @brief Sends a static asset from the spiffs partition, the .gz variant with Content-Encoding: gzip
+ * if the client takes it
+ * 
+ * @param request - the request
+ * @param path - the path of the uncompressed asset
+ * @param type - the content type
+ */
+static void send_asset(AsyncWebServerRequest *request, const char *path, const char *type)
+{
+  String gz = String(path) + ".gz";
+  bool compressed = accepts_gzip(request) && SPIFFS.exists(gz);
+  if(!compressed && !SPIFFS.exists(path))
+  {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+  AsyncWebServerResponse *response = request->beginResponse(SPIFFS, compressed ? gz : String(path), type);
+  if(compressed) response->addHeader("Content-Encoding", "gzip");
+  response->addHeader("Cache-Control", CONFIG_STATIC_CACHE_CONTROL);
+  response->addHeader("Vary", "Accept-Encoding");
+  request->send(response);
+}
+
 /**
  * @brief Static web server object.
  * 
@@ -22,62 +160,79 @@ AsyncWebServer Config::server = AsyncWebServer(80);
  */
 Config::Config()
 {
-  // initialize the commands array with 12 command slots
-  for(int i=0; i<12; i++) this->Commands.emplace(i, Command{String(i),"N " + String(i),"Alt " + String(i),"Alt N " + String(i)});
+  memset(this->Commands, 0, sizeof(this->Commands));
 }
 
 
 #pragma region public methods
 /**
- * @brief Connects the board to the configured WIFI access point. 
+ * @brief Starts connecting the board to the configured WIFI access point and setting the time. 
+ * Returns immediately, the connection is made and kept by the network task.
  * 
- * @return true if connection succeeded
- * @return false 
  */
-bool Config::Connect_Wifi()
+void Config::Connect_Wifi()
 {
-  pinMode(LED_BUILTIN, OUTPUT);
-  // read configuration from Flash
   if(!this->has_config) this->get_config();
-  if(this->ssid.isEmpty())
+  if(!this->wifi_started)
   {
-    Logger.Error("No SSID set. Cannot connect to Wifi");
-    delay(500);
-    return false;
+    Network.OnChange([this](network_event_t event) {
+      bool connected = Network.State() == NETWORK_CONNECTED;
+      if(connected == this->wifi_connected) return;
+      this->wifi_connected = connected;
+      this->invalidate_page();
+    });
+    this->wifi_started = true;
   }
+  Network.Begin(this->ssid, this->password);
+}
 
-  if (!WiFi.isConnected())
+/**
+ * @brief Writes the configuration as a JSON document
+ * 
+ * @param out - the output to write to
+ */
+void Config::ExportJson(::Print &out)
+{
+  if(!this->has_config) this->get_config(false);
+  DynamicJsonDocument config = DynamicJsonDocument(EEPROM_SIZE);
+  config["ssid"] = this->ssid;
+  config["pwd"] = this->password;
+  config["speed"] = this->baud_rate;
+  config["spiw"] = this->spi_write_frequency;
+  config["spir"] = this->spi_read_frequency;
+  config["logs"] = this->log_sinks;
+  config["logl"] = this->log_level;
+  config["logb"] = this->log_binary;
+  config["logt"] = this->log_timestamp;
+  config["tasks"] = this->task_profile;
+  JsonArray commands = config["commands"].to<JsonArray>();
+  for(int i=0; i<COMMAND_COUNT; i++)
   {
-    digitalWrite(LED_BUILTIN, HIGH); 
-    if (this->password[0] == '\0') Logger.Info(F("No WiFi password set. Continue without..."));
-    WiFi.begin(this->ssid.c_str(), this->password.c_str());
-    Logger.Info("");
-    for (int i = 0; i <= 20; i += 1)
-    {
-      delay(500);
-      if (WiFi.isConnected())
-      {
-        this->wifi_connected = true;
-        Logger.Info("");
-        Logger.Info_f(F("WiFi connected to %s"), ssid);
-        Logger.Info_f(F("IP address: %s"), WiFi.localIP().toString().c_str());
-        digitalWrite(LED_BUILTIN, LOW); 
-        return true;
-      }
-      //Serial.print(".");
-      //Serial.flush();
-    }
-    if (!WiFi.isConnected())
-    {
-      Logger.Error_f(F("Could not connect to WIFI %s..."), ssid);
-      return false;
-    }
+    JsonObject command = commands.createNestedObject();
+    command["c"] = this->Commands[i].command_on;
+    command["cn"] = this->Commands[i].name_on;
+    command["ca"] = this->Commands[i].command_off;
+    command["cna"] = this->Commands[i].name_off;
   }
+  serializeJson(config, out);
+}
+
+/**
+ * @brief Sets and saves the configuration from a JSON document as written by ExportJson
+ * 
+ * @param json - the JSON document
+ * @return true if the document was imported, false otherwise
+ */
+bool Config::ImportJson(const String &json)
+{
+  if(!this->import_json(json)) return false;
+  this->write_values();
+  this->apply_values();
   return true;
 }
 
 /**
- * @brief Initialize config structures from EEPROM
+ * @brief Initialize config structures from NVS
  * @param print - true to print the value, false otherwise
  */
 void Config::Initialize(bool print)
@@ -86,23 +241,16 @@ void Config::Initialize(bool print)
 }
 
 /**
- * @brief Initialize system time from time server.
+ * @brief Applies changes that have to wait for a safe point. Call regularly from the loop task.
  * 
  */
-void Config::InitializeTime()
+void Config::Poll()
 {
-  Logger.Info("Setting time using SNTP");
-  configTime(GMT_OFFSET_SECS, GMT_OFFSET_SECS_DST, NTP_SERVERS);
-  time_t now = time(NULL);
-  while (now < UNIX_TIME_NOV_13_2017)
-  {
-    delay(500);
-    //Serial.print(".");
-    //Serial.flush();
-    now = time(nullptr);
-  }
-  //Serial.println("");
-  Logger.Info("Time initialized!");
+  uint32_t baud_rate = this->pending_baud_rate.exchange(0);
+  if(baud_rate == 0) return;
+  Tx.SetBaudRate(baud_rate);
+    // lets the queued lines go out at the old rate
+  Logger.Info_f(F("Serial baud rate changed to %u"), baud_rate);
 }
 
 /**
@@ -119,18 +267,37 @@ void Config::Print()
   Logger.Info_f(F("SSID: %s"), this->ssid.c_str());
   Logger.Info_f(F("SSID Password: %s"), password.length() > 0 ? F("******") : F(""));
   Logger.Info_f(F("Serial Baud Rate: %u"), baud_rate);
+  Logger.Info_f(F("Display SPI clocks: write %u Hz, read %u Hz"), spi_write_frequency, spi_read_frequency);
+  Logger.Info_f(F("Log sinks: 0x%02x, level: %u, binary: %s, timestamp fields: 0x%02x"), log_sinks, log_level, log_binary ? "yes" : "no", log_timestamp);
+  Logger.Info_f(F("Task profile: %s"), TaskPlan::ProfileName(task_profile));
   Logger.Info(F("Configured Commands:"));
-  for(int idx=0; idx<12; idx++)
-    if(Commands[idx]._name_on != "")
-      Logger.Info_f(F("     %s"), Commands[idx]._name_on.c_str());
+  for(int idx=0; idx<COMMAND_COUNT; idx++)
+    if(Commands[idx].name_on[0] != '\0')
+      Logger.Info_f(F("     %s"), Commands[idx].name_on);
+}
+
+/**
+ * @brief Persists the display SPI clocks determined by the bus calibration
+ * 
+ * @param write_frequency - the SPI clock used to write to the display
+ * @param read_frequency - the SPI clock used to read from the display
+ */
+void Config::SetDisplayBusFrequency(uint32_t write_frequency, uint32_t read_frequency)
+{
+  if(write_frequency == this->spi_write_frequency && read_frequency == this->spi_read_frequency) return;
+  this->spi_write_frequency = write_frequency;
+  this->spi_read_frequency = read_frequency;
+  this->write_values();
+  this->values_saved = false;
+    // the bus clocks are not user settings, so we do not show the save notice
 }
 
 /**
  * @brief Starts an access point at the ESP. 
  * Starts a webserver at 192.168.1.4
  * Hosts a website at root (/) to configure the local WiFi.
- * Writes the password to the EEPROM of the ESP
- * Connects to the WiFi, when it is possible with the credentials from the EEPROM. 
+ * Writes the password to the NVS of the ESP
+ * Connects to the WiFi, when it is possible with the credentials from the NVS. 
  * 
  */
 void Config::StartAP()
@@ -156,40 +323,56 @@ void Config::StartAP()
     request->send(404, "text/plain", "Not found");
   });
   server.on("/", HTTP_GET, [=](AsyncWebServerRequest *request) {
-    this->values_saved = false;
-    request->send_P(200, "text/html", index_html, [=](const String &var){
-      return this->processor(var);
-    });
+    if(this->values_saved)
+    {
+      this->values_saved = false;
+      this->invalidate_page();
+    }
+    this->send_page(request);
   });
   this->server.on("/", HTTP_POST, [=](AsyncWebServerRequest *request) {
-    std::regex pattern("([0-9]{1,})_CMD_?(NAME)?_?(ALT)?");
-    std::cmatch match;
     int params_amount = request->params();
+    this->log_sinks = 0;
+    this->log_binary = false;
+    this->log_timestamp = 0;
+      // unchecked boxes are not posted
     for (int i = 0; i < params_amount; i++)
     {
       const AsyncWebParameter *p = request->getParam(i);
-      if (strcmp(p->name().c_str(), PARAM_INPUT_ssid) == 0) this->ssid = String(p->value());
-      else if (strcmp(p->name().c_str(), PARAM_INPUT_psw) == 0) this->password = String(p->value()); 
-      else if (strcmp(p->name().c_str(), "BAUDRATE") == 0) this->baud_rate = (uint32_t)strtol((p->value()).c_str(), NULL, 10);
-      else if (std::regex_match(p->name().c_str(), match, pattern))
+      int idx = 0;
+      switch(lookup_token(p->name().c_str(), &idx))
       {
-          // we have a match to a command attribute. 
-          if (match[1].matched)
-          {
-            int idx = std::stoi(match[1].str())-1;
-            if(!match[2].matched && !match[3].matched) Commands[idx]._command_on = Command_t::unescape_ctrl_characters(p->value());
-            if(!match[2].matched && match[3].matched) Commands[idx]._command_off = Command_t::unescape_ctrl_characters(p->value());
-            if(match[2].matched && !match[3].matched) Commands[idx]._name_on = p->value();
-            if(match[2].matched && match[3].matched) Commands[idx]._name_off = p->value();
-          }
+        case TOKEN_SSID: this->ssid = p->value(); break;
+        case TOKEN_PWD: this->password = p->value(); break;
+        case TOKEN_BAUDRATE: this->baud_rate = (uint32_t)strtol((p->value()).c_str(), NULL, 10); break;
+        case TOKEN_LOG_UART: this->log_sinks |= LOG_SINK_PRIMARY_UART; break;
+        case TOKEN_LOG_UART2: this->log_sinks |= LOG_SINK_SECONDARY_UART; break;
+        case TOKEN_LOG_RAM: this->log_sinks |= LOG_SINK_RAM; break;
+        case TOKEN_LOG_FILE: this->log_sinks |= LOG_SINK_FILE; break;
+        case TOKEN_LOG_BINARY: this->log_binary = true; break;
+        case TOKEN_LOG_TS_MS: this->log_timestamp |= LOG_TIMESTAMP_MILLIS; break;
+        case TOKEN_LOG_TS_US: this->log_timestamp |= LOG_TIMESTAMP_MONOTONIC; break;
+        case TOKEN_LOGLEVEL: this->log_level = (uint8_t)strtol((p->value()).c_str(), NULL, 10); break;
+        case TOKEN_COMMAND_ON: unescape_field(Commands[idx].command_on, COMMAND_SIZE, p->value().c_str()); break;
+        case TOKEN_COMMAND_OFF: unescape_field(Commands[idx].command_off, COMMAND_SIZE, p->value().c_str()); break;
+        case TOKEN_NAME_ON: copy_field(Commands[idx].name_on, COMMAND_NAME_SIZE, p->value().c_str()); break;
+        case TOKEN_NAME_OFF: copy_field(Commands[idx].name_off, COMMAND_NAME_SIZE, p->value().c_str()); break;
+        default: break;
       }
     }
-    this->write_values_to_eeprom();
+    this->check_log_format();
+    this->write_values();
+    this->apply_values();
     this->Print();
-    request->send_P(200, "text/html", index_html, [=](const String &var){
-      return this->processor(var);
-    });
+    this->send_page(request);
+  });
+  this->attach_api();
+  server.on(CONFIG_STATIC_URI "config.css", HTTP_GET, [](AsyncWebServerRequest *request) {
+    send_asset(request, CONFIG_STATIC_PATH "config.css", "text/css");
   });
+    // serveStatic prefers the uncompressed file while both are uploaded
+  server.serveStatic(CONFIG_STATIC_URI, SPIFFS, CONFIG_STATIC_PATH).setCacheControl(CONFIG_STATIC_CACHE_CONTROL);
+  Diag.Attach(server);
   server.begin();
 }
 
@@ -210,19 +393,129 @@ void Config::StopAP()
 
 #pragma region protected methods
 /**
- * @brief Reads the configuration from EEPROM
+ * @brief Reads the configuration from NVS. On first boot after an update the configuration
+ * is migrated from the JSON document earlier versions kept in EEPROM.
  * @param print - true to print the value, false otherwise
  * 
  */
 void Config::get_config(bool print)
 {  
-  this->read_values_from_eeprom();
+  int64_t start = esp_timer_get_time();
+  memcpy(this->Commands, Wheel::DefaultCommands, sizeof(this->Commands));
+    // slots of a configuration that was never saved keep the built in commands
+  if(this->read_values())
+    Logger.Info_f(F("Config record loaded in %u us"), (uint32_t)(esp_timer_get_time() - start));
+  else if(this->read_values_from_eeprom())
+  {
+    Logger.Info(F("Migrating configuration from EEPROM"));
+    this->write_values();
+    this->values_saved = false;
+  }
   this->has_config = true;
+  Wheel::Commands.Publish(this->Commands);
   if(print) this->Print();
 }
 #pragma endregion
 
 #pragma region private methods
+/**
+ * @brief Renders the config page and compresses it
+ * 
+ * @return the page, or an empty pointer if the page could not be rendered
+ */
+std::shared_ptr<Config::rendered_page_t> Config::render_page()
+{
+  std::shared_ptr<rendered_page_t> rendered = std::make_shared<rendered_page_t>();
+  const char *p = index_html;
+  String html;
+  uint8_t *data;
+  size_t size;
+
+  html.reserve(strlen(index_html) + 2048);
+  while(*p != '\0')
+  {
+    const char *start = strchr(p, '%');
+    if(start == nullptr)
+    {
+      html += p;
+      break;
+    }
+    html.concat(p, start - p);
+    const char *end = start + 1;
+    while(isalnum(*end) || *end == '_') end++;
+    if(*end == '%' && end > start + 1)
+    {
+      html += this->processor(String(start + 1, end - start - 1));
+      p = end + 1;
+    }
+    else if(*end == '%')
+    {
+      html += '%';
+        // %% renders a single percent sign
+      p = end + 1;
+    }
+    else
+    {
+      html += '%';
+      p = start + 1;
+    }
+  }
+
+  size = gzip_bound(html.length());
+  data = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if(data == nullptr) data = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  if(data == nullptr) return nullptr;
+  rendered->data = data;
+  rendered->length = gzip_compress((const uint8_t *)html.c_str(), html.length(), data, size);
+  if(rendered->length == 0) return nullptr;
+  snprintf(rendered->etag, sizeof(rendered->etag), "\"%08x\"", (unsigned)esp_rom_crc32_le(0, data, rendered->length));
+  Logger.Info_f(F("Config page rendered, %u bytes compressed to %u"), html.length(), rendered->length);
+  return rendered;
+}
+
+/**
+ * @brief Sends the config page. The page is rendered once and served from the cache until the
+ * configuration changes; a GET for the cached version is answered with 304.
+ * 
+ * @param request - the request
+ */
+void Config::send_page(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<rendered_page_t> rendered;
+  if(!accepts_gzip(request))
+  {
+    request->send_P(200, "text/html", index_html, [=](const String &var){
+      return this->processor(var);
+    });
+    return;
+  }
+  if(this->page_outdated.exchange(false) || !this->page) this->page = this->render_page();
+  rendered = this->page;
+  if(!rendered)
+  {
+    this->page_outdated = true;
+    request->send(500, "text/plain", "Unable to render page");
+    return;
+  }
+  if(request->method() == HTTP_GET && request->hasHeader("If-None-Match") && request->header("If-None-Match") == rendered->etag)
+  {
+    request->send(304);
+    return;
+  }
+  // the response holds on to the page, so a page rendered while it is sent does not pull the data away
+  AsyncWebServerResponse *response = request->beginResponse("text/html", rendered->length, [rendered](uint8_t *buffer, size_t max_length, size_t index) -> size_t {
+    size_t length = rendered->length - index;
+    if(length > max_length) length = max_length;
+    memcpy(buffer, rendered->data + index, length);
+    return length;
+  });
+  response->addHeader("Content-Encoding", "gzip");
+  response->addHeader("ETag", rendered->etag);
+  response->addHeader("Cache-Control", "no-cache");
+    // the browser revalidates on every load and gets a 304 until the configuration changes
+  request->send(response);
+}
+
 /**
  * @brief Implements the 404 Handler for the web server
  * 
@@ -233,6 +526,19 @@ void Config::not_found(AsyncWebServerRequest *request)
   request->send(404, "text/plain", "Not found");
 }
 
+/**
+ * @brief Escapes a command for the config page
+ * 
+ * @param command - the command
+ * @return String - the escaped command
+ */
+static String escaped_command(const char *command)
+{
+  char escaped[COMMAND_ESCAPED_SIZE];
+  escape_ctrl_characters(command, escaped, sizeof(escaped));
+  return String(escaped);
+}
+
 /**
  * @brief Returns the actual values corresponding to various tokens in the page. 
  * 
@@ -241,30 +547,50 @@ void Config::not_found(AsyncWebServerRequest *request)
  */
 String Config::processor(const String &var)
 {
-  std::regex pattern("([0-9]{1,})_CMD_?(NAME)?_?(ALT)?");
-  std::cmatch match;
-  if (var == "SUCCESSFULLY_CONNECTED" && this->wifi_connected == true) return F("<p style=\"color:green;\">Successfully connected to WiFi!</p>");
-  if (var == "SUCCESSFULLY_CONNECTED" && this->wifi_connected == false) return F("<p style=\"color:red;\">Not connected to WiFi!</p>");
-  if (var == "PLEASE_RESTART" && this->values_saved == true) return F("<p>Settings saved! Please restart the controller.</p>");
-  if (var == "PLEASE_RESTART" && this->values_saved == false) return F("");
-  if (var == "SSID") return this->ssid;
-  if (var == "PWD") return this->password;
-  if (var == "BAUDRATE") return String(this->baud_rate);
-  if (std::regex_match(var.c_str(), match, pattern))
-  { 
-    if (match[1].matched)
-    {
-      int idx = std::stoi(match[1].str())-1;
-      if(!match[2].matched && !match[3].matched) return Command_t::escape_ctrl_characters(Commands[idx]._command_on);
-      if(!match[2].matched && match[3].matched) return Command_t::escape_ctrl_characters(Commands[idx]._command_off);
-      if(match[2].matched && !match[3].matched) return Commands[idx]._name_on;
-      if(match[2].matched && match[3].matched) return Commands[idx]._name_off;
-    }
+  int idx = 0;
+  switch(lookup_token(var.c_str(), &idx))
+  {
+    case TOKEN_SUCCESSFULLY_CONNECTED: 
+      return this->wifi_connected ? F("<p class=\"ok\">Successfully connected to WiFi!</p>") : F("<p class=\"error\">Not connected to WiFi!</p>");
+    case TOKEN_PLEASE_RESTART: return this->values_saved ? F("<p>Settings saved and applied.</p>") : F("");
+    case TOKEN_SSID: return this->ssid;
+    case TOKEN_PWD: return this->password;
+    case TOKEN_BAUDRATE: return String(this->baud_rate);
+    case TOKEN_LOG_UART: return (this->log_sinks & LOG_SINK_PRIMARY_UART) ? F("checked") : F("");
+    case TOKEN_LOG_UART2: return (this->log_sinks & LOG_SINK_SECONDARY_UART) ? F("checked") : F("");
+    case TOKEN_LOG_RAM: return (this->log_sinks & LOG_SINK_RAM) ? F("checked") : F("");
+    case TOKEN_LOG_FILE: return (this->log_sinks & LOG_SINK_FILE) ? F("checked") : F("");
+    case TOKEN_LOG_BINARY: return this->log_binary ? F("checked") : F("");
+    case TOKEN_LOG_TS_MS: return (this->log_timestamp & LOG_TIMESTAMP_MILLIS) ? F("checked") : F("");
+    case TOKEN_LOG_TS_US: return (this->log_timestamp & LOG_TIMESTAMP_MONOTONIC) ? F("checked") : F("");
+    case TOKEN_LOGLEVEL_INFO: return this->log_level == LOG_LEVEL_INFO ? F("selected") : F("");
+    case TOKEN_LOGLEVEL_ERROR: return this->log_level == LOG_LEVEL_ERROR ? F("selected") : F("");
+    case TOKEN_LOGLEVEL_NONE: return this->log_level == LOG_LEVEL_NONE ? F("selected") : F("");
+    case TOKEN_COMMAND_ON: return escaped_command(Commands[idx].command_on);
+    case TOKEN_COMMAND_OFF: return escaped_command(Commands[idx].command_off);
+    case TOKEN_NAME_ON: return String(Commands[idx].name_on);
+    case TOKEN_NAME_OFF: return String(Commands[idx].name_off);
+    default: break;
   }
   Logger.Info_f(F("Unknonw token: %s"), var.c_str());
   return String();
 }
 
+/**
+ * @brief Applies the configuration to the running system. The commands and the logging settings
+ * take effect immediately, a baud rate change with the next Poll. Changed WiFi credentials
+ * make the network task reconnect.
+ * 
+ */
+void Config::apply_values()
+{
+  Wheel::Commands.Publish(this->Commands);
+  Logger.Configure(this->log_sinks, this->log_level, this->log_binary);
+  Logger.SetTimestampFields(this->log_timestamp);
+  if(this->baud_rate != Serial.baudRate()) this->pending_baud_rate = this->baud_rate;
+  if(this->wifi_started) Network.Begin(this->ssid, this->password);
+}
+
 /**
  * @brief Reads string from EEPROM
  * 
@@ -295,107 +621,254 @@ String Config::read_string_from_eeprom(int addrOffset, int *pos)
 }
 
 /**
- * @brief Reads configuration values from EEPROM
+ * @brief Reads the configuration written as JSON to EEPROM by earlier firmware versions
  * 
+ * @return true if a configuration was found, false otherwise
  */
-void Config::read_values_from_eeprom()
+bool Config::read_values_from_eeprom()
 {
   // the first two eeprom bytes simply contain the string OK. That is to indicate that the eeprom partition has been written at least once. 
   // this is followed by a byte containin the length of the serialized JSON config string followed by hte string itself.  
   int pos = 0;
-  if(EEPROM.begin(EEPROM_SIZE)) Logger.Info(F("EEPROM initialized."));
-  else 
+  bool found = false;
+  if(!EEPROM.begin(EEPROM_SIZE))
   {
     Logger.Error(F("Critital - Unable to initialize EEPROM."));
-    return;
+    return false;
   }
   if(read_string_from_eeprom(pos, &pos) == "OK")
   {
     Logger.Info(F("Found valid EEPROM block"));
-    String s = read_string_from_eeprom(pos, &pos);
-    DynamicJsonDocument d = DynamicJsonDocument(EEPROM_SIZE);
-    deserializeJson(d, s);
-    this->ssid = String(d["ssid"].as<String>());
-    this->password = String(d["pwd"].as<String>());
-    this->baud_rate = d["speed"];
-    int idx=0;
-    for (JsonObject command : d["commands"].as<JsonArray>()) 
-    {
-      this->Commands[idx]._command_on = String(command["c"].as<String>());
-      this->Commands[idx]._name_on = String(command["cn"].as<String>());
-      this->Commands[idx]._command_off = String(command["ca"].as<String>());
-      this->Commands[idx]._name_off = String(command["cna"].as<String>());
-      idx++;
-    }
+    found = this->import_json(read_string_from_eeprom(pos, &pos));
   }
   EEPROM.end();
+  return found;
 }
 
 /**
- * @brief Writes a string to EEPROM
+ * @brief Sets the configuration from a JSON document. Missing values keep their defaults.
  * 
- * @param addrOffset - offset at which to write
- * @param str_to_write - string to write
- * @return int the position in the Flash where the next object can be written
+ * @param json - the JSON document
+ * @return true if the document could be parsed, false otherwise
  */
-int Config::write_string_to_eeprom(int addrOffset, const String &str_to_write)
+bool Config::import_json(const String &json)
 {
-  int i = 0;
-  uint16_t len = str_to_write.length();
-  byte b1 = len & 0x000000ff;
-  byte b2 = (len & 0x0000ff00) >> 8;
-  EEPROM.write(addrOffset++, b2);
-  EEPROM.write(addrOffset++, b1);
-  if (len > 0)
+  DynamicJsonDocument d = DynamicJsonDocument(EEPROM_SIZE);
+  DeserializationError error = deserializeJson(d, json);
+  if(error)
+  {
+    Logger.Error_f(F("Unable to parse config document: %s"), error.c_str());
+    return false;
+  }
+  this->ssid = String(d["ssid"] | "");
+  this->password = String(d["pwd"] | "");
+  this->baud_rate = d["speed"] | this->baud_rate;
+  this->spi_write_frequency = d["spiw"] | 0;
+  this->spi_read_frequency = d["spir"] | 0;
+  this->log_sinks = d["logs"] | LOG_SINK_DEFAULT;
+  this->log_level = d["logl"] | LOG_LEVEL_INFO;
+  this->log_binary = d["logb"] | false;
+  this->log_timestamp = d["logt"] | LOG_TIMESTAMP_DEFAULT;
+  this->task_profile = d["tasks"] | TASK_PROFILE_DEFAULT;
+  if(this->task_profile >= TASK_PROFILE_COUNT) this->task_profile = TASK_PROFILE_DEFAULT;
+  this->check_log_format();
+  int idx=0;
+  for (JsonObject command : d["commands"].as<JsonArray>()) 
+  {
+    if(idx >= COMMAND_COUNT) break;
+    copy_field(this->Commands[idx].command_on, COMMAND_SIZE, command["c"] | "");
+    copy_field(this->Commands[idx].name_on, COMMAND_NAME_SIZE, command["cn"] | "");
+    copy_field(this->Commands[idx].command_off, COMMAND_SIZE, command["ca"] | "");
+    copy_field(this->Commands[idx].name_off, COMMAND_NAME_SIZE, command["cna"] | "");
+    idx++;
+  }
+  return true;
+}
+
+/**
+ * @brief Reads the configuration record from NVS
+ * 
+ * @return true if a valid record was found, false otherwise
+ */
+bool Config::read_values()
+{
+  Preferences prefs;
+  config_record_t *record;
+  size_t size;
+  bool valid = false;
+
+  if(!prefs.begin(CONFIG_NVS_NAMESPACE, true)) return false;
+    // fails if the namespace has never been written
+  if(!prefs.isKey(CONFIG_NVS_KEY))
+  {
+    prefs.end();
+    return false;
+  }
+  record = (config_record_t *)calloc(1, sizeof(config_record_t));
+  if(record == nullptr)
+  {
+    prefs.end();
+    return false;
+  }
+  size = prefs.getBytes(CONFIG_NVS_KEY, record, sizeof(config_record_t));
+  prefs.end();
+
+  if(size < CONFIG_RECORD_HEADER_SIZE || record->magic != CONFIG_RECORD_MAGIC || record->size != size)
+    Logger.Error(F("Config record is malformed."));
+  else if(record->version > CONFIG_RECORD_VERSION)
+    Logger.Error_f(F("Config record version %u is newer than supported version %u."), record->version, CONFIG_RECORD_VERSION);
+  else if(record->crc != esp_rom_crc32_le(0, (const uint8_t *)record + CONFIG_RECORD_HEADER_SIZE, size - CONFIG_RECORD_HEADER_SIZE))
+    Logger.Error(F("Config record checksum mismatch."));
+  else
   {
-    for (i = 0; i < len; i++)
+    if(size < sizeof(config_record_t))
     {
-      EEPROM.write(addrOffset + i, str_to_write[i]);
+      // fields appended after the version that wrote the record keep their defaults
+      config_record_t *defaults = (config_record_t *)calloc(1, sizeof(config_record_t));
+      if(defaults != nullptr)
+      {
+        this->fill_record(defaults);
+        memcpy((uint8_t *)record + size, (const uint8_t *)defaults + size, sizeof(config_record_t) - size);
+        free(defaults);
+      }
     }
+    if(record->version < 2) record->task_profile = TASK_PROFILE_DEFAULT;
+      // the byte was padding in version 1, the size and checksum match but it holds zero
+    this->apply_record(*record);
+    valid = true;
   }
-  return addrOffset + i;
+  free(record);
+  return valid;
 }
 
 /**
- * @brief Write configuration values to EEPROM
+ * @brief Writes the configuration record to NVS
  * 
  */
-void Config::write_values_to_eeprom()
+void Config::write_values()
 {
-  // the first two eeprom bytes simply contain the string OK. That is to indicate that the eeprom partition has been written at least once. 
-  // this is followed by a byte containin the length of the serialized JSON config string followed by hte string itself.   
-  if(EEPROM.begin(EEPROM_SIZE)) Logger.Info(F("EEPROM initialized."));
-  else 
+  Preferences prefs;
+  config_record_t *record = (config_record_t *)calloc(1, sizeof(config_record_t));
+  bool saved = false;
+
+  if(record == nullptr)
   {
-    Logger.Error(F("Critital - Unable to initialize EEPROM."));
+    Logger.Error(F("Critical - Unable to allocate config record."));
     return;
   }
-  int pos = write_string_to_eeprom(0, "OK");
-
-  DynamicJsonDocument config = DynamicJsonDocument(EEPROM_SIZE);
-  config["ssid"] = this->ssid;
-  config["pwd"] = this->password;
-  config["speed"] = this->baud_rate;
-  JsonArray commands = config["commands"].to<JsonArray>();
-  for(int i=0; i<12; i++)
+  this->fill_record(record);
+  record->magic = CONFIG_RECORD_MAGIC;
+  record->version = CONFIG_RECORD_VERSION;
+  record->size = sizeof(config_record_t);
+  record->crc = esp_rom_crc32_le(0, (const uint8_t *)record + CONFIG_RECORD_HEADER_SIZE, sizeof(config_record_t) - CONFIG_RECORD_HEADER_SIZE);
+  if(prefs.begin(CONFIG_NVS_NAMESPACE, false))
   {
-    JsonObject command = commands.createNestedObject();
-    command["c"] = this->Commands[i]._command_on;
-    command["cn"] = this->Commands[i]._name_on;
-    command["ca"] = this->Commands[i]._command_off;
-    command["cna"] = this->Commands[i]._name_off;
+    saved = prefs.putBytes(CONFIG_NVS_KEY, record, sizeof(config_record_t)) == sizeof(config_record_t);
+    prefs.end();
   }
-  int size = measureJson(config) + 1;
-  char *buf = (char *)malloc(size*sizeof(char));
-  serializeJson(config, buf, size);
-  pos = write_string_to_eeprom(pos, buf);
-  free(buf);
-
-  if(!EEPROM.commit()) Logger.Error(F("Critical - Unable to commit EEPROM changes."));
-  EEPROM.end();
+  free(record);
 
+  if(!saved)
+  {
+    Logger.Error(F("Critical - Unable to write config record."));
+    Journal.Record(JOURNAL_ERROR, JOURNAL_SOURCE_CONFIG, 1);
+    return;
+  }
   Logger.Info(F("New value saved in flash memory"));
   values_saved = true;  
+  this->invalidate_page();
+}
+
+/**
+ * @brief Copies the configuration into a record. The record header is left unchanged.
+ * 
+ * @param record - the record to fill
+ */
+void Config::fill_record(config_record_t *record)
+{
+  record->baud_rate = this->baud_rate;
+  record->spi_write_frequency = this->spi_write_frequency;
+  record->spi_read_frequency = this->spi_read_frequency;
+  record->log_sinks = this->log_sinks;
+  record->log_level = this->log_level;
+  record->log_binary = this->log_binary ? 1 : 0;
+  record->log_timestamp = this->log_timestamp;
+  record->task_profile = this->task_profile;
+  copy_field(record->ssid, sizeof(record->ssid), this->ssid.c_str());
+  copy_field(record->password, sizeof(record->password), this->password.c_str());
+  memcpy(record->commands, this->Commands, sizeof(record->commands));
+}
+
+/**
+ * @brief Sets the configuration from a record
+ * 
+ * @param record - the record
+ */
+void Config::apply_record(config_record_t &record)
+{
+  record.ssid[CONFIG_SSID_LENGTH - 1] = '\0';
+  record.password[CONFIG_PASSWORD_LENGTH - 1] = '\0';
+  this->ssid = record.ssid;
+  this->password = record.password;
+  this->baud_rate = record.baud_rate;
+  this->spi_write_frequency = record.spi_write_frequency;
+  this->spi_read_frequency = record.spi_read_frequency;
+  this->log_sinks = record.log_sinks;
+  this->log_level = record.log_level;
+  this->log_binary = record.log_binary != 0;
+  this->log_timestamp = record.log_timestamp;
+  this->task_profile = record.task_profile;
+  if(this->task_profile >= TASK_PROFILE_COUNT)
+  {
+    Logger.Error_f(F("Config task profile %u is unknown, using %s."), this->task_profile, TaskPlan::ProfileName(TASK_PROFILE_DEFAULT));
+    this->task_profile = TASK_PROFILE_DEFAULT;
+  }
+  this->check_log_format();
+  for(int i=0; i<COMMAND_COUNT; i++)
+  {
+    command_slot_t &c = record.commands[i];
+    c.name_on[COMMAND_NAME_SIZE - 1] = '\0';
+    c.command_on[COMMAND_SIZE - 1] = '\0';
+    c.name_off[COMMAND_NAME_SIZE - 1] = '\0';
+    c.command_off[COMMAND_SIZE - 1] = '\0';
+  }
+  memcpy(this->Commands, record.commands, sizeof(this->Commands));
+}
+
+/**
+ * @brief Turns binary log records off when the primary UART sink is selected. The host reads the
+ * link as GRBL replies, records between them would corrupt the stream.
+ */
+void Config::check_log_format()
+{
+  if(!this->log_binary || !(this->log_sinks & LOG_SINK_PRIMARY_UART)) return;
+  Logger.Error(F("Binary log records are not supported on the serial connection, logging text."));
+  this->log_binary = false;
+}
+
+/**
+ * @brief Copies a string into a fixed size record field
+ * 
+ * @param field - the field
+ * @param size - the size of the field, including the terminating zero
+ * @param value - the value to copy
+ */
+void Config::copy_field(char *field, size_t size, const char *value)
+{
+  if(strlen(value) >= size) Logger.Error_f(F("Config value '%s' truncated to %u characters."), value, size - 1);
+  strlcpy(field, value, size);
+}
+
+/**
+ * @brief Decodes a command as entered on the config page into a fixed size record field
+ * 
+ * @param field - the field
+ * @param size - the size of the field, including the terminating zero
+ * @param value - the command with control characters written as [CTRL]+<letter>
+ */
+void Config::unescape_field(char *field, size_t size, const char *value)
+{
+  if(unescape_ctrl_characters(value, field, size) >= size) Logger.Error_f(F("Config command '%s' truncated to %u characters."), value, size - 1);
 }
 #pragma endregion
 
@@ -9,20 +9,32 @@
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <EEPROM.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <memory>
 #include "html.h"
+#include "config_record.h"
+#include "network_manager.h"
 #include "../wheel/wheel.h"
+#include "../logging/SerialLogger.h"
+#include "../tasks/task_plan.h"
 
-// Utility macros and time defines
-#define NTP_SERVERS "pool.ntp.org", "time.nist.gov"
-#define UNIX_TIME_NOV_13_2017 1510592825
+// size of the EEPROM block earlier versions kept the JSON configuration in, also bounds
+// the JSON documents used for import and export
+#define EEPROM_SIZE 8192
 
-#define GST_TIME_ZONE -6
-#define GST_TIME_ZONE_DAYLIGHT_SAVINGS_DIFF   1
-#define GMT_OFFSET_SECS (GST_TIME_ZONE * 3600)
-#define GMT_OFFSET_SECS_DST (GST_TIME_ZONE_DAYLIGHT_SAVINGS_DIFF * 3600)
+// static assets of the config page, uploaded to the spiffs partition from the data folder. The
+// stylesheet is also stored as config.css.gz (gzip -9n) and sent compressed to clients taking gzip.
+#define CONFIG_STATIC_URI "/static/"
+#define CONFIG_STATIC_PATH "/www/"
+#define CONFIG_STATIC_CACHE_CONTROL "max-age=86400"
 
-// enables EEPROM usage
-#define EEPROM_SIZE 8192
+// REST interface, see config_api.cpp
+#define CONFIG_API_URI "/api/config"
+#define CONFIG_API_COMMANDS_URI "/api/commands"
+#define CONFIG_API_MACROS_URI "/api/macros"
+#define CONFIG_API_IMPORT_URI "/api/import"
+#define CONFIG_API_MACRO_SIZE 16384
 
 //Access point configuration
 #define ACCESS_POINT_NAME "cnc_hand_wheel"
@@ -34,7 +46,7 @@
 
 
 /**
- * @brief This class manages settings serializing and deserialization from EEPROM, the configuration web server, 
+ * @brief This class manages settings serializing and deserialization from NVS, the configuration web server, 
  * Connection to Wifi and time management. 
  * 
  */
@@ -49,24 +61,38 @@ class Config
     Config();
     
     /**
-     * @brief Connects the board to the configured WIFI access point. 
+     * @brief Starts connecting the board to the configured WIFI access point and setting the time. 
+     * Returns immediately, the connection is made and kept by the network task.
+     * 
+     */
+    void Connect_Wifi();
+
+    /**
+     * @brief Writes the configuration as a JSON document
      * 
-     * @return true if connection succeeded
-     * @return false 
+     * @param out - the output to write to
      */
-    bool Connect_Wifi();
+    void ExportJson(::Print &out);
 
     /**
-    * @brief Initialize config structures from EEPROM
+     * @brief Sets and saves the configuration from a JSON document as written by ExportJson
+     * 
+     * @param json - the JSON document
+     * @return true if the document was imported, false otherwise
+     */
+    bool ImportJson(const String &json);
+
+    /**
+    * @brief Initialize config structures from NVS
     * @param print - true to printout the config values
     */
     void Initialize(bool print=true);
 
     /**
-     * @brief Initialize system time from time server.
+     * @brief Applies changes that have to wait for a safe point. Call regularly from the loop task.
      * 
      */
-    void InitializeTime();
+    void Poll();
 
     /**
      * @brief Prints the current configuration
@@ -74,12 +100,20 @@ class Config
      */    
     void Print();
 
+    /**
+     * @brief Persists the display SPI clocks determined by the bus calibration
+     * 
+     * @param write_frequency - the SPI clock used to write to the display
+     * @param read_frequency - the SPI clock used to read from the display
+     */
+    void SetDisplayBusFrequency(uint32_t write_frequency, uint32_t read_frequency);
+
     /**
      * @brief Starts an access point at the ESP. 
      * Starts a webserver at 192.168.1.4
      * Hosts a website at root (/) to configure the local WiFi.
-     * Writes the password to the EEPROM of the ESP
-     * Connects to the WiFi, when it is possible with the credentials from the EEPROM. 
+     * Writes the password to the NVS of the ESP
+     * Connects to the WiFi, when it is possible with the credentials from the NVS. 
      * 
      */
     void StartAP();
@@ -96,11 +130,19 @@ class Config
     String ssid = "";
 
     uint32_t baud_rate = 115200;
-    std::unordered_map<uint8_t, Command_t> Commands;
+    uint32_t spi_write_frequency = 0;
+    uint32_t spi_read_frequency = 0;
+    uint8_t log_sinks = LOG_SINK_DEFAULT;
+    uint8_t log_level = LOG_LEVEL_INFO;
+    bool log_binary = false;
+    uint8_t log_timestamp = LOG_TIMESTAMP_DEFAULT;
+    uint8_t task_profile = TASK_PROFILE_DEFAULT;
+      // takes effect with the next boot
+    command_slot_t Commands[COMMAND_COUNT];
 
   protected:
     /**
-     * @brief Reads the configuration from EEPROM
+     * @brief Reads the configuration from NVS, migrating it from EEPROM on first boot
      * @param print - true to print the value, false otherwise
      */
     void get_config(bool print=true);
@@ -112,6 +154,71 @@ class Config
     String password = "";
 
   private:
+    /**
+     * @brief Registers the REST routes and the live state WebSocket with the web server
+     * 
+     */
+    void attach_api();
+
+    /**
+     * @brief Updates the configuration values present in a JSON document. The document is validated
+     * before any value is changed.
+     * 
+     * @param d - the document
+     * @return true if the document is valid, false otherwise
+     */
+    bool update_from_json(JsonObjectConst d);
+
+    /**
+     * @brief Writes a command slot to a JSON object
+     * 
+     * @param idx - the zero based slot
+     * @param command - the object to write to
+     */
+    void command_to_json(int idx, JsonObject command);
+
+    /**
+     * @brief Updates the fields of a command slot present in a JSON object
+     * 
+     * @param idx - the zero based slot
+     * @param command - the object
+     * @return true if the object is valid, false otherwise
+     */
+    bool command_from_json(int idx, JsonObjectConst command);
+
+    /**
+     * @brief The rendered config page, gzip compressed
+     * 
+     */
+    typedef struct rendered_page
+    {
+      uint8_t *data = nullptr;
+      size_t length = 0;
+      char etag[11] = "";
+      ~rendered_page() { free(data); }
+    } rendered_page_t;
+
+    /**
+     * @brief Marks the rendered page as outdated
+     * 
+     */
+    void invalidate_page() { this->page_outdated = true; }
+
+    /**
+     * @brief Renders the config page and compresses it
+     * 
+     * @return the page, or an empty pointer if the page could not be rendered
+     */
+    std::shared_ptr<rendered_page_t> render_page();
+
+    /**
+     * @brief Sends the config page. The page is rendered once and served from the cache until the
+     * configuration changes; a GET for the cached version is answered with 304.
+     * 
+     * @param request - the request
+     */
+    void send_page(AsyncWebServerRequest *request);
+
     /**
      * @brief Implements the 404 Handler for the web server
      * 
@@ -127,6 +234,14 @@ class Config
      */    
     String processor(const String &var);
     
+    /**
+     * @brief Applies the configuration to the running system. The commands and the logging settings
+     * take effect immediately, a baud rate change with the next Poll. Changed WiFi credentials
+   * make the network task reconnect.
+     * 
+     */
+    void apply_values();
+
     /**
      * @brief Reads string from EEPROM
      * 
@@ -137,30 +252,78 @@ class Config
     static String read_string_from_eeprom(int addrOffset, int *pos);
     
     /**
-     * @brief Reads configuration values from EEPROM
+     * @brief Reads the configuration written as JSON to EEPROM by earlier firmware versions
      * 
+     * @return true if a configuration was found, false otherwise
      */
-    void read_values_from_eeprom();
-    
+    bool read_values_from_eeprom();
+
     /**
-     * @brief Writes a string to EEPROM
+     * @brief Sets the configuration from a JSON document. Missing values keep their defaults.
      * 
-     * @param addrOffset - offset at which to write
-     * @param str_to_write - string to write
-     * @return int the position in the Flash where the next object can be written
-     */    
-    static int write_string_to_eeprom(int addrOffset, const String &str_to_write);
-    
+     * @param json - the JSON document
+     * @return true if the document could be parsed, false otherwise
+     */
+    bool import_json(const String &json);
+
     /**
-     * @brief Write configuration values to EEPROM
+     * @brief Reads the configuration record from NVS
      * 
-     */    
-    void write_values_to_eeprom();
+     * @return true if a valid record was found, false otherwise
+     */
+    bool read_values();
+
+    /**
+     * @brief Writes the configuration record to NVS
+     * 
+     */
+    void write_values();
+
+    /**
+     * @brief Copies the configuration into a record. The record header is left unchanged.
+     * 
+     * @param record - the record to fill
+     */
+    void fill_record(config_record_t *record);
+
+    /**
+     * @brief Sets the configuration from a record
+     * 
+     * @param record - the record
+     */
+    void apply_record(config_record_t &record);
+
+    /**
+     * @brief Turns binary log records off when the primary UART sink is selected
+     */
+    void check_log_format();
+
+    /**
+     * @brief Copies a string into a fixed size record field
+     * 
+     * @param field - the field
+     * @param size - the size of the field, including the terminating zero
+     * @param value - the value to copy
+     */
+    static void copy_field(char *field, size_t size, const char *value);
+
+    /**
+     * @brief Decodes a command as entered on the config page into a fixed size record field
+     * 
+     * @param field - the field
+     * @param size - the size of the field, including the terminating zero
+     * @param value - the command with control characters written as [CTRL]+<letter>
+     */
+    static void unescape_field(char *field, size_t size, const char *value);
 
     bool has_config = false;
     bool values_saved = false;
     bool wifi_connected = false;
+    bool wifi_started = false;
     bool wifi_ap_on = false;
+    std::shared_ptr<rendered_page_t> page;
+    std::atomic<bool> page_outdated{true};
+    std::atomic<uint32_t> pending_baud_rate{0};
     static AsyncWebServer server;
 };
 
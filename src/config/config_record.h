@@ -0,0 +1,51 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef CONFIG_RECORD_H_
+#define CONFIG_RECORD_H_
+
+#include <Arduino.h>
+#include "../wheel/command_store.h"
+
+#define CONFIG_RECORD_MAGIC 0x46434857
+    // "WHCF" little endian
+#define CONFIG_RECORD_VERSION 2
+    // 2 added task_profile, which lies in the trailing padding of a version 1 record
+#define CONFIG_NVS_NAMESPACE "config"
+#define CONFIG_NVS_KEY "record"
+
+#define CONFIG_SSID_LENGTH 33
+#define CONFIG_PASSWORD_LENGTH 65
+    // lengths include the terminating zero
+
+/**
+ * @brief The persisted configuration. The record is stored as a single NVS blob and read back with one
+ * bulk read. New fields are only ever appended; a record written by an older version is shorter and
+ * the fields it does not contain keep their defaults. A field that fits into the trailing padding
+ * does not change the size, so it needs a new version and a default for the older records.
+ *
+ */
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+    // size of the record as written, including this header
+  uint32_t crc;
+    // crc32 of the record following this field
+  uint32_t baud_rate;
+  uint32_t spi_write_frequency;
+  uint32_t spi_read_frequency;
+  uint8_t log_sinks;
+  uint8_t log_level;
+  uint8_t log_binary;
+  uint8_t log_timestamp;
+  char ssid[CONFIG_SSID_LENGTH];
+  char password[CONFIG_PASSWORD_LENGTH];
+  command_slot_t commands[COMMAND_COUNT];
+  uint8_t task_profile;
+} config_record_t;
+
+#define CONFIG_RECORD_HEADER_SIZE (offsetof(config_record_t, crc) + sizeof(uint32_t))
+
+#endif /* CONFIG_RECORD_H_ */
@@ -0,0 +1,166 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <stdlib.h>
+#include <string.h>
+#include <esp_rom_crc.h>
+#include "gzip.h"
+
+static const uint16_t length_base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distance_base[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distance_extra[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/**
+ * @brief Writes the bit stream of a deflate block, least significant bit first
+ *
+ */
+typedef struct
+{
+  uint8_t *out;
+  size_t size;
+  size_t position;
+  uint32_t bits;
+  uint8_t count;
+} bit_writer_t;
+
+/**
+ * @brief Appends bits to the stream
+ *
+ * @param w - the writer
+ * @param value - the bits, least significant first
+ * @param count - the number of bits
+ */
+static void put_bits(bit_writer_t &w, uint32_t value, uint8_t count)
+{
+  w.bits |= value << w.count;
+  w.count += count;
+  while(w.count >= 8)
+  {
+    if(w.position < w.size) w.out[w.position] = (uint8_t)w.bits;
+    w.position++;
+      // overruns are counted, the caller checks the final position
+    w.bits >>= 8;
+    w.count -= 8;
+  }
+}
+
+/**
+ * @brief Appends a Huffman code. Huffman codes are stored most significant bit first.
+ *
+ * @param w - the writer
+ * @param code - the code
+ * @param count - the code length
+ */
+static void put_code(bit_writer_t &w, uint32_t code, uint8_t count)
+{
+  uint32_t reversed = 0;
+  for(uint8_t i = 0; i < count; i++) reversed |= ((code >> i) & 1) << (count - 1 - i);
+  put_bits(w, reversed, count);
+}
+
+/**
+ * @brief Appends a literal/length symbol with the fixed Huffman code
+ *
+ * @param w - the writer
+ * @param symbol - the symbol, 0 to 287
+ */
+static void put_symbol(bit_writer_t &w, uint16_t symbol)
+{
+  if(symbol < 144) put_code(w, 0x30 + symbol, 8);
+  else if(symbol < 256) put_code(w, 0x190 + symbol - 144, 9);
+  else if(symbol < 280) put_code(w, symbol - 256, 7);
+  else put_code(w, 0xc0 + symbol - 280, 8);
+}
+
+/**
+ * @brief Appends a match
+ *
+ * @param w - the writer
+ * @param length - the match length
+ * @param distance - the match distance
+ */
+static void put_match(bit_writer_t &w, uint16_t length, uint16_t distance)
+{
+  uint8_t code = 28;
+  while(length < length_base[code]) code--;
+  put_symbol(w, 257 + code);
+  put_bits(w, length - length_base[code], length_extra[code]);
+  code = 29;
+  while(distance < distance_base[code]) code--;
+  put_code(w, code, 5);
+  put_bits(w, distance - distance_base[code], distance_extra[code]);
+}
+
+/**
+ * @brief Hashes the next three bytes
+ *
+ * @param p - the bytes
+ * @return the hash table index
+ */
+static inline uint32_t hash3(const uint8_t *p)
+{
+  return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - GZIP_HASH_BITS);
+}
+
+/**
+ * @brief Compresses a buffer into a gzip stream.
+ *
+ * @param in - the data to compress
+ * @param length - the length of the data
+ * @param out - receives the gzip stream
+ * @param size - the size of the output buffer, see gzip_bound
+ * @return the length of the gzip stream, 0 if the output buffer is too small or the hash table
+ * could not be allocated
+ */
+size_t gzip_compress(const uint8_t *in, size_t length, uint8_t *out, size_t size)
+{
+  static const uint8_t header[] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+  bit_writer_t w = {out, size, sizeof(header), 0, 0};
+  uint32_t *head;
+  size_t i = 0;
+
+  if(size < sizeof(header) + 8) return 0;
+  head = (uint32_t *)malloc(sizeof(uint32_t) << GZIP_HASH_BITS);
+  if(head == nullptr) return 0;
+  memset(head, 0xff, sizeof(uint32_t) << GZIP_HASH_BITS);
+  memcpy(out, header, sizeof(header));
+
+  put_bits(w, 1, 1);
+  put_bits(w, 1, 2);
+    // final block, fixed Huffman codes
+  while(i < length)
+  {
+    size_t best = 0;
+    if(i + GZIP_MIN_MATCH <= length)
+    {
+      uint32_t h = hash3(in + i);
+      uint32_t candidate = head[h];
+      head[h] = (uint32_t)i;
+      if(candidate != 0xffffffff && i - candidate <= GZIP_WINDOW_SIZE)
+      {
+        size_t limit = length - i < GZIP_MAX_MATCH ? length - i : GZIP_MAX_MATCH;
+        while(best < limit && in[candidate + best] == in[i + best]) best++;
+        if(best >= GZIP_MIN_MATCH)
+        {
+          put_match(w, (uint16_t)best, (uint16_t)(i - candidate));
+          // index the matched bytes so later matches can refer into them
+          for(size_t j = i + 1; j < i + best && j + GZIP_MIN_MATCH <= length; j++) head[hash3(in + j)] = (uint32_t)j;
+          i += best;
+          continue;
+        }
+      }
+    }
+    put_symbol(w, in[i++]);
+  }
+  put_symbol(w, 256);
+  put_bits(w, 0, 7);
+    // end of block, pad to a byte boundary
+  free(head);
+
+  uint32_t crc = esp_rom_crc32_le(0, in, length);
+  uint32_t trailer[] = {crc, (uint32_t)length};
+  if(w.position + sizeof(trailer) > size) return 0;
+  for(int k = 0; k < 8; k++) out[w.position++] = (uint8_t)(trailer[k / 4] >> (8 * (k % 4)));
+  return w.position;
+}
@@ -0,0 +1,37 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef GZIP_H_
+#define GZIP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GZIP_HASH_BITS 12
+#define GZIP_WINDOW_SIZE 32768
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+
+/**
+ * @brief Gets the output buffer size sufficient to compress any input of the given length
+ *
+ * @param length - the input length
+ * @return the buffer size
+ */
+constexpr size_t gzip_bound(size_t length) { return length + length / 8 + 32; }
+
+/**
+ * @brief Compresses a buffer into a gzip stream. The encoder emits a single deflate block with the
+ * fixed Huffman codes and finds matches through a one entry hash table, which costs little memory and
+ * compresses markup with its repeated tags well.
+ *
+ * @param in - the data to compress
+ * @param length - the length of the data
+ * @param out - receives the gzip stream
+ * @param size - the size of the output buffer, see gzip_bound
+ * @return the length of the gzip stream, 0 if the output buffer is too small or the hash table
+ * could not be allocated
+ */
+size_t gzip_compress(const uint8_t *in, size_t length, uint8_t *out, size_t size);
+
+#endif /* GZIP_H_ */
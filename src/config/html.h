@@ -9,6 +9,7 @@ const char index_html[] PROGMEM = R"rawliteral(
   <title>CNC Wheel Configuration</title>
   <meta name="viewport" content="width=device-width, initial-scale=1">
   <meta name="author" content="Thor Schueler">
+  <link rel="stylesheet" href="/static/config.css">
 </head>
 <body>
   <article>
@@ -77,13 +78,28 @@ const char index_html[] PROGMEM = R"rawliteral(
         <h3>Connection Settings</h3>
         <label for="BAUDRATE">Serial Connection Baudrate:</label><br><input type="number" maxlength="16" size="16" id="BAUDRATE" name="BAUDRATE" value="%BAUDRATE%"><br>
         <hr/>
+        <h3>Logging</h3>
+        <input type="checkbox" id="LOG_UART" name="LOG_UART" value="1" %LOG_UART%><label for="LOG_UART">Serial connection (shared with Candle)</label><br>
+        <input type="checkbox" id="LOG_UART2" name="LOG_UART2" value="1" %LOG_UART2%><label for="LOG_UART2">Second serial port (TX on GPIO32)</label><br>
+        <input type="checkbox" id="LOG_RAM" name="LOG_RAM" value="1" %LOG_RAM%><label for="LOG_RAM">Memory buffer (<a href="/diag/log">/diag/log</a>)</label><br>
+        <input type="checkbox" id="LOG_FILE" name="LOG_FILE" value="1" %LOG_FILE%><label for="LOG_FILE">Flash file (<a href="/diag/logfile">/diag/logfile</a>)</label><br>
+        <input type="checkbox" id="LOG_BINARY" name="LOG_BINARY" value="1" %LOG_BINARY%><label for="LOG_BINARY">Binary records (decode with tools/log_decoder, not on the serial connection)</label><br>
+        <input type="checkbox" id="LOG_TS_MS" name="LOG_TS_MS" value="1" %LOG_TS_MS%><label for="LOG_TS_MS">Timestamps with milliseconds</label><br>
+        <input type="checkbox" id="LOG_TS_US" name="LOG_TS_US" value="1" %LOG_TS_US%><label for="LOG_TS_US">Timestamps with microseconds since boot</label><br>
+        <label for="LOGLEVEL">Log Level:</label><br>
+        <select id="LOGLEVEL" name="LOGLEVEL">
+          <option value="0" %LOGLEVEL_INFO%>Information</option>
+          <option value="1" %LOGLEVEL_ERROR%>Errors only</option>
+          <option value="2" %LOGLEVEL_NONE%>None</option>
+        </select><br>
+        <hr/>
         <input type="submit" value="Save Configuration">
       </form> 
       %PLEASE_RESTART%
       %SUCCESSFULLY_CONNECTED%
     </section>
     <footer>
-      <p style="color:Gainsboro; font-size: x-small;">copyright 2018-2022 - Avanade.</p>
+      <p class="copyright">copyright 2018-2022 - Avanade.</p>
     </footer>
 </body>
 </html>)rawliteral";
@@ -0,0 +1,123 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include "live_state.h"
+#include "../logging/SerialLogger.h"
+#include "../tasks/task_plan.h"
+
+LiveState Live;
+
+/**
+ * @brief Construct a new LiveState object
+ *
+ */
+LiveState::LiveState() : _socket(LIVE_STATE_URI)
+{
+  memset(&_sent, 0, sizeof(_sent));
+}
+
+#pragma region public methods
+/**
+ * @brief Registers the WebSocket with the web server
+ *
+ * @param server - the web server to attach to
+ */
+void LiveState::Attach(AsyncWebServer &server)
+{
+  _socket.onEvent([this](AsyncWebSocket *socket, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    if(type != WS_EVT_CONNECT || _wheel == nullptr) return;
+    // a new client starts from the full state, the deltas that follow apply on top of it
+    char frame[LIVE_STATE_FRAME_SIZE];
+    wheel_state_t state;
+    _wheel->get_state(state);
+    if(format_frame(frame, sizeof(frame), _sequence, nullptr, state) > 0) client->text(frame);
+  });
+  server.addHandler(&_socket);
+}
+
+/**
+ * @brief Starts pushing the state of a wheel
+ *
+ * @param wheel - the wheel to report
+ */
+void LiveState::Begin(Wheel *wheel)
+{
+  if(_task != NULL) return;
+  _wheel = wheel;
+  _wheel->get_state(_sent);
+  Tasks.Create(TASK_LIVE_STATE, live_state_runner, this, &_task);
+}
+
+/**
+ * @brief Signals that the wheel state changed. Safe to call from interrupt handlers.
+ *
+ */
+void IRAM_ATTR LiveState::Notify()
+{
+  if(_task == NULL) return;
+  if(xPortInIsrContext())
+  {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(_task, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+  }
+  else xTaskNotifyGive(_task);
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Task function sending state changes
+ *
+ * @param args - pointer to the LiveState instance
+ */
+void LiveState::live_state_runner(void *args)
+{
+  LiveState *_this = reinterpret_cast<LiveState *>(args);
+  char frame[LIVE_STATE_FRAME_SIZE];
+  for(;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    _this->_socket.cleanupClients();
+    wheel_state_t state;
+    _this->_wheel->get_state(state);
+    size_t length = format_frame(frame, sizeof(frame), _this->_sequence + 1, &_this->_sent, state);
+    if(length == 0) continue;
+    _this->_sent = state;
+    _this->_sequence++;
+    if(_this->_socket.count() > 0) _this->_socket.textAll(frame, length);
+    vTaskDelay(pdMS_TO_TICKS(1000 / LIVE_STATE_MAX_RATE));
+      // notifications arriving meanwhile are collapsed into one wakeup
+  }
+}
+
+/**
+ * @brief Formats a frame containing the fields that differ between two states
+ *
+ * @param buf - receives the frame
+ * @param size - the size of the buffer
+ * @param sequence - the frame number
+ * @param previous - the state last sent, nullptr to format all fields
+ * @param current - the current state
+ * @return the length of the frame, 0 if no field changed or the frame does not fit the buffer
+ */
+size_t LiveState::format_frame(char *buf, size_t size, uint32_t sequence, const wheel_state_t *previous, const wheel_state_t &current)
+{
+  size_t n = 0;
+  #define FRAME_APPEND(...) do { int w = snprintf(buf + n, size - n, __VA_ARGS__); if(w < 0 || (size_t)w >= size - n) return 0; n += w; } while(0)
+    // a truncated frame is not valid JSON, it is dropped rather than sent
+  FRAME_APPEND("{\"seq\":%u", (unsigned)sequence);
+  size_t start = n;
+  if(previous == nullptr || previous->axis != current.axis) FRAME_APPEND(",\"axis\":\"%c\"", (char)current.axis);
+  if(previous == nullptr || previous->feed != current.feed) FRAME_APPEND(",\"feed\":%.3f", current.feed);
+  if(previous == nullptr || previous->x != current.x) FRAME_APPEND(",\"x\":%.3f", current.x);
+  if(previous == nullptr || previous->y != current.y) FRAME_APPEND(",\"y\":%.3f", current.y);
+  if(previous == nullptr || previous->z != current.z) FRAME_APPEND(",\"z\":%.3f", current.z);
+  if(previous == nullptr || previous->emergency != current.emergency) FRAME_APPEND(",\"ems\":%s", current.emergency ? "true" : "false");
+  if(n == start) return 0;
+  FRAME_APPEND("}");
+  #undef FRAME_APPEND
+  return n;
+}
+#pragma endregion
@@ -0,0 +1,89 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef LIVE_STATE_H_
+#define LIVE_STATE_H_
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include "../wheel/wheel.h"
+
+#define LIVE_STATE_URI "/ws"
+
+#ifndef LIVE_STATE_MAX_RATE
+#define LIVE_STATE_MAX_RATE 10
+    // maximum frames per second, changes in between are coalesced into the next frame
+#endif
+
+#define LIVE_STATE_FRAME_SIZE 160
+
+/**
+ * @brief Pushes the wheel state to WebSocket clients. A client receives the full state when it
+ * connects and after that frames containing only the fields that changed, for example
+ * {"seq":12,"x":1.250} while the wheel is turned. Frames are numbered so clients can detect gaps.
+ *
+ */
+class LiveState
+{
+public:
+  /**
+   * @brief Construct a new LiveState object
+   *
+   */
+  LiveState();
+
+  /**
+   * @brief Registers the WebSocket with the web server
+   *
+   * @param server - the web server to attach to
+   */
+  void Attach(AsyncWebServer &server);
+
+  /**
+   * @brief Starts pushing the state of a wheel
+   *
+   * @param wheel - the wheel to report
+   */
+  void Begin(Wheel *wheel);
+
+  /**
+   * @brief Signals that the wheel state changed. Safe to call from interrupt handlers.
+   *
+   */
+  void IRAM_ATTR Notify();
+
+private:
+  /**
+   * @brief Task function sending state changes
+   *
+   * @param args - pointer to the LiveState instance
+   */
+  static void live_state_runner(void *args);
+
+  /**
+   * @brief Formats a frame containing the fields that differ between two states
+   *
+   * @param buf - receives the frame
+   * @param size - the size of the buffer
+   * @param sequence - the frame number
+   * @param previous - the state last sent, nullptr to format all fields
+   * @param current - the current state
+   * @return the length of the frame, 0 if no field changed or the frame does not fit the buffer
+   */
+  static size_t format_frame(char *buf, size_t size, uint32_t sequence, const wheel_state_t *previous, const wheel_state_t &current);
+
+  AsyncWebSocket _socket;
+  Wheel *_wheel = nullptr;
+  TaskHandle_t _task = NULL;
+  wheel_state_t _sent;
+  uint32_t _sequence = 0;
+};
+
+/**
+ * @brief Global instance of the live state channel
+ *
+ */
+extern LiveState Live;
+
+#endif /* LIVE_STATE_H_ */
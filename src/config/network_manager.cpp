@@ -0,0 +1,266 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_sntp.h>
+#include <time.h>
+#include "network_manager.h"
+#include "../logging/SerialLogger.h"
+#include "../journal/event_journal.h"
+#include "../tasks/task_plan.h"
+
+#ifndef LED_BUILTIN
+#define LED_BUILTIN 2
+#endif
+
+#define NETWORK_NOTIFY_GOT_IP 0x01
+#define NETWORK_NOTIFY_DISCONNECTED 0x02
+#define NETWORK_NOTIFY_TIME_SET 0x04
+#define NETWORK_NOTIFY_RECONFIGURE 0x08
+
+static const char *state_names[NETWORK_STATE_COUNT] = {"idle", "connecting", "connected", "backoff"};
+
+NetworkManager Network;
+
+/**
+ * @brief Construct a new NetworkManager object
+ *
+ */
+NetworkManager::NetworkManager()
+{
+}
+
+#pragma region public methods
+/**
+ * @brief Starts connecting to an access point, or reconnects if the credentials changed.
+ * Returns immediately.
+ *
+ * @param ssid - the SSID, empty to stay disconnected
+ * @param password - the password, empty for an open network
+ */
+void NetworkManager::Begin(const String &ssid, const String &password)
+{
+  if(_task != NULL && ssid == _ssid && password == _password) return;
+  if(_mutex == NULL) _mutex = xSemaphoreCreateMutex();
+  if(xSemaphoreTake(_mutex, portMAX_DELAY) == pdTRUE)
+  {
+    strlcpy(_ssid, ssid.c_str(), sizeof(_ssid));
+    strlcpy(_password, password.c_str(), sizeof(_password));
+    xSemaphoreGive(_mutex);
+  }
+  if(_task != NULL)
+  {
+    xTaskNotify(_task, NETWORK_NOTIFY_RECONFIGURE, eSetBits);
+    return;
+  }
+
+  pinMode(LED_BUILTIN, OUTPUT);
+  WiFi.setAutoReconnect(false);
+    // reconnects are paced by the backoff of the network task
+  WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+    xTaskNotify(_task, NETWORK_NOTIFY_GOT_IP, eSetBits);
+  }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+    _reason = info.wifi_sta_disconnected.reason;
+    xTaskNotify(_task, NETWORK_NOTIFY_DISCONNECTED, eSetBits);
+  }, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+  sntp_set_time_sync_notification_cb([](struct timeval *tv) {
+    if(Network._task != NULL) xTaskNotify(Network._task, NETWORK_NOTIFY_TIME_SET, eSetBits);
+  });
+  Tasks.Create(TASK_NETWORK, NetworkManager::network_runner, this, &_task);
+}
+
+/**
+ * @brief Registers a handler for network events
+ *
+ * @param handler - the handler
+ */
+void NetworkManager::OnChange(network_handler_t handler)
+{
+  _handlers.push_back(handler);
+}
+
+/**
+ * @brief Writes the connection state
+ *
+ * @param out - the output to write to
+ */
+void NetworkManager::Print(::Print &out)
+{
+  out.printf("SSID:        %s\n", _ssid);
+  out.printf("State:       %s\n", state_names[_state]);
+  if(_state == NETWORK_CONNECTED)
+  {
+    out.printf("IP address:  %s\n", WiFi.localIP().toString().c_str());
+    out.printf("RSSI:        %d dBm\n", WiFi.RSSI());
+  }
+  else if(_state == NETWORK_BACKOFF) out.printf("Retry in:    %u ms, attempt %u\n", _backoff_ms, _attempts + 1);
+  out.printf("Connects:    %u, last took %u ms\n", _connects, _connect_ms);
+  out.printf("Last reason: %u\n", _reason);
+  out.printf("Clock:       %s\n", _time_set ? "set" : _time_requested ? "waiting for SNTP" : "not set");
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Task function running the connection state machine
+ *
+ * @param args - pointer to the NetworkManager instance
+ */
+void NetworkManager::network_runner(void *args)
+{
+  NetworkManager *_this = reinterpret_cast<NetworkManager *>(args);
+  uint32_t start = 0;
+  uint32_t sntp_start = 0;
+  _this->_state = NETWORK_CONNECTING;
+  for(;;)
+  {
+    uint32_t events;
+    switch(_this->_state)
+    {
+      case NETWORK_IDLE:
+        if(_this->wait(portMAX_DELAY) & NETWORK_NOTIFY_RECONFIGURE) _this->_state = NETWORK_CONNECTING;
+        break;
+
+      case NETWORK_CONNECTING:
+        if(_this->_ssid[0] == '\0')
+        {
+          Logger.Error(F("No SSID set. Cannot connect to Wifi"));
+          _this->change(NETWORK_IDLE, NETWORK_EVENT_DISCONNECTED);
+          break;
+        }
+        _this->report(NETWORK_EVENT_CONNECTING);
+        digitalWrite(LED_BUILTIN, HIGH);
+        ulTaskNotifyValueClear(NULL, NETWORK_NOTIFY_GOT_IP | NETWORK_NOTIFY_DISCONNECTED);
+          // drops the event of the disconnect ending the previous attempt
+        start = millis();
+        if(xSemaphoreTake(_this->_mutex, portMAX_DELAY) == pdTRUE)
+        {
+          if(_this->_password[0] == '\0') Logger.Info(F("No WiFi password set. Continue without..."));
+          WiFi.begin(_this->_ssid, _this->_password);
+          xSemaphoreGive(_this->_mutex);
+        }
+        events = 0;
+        while(!(events & (NETWORK_NOTIFY_GOT_IP | NETWORK_NOTIFY_DISCONNECTED | NETWORK_NOTIFY_RECONFIGURE)) && millis() - start < NETWORK_CONNECT_TIMEOUT_MS)
+          events |= _this->wait(NETWORK_CONNECT_TIMEOUT_MS - (millis() - start));
+        if(events & NETWORK_NOTIFY_RECONFIGURE)
+        {
+          WiFi.disconnect();
+          _this->_attempts = 0;
+        }
+        else if(events & NETWORK_NOTIFY_GOT_IP)
+        {
+          _this->_attempts = 0;
+          _this->_connects++;
+          _this->_connect_ms = millis() - start;
+          digitalWrite(LED_BUILTIN, LOW);
+          Logger.Info_f(F("WiFi connected to %s in %u ms, IP address: %s"), _this->_ssid, _this->_connect_ms, WiFi.localIP().toString().c_str());
+          _this->change(NETWORK_CONNECTED, NETWORK_EVENT_CONNECTED);
+          if(!_this->_time_requested)
+          {
+            // SNTP keeps polling in the background, the callback tells us when it answered
+            Logger.Info(F("Setting time using SNTP"));
+            configTime(GMT_OFFSET_SECS, GMT_OFFSET_SECS_DST, NTP_SERVERS);
+            _this->_time_requested = true;
+            sntp_start = millis();
+          }
+        }
+        else
+        {
+          WiFi.disconnect();
+          _this->_backoff_ms = min((uint32_t)NETWORK_BACKOFF_MAX_MS, (uint32_t)NETWORK_BACKOFF_MIN_MS << min(_this->_attempts, (uint32_t)16));
+          _this->_attempts++;
+          Logger.Error_f(F("Could not connect to WIFI %s (reason %u), retrying in %u ms"), _this->_ssid, _this->_reason, _this->_backoff_ms);
+          _this->change(NETWORK_BACKOFF, NETWORK_EVENT_DISCONNECTED);
+        }
+        break;
+
+      case NETWORK_BACKOFF:
+        start = millis();
+        events = 0;
+        while(!(events & NETWORK_NOTIFY_RECONFIGURE) && millis() - start < _this->_backoff_ms)
+          events |= _this->wait(_this->_backoff_ms - (millis() - start));
+        if(events & NETWORK_NOTIFY_RECONFIGURE) _this->_attempts = 0;
+        _this->_state = NETWORK_CONNECTING;
+        break;
+
+      case NETWORK_CONNECTED:
+      {
+        bool waiting = _this->_time_requested && !_this->_time_set && sntp_start != 0;
+        uint32_t elapsed = millis() - sntp_start;
+        events = _this->wait(!waiting ? portMAX_DELAY : elapsed < NETWORK_SNTP_TIMEOUT_MS ? NETWORK_SNTP_TIMEOUT_MS - elapsed : 0);
+        if(events == 0 && waiting && !_this->_time_set)
+        {
+          Logger.Error_f(F("SNTP did not answer within %u ms, continuing without the time"), NETWORK_SNTP_TIMEOUT_MS);
+          sntp_start = 0;
+          _this->report(NETWORK_EVENT_TIME_TIMEOUT);
+        }
+        if(events & NETWORK_NOTIFY_RECONFIGURE)
+        {
+          WiFi.disconnect();
+          _this->_attempts = 0;
+          _this->change(NETWORK_CONNECTING, NETWORK_EVENT_DISCONNECTED);
+        }
+        else if(events & NETWORK_NOTIFY_DISCONNECTED)
+        {
+          digitalWrite(LED_BUILTIN, HIGH);
+          Journal.Record(JOURNAL_ERROR, JOURNAL_SOURCE_WIFI, _this->_reason);
+          _this->_backoff_ms = NETWORK_BACKOFF_MIN_MS;
+          Logger.Error_f(F("WiFi connection to %s lost (reason %u)"), _this->_ssid, _this->_reason);
+          _this->change(NETWORK_BACKOFF, NETWORK_EVENT_DISCONNECTED);
+        }
+        break;
+      }
+
+      default:
+        _this->_state = NETWORK_CONNECTING;
+        break;
+    }
+  }
+}
+
+/**
+ * @brief Waits for events and handles those that do not depend on the state
+ *
+ * @param ms - the time to wait, portMAX_DELAY to wait forever
+ * @return the events received, 0 on timeout
+ */
+uint32_t NetworkManager::wait(uint32_t ms)
+{
+  uint32_t events = 0;
+  xTaskNotifyWait(0, 0xffffffff, &events, ms == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(ms));
+  if((events & NETWORK_NOTIFY_TIME_SET) && !_time_set)
+  {
+    // SNTP keeps the clock in sync from here on, only the first answer is of interest
+    time_t now = time(NULL);
+    _time_set = true;
+    Logger.Info(F("Time initialized!"));
+    Journal.Record(JOURNAL_CLOCK, 0, (uint32_t)now);
+    this->report(NETWORK_EVENT_TIME_SET);
+  }
+  return events;
+}
+
+/**
+ * @brief Changes the state and reports the event
+ *
+ * @param state - the new state
+ * @param event - the event to report
+ */
+void NetworkManager::change(network_state_t state, network_event_t event)
+{
+  _state = state;
+  this->report(event);
+}
+
+/**
+ * @brief Reports an event to the handlers
+ *
+ * @param event - the event
+ */
+void NetworkManager::report(network_event_t event)
+{
+  for(network_handler_t &handler : _handlers) handler(event);
+}
+#pragma endregion
@@ -0,0 +1,178 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef NETWORK_MANAGER_H_
+#define NETWORK_MANAGER_H_
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+#define NTP_SERVERS "pool.ntp.org", "time.nist.gov"
+
+#define GST_TIME_ZONE -6
+#define GST_TIME_ZONE_DAYLIGHT_SAVINGS_DIFF   1
+#define GMT_OFFSET_SECS (GST_TIME_ZONE * 3600)
+#define GMT_OFFSET_SECS_DST (GST_TIME_ZONE_DAYLIGHT_SAVINGS_DIFF * 3600)
+
+#ifndef NETWORK_CONNECT_TIMEOUT_MS
+#define NETWORK_CONNECT_TIMEOUT_MS 10000
+#endif
+
+#ifndef NETWORK_BACKOFF_MIN_MS
+#define NETWORK_BACKOFF_MIN_MS 1000
+#endif
+
+#ifndef NETWORK_BACKOFF_MAX_MS
+#define NETWORK_BACKOFF_MAX_MS 60000
+#endif
+
+#ifndef NETWORK_SNTP_TIMEOUT_MS
+#define NETWORK_SNTP_TIMEOUT_MS 30000
+    // after this the time is still set once SNTP answers, we just stop waiting for it
+#endif
+
+/**
+ * @brief State of the station connection
+ *
+ */
+typedef enum : uint8_t
+{
+  NETWORK_IDLE = 0,     // no SSID configured
+  NETWORK_CONNECTING,
+  NETWORK_CONNECTED,
+  NETWORK_BACKOFF,      // waiting before the next attempt
+  NETWORK_STATE_COUNT
+} network_state_t;
+
+/**
+ * @brief Events reported to the change handlers
+ *
+ */
+typedef enum : uint8_t
+{
+  NETWORK_EVENT_CONNECTING = 0,
+  NETWORK_EVENT_CONNECTED,
+  NETWORK_EVENT_DISCONNECTED,   // the connection was lost or an attempt failed
+  NETWORK_EVENT_TIME_SET,
+  NETWORK_EVENT_TIME_TIMEOUT    // SNTP did not answer within NETWORK_SNTP_TIMEOUT_MS
+} network_event_t;
+
+/**
+ * @brief Handler receiving network events, called on the network task
+ * @param event - the event
+ */
+typedef std::function<void(network_event_t event)> network_handler_t;
+
+/**
+ * @brief Keeps the WiFi station connected and the clock set without blocking anybody. A task on
+ * the core not used by the wheel waits for WiFi and SNTP events, retries failed connections with
+ * exponential backoff and gives SNTP a bounded time to answer.
+ *
+ */
+class NetworkManager
+{
+public:
+  /**
+   * @brief Construct a new NetworkManager object
+   *
+   */
+  NetworkManager();
+
+  /**
+   * @brief Starts connecting to an access point, or reconnects if the credentials changed.
+   * Returns immediately.
+   *
+   * @param ssid - the SSID, empty to stay disconnected
+   * @param password - the password, empty for an open network
+   */
+  void Begin(const String &ssid, const String &password);
+
+  /**
+   * @brief Registers a handler for network events
+   *
+   * @param handler - the handler
+   */
+  void OnChange(network_handler_t handler);
+
+  /**
+   * @brief Gets the state of the station connection
+   *
+   * @return the state
+   */
+  network_state_t State() const { return _state; }
+
+  /**
+   * @brief Gets the configured SSID
+   *
+   * @return the SSID
+   */
+  const char *SSID() const { return _ssid; }
+
+  /**
+   * @brief Checks whether the clock has been set by SNTP
+   *
+   * @return true if the clock is set
+   */
+  bool HasTime() const { return _time_set; }
+
+  /**
+   * @brief Writes the connection state
+   *
+   * @param out - the output to write to
+   */
+  void Print(::Print &out);
+
+private:
+  /**
+   * @brief Task function running the connection state machine
+   *
+   * @param args - pointer to the NetworkManager instance
+   */
+  static void network_runner(void *args);
+
+  /**
+   * @brief Waits for events and handles those that do not depend on the state
+   *
+   * @param ms - the time to wait, portMAX_DELAY to wait forever
+   * @return the events received, 0 on timeout
+   */
+  uint32_t wait(uint32_t ms);
+
+  /**
+   * @brief Changes the state and reports the event
+   *
+   * @param state - the new state
+   * @param event - the event to report
+   */
+  void change(network_state_t state, network_event_t event);
+
+  /**
+   * @brief Reports an event to the handlers
+   *
+   * @param event - the event
+   */
+  void report(network_event_t event);
+
+  TaskHandle_t _task = NULL;
+  SemaphoreHandle_t _mutex = NULL;
+  std::vector<network_handler_t> _handlers;
+  volatile network_state_t _state = NETWORK_IDLE;
+  volatile bool _time_set = false;
+  bool _time_requested = false;
+  char _ssid[33] = "";
+  char _password[65] = "";
+  uint32_t _attempts = 0;
+  uint32_t _connects = 0;
+  uint32_t _connect_ms = 0;
+  uint32_t _backoff_ms = 0;
+  uint8_t _reason = 0;
+};
+
+/**
+ * @brief Global instance of the network manager
+ *
+ */
+extern NetworkManager Network;
+
+#endif /* NETWORK_MANAGER_H_ */
@@ -0,0 +1,67 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <algorithm>
+#include "boot_profiler.h"
+#include "../logging/SerialLogger.h"
+
+BootProfiler Boot;
+
+#pragma region public methods
+/**
+ * @brief Records a phase ending now
+ *
+ * @param name - the name of the phase, must be a string literal
+ * @param start_us - the start of the phase as returned by Now
+ */
+void BootProfiler::Phase(const char *name, int64_t start_us)
+{
+  int64_t end_us = Now();
+  const char *task = pcTaskGetName(NULL);
+  portENTER_CRITICAL(&_lock);
+  if(_count < BOOT_PROFILER_PHASES) _phases[_count++] = {name, task, start_us, end_us};
+  portEXIT_CRITICAL(&_lock);
+}
+
+/**
+ * @brief Writes the recorded phases in the order they started
+ *
+ * @param out - the output to write to
+ */
+void BootProfiler::Print(::Print &out)
+{
+  boot_phase_t phases[BOOT_PROFILER_PHASES];
+  portENTER_CRITICAL(&_lock);
+  uint8_t count = _count;
+  memcpy(phases, _phases, count * sizeof(boot_phase_t));
+  portEXIT_CRITICAL(&_lock);
+
+  std::sort(phases, phases + count, [](const boot_phase_t &a, const boot_phase_t &b) { return a.start_us < b.start_us; });
+  out.println(BOOT_SEQUENTIAL ? F("Startup order: sequential (baseline)") : F("Startup order: deferred"));
+  out.printf("%-20s %-20s %12s %12s %12s\n", "phase", "task", "start us", "end us", "duration us");
+  for(uint8_t i = 0; i < count; i++)
+  {
+    const boot_phase_t &p = phases[i];
+    if(p.end_us == p.start_us) out.printf("%-20s %-20s %12lld\n", p.name, p.task, p.end_us);
+    else out.printf("%-20s %-20s %12lld %12lld %12lld\n", p.name, p.task, p.start_us, p.end_us, p.end_us - p.start_us);
+  }
+}
+
+/**
+ * @brief Writes the recorded phases to the log
+ *
+ */
+void BootProfiler::Report()
+{
+  portENTER_CRITICAL(&_lock);
+  uint8_t count = _count;
+  portEXIT_CRITICAL(&_lock);
+  Logger.Info(BOOT_SEQUENTIAL ? F("Boot phases, sequential startup:") : F("Boot phases:"));
+  for(uint8_t i = 0; i < count; i++)
+  {
+    const boot_phase_t &p = _phases[i];
+    Logger.Info_f(F("....%-20s %10lld us, %10lld us after reset (%s)"), p.name, p.end_us - p.start_us, p.end_us, p.task);
+  }
+}
+#pragma endregion
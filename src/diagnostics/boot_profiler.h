@@ -0,0 +1,101 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef BOOT_PROFILER_H
+#define BOOT_PROFILER_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+#define BOOT_PROFILER_PHASES 32
+
+#ifndef BOOT_SEQUENTIAL
+#define BOOT_SEQUENTIAL 0
+    // 1 restores the startup order from before the display and the access point were deferred:
+    // both come up before the wheel inputs go live. Build with -DBOOT_SEQUENTIAL=1 to take the
+    // baseline "jog ready" time the deferred startup is compared against
+#endif
+
+/**
+ * @brief A timed boot phase. Milestones are phases without duration.
+ *
+ */
+typedef struct
+{
+  const char *name;
+  const char *task;
+  int64_t start_us;
+  int64_t end_us;
+} boot_phase_t;
+
+/**
+ * @brief Records the phases of the startup with microsecond timestamps relative to the reset.
+ * Phases may run on different tasks and overlap. The record is shown by the "boot" diagnostic
+ * report and written to the log once the startup has completed.
+ *
+ */
+class BootProfiler
+{
+public:
+  /**
+   * @brief Gets the current time for the start of a phase
+   *
+   * @return the microseconds since the reset
+   */
+  static int64_t Now() { return esp_timer_get_time(); }
+
+  /**
+   * @brief Records a phase ending now
+   *
+   * @param name - the name of the phase, must be a string literal
+   * @param start_us - the start of the phase as returned by Now
+   */
+  void Phase(const char *name, int64_t start_us);
+
+  /**
+   * @brief Records a milestone
+   *
+   * @param name - the name of the milestone, must be a string literal
+   */
+  void Milestone(const char *name) { this->Phase(name, Now()); }
+
+  /**
+   * @brief Records the first jog sent to the host. Cheap to call for every jog.
+   *
+   */
+  void FirstJog()
+  {
+    if(!_jogged) 
+    {
+      _jogged = true;
+      this->Milestone("first jog");
+    }
+  }
+
+  /**
+   * @brief Writes the recorded phases in the order they started
+   *
+   * @param out - the output to write to
+   */
+  void Print(::Print &out);
+
+  /**
+   * @brief Writes the recorded phases to the log
+   *
+   */
+  void Report();
+
+private:
+  portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+  boot_phase_t _phases[BOOT_PROFILER_PHASES];
+  uint8_t _count = 0;
+  volatile bool _jogged = false;
+};
+
+/**
+ * @brief Global instance of the boot profiler
+ *
+ */
+extern BootProfiler Boot;
+
+#endif // BOOT_PROFILER_H
@@ -0,0 +1,180 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include "diagnostics.h"
+
+/**
+ * @brief Print adapter prefixing every line with "; " so reports written to the serial link
+ * are treated as comments by the G-code host.
+ *
+ */
+class CommentPrint : public Print
+{
+public:
+  CommentPrint(Print &out) : _out(out) {}
+
+  size_t write(uint8_t c) override
+  {
+    if(_line_start) _out.print(F("; "));
+    _line_start = (c == '\n');
+    return _out.write(c);
+  }
+
+  using Print::write;
+
+private:
+  Print &_out;
+  bool _line_start = true;
+};
+
+/**
+ * @brief Construct a new Diagnostics object
+ *
+ */
+Diagnostics::Diagnostics()
+{
+  _line[0] = '\0';
+}
+
+#pragma region public methods
+/**
+ * @brief Registers the diagnostic routes with the web server.
+ *
+ * @param server - the web server to attach to
+ */
+void Diagnostics::Attach(AsyncWebServer &server)
+{
+  server.on(DIAGNOSTICS_URI, HTTP_GET, [this](AsyncWebServerRequest *request) {
+    String name = request->url().substring(strlen(DIAGNOSTICS_URI) + 1);
+    String args = request->hasParam("args") ? request->getParam("args")->value() : String();
+    entry_t *entry = name.isEmpty() ? nullptr : this->find(name);
+    if(!name.isEmpty() && entry == nullptr)
+    {
+      request->send(404, "text/plain", "Unknown diagnostic report");
+      return;
+    }
+    if(entry != nullptr && entry->serial_only)
+    {
+      request->send(403, "text/plain", "Diagnostic report only available on the serial link");
+      return;
+    }
+    AsyncResponseStream *response = request->beginResponseStream("text/plain");
+    if(name.isEmpty()) this->list(*response);
+    else this->Run(name, args, *response);
+    request->send(response);
+  });
+}
+
+/**
+ * @brief Sets the handler receiving the lines of the serial link that are not diagnostic queries,
+ * for example the answers of the G-code host.
+ *
+ * @param handler - the handler
+ */
+void Diagnostics::OnLine(diagnostics_line_handler_t handler)
+{
+  _line_handler = handler;
+}
+
+/**
+ * @brief Processes pending input from the serial link. Lines starting with the command prefix are
+ * executed, all other lines are passed to the line handler. The report is written back with each line commented
+ * out so it does not interfere with the G-code host.
+ *
+ * @param in - the stream to read queries from
+ * @param out - the output to write reports to
+ */
+void Diagnostics::Poll(Stream &in, Print &out)
+{
+  while(in.available() > 0)
+  {
+    char c = (char)in.read();
+    if(c != '\n' && c != '\r')
+    {
+      if(_line_length < DIAGNOSTICS_MAX_LINE - 1) _line[_line_length++] = c;
+      else _line_overflow = true;
+      continue;
+    }
+    _line[_line_length] = '\0';
+    if(_line_length > 0 && _line[0] == DIAGNOSTICS_COMMAND_PREFIX && !_line_overflow)
+    {
+      CommentPrint comment(out);
+      String query = String(&_line[1]);
+      query.trim();
+      int split = query.indexOf(' ');
+      String name = split < 0 ? query : query.substring(0, split);
+      String args = split < 0 ? String() : query.substring(split + 1);
+      if(name.isEmpty() || name == "help") this->list(comment);
+      else if(!this->Run(name, args, comment)) comment.printf("Unknown diagnostic report %s\n", name.c_str());
+    }
+    else if(_line_length > 0 && !_line_overflow && _line_handler) _line_handler(_line);
+    _line_length = 0;
+    _line_overflow = false;
+  }
+}
+
+/**
+ * @brief Registers a diagnostic report.
+ *
+ * @param name - the name of the report, must be a string literal
+ * @param description - a short description of the report, must be a string literal
+ * @param handler - the handler producing the report
+ * @param serial_only - true for reports that block for seconds or act on the machine; the web
+ * route refuses them
+ */
+void Diagnostics::Register(const char *name, const char *description, diagnostics_handler_t handler, bool serial_only)
+{
+  _entries.push_back({name, description, handler, serial_only});
+}
+
+/**
+ * @brief Runs a diagnostic report
+ *
+ * @param name - the name of the report
+ * @param args - arguments for the report
+ * @param out - the output to write the report to
+ * @return true if the report exists, false otherwise
+ */
+bool Diagnostics::Run(const String &name, const String &args, Print &out)
+{
+  entry_t *entry = this->find(name);
+  if(entry == nullptr) return false;
+  entry->handler(out, args);
+  return true;
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Finds a registered report by name
+ *
+ * @param name - the name of the report
+ * @return the report entry or nullptr if there is none
+ */
+Diagnostics::entry_t *Diagnostics::find(const String &name)
+{
+  for(entry_t &entry : _entries)
+  {
+    if(name == entry.name) return &entry;
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Writes the list of registered reports
+ *
+ * @param out - the output to write to
+ */
+void Diagnostics::list(Print &out)
+{
+  out.println(F("Available diagnostic reports:"));
+  for(entry_t &entry : _entries) out.printf("  %-12s %s%s\n", entry.name, entry.description, entry.serial_only ? " (serial link only)" : "");
+}
+#pragma endregion
+
+/**
+ * @brief Global instance for the diagnostic reports
+ *
+ */
+Diagnostics Diag;
@@ -0,0 +1,130 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+#include <ESPAsyncWebServer.h>
+
+#ifndef DIAGNOSTICS_COMMAND_PREFIX
+#define DIAGNOSTICS_COMMAND_PREFIX '#'
+#endif
+
+#define DIAGNOSTICS_MAX_LINE 64
+#define DIAGNOSTICS_URI "/diag"
+
+/**
+ * @brief Handler producing a diagnostic report.
+ * @param out - the output to write the report to
+ * @param args - arguments passed with the query, empty if there are none
+ */
+typedef std::function<void(Print &out, const String &args)> diagnostics_handler_t;
+
+/**
+ * @brief Handler receiving the lines of the serial link that are not diagnostic queries.
+ * @param line - the line, without the line ending
+ */
+typedef std::function<void(const char *line)> diagnostics_line_handler_t;
+
+/**
+ * @brief Registry of diagnostic reports. Reports are queryable over the serial link by sending
+ * a line starting with DIAGNOSTICS_COMMAND_PREFIX followed by the report name and optional arguments
+ * (for example "#display reset") and over the config web server at /diag/<name>?args=...
+ *
+ */
+class Diagnostics
+{
+public:
+  /**
+   * @brief Construct a new Diagnostics object
+   *
+   */
+  Diagnostics();
+
+  /**
+   * @brief Registers the diagnostic routes with the web server.
+   *
+   * @param server - the web server to attach to
+   */
+  void Attach(AsyncWebServer &server);
+
+  /**
+   * @brief Sets the handler receiving the lines of the serial link that are not diagnostic queries,
+   * for example the answers of the G-code host.
+   *
+   * @param handler - the handler
+   */
+  void OnLine(diagnostics_line_handler_t handler);
+
+  /**
+   * @brief Processes pending input from the serial link. Lines starting with the command prefix are
+   * executed, all other lines are passed to the line handler. The report is written back with each line commented
+   * out so it does not interfere with the G-code host.
+   *
+   * @param in - the stream to read queries from
+   * @param out - the output to write reports to
+   */
+  void Poll(Stream &in, Print &out);
+
+  /**
+   * @brief Registers a diagnostic report.
+   *
+   * @param name - the name of the report, must be a string literal
+   * @param description - a short description of the report, must be a string literal
+   * @param handler - the handler producing the report
+   * @param serial_only - true for reports that block for seconds or act on the machine; the web
+   * route refuses them
+   */
+  void Register(const char *name, const char *description, diagnostics_handler_t handler, bool serial_only = false);
+
+  /**
+   * @brief Runs a diagnostic report
+   *
+   * @param name - the name of the report
+   * @param args - arguments for the report
+   * @param out - the output to write the report to
+   * @return true if the report exists, false otherwise
+   */
+  bool Run(const String &name, const String &args, Print &out);
+
+private:
+  typedef struct
+  {
+    const char *name;
+    const char *description;
+    diagnostics_handler_t handler;
+    bool serial_only;
+  } entry_t;
+
+  /**
+   * @brief Finds a registered report by name
+   *
+   * @param name - the name of the report
+   * @return the report entry or nullptr if there is none
+   */
+  entry_t *find(const String &name);
+
+  /**
+   * @brief Writes the list of registered reports
+   *
+   * @param out - the output to write to
+   */
+  void list(Print &out);
+
+  std::vector<entry_t> _entries;
+  diagnostics_line_handler_t _line_handler;
+  char _line[DIAGNOSTICS_MAX_LINE];
+  uint8_t _line_length = 0;
+  bool _line_overflow = false;
+};
+
+/**
+ * @brief Global instance for the diagnostic reports
+ *
+ */
+extern Diagnostics Diag;
+
+#endif // DIAGNOSTICS_H
@@ -6,6 +6,7 @@
 #include <SPI.h>
 #include "display_wheel.h"
 #include "../logging/SerialLogger.h"
+#include "../diagnostics/boot_profiler.h"
 
 
 /**
@@ -28,21 +29,32 @@ DISPLAY_Wheel::DISPLAY_Wheel()
 void DISPLAY_Wheel::init()
 {
     uint32_t buffer_size = (w_area_x2-w_area_x1)*(w_area_y2-w_area_y1)*3/2;
+    int64_t start = Boot.Now();
     DISPLAY_SPI::init();
+    Boot.Phase("display bus", start);
+    Logger.Info_f(F("Display SPI clocks: write %u Hz, read %u Hz"), get_write_frequency(), get_read_frequency());
+    start = Boot.Now();
     draw_background(lcars, lcars_size);
+    Boot.Phase("background", start);
+    start = Boot.Now();
     draw_image(splash, splash_size, w_area_x1, w_area_y1, w_area_x2-w_area_x1, w_area_y2-w_area_y1);
+    Boot.Phase("splash", start);
     
+    start = Boot.Now();
     Logger.Info(F("Attempting allocation of screen scrolling memory buffer..."));
     Logger.Info_f(F("....Largest free block: %d"), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
     buf1 = (uint8_t *)heap_caps_malloc(buffer_size, MALLOC_CAP_8BIT);
+    DISPLAY_STATS(count_allocation());
     if(buf1 == nullptr) Logger.Error(F("....Allocation of upper scroll buffer (buf1) did not succeed"));
     else Logger.Info(F("....Allocation of upper scroll buffer (buf1) successful"));
 
     buf2 = (uint8_t *)heap_caps_malloc(buffer_size, MALLOC_CAP_8BIT);
+    DISPLAY_STATS(count_allocation());
     if(buf2 == nullptr) Logger.Error(F("....Allocation of lower scroll buffer (buf2) did not succeed"));
     else Logger.Info(F("....Allocation of lower scroll buffer (buf2) successful"));
     Logger.Info_f(F("....Free heap: %d"), ESP.getFreeHeap());
     Logger.Info_f(F("....Largest free block: %d"), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    Boot.Phase("scroll buffers", start);
     Logger.Info(F("Done."));
 }
 
@@ -64,8 +76,9 @@ size_t DISPLAY_Wheel::print(uint8_t *st, int16_t x, int16_t y, int16_t xo, int16
  * @param c - Font color to use.
  * @param s - String to print
  */
-void DISPLAY_Wheel::w_area_print(String s, uint16_t c, bool newline)
+void DISPLAY_Wheel::w_area_print(const char *s, uint16_t c, bool newline)
 {
+    DISPLAY_STATS_SCOPE(PRIM_W_AREA_PRINT);
     if(!w_area_initialized)
     {
       fill_rect(w_area_x1, w_area_y1, w_area_x2-w_area_x1, w_area_y2-w_area_y1, 0x0000);
@@ -82,12 +95,12 @@ void DISPLAY_Wheel::w_area_print(String s, uint16_t c, bool newline)
         w_area_cursor_y = w_area_cursor_y - text_size*8;
     }
 
-    print_string(s, w_area_cursor_x, w_area_cursor_y, w_area_x1, w_area_y1);
+    print_string((const uint8_t *)s, w_area_cursor_x, w_area_cursor_y, w_area_x1, w_area_y1);
     w_area_cursor_x = get_text_X_cursor();
     w_area_cursor_y = get_text_Y_cursor();
     if(newline)
     {
-        print_string("\n", w_area_cursor_x, w_area_cursor_y, w_area_x1, w_area_y1);
+        print_string((const uint8_t *)"\n", w_area_cursor_x, w_area_cursor_y, w_area_x1, w_area_y1);
         w_area_cursor_x = 0;
         w_area_cursor_y = get_text_Y_cursor();
     }
@@ -96,6 +109,7 @@ void DISPLAY_Wheel::w_area_print(String s, uint16_t c, bool newline)
 
 void DISPLAY_Wheel::draw_arrow(int16_t x, int16_t y, Direction d, uint8_t size, int16_t fg, int16_t bg)
 {
+    DISPLAY_STATS_SCOPE(PRIM_DRAW_ARROW);
     const uint8_t _w = 8;
     const uint8_t _h = 5;
     if(d == Direction::LEFT || d == Direction::RIGHT)
@@ -190,6 +204,7 @@ void DISPLAY_Wheel::draw_arrow(int16_t x, int16_t y, Direction d, uint8_t size,
  */
 void DISPLAY_Wheel::window_scroll(int16_t x, int16_t y, int16_t w, int16_t h, int16_t dx, int16_t dy, uint8_t *bufh, uint8_t *bufl, uint8_t inc)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WINDOW_SCROLL);
     uint32_t cnth = 0;
     uint32_t cntl = 0;
     uint16_t bh = h/2;
@@ -228,8 +243,8 @@ void DISPLAY_Wheel::window_scroll(int16_t x, int16_t y, int16_t w, int16_t h, in
         CS_ACTIVE;
         writeCmd8(CC);
         CD_DATA;
-        spi->transferBytes(bufh, nullptr, cnth);                            // transfer the updated buffer into the window.
-        spi->transferBytes(bufl, nullptr, cntl);
+        spi_write_block(bufh, cnth);                                        // transfer the updated buffer into the window.
+        spi_write_block(bufl, cntl);
         CS_IDLE;
       }
     }
@@ -248,10 +263,10 @@ void DISPLAY_Wheel::window_scroll(int16_t x, int16_t y, int16_t w, int16_t h, in
       {
         if(i<=bh)
         {
-          spi->transferBytes(bufh + i*3*w, nullptr, cnth-3*i*w);
-          spi->transferBytes(bufl, nullptr, cntl);
+          spi_write_block(bufh + i*3*w, cnth-3*i*w);
+          spi_write_block(bufl, cntl);
           memset(bufh + 3*(i-inc)*w, 0x0, inc*w*3);
-          spi->transferBytes(bufh, nullptr, 3*i*w);
+          spi_write_block(bufh, 3*i*w);
                 // each dy means we have to move the start over by 3* the with of the area
                 // conversely, the size to transfer reduces by dy*3*width
                 // but now the last row needs to be blanked....
@@ -259,10 +274,10 @@ void DISPLAY_Wheel::window_scroll(int16_t x, int16_t y, int16_t w, int16_t h, in
         else
         {
           // now bufh has been fully processes and we need to shif processing to bufl
-          spi->transferBytes(bufl + (i-bh)*3*w, nullptr, cntl-3*(i-bh)*w);
-          spi->transferBytes(bufh, nullptr, cnth);
+          spi_write_block(bufl + (i-bh)*3*w, cntl-3*(i-bh)*w);
+          spi_write_block(bufh, cnth);
           memset(bufl + 3*(i-bh-inc)*w, 0x0, inc*w*3);
-          spi->transferBytes(bufl, nullptr, 3*(i-bh)*w);
+          spi_write_block(bufl, 3*(i-bh)*w);
         }
       }
       CS_IDLE;
@@ -370,6 +385,7 @@ void DISPLAY_Wheel::test()
  */
 void DISPLAY_Wheel::write_axis(Axis axis)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_DRO);
     set_text_back_color(RGB_to_565(177,0,254));
     set_text_color(0xffff);
     set_text_size(4);
@@ -386,13 +402,14 @@ void DISPLAY_Wheel::write_axis(Axis axis)
  * @brief Writes the last command into the display
  * @param c - the command name.
  */
-void DISPLAY_Wheel::write_command(String c)
+void DISPLAY_Wheel::write_command(const char *c)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_STATUS);
     fill_rect(136, 101, 300, 9, RGB_to_565(127,106,0));
     set_text_back_color(RGB_to_565(127,106,0));
     set_text_color(0xffffff);
     set_text_size(1);
-    print_string(c, 141, 101);  
+    print_string((const uint8_t *)c, 141, 101);  
 }
 
 /**
@@ -401,6 +418,7 @@ void DISPLAY_Wheel::write_command(String c)
 */
 void DISPLAY_Wheel::write_emergency(bool has_emergency)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_STATUS);
   if(has_emergency)
   {
     fill_rect(0, 50, 66, 24, 0xf800);
@@ -426,6 +444,7 @@ void DISPLAY_Wheel::write_emergency(bool has_emergency)
  */
 void DISPLAY_Wheel::write_feed(float feed)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_DRO);
     set_text_back_color(RGB_to_565(177,0,254));
     set_text_color(0xffffff);
     set_text_size(3);
@@ -439,6 +458,7 @@ void DISPLAY_Wheel::write_feed(float feed)
  */
 void DISPLAY_Wheel::write_status(const String &format, ...)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_STATUS);
     char *buf = NULL;
     va_list copy;
     va_list args; 
@@ -467,6 +487,7 @@ void DISPLAY_Wheel::write_status(const String &format, ...)
       va_end(copy);
       return;
     }
+    DISPLAY_STATS(count_allocation());
 
     // Format the string  
     vsnprintf(buf, len+1, format.c_str(), copy);
@@ -483,6 +504,7 @@ void DISPLAY_Wheel::write_status(const String &format, ...)
  */
 void DISPLAY_Wheel::write_x(float x)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_DRO);
     set_text_back_color(RGB_to_565(177,0,254));
     set_text_color(0xffffff);
     set_text_size(2);
@@ -495,6 +517,7 @@ void DISPLAY_Wheel::write_x(float x)
  */
 void DISPLAY_Wheel::write_y(float y)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_DRO);
     set_text_back_color(RGB_to_565(177,0,254));
     set_text_color(0xffffff);
     set_text_size(2);
@@ -507,6 +530,7 @@ void DISPLAY_Wheel::write_y(float y)
  */
 void DISPLAY_Wheel::write_z(float z)
 {
+    DISPLAY_STATS_SCOPE(PRIM_WRITE_DRO);
     set_text_back_color(RGB_to_565(177,0,254));
     set_text_color(0xffffff);
     set_text_size(2);
@@ -58,7 +58,7 @@ class DISPLAY_Wheel:public DISPLAY_SPI
 		 * @param c - Font color to use.
 		 * @param newline - True to add a carriage return
 		 */
-		void w_area_print(String s, uint16_t color, bool newline);
+		void w_area_print(const char *s, uint16_t color, bool newline);
 
 		/**
 		 * @brief Tests the display by going through a routine of drawing various
@@ -76,7 +76,7 @@ class DISPLAY_Wheel:public DISPLAY_SPI
 		 * @brief Writes the last command into the display
 		 * @param c - the command name.
 		 */
-		void write_command(String c);
+		void write_command(const char *c);
 
 		/**
 		 * @brief Writes emergency indicator to the disaply
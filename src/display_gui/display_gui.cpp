@@ -20,6 +20,7 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "display_gui.h"
+#include "display_stats.h"
 #include "../logging/SerialLogger.h"
 
 #define swap(a, b) { int16_t t = a; a = b; b = t; }
@@ -803,6 +804,7 @@ void DISPLAY_GUI::set_text_size(uint8_t s)
  */
 void DISPLAY_GUI::draw_char(int16_t x, int16_t y, uint8_t c, uint16_t color, uint16_t bg, uint8_t size, boolean mode)
 {
+	DISPLAY_STATS_SCOPE(PRIM_DRAW_CHAR);
 	if((x >= get_width()) || (y >= get_height()) || ((x + 6 * size - 1) < 0) || ((y + 8 * size - 1) < 0))
 	{
     	return;
@@ -975,6 +977,7 @@ void DISPLAY_GUI::fill_circle_helper(int16_t x0, int16_t y0, int16_t r, uint8_t
  */
 size_t DISPLAY_GUI::print(uint8_t *st, int16_t x, int16_t y, int16_t xo, int16_t yo)
 {
+	DISPLAY_STATS_SCOPE(PRIM_PRINT);
 	int16_t pos;
 	uint16_t len;
 	const char * p = (const char *)st;
@@ -0,0 +1,120 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include "display_stats.h"
+
+static const char *primitive_names[PRIM_COUNT] = {
+	"other", "draw_background", "draw_image", "draw_pixel", "fill_rect", "push_colors", "read_gram", "vert_scroll",
+	"draw_char", "print", "draw_arrow", "write_dro", "write_status", "w_area_print", "window_scroll"
+};
+
+/**
+ * @brief Generates a new instance of the DisplayStats class
+ */
+DisplayStats::DisplayStats()
+{
+	reset();
+}
+
+#pragma region public methods
+/**
+ * @brief Enters a primitive
+ * @param primitive - the primitive entered
+ */
+void DisplayStats::enter(display_primitive_t primitive)
+{
+	_counters[primitive].calls++;
+	if(_depth++ == 0)
+	{
+		_current = primitive;
+		_start_us = micros();
+	}
+}
+
+/**
+ * @brief Leaves the most recently entered primitive
+ */
+void DisplayStats::leave()
+{
+	if(_depth == 0) return;
+	if(--_depth == 0)
+	{
+		_counters[_current].time_us += (uint32_t)(micros() - _start_us);
+		_current = PRIM_OTHER;
+	}
+}
+
+/**
+ * @brief Writes the statistics report
+ * @param out - the output to write to
+ */
+void DisplayStats::print(Print &out) const
+{
+	out.printf("%-16s %8s %8s %10s %8s %7s %10s\n", "primitive", "calls", "trans", "bytes", "windows", "allocs", "time_us");
+	for(uint8_t i=0; i<PRIM_COUNT; i++)
+	{
+		const display_counters_t &c = _counters[i];
+		if(c.calls == 0 && c.transactions == 0) continue;
+		out.printf("%-16s %8u %8u %10u %8u %7u %10llu\n", primitive_names[i],
+			c.calls, c.transactions, c.bytes, c.addr_windows, c.allocations, c.time_us);
+	}
+	out.printf("frames: %u, avg %llu us, max %u us\n",
+		_frame_count, _frame_count ? _frame_total_us / _frame_count : 0ULL, _frame_max_us);
+	for(uint8_t i=0; i<FRAME_HISTOGRAM_BUCKETS; i++)
+	{
+		if(i < FRAME_HISTOGRAM_BUCKETS - 1) out.printf("  < %6u us: %u\n", 250u << i, _frames[i]);
+		else out.printf("  >=%6u us: %u\n", 250u << (i - 1), _frames[i]);
+	}
+}
+
+/**
+ * @brief Records the duration of a display update cycle in the frame histogram
+ * @param us - the cycle duration in microseconds
+ */
+void DisplayStats::record_frame(uint32_t us)
+{
+	uint8_t bucket = 0;
+	while(bucket < FRAME_HISTOGRAM_BUCKETS - 1 && us >= (250u << bucket)) bucket++;
+	_frames[bucket]++;
+	_frame_count++;
+	_frame_total_us += us;
+	if(us > _frame_max_us) _frame_max_us = us;
+}
+
+/**
+ * @brief Resets all counters and the frame histogram
+ */
+void DisplayStats::reset()
+{
+	memset(_counters, 0, sizeof(_counters));
+	memset(_frames, 0, sizeof(_frames));
+	_frame_count = 0;
+	_frame_max_us = 0;
+	_frame_total_us = 0;
+	_start_us = 0;
+	_depth = 0;
+	_current = PRIM_OTHER;
+}
+#pragma endregion
+
+/**
+ * @brief Enters the primitive for the lifetime of the scope guard
+ * @param primitive - the primitive
+ */
+DisplayStatsScope::DisplayStatsScope(display_primitive_t primitive)
+{
+	DisplayMetrics.enter(primitive);
+}
+
+/**
+ * @brief Leaves the primitive
+ */
+DisplayStatsScope::~DisplayStatsScope()
+{
+	DisplayMetrics.leave();
+}
+
+/**
+ * @brief Global instance collecting the display statistics
+ */
+DisplayStats DisplayMetrics;
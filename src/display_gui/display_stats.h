@@ -0,0 +1,151 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef _DISPLAY_STATS_H_
+#define _DISPLAY_STATS_H_
+
+#include "Arduino.h"
+
+#ifndef DISPLAY_STATS_ENABLED
+#define DISPLAY_STATS_ENABLED 1
+#endif
+
+#define FRAME_HISTOGRAM_BUCKETS 10
+	// bucket i counts frames shorter than 250us << i, the last bucket counts everything longer
+
+/**
+ * @brief The display primitives bus activity is attributed to
+ */
+typedef enum
+{
+	PRIM_OTHER,
+	PRIM_DRAW_BACKGROUND,
+	PRIM_DRAW_IMAGE,
+	PRIM_DRAW_PIXEL,
+	PRIM_FILL_RECT,
+	PRIM_PUSH_COLORS,
+	PRIM_READ_GRAM,
+	PRIM_VERT_SCROLL,
+	PRIM_DRAW_CHAR,
+	PRIM_PRINT,
+	PRIM_DRAW_ARROW,
+	PRIM_WRITE_DRO,
+	PRIM_WRITE_STATUS,
+	PRIM_W_AREA_PRINT,
+	PRIM_WINDOW_SCROLL,
+	PRIM_COUNT
+} display_primitive_t;
+
+/**
+ * @brief Counters collected for a display primitive
+ */
+typedef struct
+{
+	uint32_t calls;
+	uint32_t transactions;
+	uint32_t bytes;
+	uint32_t addr_windows;
+	uint32_t allocations;
+	uint64_t time_us;
+} display_counters_t;
+
+/**
+ * @brief Collects bus statistics for the display stack.
+ * @details Calls are counted for every primitive entered, including nested ones (a fill_rect issued
+ * by draw_char counts as a fill_rect call). Transactions, bytes, address window sets, heap allocations
+ * and time are attributed to the outermost primitive only, so the totals add up to the actual bus
+ * traffic. The display is only ever driven by the task holding the display mutex, so the counters
+ * are not synchronized.
+ */
+class DisplayStats
+{
+	public:
+		/**
+		 * @brief Generates a new instance of the DisplayStats class
+		 */
+		DisplayStats();
+
+		/**
+		 * @brief Counts a heap allocation made by the current primitive
+		 */
+		inline void count_allocation() { _counters[_current].allocations++; }
+
+		/**
+		 * @brief Counts an address window set by the current primitive
+		 */
+		inline void count_addr_window() { _counters[_current].addr_windows++; }
+
+		/**
+		 * @brief Counts bytes moved over the bus by the current primitive
+		 * @param n - the number of bytes
+		 */
+		inline void count_bytes(uint32_t n) { _counters[_current].bytes += n; }
+
+		/**
+		 * @brief Counts a bus transaction (CS assertion) by the current primitive
+		 */
+		inline void count_transaction() { _counters[_current].transactions++; }
+
+		/**
+		 * @brief Enters a primitive
+		 * @param primitive - the primitive entered
+		 */
+		void enter(display_primitive_t primitive);
+
+		/**
+		 * @brief Leaves the most recently entered primitive
+		 */
+		void leave();
+
+		/**
+		 * @brief Writes the statistics report
+		 * @param out - the output to write to
+		 */
+		void print(Print &out) const;
+
+		/**
+		 * @brief Records the duration of a display update cycle in the frame histogram
+		 * @param us - the cycle duration in microseconds
+		 */
+		void record_frame(uint32_t us);
+
+		/**
+		 * @brief Resets all counters and the frame histogram
+		 */
+		void reset();
+
+	private:
+		display_counters_t _counters[PRIM_COUNT];
+		uint32_t _frames[FRAME_HISTOGRAM_BUCKETS];
+		uint32_t _frame_count;
+		uint32_t _frame_max_us;
+		uint64_t _frame_total_us;
+		uint32_t _start_us;
+		uint8_t _depth;
+		display_primitive_t _current;
+};
+
+/**
+ * @brief Scope guard attributing bus activity to a primitive for the lifetime of the guard
+ */
+class DisplayStatsScope
+{
+	public:
+		DisplayStatsScope(display_primitive_t primitive);
+		~DisplayStatsScope();
+};
+
+/**
+ * @brief Global instance collecting the display statistics
+ */
+extern DisplayStats DisplayMetrics;
+
+#if DISPLAY_STATS_ENABLED
+#define DISPLAY_STATS_SCOPE(p) DisplayStatsScope _display_stats_scope(p)
+#define DISPLAY_STATS(op) DisplayMetrics.op
+#else
+#define DISPLAY_STATS_SCOPE(p)
+#define DISPLAY_STATS(op)
+#endif
+
+#endif
@@ -15,6 +15,18 @@
 #define TFTLCD_DELAY8   0x7F
 #define MAX_REG_NUM     24
 
+#define CALIBRATION_WIDTH   32
+#define CALIBRATION_HEIGHT  2
+#define CALIBRATION_PASSES  3
+
+/**
+ * @brief Candidate SPI clocks, fastest first. The ESP32 derives the SPI clock from the 80MHz APB 
+ * clock, so only integer divisions of it are useful. Writes are tried down to the default clock, 
+ * reads on the ILI9488 need to be considerably slower than writes. 
+ */
+static const uint32_t write_frequencies[] = {80000000, 40000000, 26666667, SPI_DEFAULT_FREQUENCY};
+static const uint32_t read_frequencies[] = {SPI_DEFAULT_FREQUENCY, 16000000, 13333333, 10000000, 8000000, 6666667, 4000000};
+
 
 static const uint8_t display_buffer[WIDTH * HEIGHT * 3] PROGMEM = {0};
 
@@ -36,7 +48,7 @@ DISPLAY_SPI::DISPLAY_SPI()
 
 	spi = new SPIClass(HSPI);
   	spi->begin();
-	spi->setFrequency(20000000);
+	spi->setFrequency(SPI_DEFAULT_FREQUENCY);
   	spi->setBitOrder(MSBFIRST);
 	spi->setDataMode(SPI_MODE0);
 
@@ -62,6 +74,49 @@ uint16_t DISPLAY_SPI::RGB_to_565(uint8_t r, uint8_t g, uint8_t b)
 	return ((r& 0xF8) << 8) | ((g & 0xFC) << 3) | ((b & 0xF8) >> 3);
 }
 
+/**
+ * @brief Determines the fastest reliable SPI clocks for the display
+ * @details First finds the fastest read clock at which test patterns written at the default 
+ * write clock read back correctly through RAMRD. Then finds the fastest write clock whose test 
+ * patterns verify using that read clock. The display must be initialized and the test area in 
+ * the upper left corner is overwritten.
+ * @returns true if a working combination of clocks was found, false if the defaults are used
+ */
+bool DISPLAY_SPI::calibrate_bus_frequency()
+{
+	uint32_t read = 0;
+	uint32_t write = 0;
+	for(uint8_t i=0; i<sizeof(read_frequencies)/sizeof(read_frequencies[0]); i++)
+	{
+		set_bus_frequency(SPI_DEFAULT_FREQUENCY, read_frequencies[i]);
+		if(verify_bus_frequency())
+		{
+			read = read_frequencies[i];
+			break;
+		}
+	}
+	if(read == 0)
+	{
+		// not even the slowest read clock verifies. Reads are broken on this board, so we 
+		// cannot determine anything. Fall back to the defaults.
+		set_bus_frequency(SPI_DEFAULT_FREQUENCY, SPI_DEFAULT_FREQUENCY);
+		return false;
+	}
+
+	for(uint8_t i=0; i<sizeof(write_frequencies)/sizeof(write_frequencies[0]); i++)
+	{
+		set_bus_frequency(write_frequencies[i], read);
+		if(verify_bus_frequency())
+		{
+			write = write_frequencies[i];
+			break;
+		}
+	}
+	if(write == 0) write = SPI_DEFAULT_FREQUENCY;
+	set_bus_frequency(write, read);
+	return true;
+}
+
 /**
  * @brief draw backgound image on the display
  * @param image - array to image containing 3 6-bit color values per pixel
@@ -69,11 +124,12 @@ uint16_t DISPLAY_SPI::RGB_to_565(uint8_t r, uint8_t g, uint8_t b)
  */
 void DISPLAY_SPI::draw_background(const unsigned char* image, size_t size)
 {
+	DISPLAY_STATS_SCOPE(PRIM_DRAW_BACKGROUND);
 	set_addr_window(0, 0, width - 1, height);
 	CS_ACTIVE;
 	writeCmd8(CC);
 	CD_DATA;
-	spi->transferBytes(image, nullptr, size);
+	spi_write_block(image, size);
 	CS_IDLE;
 }
 
@@ -129,11 +185,12 @@ void DISPLAY_SPI::draw_bitmap(uint8_t x,uint8_t y,uint8_t width, uint8_t height,
  */
 void DISPLAY_SPI::draw_image(const unsigned char* image, size_t size, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
 {
+	DISPLAY_STATS_SCOPE(PRIM_DRAW_IMAGE);
 	set_addr_window(x, y, x+ w - 1, y + h);
 	CS_ACTIVE;
 	writeCmd8(CC);
 	CD_DATA;
-	spi->transferBytes(image, nullptr, size);
+	spi_write_block(image, size);
 	CS_IDLE;
 }
 
@@ -145,7 +202,8 @@ void DISPLAY_SPI::draw_image(const unsigned char* image, size_t size, uint16_t x
  */
 void DISPLAY_SPI::draw_pixel(int16_t x, int16_t y, uint16_t color)
 {
-	if((x < 0) || (y < 0) || (x > get_width()) || (y > get_height()))
+	DISPLAY_STATS_SCOPE(PRIM_DRAW_PIXEL);
+	if((x < 0) || (y < 0) || (x >= get_width()) || (y >= get_height()))
 	{
 		return;
 	}
@@ -166,6 +224,7 @@ void DISPLAY_SPI::draw_pixel(int16_t x, int16_t y, uint16_t color)
  */
 void DISPLAY_SPI::fill_rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
 {
+	DISPLAY_STATS_SCOPE(PRIM_FILL_RECT);
 	int16_t end; 
 	uint8_t *buffer;
 	uint16_t i;
@@ -202,6 +261,7 @@ void DISPLAY_SPI::fill_rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t
 	if(true)
 	{
 		buffer = new uint8_t[(size_t)(h*3)];
+		DISPLAY_STATS(count_allocation());
 		uint8_t r = (uint8_t)((((color >> 11) & 0x1F) * 63)/31);
 		uint8_t g = (uint8_t)((color >> 5) & 0x3F);
 		uint8_t b = (uint8_t)(((color & 0x1F) * 63) / 31);
@@ -220,7 +280,7 @@ void DISPLAY_SPI::fill_rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t
 		CD_DATA;
 		for (i=0; i<w; i++)
 		{
-			spi->transferBytes(buffer, nullptr, h*3);
+			spi_write_block(buffer, h*3);
 		} 
 		CS_IDLE;
 		delete[] buffer;
@@ -231,7 +291,7 @@ void DISPLAY_SPI::fill_rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t
 		CS_ACTIVE;
 		writeCmd8(CC);
 		CD_DATA;
-		spi->transferBytes(display_buffer, nullptr, WIDTH * HEIGHT * 3);
+		spi_write_block(display_buffer, WIDTH * HEIGHT * 3);
 		CS_IDLE;
 	}
 }
@@ -245,6 +305,15 @@ int16_t DISPLAY_SPI::get_height() const
 	return height;
 }
 
+/**
+ * @brief Gets the SPI clock used to read from the display
+ * @returns The read clock in Hz, 0 if not yet configured
+ */
+uint32_t DISPLAY_SPI::get_read_frequency() const
+{
+	return read_frequency;
+}
+
 /**
  * @brief Gets the current display rotation
  * @returns the rotation: 
@@ -267,14 +336,35 @@ int16_t DISPLAY_SPI::get_width() const
 	return width;
 }
 
+/**
+ * @brief Gets the SPI clock used to write to the display
+ * @returns The write clock in Hz, 0 if not yet configured
+ */
+uint32_t DISPLAY_SPI::get_write_frequency() const
+{
+	return write_frequency;
+}
+
 /**
  * @brief Initializes the display
+ * @details The controller is initialized at the default SPI clock. Afterwards the configured 
+ * bus clocks are verified and, if they are not set or do not verify, the bus is calibrated.
  */
 void DISPLAY_SPI::init()
 {
+	uint32_t write = write_frequency;
+	uint32_t read = read_frequency;
+	spi->setFrequency(SPI_DEFAULT_FREQUENCY);
 	reset();
 	toggle_backlight(true);
 	start_display();
+
+	if(write != 0 && read != 0)
+	{
+		set_bus_frequency(write, read);
+		if(verify_bus_frequency()) return;
+	}
+	calibrate_bus_frequency();
 }
 
 /**
@@ -298,6 +388,7 @@ void DISPLAY_SPI::invert_display(boolean invert)
  */
 void DISPLAY_SPI::push_color_table(uint16_t * block, int16_t n, bool first, uint8_t flags)
 {
+	DISPLAY_STATS_SCOPE(PRIM_PUSH_COLORS);
 	uint16_t color;
     uint8_t h, l;
 	bool isconst = flags & 1;
@@ -331,6 +422,7 @@ void DISPLAY_SPI::push_color_table(uint16_t * block, int16_t n, bool first, uint
  */
 void DISPLAY_SPI::push_color_table(uint8_t * block, int16_t n, bool first, uint8_t flags)
 {
+	DISPLAY_STATS_SCOPE(PRIM_PUSH_COLORS);
 	uint16_t color;
     uint8_t h, l;
 	bool isconst = flags & 1;
@@ -382,6 +474,30 @@ void DISPLAY_SPI::reset()
   	CS_IDLE;
 }
 
+/**
+ * @brief Sets the SPI clocks used for writing to and reading from the display
+ * @param write_frequency - the write clock in Hz
+ * @param read_frequency - the read clock in Hz
+ * @remarks Passing 0 for either clock marks the bus as not configured, in which case it 
+ * will be calibrated during init.
+ */
+void DISPLAY_SPI::set_bus_frequency(uint32_t write_frequency, uint32_t read_frequency)
+{
+	if(write_frequency == 0 || read_frequency == 0)
+	{
+		this->write_frequency = 0;
+		this->read_frequency = 0;
+		return;
+	}
+	this->write_frequency = write_frequency;
+	this->read_frequency = read_frequency;
+	write_clock_div = spiFrequencyToClockDiv(write_frequency);
+	read_clock_div = spiFrequencyToClockDiv(read_frequency);
+		// the dividers are computed once here so switching between the read and write
+		// clock for each GRAM read is only a register update.
+	spi->setClockDivider(write_clock_div);
+}
+
 /**
  * @brief Set display rotation
  * @param r - The Rotation to set. 
@@ -447,6 +563,7 @@ void DISPLAY_SPI::toggle_backlight(boolean state)
  */
 void DISPLAY_SPI::vert_scroll(int16_t scroll_area_top, int16_t scroll_area_height, int16_t offset)
 {
+	DISPLAY_STATS_SCOPE(PRIM_VERT_SCROLL);
     int16_t bfa;
     int16_t vsp;
 	bfa = HEIGHT - scroll_area_top - scroll_area_height; 
@@ -478,9 +595,75 @@ void DISPLAY_SPI::vert_scroll(int16_t scroll_area_top, int16_t scroll_area_heigh
 	}
 }
 
+/**
+ * @brief Verifies the current bus clocks by writing test patterns to the display and reading 
+ * them back through RAMRD
+ * @returns true if all patterns read back correctly, false otherwise
+ */
+bool DISPLAY_SPI::verify_bus_frequency()
+{
+	uint8_t pattern[CALIBRATION_WIDTH * CALIBRATION_HEIGHT * 3];
+	uint8_t readback[CALIBRATION_WIDTH * CALIBRATION_HEIGHT * 3];
+	uint32_t seed = 0xA5C3E1F7;
+	if(write_frequency == 0 || read_frequency == 0) return false;
+	for(uint8_t pass=0; pass<CALIBRATION_PASSES; pass++)
+	{
+		for(uint16_t i=0; i<sizeof(pattern); i++)
+		{
+			// in 18 bit mode only the upper 6 bits of each color byte are stored in GRAM, 
+			// so all patterns keep the lower two bits clear.
+			switch(pass)
+			{
+				case 0:
+					pattern[i] = (i & 1) ? 0xFC : 0x00;		// toggle every data line on every byte
+					break;
+				case 1:
+					pattern[i] = 0x04 << (i % 6);			// walking one across the color bits
+					break;
+				default:
+					seed ^= seed << 13;						// xorshift pseudo random data
+					seed ^= seed >> 17;
+					seed ^= seed << 5;
+					pattern[i] = seed & 0xFC;
+					break;
+			}
+		}
+		memset(readback, 0x00, sizeof(readback));
+
+		set_addr_window(0, 0, CALIBRATION_WIDTH - 1, CALIBRATION_HEIGHT - 1);
+		CS_ACTIVE;
+		writeCmd8(CC);
+		CD_DATA;
+		spi_write_block(pattern, sizeof(pattern));
+		CS_IDLE;
+
+		if(read_GRAM_RGB(0, 0, readback, CALIBRATION_WIDTH, CALIBRATION_HEIGHT) != sizeof(readback)) return false;
+		for(uint16_t i=0; i<sizeof(pattern); i++)
+		{
+			if((readback[i] & 0xFC) != pattern[i]) return false;
+		}
+	}
+	return true;
+}
+
 #pragma endregion
 
 #pragma region protected methods
+/**
+ * @brief Switches the SPI bus to the read clock. Call before issuing RAMRD or register reads. 
+ */
+void DISPLAY_SPI::begin_read()
+{
+	if(read_clock_div != 0) spi->setClockDivider(read_clock_div);
+}
+
+/**
+ * @brief Switches the SPI bus back to the write clock after a read. 
+ */
+void DISPLAY_SPI::end_read()
+{
+	if(write_clock_div != 0) spi->setClockDivider(write_clock_div);
+}
 /**
  * @brief Read graphics RAM data
  * @param x - x Coordinate to start reading from
@@ -492,11 +675,13 @@ void DISPLAY_SPI::vert_scroll(int16_t scroll_area_top, int16_t scroll_area_heigh
  */
 uint32_t DISPLAY_SPI::read_GRAM(int16_t x, int16_t y, uint16_t *block, int16_t w, int16_t h)
 {
+	DISPLAY_STATS_SCOPE(PRIM_READ_GRAM);
 	uint16_t ret, dummy;
     uint32_t n = w * h;
 	uint32_t cnt = 0;
     uint8_t r, g, b, tmp;
     set_addr_window(x, y, x + w - 1, y + h - 1);
+	begin_read();
     while (n > 0) 
 	{
         CS_ACTIVE;
@@ -524,6 +709,7 @@ uint32_t DISPLAY_SPI::read_GRAM(int16_t x, int16_t y, uint16_t *block, int16_t w
         CS_IDLE;
         setWriteDir();
     }
+	end_read();
 	return cnt;
 }
 
@@ -538,17 +724,20 @@ uint32_t DISPLAY_SPI::read_GRAM(int16_t x, int16_t y, uint16_t *block, int16_t w
  */
 uint32_t DISPLAY_SPI::read_GRAM_RGB(int16_t x, int16_t y, uint8_t *block, int16_t w, int16_t h)
 {
+	DISPLAY_STATS_SCOPE(PRIM_READ_GRAM);
 	uint32_t ret;
     uint32_t n = (uint32_t)w * (uint32_t)h * 3;
 	uint32_t cnt = 0;
     uint8_t r;
 
     set_addr_window(x, y, x+w-1, y+h-1);
+	begin_read();
 	CS_ACTIVE;
 	writeCmd16(0x2E);
     setReadDir();
 
 	r=spi->transfer(0x00);  // first byte just contains some status info... discard...
+	DISPLAY_STATS(count_bytes(1));
     if(R24BIT == 1)
 	{
 		for (uint32_t i = 0; i < n; i++) 
@@ -556,6 +745,7 @@ uint32_t DISPLAY_SPI::read_GRAM_RGB(int16_t x, int16_t y, uint8_t *block, int16_
 			block[i] = (spi->transfer(0x00) & 0x7F) << 1;
 			cnt++;
 		}
+		DISPLAY_STATS(count_bytes(n));
 	}
 	else
 	{
@@ -571,6 +761,7 @@ uint32_t DISPLAY_SPI::read_GRAM_RGB(int16_t x, int16_t y, uint8_t *block, int16_
 	}
     CS_IDLE;
     setWriteDir();
+	end_read();
 	return cnt;
 }
 
@@ -584,6 +775,7 @@ uint16_t DISPLAY_SPI::read_reg(uint16_t reg, int8_t index)
 {
 	uint16_t ret,high;
     uint8_t low;
+	begin_read();
 	CS_ACTIVE;
     writeCmd16(reg);
     setReadDir();
@@ -594,6 +786,7 @@ uint16_t DISPLAY_SPI::read_reg(uint16_t reg, int8_t index)
 	} while (--index >= 0);  
     CS_IDLE;
     setWriteDir();
+	end_read();
     return ret;
 }
 
@@ -606,6 +799,7 @@ uint16_t DISPLAY_SPI::read_reg(uint16_t reg, int8_t index)
  */
 void DISPLAY_SPI::set_addr_window(unsigned int x1, unsigned int y1, unsigned int x2, unsigned int y2)
 {
+	DISPLAY_STATS(count_addr_window());
 	CS_ACTIVE;
 	uint8_t x_buf[] = {x1>>8,x1,x2>>8,x2};
 	uint8_t y_buf[] = {y1>>8,y1,y2>>8,y2};
@@ -832,6 +1026,7 @@ void DISPLAY_SPI::push_command(uint8_t cmd, uint8_t *data, int8_t data_size)
  */
 uint8_t DISPLAY_SPI::spi_read()
 {
+	DISPLAY_STATS(count_bytes(1));
 	return spi->transfer(0xFF);
 }
 
@@ -841,9 +1036,21 @@ uint8_t DISPLAY_SPI::spi_read()
  */
 void DISPLAY_SPI::spi_write(uint8_t data)
 {
+	DISPLAY_STATS(count_bytes(1));
 	spi->transfer(data);
 }
 
+/**
+ * @brief Writes a block of data on the SPI bus.
+ * @param data - pointer to the data to write
+ * @param size - the number of bytes to write
+ */
+void DISPLAY_SPI::spi_write_block(const uint8_t *data, uint32_t size)
+{
+	DISPLAY_STATS(count_bytes(size));
+	spi->transferBytes(data, nullptr, size);
+}
+
 /**
  * @brief Writes a command to the display controller.
  * @param cmd - Command to write
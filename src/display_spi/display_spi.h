@@ -8,6 +8,7 @@
 #include <SPI.h>
 #include "mcu_spi_magic.h"
 #include "../display_gui/display_gui.h"
+#include "../display_gui/display_stats.h"
 
 /** 
  * This program implements the SPI display for the wheel.
@@ -39,6 +40,16 @@ class DISPLAY_SPI:public DISPLAY_GUI
 		 */
 		uint16_t RGB_to_565(uint8_t r, uint8_t g, uint8_t b) override;
 
+		/**
+		 * @brief Determines the fastest reliable SPI clocks for the display
+		 * @details First finds the fastest read clock at which test patterns written at the default 
+		 * write clock read back correctly through RAMRD. Then finds the fastest write clock whose test 
+		 * patterns verify using that read clock. The display must be initialized and the test area in 
+		 * the upper left corner is overwritten.
+		 * @returns true if a working combination of clocks was found, false if the defaults are used
+		 */
+		bool calibrate_bus_frequency();
+
 		/**
 		 * @brief draw backgound image on the display
 		 * @param image - array to image containing 3 6-bit color values per pixel
@@ -86,6 +97,18 @@ class DISPLAY_SPI:public DISPLAY_GUI
 		 */
 		void fill_rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override;
 
+		/**
+		 * @brief Gets the SPI clock used to read from the display
+		 * @returns The read clock in Hz, 0 if not yet configured
+		 */
+		uint32_t get_read_frequency(void) const;
+
+		/**
+		 * @brief Gets the SPI clock used to write to the display
+		 * @returns The write clock in Hz, 0 if not yet configured
+		 */
+		uint32_t get_write_frequency(void) const;
+
 		/**
 		 * @brief Gets teh display height
 		 * @returns The display height
@@ -110,6 +133,8 @@ class DISPLAY_SPI:public DISPLAY_GUI
 
 		/**
 		 * @brief Initializes the display
+		 * @details The controller is initialized at the default SPI clock. Afterwards the configured 
+		 * bus clocks are verified and, if they are not set or do not verify, the bus is calibrated.
 		 */
 		void init();
 
@@ -142,6 +167,15 @@ class DISPLAY_SPI:public DISPLAY_GUI
 		*/
 		void reset();
 
+		/**
+		 * @brief Sets the SPI clocks used for writing to and reading from the display
+		 * @param write_frequency - the write clock in Hz
+		 * @param read_frequency - the read clock in Hz
+		 * @remarks Passing 0 for either clock marks the bus as not configured, in which case it 
+		 * will be calibrated during init.
+		 */
+		void set_bus_frequency(uint32_t write_frequency, uint32_t read_frequency);
+
 		/**
 		 * @brief Set display rotation
 		 * @param rotation - The Rotation to set. 
@@ -166,7 +200,46 @@ class DISPLAY_SPI:public DISPLAY_GUI
 		 */
 		void vert_scroll(int16_t scroll_area_top, int16_t scroll_area_height, int16_t offset);
 
+		/**
+		 * @brief Verifies the current bus clocks by writing test patterns to the display and reading 
+		 * them back through RAMRD
+		 * @returns true if all patterns read back correctly, false otherwise
+		 */
+		bool verify_bus_frequency();
+
 	protected:
+		/**
+		 * @brief Switches the SPI bus to the read clock. Call before issuing RAMRD or register reads. 
+		 */
+		void begin_read();
+
+		/**
+		 * @brief Asserts the chip select line, counting a bus transaction if it was idle
+		 */
+		inline void cs_active()
+		{
+			if(!cs_asserted)
+			{
+				cs_asserted = true;
+				DISPLAY_STATS(count_transaction());
+			}
+			digitalWrite(CS, LOW);
+		}
+
+		/**
+		 * @brief Releases the chip select line
+		 */
+		inline void cs_idle()
+		{
+			cs_asserted = false;
+			digitalWrite(CS, HIGH);
+		}
+
+		/**
+		 * @brief Switches the SPI bus back to the write clock after a read. 
+		 */
+		void end_read();
+
 		/**
 		 * @brief Read graphics RAM data as 565 values
 		 * @param x - x Coordinate to start reading from
@@ -229,6 +302,13 @@ class DISPLAY_SPI:public DISPLAY_GUI
 		 * @param data - data to write
 		 */
 		void spi_write(uint8_t data);
+
+		/**
+		 * @brief Writes a block of data on the SPI bus.
+		 * @param data - pointer to the data to write
+		 * @param size - the number of bytes to write
+		 */
+		void spi_write_block(const uint8_t *data, uint32_t size);
 		
 		/**
 		 * @brief Read data from the SPI bus
@@ -277,6 +357,11 @@ class DISPLAY_SPI:public DISPLAY_GUI
 		unsigned int height = HEIGHT;
 		uint16_t XC,YC,CC,RC,SC1,SC2,MD,VL,R24BIT;
 		SPIClass *spi = NULL;
+		uint32_t write_frequency = 0;
+		uint32_t read_frequency = 0;
+		uint32_t write_clock_div = 0;
+		uint32_t read_clock_div = 0;
+		bool cs_asserted = false;
 		volatile uint32_t *spicsPort, *spicdPort, *spimisoPort , *spimosiPort, *spiclkPort;
 		uint8_t  spicsPinSet, spicdPinSet  ,spimisoPinSet , spimosiPinSet , spiclkPinSet, spicsPinUnset, spicdPinUnset, spimisoPinUnset,  spimosiPinUnset,spiclkPinUnset;
 };
@@ -30,10 +30,14 @@
 #define WIDTH 320
 #define HEIGHT 480
 
+#define SPI_DEFAULT_FREQUENCY 20000000
+    // conservative SPI clock used to initialize the controller and as the fallback if 
+    // bus calibration does not find a working combination of read and write clocks.
+
 #define CD_COMMAND  (digitalWrite(RS,LOW))    
 #define CD_DATA     (digitalWrite(RS,HIGH)) 
-#define CS_ACTIVE   (digitalWrite(CS,LOW)) 
-#define CS_IDLE     (digitalWrite(CS, HIGH)) 
+#define CS_ACTIVE   (cs_active()) 
+#define CS_IDLE     (cs_idle()) 
 #define MISO_STATE(x) { x = digitalRead(SID);}
 #define MOSI_LOW    (digitalWrite(SID,LOW)) 
 #define MOSI_HIGH   (digitalWrite(SID,HIGH)) 
@@ -0,0 +1,345 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include <esp_system.h>
+#include "event_journal.h"
+#include "../logging/SerialLogger.h"
+#include "../macro/macro_engine.h"
+#ifdef CONFIG_ESP_COREDUMP_ENABLE_TO_FLASH
+#include <esp_core_dump.h>
+#endif
+
+#define RECORDS_PER_PAGE (JOURNAL_PAGE_SIZE / sizeof(journal_record_t))
+
+static const char *event_names[JOURNAL_TYPE_COUNT] = {
+  "?", "boot", "coredump", "clock", "ems", "command", "counter", "error", "macro"
+};
+
+static const char *reset_reasons[] = {
+  "unknown", "power on", "external", "software", "panic", "interrupt watchdog", "task watchdog",
+  "watchdog", "deep sleep", "brownout", "sdio"
+};
+
+static const char *counter_names[JOURNAL_COUNTER_COUNT] = {"log dropped", "journal dropped"};
+static const char *source_names[JOURNAL_SOURCE_COUNT] = {"config", "display", "wifi"};
+static const char *macro_results[] = {"done", "cancelled", "failed", "timed out"};
+
+/**
+ * @brief Construct a new EventJournal object
+ *
+ */
+EventJournal::EventJournal()
+{
+  _dropped.store(0, std::memory_order_relaxed);
+  memset(_counters, 0, sizeof(_counters));
+}
+
+#pragma region public methods
+/**
+ * @brief Starts the journal task and records the boot. Mounting the file system (and
+ * formatting it on first use) happens on the journal task.
+ *
+ */
+void EventJournal::Begin()
+{
+  if(_queue != NULL) return;
+  _queue = xQueueCreate(JOURNAL_QUEUE_LENGTH, sizeof(journal_record_t));
+  _fs_mutex = xSemaphoreCreateMutex();
+  this->Record(JOURNAL_BOOT, (uint8_t)esp_reset_reason());
+#ifdef CONFIG_ESP_COREDUMP_ENABLE_TO_FLASH
+  size_t address, size;
+  if(esp_core_dump_image_get(&address, &size) == ESP_OK) this->Record(JOURNAL_COREDUMP, 0, size);
+#endif
+  xTaskCreate(EventJournal::journal_runner, "journal", JOURNAL_TASK_STACK, this, JOURNAL_TASK_PRIORITY, &_task);
+}
+
+/**
+ * @brief Queues an event. Never blocks; if the queue is full the event is counted as dropped.
+ *
+ * @param type - the event type
+ * @param arg - the event argument
+ * @param value - the event value
+ */
+void EventJournal::Record(journal_event_t type, uint8_t arg, uint32_t value)
+{
+  journal_record_t record = {0, (uint32_t)millis(), (uint8_t)type, arg, 0, value};
+    // the sequence number and check are assigned by the journal task
+  if(_queue == NULL || xQueueSend(_queue, &record, 0) != pdTRUE) _dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Writes the journal contents, oldest record first
+ *
+ * @param out - the output to write to
+ * @param count - the number of most recent records to write, 0 for all
+ */
+void EventJournal::Dump(Print &out, uint32_t count)
+{
+  char path[24];
+  journal_record_t page[RECORDS_PER_PAGE];
+  if(!_mounted)
+  {
+    out.println(F("Journal not available"));
+    return;
+  }
+  if(xSemaphoreTake(_fs_mutex, portMAX_DELAY) != pdTRUE) return;
+  uint32_t first = _sequence > count && count > 0 ? _sequence - count + 1 : 0;
+  out.printf("%-10s %12s %-9s %s\n", "sequence", "uptime_ms", "event", "details");
+  for(uint32_t n = 1; n <= JOURNAL_SEGMENTS; n++)
+  {
+    // the slot following the newest segment holds the oldest one
+    uint32_t segment = _segment + n;
+    segment_path(segment, path);
+    File f = SPIFFS.open(path, FILE_READ);
+    if(!f) continue;
+    size_t read;
+    while((read = f.read((uint8_t *)page, sizeof(page))) >= sizeof(journal_record_t))
+    {
+      for(size_t i = 0; i < read / sizeof(journal_record_t); i++)
+      {
+        const journal_record_t &r = page[i];
+        if(r.check != check(r) || r.sequence < first) continue;
+        out.printf("%-10u %12u %-9s ", r.sequence, r.uptime_ms, r.type < JOURNAL_TYPE_COUNT ? event_names[r.type] : "?");
+        switch(r.type)
+        {
+          case JOURNAL_BOOT:
+            out.println(r.arg < sizeof(reset_reasons) / sizeof(reset_reasons[0]) ? reset_reasons[r.arg] : "?");
+            break;
+          case JOURNAL_CLOCK:
+          {
+            time_t t = r.value;
+            struct tm tm;
+            localtime_r(&t, &tm);
+            out.printf("%d/%d/%d %02d:%02d:%02d\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+            break;
+          }
+          case JOURNAL_EMS:
+            out.println(r.arg ? F("engaged") : F("released"));
+            break;
+          case JOURNAL_COMMAND:
+            out.printf("%u %s\n", r.arg + 1, r.value == JOURNAL_COMMAND_BLOCKED ? "blocked" : r.value == JOURNAL_COMMAND_ON ? "on" : "off");
+            break;
+          case JOURNAL_COUNTER:
+            out.printf("%s %u\n", r.arg < JOURNAL_COUNTER_COUNT ? counter_names[r.arg] : "?", r.value);
+            break;
+          case JOURNAL_ERROR:
+            out.printf("%s %u\n", r.arg < JOURNAL_SOURCE_COUNT ? source_names[r.arg] : "?", r.value);
+            break;
+          case JOURNAL_MACRO:
+          {
+            char name[MACRO_NAME_SIZE];
+            MacroEngine::Name(r.arg, name);
+            out.printf("%s %s\n", name, 
+              r.value < sizeof(macro_results) / sizeof(macro_results[0]) ? macro_results[r.value] : "?");
+            break;
+          }
+          default:
+            out.printf("%u %u\n", r.arg, r.value);
+            break;
+        }
+      }
+    }
+    f.close();
+  }
+  xSemaphoreGive(_fs_mutex);
+}
+
+/**
+ * @brief Removes all journal segments
+ *
+ */
+void EventJournal::Clear()
+{
+  char path[24];
+  if(!_mounted || xSemaphoreTake(_fs_mutex, portMAX_DELAY) != pdTRUE) return;
+  for(uint32_t i = 0; i < JOURNAL_SEGMENTS; i++)
+  {
+    segment_path(i, path);
+    SPIFFS.remove(path);
+  }
+  _segment_size = 0;
+  _page_written = _page_fill;
+    // records still in the page buffer belong to the cleared journal
+  xSemaphoreGive(_fs_mutex);
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Task function writing queued events to flash
+ *
+ * @param args - pointer to the journal instance
+ */
+void EventJournal::journal_runner(void *args)
+{
+  EventJournal *_this = reinterpret_cast<EventJournal *>(args);
+  journal_record_t record;
+  uint32_t last_sample = millis();
+  uint32_t first_pending = 0;
+
+  for(uint8_t attempt = 0; attempt < 3 && !_this->_mounted; attempt++)
+  {
+    // the log file sink mounts the partition from the log drain task. begin() is fine with an
+    // existing mount, but a concurrent first mount fails for one of the two, so we retry.
+    if(attempt > 0) vTaskDelay(pdMS_TO_TICKS(500));
+    _this->_mounted = SPIFFS.begin(true);
+  }
+  if(!_this->_mounted)
+  {
+    Logger.Error(F("Unable to mount the spiffs partition, the event journal is disabled."));
+    vTaskDelete(NULL);
+    return;
+  }
+  _this->recover();
+  Logger.Info_f(F("Event journal at segment %u, sequence %u"), _this->_segment, _this->_sequence);
+
+  for(;;)
+  {
+    if(xQueueReceive(_this->_queue, &record, pdMS_TO_TICKS(JOURNAL_FLUSH_MS)) == pdTRUE)
+    {
+      record.sequence = ++_this->_sequence;
+      record.check = check(record);
+      if(_this->_page_fill == _this->_page_written) first_pending = millis();
+      _this->_page[_this->_page_fill++] = record;
+      if(_this->_page_fill == RECORDS_PER_PAGE || record.type == JOURNAL_BOOT || record.type == JOURNAL_EMS || record.type == JOURNAL_COREDUMP)
+        _this->write_page();
+          // full pages are written right away, as are the events most likely to precede a reset
+    }
+    if(_this->_page_fill != _this->_page_written && millis() - first_pending >= JOURNAL_FLUSH_MS) _this->write_page();
+    if(millis() - last_sample >= JOURNAL_COUNTER_INTERVAL_MS)
+    {
+      _this->sample_counters();
+      last_sample = millis();
+    }
+  }
+}
+
+/**
+ * @brief Computes the check field of a record
+ *
+ * @param record - the record
+ * @return the check value
+ */
+uint16_t EventJournal::check(const journal_record_t &record)
+{
+  journal_record_t r = record;
+  uint32_t hash = 2166136261u;
+  r.check = 0;
+  const uint8_t *p = (const uint8_t *)&r;
+  for(size_t i = 0; i < sizeof(r); i++)
+  {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+  hash = (hash >> 16) ^ (hash & 0xffff);
+  return hash == 0xffff ? 0 : hash;
+    // erased flash reads as 0xff, so a valid record never carries an all ones check
+}
+
+/**
+ * @brief Finds the newest segment and the last sequence number written
+ *
+ */
+void EventJournal::recover()
+{
+  char path[24];
+  journal_record_t record;
+  _segment = 0;
+  _segment_size = 0;
+  _sequence = 0;
+  for(uint32_t i = 0; i < JOURNAL_SEGMENTS; i++)
+  {
+    segment_path(i, path);
+    File f = SPIFFS.open(path, FILE_READ);
+    if(!f) continue;
+    size_t size = f.size();
+    size_t offset = size - size % sizeof(journal_record_t);
+    while(offset >= sizeof(journal_record_t))
+    {
+      // the last intact record of the segment carries its highest sequence number
+      offset -= sizeof(journal_record_t);
+      f.seek(offset);
+      if(f.read((uint8_t *)&record, sizeof(record)) != sizeof(record) || record.check != check(record)) continue;
+      if(record.sequence > _sequence)
+      {
+        _sequence = record.sequence;
+        _segment = i;
+        _segment_size = size;
+      }
+      break;
+    }
+    f.close();
+  }
+}
+
+/**
+ * @brief Samples the counters and records changes
+ *
+ */
+void EventJournal::sample_counters()
+{
+  uint32_t values[JOURNAL_COUNTER_COUNT] = {Logger.GetDropped(), _dropped.load(std::memory_order_relaxed)};
+  for(uint8_t i = 0; i < JOURNAL_COUNTER_COUNT; i++)
+  {
+    if(values[i] == _counters[i]) continue;
+    _counters[i] = values[i];
+    this->Record(JOURNAL_COUNTER, i, values[i]);
+  }
+}
+
+/**
+ * @brief Writes the records of the page buffer not yet written
+ *
+ */
+void EventJournal::write_page()
+{
+  char path[24];
+  if(xSemaphoreTake(_fs_mutex, portMAX_DELAY) != pdTRUE) return;
+  size_t length = (_page_fill - _page_written) * sizeof(journal_record_t);
+  if(length > 0)
+  {
+    if(_segment_size + length > JOURNAL_SEGMENT_SIZE)
+    {
+      // recycle the oldest segment slot
+      _segment++;
+      _segment_size = 0;
+      segment_path(_segment % JOURNAL_SEGMENTS, path);
+      SPIFFS.remove(path);
+    }
+    segment_path(_segment % JOURNAL_SEGMENTS, path);
+    File f = SPIFFS.open(path, FILE_APPEND);
+    if(f)
+    {
+      size_t written = f.write((const uint8_t *)&_page[_page_written], length);
+      f.close();
+      _segment_size += written;
+    }
+  }
+  _page_written = _page_fill;
+  if(_page_fill == RECORDS_PER_PAGE)
+  {
+    _page_fill = 0;
+    _page_written = 0;
+  }
+  xSemaphoreGive(_fs_mutex);
+}
+
+/**
+ * @brief Gets the path of a segment file
+ *
+ * @param segment - the segment number
+ * @param path - receives the path
+ */
+void EventJournal::segment_path(uint32_t segment, char *path)
+{
+  snprintf(path, 24, JOURNAL_SEGMENT_PATH, (unsigned)(segment % JOURNAL_SEGMENTS));
+}
+#pragma endregion
+
+/**
+ * @brief Global instance of the event journal
+ *
+ */
+EventJournal Journal;
@@ -0,0 +1,204 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef EVENT_JOURNAL_H
+#define EVENT_JOURNAL_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef JOURNAL_SEGMENTS
+#define JOURNAL_SEGMENTS 16
+    // number of segment files kept, the oldest is recycled when a new segment is started
+#endif
+
+#ifndef JOURNAL_SEGMENT_SIZE
+#define JOURNAL_SEGMENT_SIZE 16384
+#endif
+
+#ifndef JOURNAL_FLUSH_MS
+#define JOURNAL_FLUSH_MS 5000
+    // maximum time a record waits in the page buffer before it is written
+#endif
+
+#ifndef JOURNAL_COUNTER_INTERVAL_MS
+#define JOURNAL_COUNTER_INTERVAL_MS 60000
+#endif
+
+#define JOURNAL_PAGE_SIZE 256
+#define JOURNAL_QUEUE_LENGTH 32
+#define JOURNAL_TASK_STACK 4096
+#define JOURNAL_TASK_PRIORITY 0
+#define JOURNAL_SEGMENT_PATH "/journal%02u.bin"
+
+/**
+ * @brief Journal event types
+ *
+ */
+typedef enum : uint8_t
+{
+  JOURNAL_BOOT = 1,       // arg: esp_reset_reason_t
+  JOURNAL_COREDUMP,       // value: size of the core dump found on the coredump partition
+  JOURNAL_CLOCK,          // value: wall clock seconds once the time has been set
+  JOURNAL_EMS,            // arg: 1 engaged, 0 released
+  JOURNAL_COMMAND,        // arg: command index, value: JOURNAL_COMMAND_*
+  JOURNAL_COUNTER,        // arg: journal_counter_t, value: the counter
+  JOURNAL_ERROR,          // arg: journal_source_t, value: error code
+  JOURNAL_MACRO,          // arg: the program, see MACRO_PROGRAM*, value: macro_result_t
+  JOURNAL_TYPE_COUNT
+} journal_event_t;
+
+#define JOURNAL_COMMAND_OFF 0
+#define JOURNAL_COMMAND_ON 1
+#define JOURNAL_COMMAND_BLOCKED 2
+    // the command was not sent because the emergency stop is engaged
+
+/**
+ * @brief Counters sampled by the journal
+ *
+ */
+typedef enum : uint8_t
+{
+  JOURNAL_COUNTER_LOG_DROPPED = 0,
+  JOURNAL_COUNTER_JOURNAL_DROPPED,
+  JOURNAL_COUNTER_COUNT
+} journal_counter_t;
+
+/**
+ * @brief Sources of journaled errors
+ *
+ */
+typedef enum : uint8_t
+{
+  JOURNAL_SOURCE_CONFIG = 0,
+  JOURNAL_SOURCE_DISPLAY,
+  JOURNAL_SOURCE_WIFI,
+  JOURNAL_SOURCE_COUNT
+} journal_source_t;
+
+/**
+ * @brief A journal record. Records are written in pages of JOURNAL_PAGE_SIZE bytes.
+ *
+ */
+typedef struct __attribute__((packed))
+{
+  uint32_t sequence;
+  uint32_t uptime_ms;
+  uint8_t type;
+  uint8_t arg;
+  uint16_t check;
+    // detects records torn by a reset during the write
+  uint32_t value;
+} journal_record_t;
+
+static_assert(JOURNAL_PAGE_SIZE % sizeof(journal_record_t) == 0, "journal records must tile a page");
+
+/**
+ * @brief Append-only event journal on the spiffs partition. Events are queued by the caller
+ * and written by a low priority background task, batched per flash page. The journal is
+ * split into segment files which are recycled oldest first, so it survives resets and
+ * crashes and can be read back with the "journal" diagnostic report.
+ *
+ */
+class EventJournal
+{
+public:
+  /**
+   * @brief Construct a new EventJournal object
+   *
+   */
+  EventJournal();
+
+  /**
+   * @brief Starts the journal task and records the boot. Mounting the file system (and
+   * formatting it on first use) happens on the journal task.
+   *
+   */
+  void Begin();
+
+  /**
+   * @brief Queues an event. Never blocks; if the queue is full the event is counted as dropped.
+   *
+   * @param type - the event type
+   * @param arg - the event argument
+   * @param value - the event value
+   */
+  void Record(journal_event_t type, uint8_t arg = 0, uint32_t value = 0);
+
+  /**
+   * @brief Writes the journal contents, oldest record first
+   *
+   * @param out - the output to write to
+   * @param count - the number of most recent records to write, 0 for all
+   */
+  void Dump(Print &out, uint32_t count = 0);
+
+  /**
+   * @brief Removes all journal segments
+   *
+   */
+  void Clear();
+
+private:
+  /**
+   * @brief Task function writing queued events to flash
+   *
+   * @param args - pointer to the journal instance
+   */
+  static void journal_runner(void *args);
+
+  /**
+   * @brief Computes the check field of a record
+   *
+   * @param record - the record
+   * @return the check value
+   */
+  static uint16_t check(const journal_record_t &record);
+
+  /**
+   * @brief Finds the newest segment and the last sequence number written
+   *
+   */
+  void recover();
+
+  /**
+   * @brief Samples the counters and records changes
+   *
+   */
+  void sample_counters();
+
+  /**
+   * @brief Writes the records of the page buffer not yet written
+   *
+   */
+  void write_page();
+
+  /**
+   * @brief Gets the path of a segment file
+   *
+   * @param segment - the segment number
+   * @param path - receives the path
+   */
+  static void segment_path(uint32_t segment, char *path);
+
+  QueueHandle_t _queue = NULL;
+  SemaphoreHandle_t _fs_mutex = NULL;
+  TaskHandle_t _task = NULL;
+  bool _mounted = false;
+  std::atomic<uint32_t> _dropped;
+  uint32_t _counters[JOURNAL_COUNTER_COUNT];
+  uint32_t _sequence = 0;
+  uint32_t _segment = 0;
+  uint32_t _segment_size = 0;
+  journal_record_t _page[JOURNAL_PAGE_SIZE / sizeof(journal_record_t)];
+  uint8_t _page_fill = 0;
+  uint8_t _page_written = 0;
+};
+
+/**
+ * @brief Global instance of the event journal
+ *
+ */
+extern EventJournal Journal;
+
+#endif // EVENT_JOURNAL_H
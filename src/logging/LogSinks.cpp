@@ -0,0 +1,174 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include "LogSinks.h"
+#include "../serial/serial_tx.h"
+
+#pragma region UartSink
+/**
+ * @brief Construct a new UartSink
+ *
+ * @param port The UART to write to
+ * @param tx_pin The TX pin to use or -1 if the port is already set up
+ * @param baud_rate The baud rate used when the sink sets up the port
+ */
+UartSink::UartSink(HardwareSerial &port, int8_t tx_pin, uint32_t baud_rate) : _port(port), _tx_pin(tx_pin), _baud_rate(baud_rate)
+{
+}
+
+bool UartSink::begin()
+{
+  if(!_started && _tx_pin >= 0) _port.begin(_baud_rate, SERIAL_8N1, -1, _tx_pin);
+  _started = true;
+  return true;
+}
+
+void UartSink::write(const char *data, size_t length)
+{
+  _port.write((const uint8_t *)data, length);
+}
+
+void UartSink::flush()
+{
+  _port.flush();
+}
+#pragma endregion
+
+#pragma region LinkSink
+bool LinkSink::begin()
+{
+  return true;
+}
+
+void LinkSink::write(const char *data, size_t length)
+{
+  Tx.Write(data, length);
+    // waits up to 100ms for room, the line is dropped when the link is that far behind
+}
+
+void LinkSink::flush()
+{
+  Tx.Flush();
+}
+#pragma endregion
+
+#pragma region RingSink
+/**
+ * @brief Construct a new RingSink
+ *
+ * @param size The size of the ring buffer in bytes
+ */
+RingSink::RingSink(size_t size) : _size(size)
+{
+}
+
+bool RingSink::begin()
+{
+  if(_buffer != nullptr) return true;
+  _mutex = xSemaphoreCreateMutex();
+  _buffer = (char *)heap_caps_malloc(_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if(_buffer == nullptr) _buffer = (char *)heap_caps_malloc(_size, MALLOC_CAP_8BIT);
+  return _buffer != nullptr && _mutex != NULL;
+}
+
+void RingSink::write(const char *data, size_t length)
+{
+  if(_buffer == nullptr || length >= _size) return;
+  if(xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+  size_t first = _size - _head;
+  if(length < first) first = length;
+  memcpy(_buffer + _head, data, first);
+  memcpy(_buffer, data + first, length - first);
+  _head += length;
+  if(_head >= _size)
+  {
+    _head -= _size;
+    _wrapped = true;
+  }
+  xSemaphoreGive(_mutex);
+}
+
+/**
+ * @brief Writes the buffered lines, oldest first
+ *
+ * @param out The output to write to
+ */
+void RingSink::dump(Print &out)
+{
+  if(_buffer == nullptr) return;
+  if(xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+  if(_wrapped)
+  {
+    // skip the partially overwritten oldest line
+    size_t start = _head;
+    while(start < _size && _buffer[start] != '\n') start++;
+    if(start < _size) out.write((const uint8_t *)_buffer + start + 1, _size - start - 1);
+  }
+  out.write((const uint8_t *)_buffer, _head);
+  xSemaphoreGive(_mutex);
+}
+#pragma endregion
+
+#pragma region FileSink
+bool FileSink::begin()
+{
+  if(_started) return true;
+  if(_mutex == NULL) _mutex = xSemaphoreCreateMutex();
+  if(_mutex == NULL) return false;
+  if(!SPIFFS.begin(true)) return false;
+    // mounts the spiffs partition, formatting it on first use
+  _file = SPIFFS.open(LOG_FILE_PATH, FILE_APPEND);
+  _started = (bool)_file;
+  return _started;
+}
+
+void FileSink::write(const char *data, size_t length)
+{
+  if(!_started) return;
+  if(xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+  if(_file.size() + length > LOG_FILE_MAX_SIZE)
+  {
+    _file.close();
+    SPIFFS.remove(LOG_FILE_ROTATED_PATH);
+    SPIFFS.rename(LOG_FILE_PATH, LOG_FILE_ROTATED_PATH);
+    _file = SPIFFS.open(LOG_FILE_PATH, FILE_APPEND);
+    if(!_file) _started = false;
+  }
+  if(_started) _file.write((const uint8_t *)data, length);
+  xSemaphoreGive(_mutex);
+}
+
+void FileSink::flush()
+{
+  if(!_started) return;
+  if(xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+  _file.flush();
+  xSemaphoreGive(_mutex);
+}
+
+/**
+ * @brief Writes the log file contents, previous generation first
+ *
+ * @param out The output to write to
+ */
+void FileSink::dump(Print &out)
+{
+  uint8_t buf[256];
+  const char *paths[] = {LOG_FILE_ROTATED_PATH, LOG_FILE_PATH};
+  if(!_started) return;
+  if(xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+    // the drain task rotates the files in write, which must not close a generation being read
+  _file.flush();
+  for(const char *path : paths)
+  {
+    File f = SPIFFS.open(path, FILE_READ);
+    if(!f) continue;
+    size_t n;
+    while((n = f.read(buf, sizeof(buf))) > 0) out.write(buf, n);
+    f.close();
+  }
+  xSemaphoreGive(_mutex);
+}
+#pragma endregion
@@ -0,0 +1,168 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef LOGSINKS_H
+#define LOGSINKS_H
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <FS.h>
+
+#define LOG_SINK_PRIMARY_UART   0x01
+#define LOG_SINK_SECONDARY_UART 0x02
+#define LOG_SINK_RAM            0x04
+#define LOG_SINK_FILE           0x08
+#define LOG_SINK_COUNT          4
+
+#ifndef LOG_SINK_DEFAULT
+#define LOG_SINK_DEFAULT LOG_SINK_RAM
+    // the G-code link carries no log traffic unless the primary UART sink is enabled in the config
+#endif
+
+#ifndef LOG_UART2_TX_PIN
+#define LOG_UART2_TX_PIN 32
+#endif
+
+#ifndef LOG_UART2_BAUD_RATE
+#define LOG_UART2_BAUD_RATE 115200
+#endif
+
+#ifndef LOG_RAM_SINK_SIZE
+#define LOG_RAM_SINK_SIZE 8192
+#endif
+
+#define LOG_FILE_PATH "/log.txt"
+#define LOG_FILE_ROTATED_PATH "/log.1.txt"
+#define LOG_FILE_MAX_SIZE 65536
+
+/**
+ * @brief Destination for formatted log lines. Sinks are only written from the logger drain task.
+ *
+ */
+class LogSink
+{
+public:
+  virtual ~LogSink() {}
+
+  /**
+   * @brief Prepares the sink for writing
+   *
+   * @return true if the sink is ready, false otherwise
+   */
+  virtual bool begin() = 0;
+
+  /**
+   * @brief Writes a log line
+   *
+   * @param data The line, including the line terminator
+   * @param length The length of the line
+   */
+  virtual void write(const char *data, size_t length) = 0;
+
+  /**
+   * @brief Pushes buffered data to the underlying device
+   *
+   */
+  virtual void flush() {}
+};
+
+/**
+ * @brief Writes log lines to a hardware UART
+ *
+ */
+class UartSink : public LogSink
+{
+public:
+  /**
+   * @brief Construct a new UartSink
+   *
+   * @param port The UART to write to
+   * @param tx_pin The TX pin to use or -1 if the port is already set up
+   * @param baud_rate The baud rate used when the sink sets up the port
+   */
+  UartSink(HardwareSerial &port, int8_t tx_pin = -1, uint32_t baud_rate = 0);
+
+  bool begin() override;
+  void write(const char *data, size_t length) override;
+  void flush() override;
+
+private:
+  HardwareSerial &_port;
+  int8_t _tx_pin;
+  uint32_t _baud_rate;
+  bool _started = false;
+};
+
+/**
+ * @brief Writes log lines to the line lane of the G-code link, so they never split a command
+ * line sent by the wheel
+ *
+ */
+class LinkSink : public LogSink
+{
+public:
+  bool begin() override;
+  void write(const char *data, size_t length) override;
+  void flush() override;
+};
+
+/**
+ * @brief Keeps the most recent log lines in a RAM ring buffer for retrieval over HTTP
+ *
+ */
+class RingSink : public LogSink
+{
+public:
+  /**
+   * @brief Construct a new RingSink
+   *
+   * @param size The size of the ring buffer in bytes
+   */
+  RingSink(size_t size);
+
+  bool begin() override;
+  void write(const char *data, size_t length) override;
+
+  /**
+   * @brief Writes the buffered lines, oldest first
+   *
+   * @param out The output to write to
+   */
+  void dump(Print &out);
+
+private:
+  char *_buffer = nullptr;
+  size_t _size;
+  size_t _head = 0;
+  bool _wrapped = false;
+  SemaphoreHandle_t _mutex = NULL;
+};
+
+/**
+ * @brief Appends log lines to a file on the spiffs partition. The file is rotated once it exceeds
+ * LOG_FILE_MAX_SIZE, keeping one previous generation.
+ *
+ */
+class FileSink : public LogSink
+{
+public:
+  bool begin() override;
+  void write(const char *data, size_t length) override;
+  void flush() override;
+
+  /**
+   * @brief Writes the log file contents, previous generation first. The file is flushed first, so
+   * the output lags only by the lines the drain task has not taken from the queue yet. Logging to
+   * the file waits while the dump runs.
+   *
+   * @param out The output to write to
+   */
+  void dump(Print &out);
+
+private:
+  File _file;
+  bool _started = false;
+  SemaphoreHandle_t _mutex = NULL;
+};
+
+#endif // LOGSINKS_H
@@ -0,0 +1,114 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <sys/time.h>
+#include <esp_timer.h>
+#include "LogTimestamp.h"
+
+#define UNIX_EPOCH_START_YEAR 1900
+
+/**
+ * @brief Construct a new LogTimestamp object
+ *
+ */
+LogTimestamp::LogTimestamp()
+{
+  _sequence.store(0, std::memory_order_relaxed);
+  _fields.store(LOG_TIMESTAMP_DEFAULT, std::memory_order_relaxed);
+  _second = (time_t)-1;
+}
+
+#pragma region public methods
+/**
+ * @brief Selects the optional sub-second fields
+ *
+ * @param fields Combination of the LOG_TIMESTAMP_* flags
+ */
+void LogTimestamp::SetFields(uint8_t fields)
+{
+  _fields.store(fields, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the selected sub-second fields
+ *
+ * @return uint8_t Combination of the LOG_TIMESTAMP_* flags
+ */
+uint8_t LogTimestamp::GetFields() const
+{
+  return _fields.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Writes the timestamp prefix into a buffer.
+ *
+ * @param buf The buffer to write to
+ * @param size The size of the buffer
+ * @return size_t The number of characters written
+ */
+size_t LogTimestamp::Write(char *buf, size_t size)
+{
+  struct timeval tv;
+  size_t len = 0;
+  bool cached = false;
+  uint8_t fields = _fields.load(std::memory_order_relaxed);
+  gettimeofday(&tv, NULL);
+  if(size == 0) return 0;
+
+  uint32_t seq = _sequence.load(std::memory_order_acquire);
+  if((seq & 1) == 0 && _second == tv.tv_sec && _length < size)
+  {
+    len = _length;
+    memcpy(buf, _prefix, len);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    cached = _sequence.load(std::memory_order_relaxed) == seq;
+      // a concurrent update invalidates the copy
+  }
+  if(!cached)
+  {
+    len = render(tv.tv_sec, buf, size);
+    if((seq & 1) == 0 && len < LOG_TIMESTAMP_PREFIX_SIZE && _sequence.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+    {
+      // we own the cache until the sequence is even again. Losers of the race keep their own copy.
+      _second = tv.tv_sec;
+      _length = (uint8_t)len;
+      memcpy(_prefix, buf, len);
+      _sequence.store(seq + 2, std::memory_order_release);
+    }
+  }
+
+  int n = 0;
+  if(fields & LOG_TIMESTAMP_MILLIS && len < size) 
+  {
+    n = snprintf(buf + len, size - len, ".%03u", (unsigned)(tv.tv_usec / 1000));
+    if(n > 0) len += ((size_t)n < size - len) ? (size_t)n : size - len - 1;
+  }
+  if(fields & LOG_TIMESTAMP_MONOTONIC && len < size)
+  {
+    n = snprintf(buf + len, size - len, " @%llu", (unsigned long long)esp_timer_get_time());
+    if(n > 0) len += ((size_t)n < size - len) ? (size_t)n : size - len - 1;
+  }
+  return len;
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Renders the date and time part of the prefix
+ *
+ * @param second The wall clock second to render
+ * @param buf The buffer to write to
+ * @param size The size of the buffer
+ * @return size_t The number of characters written
+ */
+size_t LogTimestamp::render(time_t second, char *buf, size_t size)
+{
+  struct tm tm;
+  localtime_r(&second, &tm);
+  int n = snprintf(buf, size, "; %d/%d/%d %02d:%02d:%02d",
+    tm.tm_year + UNIX_EPOCH_START_YEAR, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+  if(n < 0) return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
+#pragma endregion
@@ -0,0 +1,80 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef LOGTIMESTAMP_H
+#define LOGTIMESTAMP_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <time.h>
+
+#define LOG_TIMESTAMP_MILLIS    0x01
+    // appends the milliseconds of the wall clock second, "; 2024/5/1 12:00:00.123"
+#define LOG_TIMESTAMP_MONOTONIC 0x02
+    // appends the microseconds since boot, "; 2024/5/1 12:00:00 @12345678"
+
+#ifndef LOG_TIMESTAMP_DEFAULT
+#define LOG_TIMESTAMP_DEFAULT 0
+#endif
+
+#define LOG_TIMESTAMP_PREFIX_SIZE 32
+
+/**
+ * @brief Renders the log line timestamp prefix. The date and time part is rendered once per second
+ * and shared between all callers; subsequent lines in the same second only copy the cached text
+ * and append the optional sub-second fields.
+ * @details The cache is guarded by a sequence lock, so readers never block. A reader that races
+ * with an update simply renders the prefix itself.
+ *
+ */
+class LogTimestamp
+{
+public:
+  /**
+   * @brief Construct a new LogTimestamp object
+   *
+   */
+  LogTimestamp();
+
+  /**
+   * @brief Selects the optional sub-second fields
+   *
+   * @param fields Combination of the LOG_TIMESTAMP_* flags
+   */
+  void SetFields(uint8_t fields);
+
+  /**
+   * @brief Gets the selected sub-second fields
+   *
+   * @return uint8_t Combination of the LOG_TIMESTAMP_* flags
+   */
+  uint8_t GetFields() const;
+
+  /**
+   * @brief Writes the timestamp prefix into a buffer.
+   *
+   * @param buf The buffer to write to
+   * @param size The size of the buffer
+   * @return size_t The number of characters written
+   */
+  size_t Write(char *buf, size_t size);
+
+private:
+  /**
+   * @brief Renders the date and time part of the prefix
+   *
+   * @param second The wall clock second to render
+   * @param buf The buffer to write to
+   * @param size The size of the buffer
+   * @return size_t The number of characters written
+   */
+  static size_t render(time_t second, char *buf, size_t size);
+
+  std::atomic<uint32_t> _sequence;
+  std::atomic<uint8_t> _fields;
+  time_t _second = 0;
+  uint8_t _length = 0;
+  char _prefix[LOG_TIMESTAMP_PREFIX_SIZE];
+};
+
+#endif // LOGTIMESTAMP_H
@@ -9,194 +9,569 @@
 #include <stdarg.h>
 #include "SerialLogger.h"
 
-#define UNIX_EPOCH_START_YEAR 1900
+#define LOG_LINE_END "\r\n"
+#define LOG_LINE_END_LENGTH 2
+
+static_assert((LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)) == 0, "LOG_RING_SLOTS must be a power of two");
+
+static const char *level_tags[] = {" [INFO] ", " [ERROR] "};
+
+static std::atomic<uint64_t> format_cache[LOG_FORMAT_CACHE_SIZE];
+    // format string address in the upper, id in the lower half. A single word keeps entries
+    // consistent when both cores update the cache.
+
+static LinkSink primary_uart_sink;
+static UartSink secondary_uart_sink(Serial1, LOG_UART2_TX_PIN, LOG_UART2_BAUD_RATE);
+static RingSink ram_sink(LOG_RAM_SINK_SIZE);
+static FileSink file_sink;
+static LogSink *sinks[LOG_SINK_COUNT] = {&primary_uart_sink, &secondary_uart_sink, &ram_sink, &file_sink};
+    // in the order of the LOG_SINK_* flags
 
 /**
  * @brief Construct a new Serial Logger:: Serial Logger object
- * 
+ *
  */
-SerialLogger::SerialLogger() 
-{ 
-  Serial.begin(SERIAL_LOGGER_BAUD_RATE); 
+SerialLogger::SerialLogger()
+{
+  for(uint32_t i = 0; i < LOG_RING_SLOTS; i++) _slots[i].sequence.store(i, std::memory_order_relaxed);
+  _enqueue_pos.store(0, std::memory_order_relaxed);
+  _dropped.store(0, std::memory_order_relaxed);
+  _drain_started.store(false, std::memory_order_relaxed);
+  _sinks.store(LOG_SINK_DEFAULT, std::memory_order_relaxed);
+  _level.store(LOG_LEVEL_INFO, std::memory_order_relaxed);
+  _binary.store(false, std::memory_order_relaxed);
+  _flushed.store(true, std::memory_order_relaxed);
+  Serial.begin(SERIAL_LOGGER_BAUD_RATE);
 }
 
+/**
+ * @brief Selects the log sinks and the minimum level logged.
+ *
+ * @param sinks Combination of the LOG_SINK_* flags
+ * @param level The minimum level to log, one of the LOG_LEVEL_* values
+ * @param binary true to write binary records instead of text lines. Ignored with an error when the
+ * primary UART is selected.
+ */
+void SerialLogger::Configure(uint8_t sinks, uint8_t level, bool binary)
+{
+  if(binary && (sinks & LOG_SINK_PRIMARY_UART))
+  {
+    binary = false;
+    this->log_f(LOG_LEVEL_ERROR, "Binary log records are not written to the G-code link, logging text");
+      // the host parses every line of the link as a GRBL reply
+  }
+  _level.store(level, std::memory_order_relaxed);
+  _binary.store(binary, std::memory_order_relaxed);
+  _sinks.store(sinks & ((1 << LOG_SINK_COUNT) - 1), std::memory_order_release);
+  if(_drain_task != NULL) xTaskNotifyGive(_drain_task);
+    // the drain task brings up newly selected sinks before writing the next line
+}
 
 #pragma region Information Logging methods
 /**
- * @brief Logs an information message to the serial console. 
- * 
+ * @brief Logs an information message to the serial console.
+ *
  * @param message The message to log
  */
-void SerialLogger::Info(String message)
+void SerialLogger::Info(const char *message)
+{
+  this->Info_f("%s", message);
+}
+
+void SerialLogger::Info(const __FlashStringHelper *message)
 {
-  Serial.print("; ");
-  this->writeTime();
-  Serial.print(F(" [INFO] "));
-  Serial.println(message);
+  if(strchr((const char *)message, '%') == nullptr) this->log_f(LOG_LEVEL_INFO, (const char *)message);
+    // flash literals without conversions are their own format string, so binary records only carry the id
+  else this->Info_f("%s", (const char *)message);
+}
+
+void SerialLogger::Info(const String &message)
+{
+  this->Info_f("%s", message.c_str());
 }
 
 /**
  * @brief Logs a formatted message to the serial console. Follows print_f conventions.
- * 
+ *
  * @param format The format string
  * @param ... Argument list for the token replacement in the format string.
  * @return size_t The lenght of the actual string logged.
  */
-size_t SerialLogger::Info_f(String format, ...)
-{
-  char *buf = NULL;
-  va_list arg;
-  va_list copy;
-  Serial.print("; ");
-  this->writeTime();
-  Serial.print(F(" [INFO] "));
-
-  va_start(arg, format);
-  va_copy(copy, arg);
-  int len = vsnprintf(NULL, 0, format.c_str(), arg);
-    // determine the length first, before we attempt the actual conversion 
-  if(len < 0) {
-    // error condition, most likely in the format string. 
-    va_end(arg);
-    va_end(copy);
-    return 0;
-  };
-
-  // allocate memory for the operation
-  buf = (char*) malloc(len+1);
-  if(buf == NULL) {
-    // memory allocation error. 
-    va_end(arg);
-    va_end(copy);
-    return 0;
-  } 
-  len = vsnprintf(buf, len+1, format.c_str(), copy);
-  va_end(arg);
-  va_end(copy);
-  len = Serial.print(buf);
-  free(buf);
-  Serial.println();
+size_t SerialLogger::Info_f(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  size_t len = this->log(LOG_LEVEL_INFO, format, args);
+  va_end(args);
+  return len;
+}
+
+size_t SerialLogger::Info_f(const __FlashStringHelper *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  size_t len = this->log(LOG_LEVEL_INFO, (const char *)format, args);
+  va_end(args);
   return len;
 }
-#pragma endregion 
+#pragma endregion
 
 #pragma region Error Logging methods
 /**
- * @brief Logs an error message to the serial console. 
- * 
+ * @brief Logs an error message to the serial console.
+ *
  * @param message The message to log
- */  
-void SerialLogger::Error(String message)
+ */
+void SerialLogger::Error(const char *message)
 {
-  Serial.print("; ");
-  this->writeTime();
-  Serial.print(F(" [ERROR] "));
-  Serial.println(message);
+  this->Error_f("%s", message);
+}
+
+void SerialLogger::Error(const __FlashStringHelper *message)
+{
+  if(strchr((const char *)message, '%') == nullptr) this->log_f(LOG_LEVEL_ERROR, (const char *)message);
+  else this->Error_f("%s", (const char *)message);
+}
+
+void SerialLogger::Error(const String &message)
+{
+  this->Error_f("%s", message.c_str());
 }
 
 /**
  * @brief Logs a formatted error to the serial console. Follows print_f conventions.
- * 
+ *
  * @param format The format string
  * @param ... Argument list for the token replacement in the format string.
  * @return size_t The lenght of the actual string logged.
- */ 
-size_t SerialLogger::Error_f(String format, ...)
-{
-  char *buf = NULL;
-  va_list arg;
-  va_list copy;
-  Serial.print("; ");
-  this->writeTime();
-  Serial.print(F(" [ERROR] "));
-
-  va_start(arg, format);
-  va_copy(copy, arg);
-  int len = vsnprintf(NULL, 0, format.c_str(), arg);
-  if(len < 0) {
-    // error condition, most likely in the format string. 
-    va_end(arg);
-    va_end(copy);
-    return 0;
-  };
-  // allocate memory for the operation
-  buf = (char*) malloc(len+1);
-  if(buf == NULL) {
-    // memory allocation error. 
-    va_end(arg);
-    va_end(copy);
-    return 0;
-  } 
-  len = vsnprintf(buf, len+1, format.c_str(), copy);
-  va_end(arg);
-  va_end(copy);
-  len = Serial.print(buf);
-  free(buf);
-
-  Serial.println();
+ */
+size_t SerialLogger::Error_f(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  size_t len = this->log(LOG_LEVEL_ERROR, format, args);
+  va_end(args);
+  return len;
+}
+
+size_t SerialLogger::Error_f(const __FlashStringHelper *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  size_t len = this->log(LOG_LEVEL_ERROR, (const char *)format, args);
+  va_end(args);
   return len;
 }
 #pragma endregion
 
+/**
+ * @brief Waits until all buffered messages have been written out.
+ *
+ * @param timeout_ms The maximum time to wait in milliseconds
+ * @return true if the buffer was drained, false on timeout
+ */
+bool SerialLogger::Flush(uint32_t timeout_ms)
+{
+  uint32_t start = millis();
+  if(_drain_task != NULL) xTaskNotifyGive(_drain_task);
+  while(_dequeue_pos != _enqueue_pos.load(std::memory_order_acquire) || !_flushed.load(std::memory_order_acquire))
+  {
+    if(_drain_task == NULL || millis() - start > timeout_ms) return false;
+    vTaskDelay(1);
+  }
+  return true;
+}
+
+/**
+ * @brief Writes the contents of the RAM ring sink
+ *
+ * @param out The output to write to
+ */
+void SerialLogger::DumpRam(Print &out)
+{
+  ram_sink.dump(out);
+}
+
+/**
+ * @brief Writes the contents of the log file sink
+ *
+ * @param out The output to write to
+ */
+void SerialLogger::DumpFile(Print &out)
+{
+  file_sink.dump(out);
+}
+
+/**
+ * @brief Gets the number of messages dropped because the ring buffer was full.
+ *
+ * @return uint32_t The number of dropped messages since startup
+ */
+uint32_t SerialLogger::GetDropped() const
+{
+  return _dropped.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Gets the active log sinks
+ *
+ * @return uint8_t Combination of the LOG_SINK_* flags
+ */
+uint8_t SerialLogger::GetSinks() const
+{
+  return _sinks.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Selects the optional sub-second timestamp fields
+ *
+ * @param fields Combination of the LOG_TIMESTAMP_* flags
+ */
+void SerialLogger::SetTimestampFields(uint8_t fields)
+{
+  _timestamp.SetFields(fields);
+}
+
 #pragma region private methods
 /**
- * @brief Writes the current time inline to the console. 
- * 
+ * @brief Task function writing buffered messages to the log sinks.
+ *
+ * @param args - pointer to the logger instance
  */
-void SerialLogger::writeTime()
+void SerialLogger::drain_runner(void *args)
 {
-  struct tm* ptm;
-  time_t now = time(NULL);
+  SerialLogger *_this = reinterpret_cast<SerialLogger *>(args);
+  uint32_t reported = 0;
+  uint8_t active = 0;
+  bool dirty = false;
+  for(;;)
+  {
+    if(active != _this->_sinks.load(std::memory_order_acquire)) active = _this->update_sinks(active);
+    log_slot_t *slot = &_this->_slots[_this->_dequeue_pos & (LOG_RING_SLOTS - 1)];
+    if(slot->sequence.load(std::memory_order_acquire) != _this->_dequeue_pos + 1)
+    {
+      // nothing to write (or the next slot is still being formatted by its producer).
+      // Report drops once the backlog is written, then wait for the next message.
+      uint32_t dropped = _this->_dropped.load(std::memory_order_relaxed);
+      if(dropped != reported)
+      {
+        _this->log_f(LOG_LEVEL_ERROR, "%u log messages dropped", dropped - reported);
+        reported = dropped;
+        continue;
+      }
+      if(dirty)
+      {
+        for(uint8_t i = 0; i < LOG_SINK_COUNT; i++) if(active & (1 << i)) sinks[i]->flush();
+        dirty = false;
+      }
+      _this->_flushed.store(true, std::memory_order_release);
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+      continue;
+    }
+    _this->_flushed.store(false, std::memory_order_relaxed);
+    _this->write_sinks(active, slot->data, slot->length);
+    dirty = true;
+    slot->sequence.store(_this->_dequeue_pos + LOG_RING_SLOTS, std::memory_order_release);
+    _this->_dequeue_pos++;
+  }
+}
 
-  ptm = localtime(&now);
-  Serial.print(ptm->tm_year + UNIX_EPOCH_START_YEAR);
-  Serial.print("/");
-  Serial.print(ptm->tm_mon + 1);
-  Serial.print("/");
-  Serial.print(ptm->tm_mday);
-  Serial.print(" ");
-  
-  if (ptm->tm_hour < 10)
+/**
+ * @brief Brings up newly selected sinks. Called on the drain task.
+ *
+ * @param active The currently active sinks
+ * @return uint8_t The sinks active after the update
+ */
+uint8_t SerialLogger::update_sinks(uint8_t active)
+{
+  uint8_t requested = _sinks.load(std::memory_order_acquire);
+  uint8_t failed = 0;
+  for(uint8_t i = 0; i < LOG_SINK_COUNT; i++)
   {
-    Serial.print(0);
+    uint8_t flag = 1 << i;
+    if(active & flag & ~requested) sinks[i]->flush();
+    if((requested & flag) && !(active & flag) && !sinks[i]->begin()) failed |= flag;
   }
+  active = requested & ~failed;
+  if(failed)
+  {
+    _sinks.fetch_and(~failed, std::memory_order_relaxed);
+    this->log_f(LOG_LEVEL_ERROR, "Unable to start log sinks 0x%02x", failed);
+  }
+  return active;
+}
 
-  Serial.print(ptm->tm_hour);
-  Serial.print(":");
+/**
+ * @brief Writes a line to the active sinks
+ *
+ * @param active The active sinks
+ * @param data The line
+ * @param length The length of the line
+ */
+void SerialLogger::write_sinks(uint8_t active, const char *data, size_t length)
+{
+  for(uint8_t i = 0; i < LOG_SINK_COUNT; i++) if(active & (1 << i)) sinks[i]->write(data, length);
+}
+
+/**
+ * @brief Encodes a message as a binary record
+ *
+ * @param buf The buffer to write to
+ * @param size The size of the buffer
+ * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+ * @param format The format string
+ * @param args Argument list for the format string
+ * @return size_t The length of the record
+ */
+size_t SerialLogger::encode_binary(char *buf, size_t size, uint8_t level, const char *format, va_list args)
+{
+  uint8_t *start = (uint8_t *)buf + 2;
+  uint8_t *end = (uint8_t *)buf + (size < 258 ? size : 258) - 1;
+    // the length is a single byte and the checksum goes last
+  uint8_t *p = start;
+  uint32_t id = this->format_id(format);
+  uint32_t ms = millis();
 
-  if (ptm->tm_min < 10)
+  *p++ = level;
+  memcpy(p, &id, 4); p += 4;
+  memcpy(p, &ms, 4); p += 4;
+  for(const char *f = format; *f != '\0'; f++)
   {
-    Serial.print(0);
+    if(*f != '%') continue;
+    if(*++f == '%') continue;
+    uint32_t word;
+    uint64_t wide;
+    double d;
+    uint8_t longs = 0;
+    size_t need = 4;
+    while(*f != '\0' && strchr("-+ #0", *f) != nullptr) f++;
+    for(uint8_t field = 0; field < 2; field++)
+    {
+      // width and precision, either of which may be passed as an argument
+      if(field == 1 && *f != '.') break;
+      if(field == 1) f++;
+      if(*f == '*')
+      {
+        f++;
+        word = va_arg(args, int);
+        if(p + 4 > end) { level |= LOG_RECORD_TRUNCATED; break; }
+        memcpy(p, &word, 4);
+        p += 4;
+      }
+      while(isdigit(*f)) f++;
+    }
+    if(level & LOG_RECORD_TRUNCATED) break;
+    for(; *f != '\0' && strchr("hlzjtL", *f) != nullptr; f++)
+    {
+      if(*f == 'l') longs++;
+      if(*f == 'j') longs = 2;
+    }
+    switch(*f)
+    {
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        // int, long and size_t are 32 bit on the ESP32
+        if(longs >= 2) { wide = va_arg(args, unsigned long long); need = 8; }
+        else word = va_arg(args, unsigned int);
+        if(p + need > end) { level |= LOG_RECORD_TRUNCATED; break; }
+        if(need == 8) memcpy(p, &wide, 8); else memcpy(p, &word, 4);
+        p += need;
+        continue;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        d = va_arg(args, double);
+        if(p + 8 > end) { level |= LOG_RECORD_TRUNCATED; break; }
+        memcpy(p, &d, 8);
+        p += 8;
+        continue;
+      case 's':
+      {
+        const char *str = va_arg(args, const char *);
+        if(str == nullptr) str = "(null)";
+        size_t n = strnlen(str, 255);
+        if(p + 1 + n > end)
+        {
+          level |= LOG_RECORD_TRUNCATED;
+          if(p + 1 >= end) break;
+          n = end - p - 1;
+        }
+        *p++ = (uint8_t)n;
+        memcpy(p, str, n);
+        p += n;
+        if(level & LOG_RECORD_TRUNCATED) break;
+        continue;
+      }
+      case 'p':
+        word = (uint32_t)(uintptr_t)va_arg(args, void *);
+        if(p + 4 > end) { level |= LOG_RECORD_TRUNCATED; break; }
+        memcpy(p, &word, 4);
+        p += 4;
+        continue;
+      case '\0':
+        break;
+      default:
+        continue;
+    }
+    break;
   }
 
-  Serial.print(ptm->tm_min);
-  Serial.print(":");
+  uint8_t sum = 0;
+  start[0] = level;
+  for(uint8_t *q = start; q < p; q++) sum ^= *q;
+  buf[0] = (char)LOG_RECORD_SYNC;
+  buf[1] = (char)(p - start);
+  *p++ = sum;
+  return p - (uint8_t *)buf;
+}
+
+/**
+ * @brief Formats a message as a text line
+ *
+ * @param buf The buffer to write to
+ * @param size The size of the buffer
+ * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+ * @param format The format string
+ * @param args Argument list for the format string
+ * @return size_t The length of the line including the line terminator
+ */
+size_t SerialLogger::encode_text(char *buf, size_t size, uint8_t level, const char *format, va_list args)
+{
+  const size_t capacity = size - LOG_LINE_END_LENGTH;
+  size_t len = _timestamp.Write(buf, capacity);
+  len += strlcpy(buf + len, level_tags[level], capacity - len);
+  if(len > capacity - 1) len = capacity - 1;
+
+  int n = vsnprintf(buf + len, capacity - len, format, args);
+  if(n < 0) n = 0;
+    // error condition, most likely in the format string. We still log the prefix so the
+    // slot does not go to waste and the problem is visible.
+  len += ((size_t)n < capacity - len) ? (size_t)n : capacity - len - 1;
+    // messages longer than the slot are truncated
 
-  if (ptm->tm_sec < 10)
+  memcpy(buf + len, LOG_LINE_END, LOG_LINE_END_LENGTH);
+  return len + LOG_LINE_END_LENGTH;
+}
+
+/**
+ * @brief Gets the id of a format string
+ *
+ * @param format The format string
+ * @return uint32_t The FNV-1a hash of the format string
+ */
+uint32_t SerialLogger::format_id(const char *format)
+{
+  uint32_t key = (uint32_t)(uintptr_t)format;
+  std::atomic<uint64_t> &entry = format_cache[(key >> 2) & (LOG_FORMAT_CACHE_SIZE - 1)];
+  uint64_t cached = entry.load(std::memory_order_relaxed);
+  if((uint32_t)(cached >> 32) == key && key != 0) return (uint32_t)cached;
+
+  uint32_t id = 2166136261u;
+  for(const char *c = format; *c != '\0'; c++)
+  {
+    id ^= (uint8_t)*c;
+    id *= 16777619u;
+  }
+  entry.store(((uint64_t)key << 32) | id, std::memory_order_relaxed);
+  return id;
+}
+
+/**
+ * @brief Formats a message into the ring buffer
+ *
+ * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+ * @param format The format string
+ * @param args Argument list for the format string
+ * @return size_t The length of the entry logged, 0 if it was dropped
+ */
+size_t SerialLogger::log(uint8_t level, const char *format, va_list args)
+{
+  uint32_t pos;
+  if(level < _level.load(std::memory_order_relaxed) || _sinks.load(std::memory_order_relaxed) == 0) return 0;
+    // filtered messages are rejected before any formatting work
+  if(!_drain_started.exchange(true))
   {
-    Serial.print(0);
+    // the drain task is started on first use as the global logger is constructed before the
+    // scheduler is available.
+    xTaskCreate(SerialLogger::drain_runner, "logDrain", LOG_DRAIN_TASK_STACK, this, LOG_DRAIN_TASK_PRIORITY, &_drain_task);
   }
 
-  Serial.print(ptm->tm_sec);
+  log_slot_t *slot = this->reserve(&pos);
+  if(slot == nullptr) return 0;
+
+  size_t len;
+  if(_binary.load(std::memory_order_relaxed)) len = this->encode_binary(slot->data, LOG_SLOT_SIZE, level, format, args);
+  else len = this->encode_text(slot->data, LOG_SLOT_SIZE, level, format, args);
+  slot->length = len;
+  this->commit(slot, pos);
+  return len;
 }
-#pragma endregion
 
 /**
- * @brief Sets the transmission speed
- * @param speed - the transmission speed. 
+ * @brief Formats a message into the ring buffer. Follows print_f conventions.
+ *
+ * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+ * @param format The format string
+ * @param ... Argument list for the format string
+ * @return size_t The length of the entry logged, 0 if it was dropped
  */
-void SerialLogger::SetSpeed(uint32_t speed)
+size_t SerialLogger::log_f(uint8_t level, const char *format, ...)
 {
-  if(Serial)
+  va_list args;
+  va_start(args, format);
+  size_t len = this->log(level, format, args);
+  va_end(args);
+  return len;
+}
+
+/**
+ * @brief Reserves a slot in the ring buffer.
+ *
+ * @param pos Receives the ring position of the reserved slot
+ * @return log_slot_t* The reserved slot, nullptr if the ring is full
+ */
+log_slot_t *SerialLogger::reserve(uint32_t *pos)
+{
+  uint32_t p = _enqueue_pos.load(std::memory_order_relaxed);
+  for(;;)
   {
-    Serial.flush();
-    Serial.end();
+    log_slot_t *slot = &_slots[p & (LOG_RING_SLOTS - 1)];
+    int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - p);
+    if(diff == 0)
+    {
+      // the slot is free for position p, try to claim it. On failure p is reloaded
+      // and we try again with the next position.
+      if(_enqueue_pos.compare_exchange_weak(p, p + 1, std::memory_order_relaxed))
+      {
+        *pos = p;
+        return slot;
+      }
+    }
+    else if(diff < 0)
+    {
+      // the slot still holds a message from the previous lap, so the ring is full
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    else
+    {
+      p = _enqueue_pos.load(std::memory_order_relaxed);
+    }
   }
-  Serial.begin(speed);
 }
 
+/**
+ * @brief Publishes a reserved slot to the drain task
+ *
+ * @param slot The slot to publish
+ * @param pos The ring position of the slot
+ */
+void SerialLogger::commit(log_slot_t *slot, uint32_t pos)
+{
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  if(_drain_task != NULL) xTaskNotifyGive(_drain_task);
+}
+#pragma endregion
+
 /**
  * @brief Global instance to be used for logging
- * 
+ *
  */
 SerialLogger Logger;
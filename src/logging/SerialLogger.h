@@ -7,73 +7,281 @@
 
 #include <Arduino.h>
 #include <HardwareSerial.h>
+#include <atomic>
+#include "LogSinks.h"
+#include "LogTimestamp.h"
 
 #ifndef SERIAL_LOGGER_BAUD_RATE
 #define SERIAL_LOGGER_BAUD_RATE 115200
 #endif
 
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 32
+    // number of messages the ring buffer holds, must be a power of two
+#endif
+
+#ifndef LOG_SLOT_SIZE
+#define LOG_SLOT_SIZE 192
+    // maximum length of a log line including timestamp and level, longer messages are truncated
+#endif
+
+#ifndef LOG_DRAIN_TASK_PRIORITY
+#define LOG_DRAIN_TASK_PRIORITY 0
+#endif
+
+#define LOG_DRAIN_TASK_STACK 4096
+    // the file sink runs spiffs writes on the drain task
+
+#define LOG_LEVEL_INFO  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_NONE  2
+
+#ifndef LOG_FORMAT_CACHE_SIZE
+#define LOG_FORMAT_CACHE_SIZE 64
+    // number of format string ids cached by address, must be a power of two
+#endif
+
+#define LOG_RECORD_SYNC 0xA5
+#define LOG_RECORD_TRUNCATED 0x80
+    // set in the level byte if the arguments did not fit into the record
+
+/**
+ * @brief A slot in the log ring buffer.
+ *
+ */
+typedef struct
+{
+  std::atomic<uint32_t> sequence;
+  uint16_t length;
+  char data[LOG_SLOT_SIZE];
+} log_slot_t;
+
 /**
  * @brief Allows logging of messages and errors to the serial console.
- * 
+ * @details Log calls format the message into a lock-free multi producer ring buffer and return
+ * immediately. A low priority drain task writes the buffered lines to the serial port. If the ring
+ * is full, messages are dropped and counted rather than blocking the caller. The drain task writes each
+ * line to the sinks selected with Configure(), by default only the RAM ring so the G-code link on the
+ * primary UART carries no log traffic.
+ *
+ * In binary mode the message is not formatted on the device. Instead a compact record is written:
+ *   sync (0xA5) | length | level | format id (4) | millis (4) | arguments... | xor checksum
+ * The length covers the bytes between the length and the checksum. The format id is the 32 bit
+ * FNV-1a hash of the format string. Integer arguments are stored as 4 bytes (8 for ll and j),
+ * floating point arguments as 8 byte doubles and strings as a length byte followed by the
+ * characters. Multi byte values are little endian. tools/log_decoder turns captured records back
+ * into text using a string table scanned from the sources.
+ *
  */
 class SerialLogger
 {
 public:
   /**
    * @brief Construct a new Serial Logger:: Serial Logger object
-   * 
+   *
    */
   SerialLogger();
-  
+
   /**
-   * @brief Logs an information message to the serial console. 
-   * 
+   * @brief Selects the log sinks and the minimum level logged.
+   *
+   * @param sinks Combination of the LOG_SINK_* flags
+   * @param level The minimum level to log, one of the LOG_LEVEL_* values
+   * @param binary true to write binary records instead of text lines. Ignored with an error when the
+   * primary UART is selected.
+   */
+  void Configure(uint8_t sinks, uint8_t level, bool binary = false);
+
+  /**
+   * @brief Logs an information message to the serial console.
+   *
    * @param message The message to log
    */
-  void Info(String message);
+  void Info(const char *message);
+  void Info(const __FlashStringHelper *message);
+  void Info(const String &message);
 
   /**
    * @brief Logs a formatted message to the serial console. Follows print_f conventions.
-   * 
+   *
    * @param format The format string
    * @param ... Argument list for the token replacement in the format string.
    * @return size_t The lenght of the actual string logged.
-   */ 
-  size_t Info_f(String format, ...);
+   */
+  size_t Info_f(const char *format, ...);
+  size_t Info_f(const __FlashStringHelper *format, ...);
 
   /**
-   * @brief Logs an error message to the serial console. 
-   * 
+   * @brief Logs an error message to the serial console.
+   *
    * @param message The message to log
-   */  
-  void Error(String message);
+   */
+  void Error(const char *message);
+  void Error(const __FlashStringHelper *message);
+  void Error(const String &message);
 
   /**
    * @brief Logs a formatted error to the serial console. Follows print_f conventions.
-   * 
+   *
    * @param format The format string
    * @param ... Argument list for the token replacement in the format string.
    * @return size_t The lenght of the actual string logged.
-   */ 
-  size_t Error_f(String format, ...);
+   */
+  size_t Error_f(const char *format, ...);
+  size_t Error_f(const __FlashStringHelper *format, ...);
+
+  /**
+   * @brief Waits until all buffered messages have been written out.
+   *
+   * @param timeout_ms The maximum time to wait in milliseconds
+   * @return true if the buffer was drained, false on timeout
+   */
+  bool Flush(uint32_t timeout_ms = 1000);
+
+  /**
+   * @brief Writes the contents of the RAM ring sink
+   *
+   * @param out The output to write to
+   */
+  void DumpRam(Print &out);
+
+  /**
+   * @brief Writes the contents of the log file sink
+   *
+   * @param out The output to write to
+   */
+  void DumpFile(Print &out);
+
+  /**
+   * @brief Gets the number of messages dropped because the ring buffer was full.
+   *
+   * @return uint32_t The number of dropped messages since startup
+   */
+  uint32_t GetDropped() const;
+
+  /**
+   * @brief Gets the active log sinks
+   *
+   * @return uint8_t Combination of the LOG_SINK_* flags
+   */
+  uint8_t GetSinks() const;
 
   /**
-   * @brief Sets the transmission speed
-   * @param speed - the transmission speed. 
+   * @brief Selects the optional sub-second timestamp fields
+   *
+   * @param fields Combination of the LOG_TIMESTAMP_* flags
    */
-  void SetSpeed(uint32_t speed);
+  void SetTimestampFields(uint8_t fields);
 
 private:
   /**
-   * @brief Writes the current time inline to the console. 
-   * 
+   * @brief Task function writing buffered messages to the serial port.
+   *
+   * @param args - pointer to the logger instance
+   */
+  static void drain_runner(void *args);
+
+  /**
+   * @brief Brings up newly selected sinks. Called on the drain task.
+   *
+   * @param active The currently active sinks
+   * @return uint8_t The sinks active after the update
+   */
+  uint8_t update_sinks(uint8_t active);
+
+  /**
+   * @brief Writes a line to the active sinks
+   *
+   * @param active The active sinks
+   * @param data The line
+   * @param length The length of the line
+   */
+  void write_sinks(uint8_t active, const char *data, size_t length);
+
+  /**
+   * @brief Encodes a message as a binary record
+   *
+   * @param buf The buffer to write to
+   * @param size The size of the buffer
+   * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+   * @param format The format string
+   * @param args Argument list for the format string
+   * @return size_t The length of the record
    */
-  void writeTime();
+  size_t encode_binary(char *buf, size_t size, uint8_t level, const char *format, va_list args);
+
+  /**
+   * @brief Formats a message as a text line
+   *
+   * @param buf The buffer to write to
+   * @param size The size of the buffer
+   * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+   * @param format The format string
+   * @param args Argument list for the format string
+   * @return size_t The length of the line including the line terminator
+   */
+  size_t encode_text(char *buf, size_t size, uint8_t level, const char *format, va_list args);
+
+  /**
+   * @brief Gets the id of a format string
+   *
+   * @param format The format string
+   * @return uint32_t The FNV-1a hash of the format string
+   */
+  uint32_t format_id(const char *format);
+
+  /**
+   * @brief Formats a message into the ring buffer
+   *
+   * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+   * @param format The format string
+   * @param args Argument list for the format string
+   * @return size_t The length of the entry logged, 0 if it was dropped
+   */
+  size_t log(uint8_t level, const char *format, va_list args);
+
+  /**
+   * @brief Formats a message into the ring buffer. Follows print_f conventions.
+   *
+   * @param level The level, LOG_LEVEL_INFO or LOG_LEVEL_ERROR
+   * @param format The format string
+   * @param ... Argument list for the format string
+   * @return size_t The length of the entry logged, 0 if it was dropped
+   */
+  size_t log_f(uint8_t level, const char *format, ...);
+
+  /**
+   * @brief Reserves a slot in the ring buffer.
+   *
+   * @param pos Receives the ring position of the reserved slot
+   * @return log_slot_t* The reserved slot, nullptr if the ring is full
+   */
+  log_slot_t *reserve(uint32_t *pos);
+
+  /**
+   * @brief Publishes a reserved slot to the drain task
+   *
+   * @param slot The slot to publish
+   * @param pos The ring position of the slot
+   */
+  void commit(log_slot_t *slot, uint32_t pos);
+
+  log_slot_t _slots[LOG_RING_SLOTS];
+  std::atomic<uint32_t> _enqueue_pos;
+  uint32_t _dequeue_pos = 0;
+  std::atomic<uint32_t> _dropped;
+  std::atomic<bool> _drain_started;
+  std::atomic<uint8_t> _sinks;
+  std::atomic<uint8_t> _level;
+  std::atomic<bool> _binary;
+  std::atomic<bool> _flushed;
+  LogTimestamp _timestamp;
+  TaskHandle_t _drain_task = NULL;
 };
 
 /**
  * @brief Global instance to be used for logging
- * 
+ *
  */
 extern SerialLogger Logger;
 
@@ -0,0 +1,475 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include "macro_engine.h"
+#include "../logging/SerialLogger.h"
+#include "../journal/event_journal.h"
+#include "../serial/serial_tx.h"
+#include "../tasks/task_plan.h"
+
+#define MACRO_NOTIFY_ACK 0x01
+#define MACRO_NOTIFY_ERROR 0x02
+#define MACRO_NOTIFY_CANCEL 0x04
+
+static const char *result_names[MACRO_RESULT_COUNT] = {"done", "cancelled", "failed", "timed out"};
+
+MacroEngine Macros;
+
+/**
+ * @brief Reads a line from a program. Leading white space and the line ending are removed.
+ *
+ * @param file - the program
+ * @param buf - receives the line
+ * @param size - the size of the buffer
+ * @return the length of the line, -1 at the end of the program, -2 if the line does not fit
+ */
+static int read_line(File &file, char *buf, size_t size)
+{
+  size_t length = 0;
+  bool overflow = false;
+  int c = file.read();
+  if(c < 0) return -1;
+  for(; c >= 0 && c != '\n'; c = file.read())
+  {
+    if(c == '\r' || ((c == ' ' || c == '\t') && length == 0)) continue;
+    if(length < size - 1) buf[length++] = (char)c;
+    else overflow = true;
+  }
+  buf[length] = '\0';
+  return overflow ? -2 : (int)length;
+}
+
+/**
+ * @brief Construct a new MacroEngine object
+ *
+ */
+MacroEngine::MacroEngine()
+{
+  for(int i=0; i<MACRO_PROGRAM_WORDS; i++) _present[i].store(0, std::memory_order_relaxed);
+  _binds.store(0, std::memory_order_relaxed);
+  _running.store(MACRO_IDLE, std::memory_order_relaxed);
+}
+
+#pragma region public methods
+/**
+ * @brief Starts the macro task
+ *
+ * @param wheel - the wheel providing the state variables and the status area
+ */
+void MacroEngine::Begin(Wheel *wheel)
+{
+  if(_queue != NULL) return;
+  _wheel = wheel;
+  _queue = xQueueCreate(1, sizeof(int));
+  Tasks.Create(TASK_MACRO, MacroEngine::macro_runner, this, &_task);
+}
+
+/**
+ * @brief Checks whether a program exists. Does not access the flash.
+ *
+ * @param program - the program, see MACRO_PROGRAM*
+ * @return true if there is a program
+ */
+bool MacroEngine::Has(int program) const
+{
+  if(program < 0 || program >= MACRO_PROGRAMS) return false;
+  return _present[program / 32].load(std::memory_order_relaxed) & (1u << (program % 32));
+}
+
+/**
+ * @brief Starts a program
+ *
+ * @param program - the program, see MACRO_PROGRAM*
+ * @return true if the program was started, false if there is no such program, another is running
+ * or the emergency stop holds the machine
+ */
+bool MacroEngine::Run(int program)
+{
+  if(_queue == NULL || !this->Has(program) || _running.load() != MACRO_IDLE || _wheel->is_halted()) return false;
+  int request = program;
+  ulTaskNotifyValueClear(_task, 0xffffffff);
+    // drops answers and cancellations meant for an earlier program
+  return xQueueSend(_queue, &request, 0) == pdTRUE;
+}
+
+/**
+ * @brief Cancels the running program. Safe to call from any task.
+ *
+ */
+void MacroEngine::Cancel()
+{
+  if(_queue == NULL) return;
+  xQueueReset(_queue);
+  xTaskNotify(_task, MACRO_NOTIFY_CANCEL, eSetBits);
+}
+
+/**
+ * @brief Passes a line received from the host to the running program
+ *
+ * @param line - the line, without the line ending
+ */
+void MacroEngine::OnHostLine(const char *line)
+{
+  if(_running.load() == MACRO_IDLE || !_ack) return;
+  if(strcmp(line, "ok") == 0) xTaskNotify(_task, MACRO_NOTIFY_ACK, eSetBits);
+  else if(strncmp(line, "error", 5) == 0 || strncmp(line, "ALARM", 5) == 0) xTaskNotify(_task, MACRO_NOTIFY_ERROR, eSetBits);
+}
+
+/**
+ * @brief Rescans the macro directory after programs were added or removed
+ *
+ */
+void MacroEngine::Refresh()
+{
+  // one pass over the directory, probing every possible program would take a file system 
+  // lookup for each of them
+  uint32_t present[MACRO_PROGRAM_WORDS] = {};
+  uint16_t binds = 0;
+  File dir = SPIFFS.open(MACRO_DIRECTORY);
+  for(File file = dir.openNextFile(); file; file = dir.openNextFile())
+  {
+    const char *name = strrchr(file.name(), '/');
+    name = name != nullptr ? name + 1 : file.name();
+    size_t length = strlen(name);
+    size_t extension = strlen(MACRO_EXTENSION);
+    int program = length > extension && strcmp(name + length - extension, MACRO_EXTENSION) == 0 ? 
+      Program(name, length - extension) : -1;
+    file.close();
+    if(program < 0) continue;
+    present[program / 32] |= 1u << (program % 32);
+    if(program >= MACRO_PROGRAM_CHORD(0, 0)) 
+    {
+      program -= MACRO_PROGRAM_CHORD(0, 0);
+      binds |= 1 << (program / COMMAND_COUNT) | 1 << (program % COMMAND_COUNT);
+    }
+    else if(program >= MACRO_PROGRAM_LONG(0)) binds |= 1 << (program - MACRO_PROGRAM_LONG(0));
+  }
+  for(int i=0; i<MACRO_PROGRAM_WORDS; i++) _present[i].store(present[i]);
+  _binds.store(binds);
+}
+
+/**
+ * @brief Gets the program for a name as used in the file names, such as 3, 3_alt, 3_long or 3+5
+ *
+ * @param name - the name, buttons are counted from 1
+ * @param length - the length of the name
+ * @return the program, -1 if the name is invalid
+ */
+int MacroEngine::Program(const char *name, size_t length)
+{
+  char buf[MACRO_NAME_SIZE];
+  if(length == 0 || length >= sizeof(buf)) return -1;
+  memcpy(buf, name, length);
+  buf[length] = '\0';
+
+  char *end;
+  long a = strtol(buf, &end, 10);
+  if(!isdigit(buf[0]) || a < 1 || a > COMMAND_COUNT) return -1;
+  if(*end == '\0') return MACRO_PROGRAM(a - 1, true);
+  if(strcmp(end, MACRO_ALT_SUFFIX) == 0) return MACRO_PROGRAM(a - 1, false);
+  if(strcmp(end, MACRO_LONG_SUFFIX) == 0) return MACRO_PROGRAM_LONG(a - 1);
+  if(*end != MACRO_CHORD_SEPARATOR) return -1;
+
+  const char *second = end + 1;
+  long b = strtol(second, &end, 10);
+  if(!isdigit(second[0]) || *end != '\0' || b < 1 || b > COMMAND_COUNT || a == b) return -1;
+  return a < b ? MACRO_PROGRAM_CHORD(a - 1, b - 1) : MACRO_PROGRAM_CHORD(b - 1, a - 1);
+}
+
+/**
+ * @brief Gets the name of a program
+ *
+ * @param program - the program
+ * @param name - receives the name, MACRO_NAME_SIZE bytes
+ */
+void MacroEngine::Name(int program, char *name)
+{
+  if(program >= MACRO_PROGRAM_CHORD(0, 0))
+  {
+    program -= MACRO_PROGRAM_CHORD(0, 0);
+    snprintf(name, MACRO_NAME_SIZE, "%d%c%d", program / COMMAND_COUNT + 1, MACRO_CHORD_SEPARATOR, program % COMMAND_COUNT + 1);
+  }
+  else if(program >= MACRO_PROGRAM_LONG(0)) snprintf(name, MACRO_NAME_SIZE, "%d" MACRO_LONG_SUFFIX, program - MACRO_PROGRAM_LONG(0) + 1);
+  else snprintf(name, MACRO_NAME_SIZE, "%d%s", (program >> 1) + 1, (program & 1) ? MACRO_ALT_SUFFIX : "");
+}
+
+/**
+ * @brief Gets the path of a program
+ *
+ * @param program - the program
+ * @param path - receives the path, MACRO_PATH_SIZE bytes
+ */
+void MacroEngine::Path(int program, char *path)
+{
+  char name[MACRO_NAME_SIZE];
+  Name(program, name);
+  snprintf(path, MACRO_PATH_SIZE, MACRO_DIRECTORY "/%s" MACRO_EXTENSION, name);
+}
+
+/**
+ * @brief Writes the available programs and the state of the engine
+ *
+ * @param out - the output to write to
+ */
+void MacroEngine::Print(::Print &out)
+{
+  char path[MACRO_PATH_SIZE];
+  bool present = false;
+  int running = _running.load();
+  for(int i=0; i<MACRO_PROGRAMS; i++)
+  {
+    if(!this->Has(i)) continue;
+    present = true;
+    Path(i, path);
+    out.printf("%-24s %s\n", path, i == running ? "running" : "");
+  }
+  if(!present) out.println(F("No programs in " MACRO_DIRECTORY));
+  if(running != MACRO_IDLE) out.printf("Line %u, acknowledge %s\n", _lines, _ack ? "on" : "off");
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Task function running the programs
+ *
+ * @param args - pointer to the MacroEngine instance
+ */
+void MacroEngine::macro_runner(void *args)
+{
+  MacroEngine *_this = reinterpret_cast<MacroEngine *>(args);
+  bool mounted = false;
+  for(uint8_t attempt = 0; attempt < 3 && !mounted; attempt++)
+  {
+    // the journal and the log file sink mount the partition from their own tasks, a concurrent
+    // first mount fails for all but one of them
+    if(attempt > 0) vTaskDelay(pdMS_TO_TICKS(500));
+    mounted = SPIFFS.begin(true);
+  }
+  if(!mounted)
+  {
+    Logger.Error(F("Unable to mount the spiffs partition, button programs are disabled."));
+    QueueHandle_t queue = _this->_queue;
+    _this->_queue = NULL;
+    vQueueDelete(queue);
+    vTaskDelete(NULL);
+    return;
+  }
+  _this->Refresh();
+
+  int request;
+  for(;;)
+  {
+    if(xQueueReceive(_this->_queue, &request, portMAX_DELAY) != pdTRUE) continue;
+    char name[MACRO_NAME_SIZE];
+    Name(request, name);
+    _this->_running.store(request);
+    _this->_wheel->write_status_message(F("Program %s running"), name);
+
+    uint32_t start = millis();
+    macro_result_t result = _this->execute(request);
+    _this->_running.store(MACRO_IDLE);
+
+    Journal.Record(JOURNAL_MACRO, request, result);
+    Logger.Info_f(F("Program %s %s after %u lines in %u ms"), name, result_names[result], _this->_lines, millis() - start);
+    _this->_wheel->write_status_message(F("Program %s %s"), name, result_names[result]);
+  }
+}
+
+/**
+ * @brief Runs a program to its end
+ *
+ * @param program - the program
+ * @return the outcome
+ */
+macro_result_t MacroEngine::execute(int program)
+{
+  char path[MACRO_PATH_SIZE];
+  Path(program, path);
+  _ack = MACRO_ACK_DEFAULT;
+  _variable_count = 0;
+  _lines = 0;
+
+  File file = SPIFFS.open(path, FILE_READ);
+  if(!file)
+  {
+    Logger.Error_f(F("Unable to open program %s"), path);
+    return MACRO_FAILED;
+  }
+
+  macro_result_t result = MACRO_DONE;
+  int length;
+  while(result == MACRO_DONE && (length = read_line(file, _line, sizeof(_line))) != -1)
+  {
+    _lines++;
+    if(this->wait(MACRO_NOTIFY_CANCEL, 0) || _wheel->is_halted()) result = MACRO_CANCELLED;
+      // the feed hold of the emergency stop is set by its interrupt, before the EMS task cancels
+    else if(length == -2)
+    {
+      Logger.Error_f(F("%s:%u: line too long"), path, _lines);
+      result = MACRO_FAILED;
+    }
+    else if(length == 0 || _line[0] == ';') continue;
+    else if(_line[0] == '@') result = this->directive(&_line[1]);
+    else if(!this->expand(_line, _expanded, sizeof(_expanded) - strlen(COMMAND_LINE_ENDING)))
+    {
+      Logger.Error_f(F("%s:%u: unknown variable or line too long"), path, _lines);
+      result = MACRO_FAILED;
+    }
+    else
+    {
+      strcat(_expanded, COMMAND_LINE_ENDING);
+      size_t sent = 0;
+      while(sent == 0 && !_wheel->is_halted() && !this->wait(MACRO_NOTIFY_CANCEL, 0))
+        sent = Tx.Write(_expanded, strlen(_expanded), pdMS_TO_TICKS(MACRO_WRITE_POLL_MS));
+        // a line waiting for room must not be queued after the emergency stop discarded the lane
+      if(sent == 0)
+      {
+        result = MACRO_CANCELLED;
+        continue;
+      }
+      if(!_ack) continue;
+
+      uint32_t answer = this->wait(MACRO_NOTIFY_ACK | MACRO_NOTIFY_ERROR | MACRO_NOTIFY_CANCEL, MACRO_ACK_TIMEOUT_MS);
+      if(answer & MACRO_NOTIFY_CANCEL) result = MACRO_CANCELLED;
+      else if(answer & MACRO_NOTIFY_ERROR) result = MACRO_FAILED;
+      else if(answer == 0) result = MACRO_TIMEOUT;
+    }
+  }
+  file.close();
+  return result;
+}
+
+/**
+ * @brief Handles a directive line
+ *
+ * @param line - the line, starting after the @
+ * @return MACRO_DONE to continue with the next line, the outcome of the program otherwise
+ */
+macro_result_t MacroEngine::directive(char *line)
+{
+  char *args = strchr(line, ' ');
+  if(args != nullptr)
+  {
+    *args++ = '\0';
+    while(*args == ' ') args++;
+  }
+  else args = line + strlen(line);
+
+  if(strcmp(line, "wait") == 0)
+  {
+    return this->wait(MACRO_NOTIFY_CANCEL, strtoul(args, NULL, 10)) ? MACRO_CANCELLED : MACRO_DONE;
+  }
+  if(strcmp(line, "ack") == 0)
+  {
+    _ack = strcmp(args, "on") == 0;
+    return MACRO_DONE;
+  }
+  if(strcmp(line, "msg") == 0)
+  {
+    if(!this->expand(args, _expanded, sizeof(_expanded))) return MACRO_FAILED;
+    _wheel->write_status_message(F("%s"), _expanded);
+    return MACRO_DONE;
+  }
+  if(strcmp(line, "set") == 0)
+  {
+    char *value = strchr(args, ' ');
+    if(value == nullptr || value - args >= MACRO_VARIABLE_NAME_SIZE) return MACRO_FAILED;
+    *value++ = '\0';
+    if(!this->expand(value, _expanded, MACRO_VARIABLE_VALUE_SIZE)) return MACRO_FAILED;
+
+    variable_t *variable = nullptr;
+    for(uint8_t i=0; i<_variable_count && variable == nullptr; i++)
+      if(strcmp(_variables[i].name, args) == 0) variable = &_variables[i];
+    if(variable == nullptr)
+    {
+      if(_variable_count == MACRO_VARIABLES) return MACRO_FAILED;
+      variable = &_variables[_variable_count++];
+      strcpy(variable->name, args);
+    }
+    strcpy(variable->value, _expanded);
+    return MACRO_DONE;
+  }
+  Logger.Error_f(F("Unknown program directive @%s"), line);
+  return MACRO_FAILED;
+}
+
+/**
+ * @brief Replaces the variable references of a line
+ *
+ * @param line - the line
+ * @param out - receives the expanded line
+ * @param size - the size of the output buffer
+ * @return true if the line was expanded, false on an unknown variable or an overflow
+ */
+bool MacroEngine::expand(const char *line, char *out, size_t size)
+{
+  size_t length = 0;
+  while(*line != '\0')
+  {
+    const char *end = *line == '{' ? strchr(line, '}') : nullptr;
+    if(end == nullptr)
+    {
+      if(length + 1 >= size) return false;
+      out[length++] = *line++;
+      continue;
+    }
+
+    char name[MACRO_VARIABLE_NAME_SIZE];
+    char builtin[MACRO_VARIABLE_VALUE_SIZE];
+    const char *value;
+    size_t name_length = end - line - 1;
+    if(name_length >= sizeof(name)) return false;
+    memcpy(name, line + 1, name_length);
+    name[name_length] = '\0';
+
+    wheel_state_t state;
+    _wheel->get_state(state);
+    value = builtin;
+    if(strcmp(name, "x") == 0) snprintf(builtin, sizeof(builtin), "%.4f", state.x);
+    else if(strcmp(name, "y") == 0) snprintf(builtin, sizeof(builtin), "%.4f", state.y);
+    else if(strcmp(name, "z") == 0) snprintf(builtin, sizeof(builtin), "%.4f", state.z);
+    else if(strcmp(name, "feed") == 0) snprintf(builtin, sizeof(builtin), "%.4f", state.feed);
+    else if(strcmp(name, "axis") == 0) snprintf(builtin, sizeof(builtin), "%c", (char)state.axis);
+    else value = nullptr;
+    for(uint8_t i=0; i<_variable_count && value == nullptr; i++)
+      if(strcmp(_variables[i].name, name) == 0) value = _variables[i].value;
+    if(value == nullptr) return false;
+
+    size_t value_length = strlen(value);
+    if(length + value_length >= size) return false;
+    memcpy(out + length, value, value_length);
+    length += value_length;
+    line = end + 1;
+  }
+  out[length] = '\0';
+  return true;
+}
+
+/**
+ * @brief Waits for a notification
+ *
+ * @param bits - the notifications to wait for
+ * @param ms - the time to wait
+ * @return the notifications received, 0 on timeout
+ */
+uint32_t MacroEngine::wait(uint32_t bits, uint32_t ms)
+{
+  uint32_t start = millis();
+  uint32_t elapsed = 0;
+  uint32_t value = 0;
+  do
+  {
+    // notifications we are not waiting for stay pending, so an early cancel is not lost
+    xTaskNotifyWait(0, 0, &value, pdMS_TO_TICKS(ms - elapsed));
+    if(value & bits)
+    {
+      ulTaskNotifyValueClear(NULL, value & bits);
+      return value & bits;
+    }
+    elapsed = millis() - start;
+  } while(elapsed < ms);
+  return 0;
+}
+#pragma endregion
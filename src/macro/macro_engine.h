@@ -0,0 +1,255 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef MACRO_ENGINE_H_
+#define MACRO_ENGINE_H_
+
+#include <Arduino.h>
+#include <atomic>
+#include "../wheel/wheel.h"
+
+/*
+ * Button programs stored on the spiffs partition as /macros/<n>.gcode, or /macros/<n>_alt.gcode
+ * for the alternate command of a toggling button. When a program exists for a button it is run
+ * instead of the configured command. /macros/<n>_long.gcode is run when button n is held and
+ * /macros/<a>+<b>.gcode when buttons a and b are pressed together; a button with such a program
+ * sends its command when it is released instead of when it is pressed. 
+ * Programs are read and sent one line at a time:
+ *
+ *   ; comment            comment and blank lines are skipped
+ *   @set <name> <value>  defines a variable, referenced as {name} in later lines
+ *   @wait <ms>           pauses the program
+ *   @ack on|off          waits for the host to answer each line with ok or error
+ *   @msg <text>          shows a message in the status area
+ *   anything else        is sent to the host after the variables have been replaced
+ *
+ * The variables {x}, {y}, {z}, {feed} and {axis} hold the wheel state when the line is sent.
+ *
+ * "@ack on" needs a host that passes the answers of grbl back to the wheel on the serial link,
+ * where they arrive as lines that are not diagnostic queries. Without them every line waits
+ * MACRO_ACK_TIMEOUT_MS and the program fails with a timeout.
+ */
+
+#define MACRO_DIRECTORY "/macros"
+#define MACRO_EXTENSION ".gcode"
+#define MACRO_ALT_SUFFIX "_alt"
+#define MACRO_LONG_SUFFIX "_long"
+#define MACRO_CHORD_SEPARATOR '+'
+#define MACRO_NAME_SIZE 8
+#define MACRO_PATH_SIZE 32
+#define MACRO_LINE_SIZE 256
+#define MACRO_VARIABLES 8
+#define MACRO_VARIABLE_NAME_SIZE 16
+#define MACRO_VARIABLE_VALUE_SIZE 32
+#define MACRO_IDLE -1
+
+#define MACRO_PROGRAM(slot, on) ((slot) << 1 | ((on) ? 0 : 1))
+#define MACRO_PROGRAM_LONG(slot) (COMMAND_COUNT * 2 + (slot))
+#define MACRO_PROGRAM_CHORD(a, b) (COMMAND_COUNT * 3 + (a) * COMMAND_COUNT + (b))
+    // a chord is stored once, with a < b
+#define MACRO_PROGRAMS (COMMAND_COUNT * 3 + COMMAND_COUNT * COMMAND_COUNT)
+#define MACRO_PROGRAM_WORDS ((MACRO_PROGRAMS + 31) / 32)
+
+#ifndef MACRO_ACK_DEFAULT
+#define MACRO_ACK_DEFAULT false
+    // grbl answers every line, enable this when the host forwards the answers to the wheel
+#endif
+
+#ifndef MACRO_WRITE_POLL_MS
+#define MACRO_WRITE_POLL_MS 100
+    // while the link is full a line is retried at this interval, checking for a cancel in between
+#endif
+
+#ifndef MACRO_ACK_TIMEOUT_MS
+#define MACRO_ACK_TIMEOUT_MS 60000
+    // grbl answers a motion once it is planned, a long probing move can take a while to get there
+#endif
+
+/**
+ * @brief The outcome of a program, recorded in the journal
+ *
+ */
+typedef enum : uint8_t
+{
+  MACRO_DONE = 0,
+  MACRO_CANCELLED,
+  MACRO_FAILED,       // the program is invalid or the host answered with an error
+  MACRO_TIMEOUT,      // the host did not answer a line
+  MACRO_RESULT_COUNT
+} macro_result_t;
+
+/**
+ * @brief Runs button programs from flash on a task of its own, so the button task never blocks
+ * and a program is never held in memory as a whole. A running program is cancelled by the
+ * emergency stop, and neither started nor continued while it holds the machine.
+ *
+ */
+class MacroEngine
+{
+public:
+  /**
+   * @brief Construct a new MacroEngine object
+   *
+   */
+  MacroEngine();
+
+  /**
+   * @brief Starts the macro task
+   *
+   * @param wheel - the wheel providing the state variables and the status area
+   */
+  void Begin(Wheel *wheel);
+
+  /**
+   * @brief Checks whether a program exists. Does not access the flash.
+   *
+   * @param program - the program, see MACRO_PROGRAM*
+   * @return true if there is a program
+   */
+  bool Has(int program) const;
+
+  /**
+   * @brief Checks whether a button has a long press or chord program. Does not access the flash.
+   *
+   * @param slot - the zero based button
+   * @return true if the button has such a program
+   */
+  bool Binds(int slot) const { return _binds.load(std::memory_order_relaxed) & (1 << slot); }
+
+  /**
+   * @brief Starts a program
+   *
+   * @param program - the program, see MACRO_PROGRAM*
+   * @return true if the program was started, false if there is no such program, another is running
+   * or the emergency stop holds the machine
+   */
+  bool Run(int program);
+
+  /**
+   * @brief Checks whether a program is running
+   *
+   * @return true if a program is running
+   */
+  bool IsRunning() const { return _running.load() != MACRO_IDLE; }
+
+  /**
+   * @brief Cancels the running program. Safe to call from any task.
+   *
+   */
+  void Cancel();
+
+  /**
+   * @brief Passes a line received from the host to the running program
+   *
+   * @param line - the line, without the line ending
+   */
+  void OnHostLine(const char *line);
+
+  /**
+   * @brief Rescans the macro directory after programs were added or removed
+   *
+   */
+  void Refresh();
+
+  /**
+   * @brief Gets the program for a name as used in the file names, such as 3, 3_alt, 3_long or 3+5
+   *
+   * @param name - the name, buttons are counted from 1
+   * @param length - the length of the name
+   * @return the program, -1 if the name is invalid
+   */
+  static int Program(const char *name, size_t length);
+
+  /**
+   * @brief Gets the name of a program
+   *
+   * @param program - the program
+   * @param name - receives the name, MACRO_NAME_SIZE bytes
+   */
+  static void Name(int program, char *name);
+
+  /**
+   * @brief Gets the path of a program
+   *
+   * @param program - the program
+   * @param path - receives the path, MACRO_PATH_SIZE bytes
+   */
+  static void Path(int program, char *path);
+
+  /**
+   * @brief Writes the available programs and the state of the engine
+   *
+   * @param out - the output to write to
+   */
+  void Print(::Print &out);
+
+private:
+  /**
+   * @brief Task function running the programs
+   *
+   * @param args - pointer to the MacroEngine instance
+   */
+  static void macro_runner(void *args);
+
+  /**
+   * @brief Runs a program to its end
+   *
+   * @param program - the program
+   * @return the outcome
+   */
+  macro_result_t execute(int program);
+
+  /**
+   * @brief Handles a directive line
+   *
+   * @param line - the line, starting after the @
+   * @return MACRO_DONE to continue with the next line, the outcome of the program otherwise
+   */
+  macro_result_t directive(char *line);
+
+  /**
+   * @brief Replaces the variable references of a line
+   *
+   * @param line - the line
+   * @param out - receives the expanded line
+   * @param size - the size of the output buffer
+   * @return true if the line was expanded, false on an unknown variable or an overflow
+   */
+  bool expand(const char *line, char *out, size_t size);
+
+  /**
+   * @brief Waits for a notification
+   *
+   * @param bits - the notifications to wait for
+   * @param ms - the time to wait
+   * @return the notifications received, 0 on timeout
+   */
+  uint32_t wait(uint32_t bits, uint32_t ms);
+
+  typedef struct
+  {
+    char name[MACRO_VARIABLE_NAME_SIZE];
+    char value[MACRO_VARIABLE_VALUE_SIZE];
+  } variable_t;
+
+  Wheel *_wheel = nullptr;
+  TaskHandle_t _task = NULL;
+  QueueHandle_t _queue = NULL;
+  std::atomic<uint32_t> _present[MACRO_PROGRAM_WORDS];
+  std::atomic<uint16_t> _binds;
+  std::atomic<int> _running;
+  bool _ack = MACRO_ACK_DEFAULT;
+  uint8_t _variable_count = 0;
+  variable_t _variables[MACRO_VARIABLES];
+  char _line[MACRO_LINE_SIZE];
+  char _expanded[MACRO_LINE_SIZE + sizeof(COMMAND_LINE_ENDING)];
+  uint32_t _lines = 0;
+};
+
+/**
+ * @brief Global instance of the macro engine
+ *
+ */
+extern MacroEngine Macros;
+
+#endif /* MACRO_ENGINE_H_ */
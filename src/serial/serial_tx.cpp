@@ -0,0 +1,330 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <hal/uart_ll.h>
+#include "serial_tx.h"
+#include "../tasks/task_plan.h"
+
+#define SERIAL_TX_NOTIFY_REALTIME 0x01
+#define SERIAL_TX_NOTIFY_LINE 0x02
+#define SERIAL_TX_NOTIFY_DISCARD 0x04
+
+SerialTx Tx;
+
+/**
+ * @brief Construct a new SerialTx object
+ *
+ */
+SerialTx::SerialTx()
+{
+  _depth.store(0, std::memory_order_relaxed);
+}
+
+#pragma region public methods
+/**
+ * @brief Starts the transmit task. Until then writes go to Serial directly.
+ *
+ * @param port - the port of the G-code link, already started
+ */
+void SerialTx::Begin(HardwareSerial &port)
+{
+  _port = &port;
+  this->set_fifo_limit(port.baudRate());
+  if(_task != NULL) return;
+  _lines = xRingbufferCreate(SERIAL_TX_LINE_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+  Tasks.Create(TASK_SERIAL_TX, SerialTx::tx_runner, this, &_task);
+}
+
+/**
+ * @brief Queues a realtime byte. Safe to call from any task.
+ *
+ * @param c - the byte
+ * @return true if the byte was queued, false if the realtime lane is full
+ */
+bool SerialTx::Realtime(uint8_t c)
+{
+  if(_task == NULL) return _port->write(c) == 1;
+  bool queued = false;
+  portENTER_CRITICAL(&_realtime_lock);
+  if(_realtime_head - _realtime_tail < SERIAL_TX_REALTIME_SIZE)
+  {
+    _realtime[_realtime_head & (SERIAL_TX_REALTIME_SIZE - 1)] = c;
+    _realtime_at[_realtime_head & (SERIAL_TX_REALTIME_SIZE - 1)] = micros();
+    _realtime_head++;
+    queued = true;
+  }
+  else _realtime_dropped++;
+  portEXIT_CRITICAL(&_realtime_lock);
+  if(queued) xTaskNotify(_task, SERIAL_TX_NOTIFY_REALTIME, eSetBits);
+  return queued;
+}
+
+/**
+ * @brief Writes a realtime byte straight into the hardware FIFO, ahead of the transmit task.
+ * Callable from interrupt handlers; the byte may land in between two bytes of a line.
+ *
+ * @param c - the byte
+ * @return the number of bytes ahead of it in the FIFO, -1 if the FIFO was full
+ */
+int IRAM_ATTR SerialTx::RealtimeFromISR(uint8_t c)
+{
+  uart_dev_t *hw = UART_LL_GET_HW(SERIAL_TX_UART_NUM);
+  uint32_t room = uart_ll_get_txfifo_len(hw);
+  if(room == 0)
+  {
+    _isr_dropped++;
+    return -1;
+  }
+  uart_ll_write_txfifo(hw, &c, 1);
+  _isr_bytes++;
+  return SERIAL_TX_FIFO_SIZE - room;
+}
+
+/**
+ * @brief Queues a line. The line is written as a whole, including its line ending.
+ *
+ * @param data - the line
+ * @param length - the length of the line
+ * @param ticks - the time to wait for room in the line lane
+ * @return the number of bytes queued, 0 if the line was dropped
+ */
+size_t SerialTx::Write(const char *data, size_t length, TickType_t ticks)
+{
+  if(length == 0) return 0;
+  if(_task == NULL) return _port->write((const uint8_t *)data, length);
+
+  void *item = nullptr;
+  if(xRingbufferSendAcquire(_lines, &item, sizeof(line_header_t) + length, ticks) != pdTRUE)
+  {
+    _lines_dropped++;
+    return 0;
+  }
+  reinterpret_cast<line_header_t *>(item)->queued_us = micros();
+  memcpy((uint8_t *)item + sizeof(line_header_t), data, length);
+  uint32_t depth = _depth.fetch_add(length) + length;
+    // counted before the task can see the line
+  if(depth > _depth_max) _depth_max = depth;
+  xRingbufferSendComplete(_lines, item);
+  xTaskNotify(_task, SERIAL_TX_NOTIFY_LINE, eSetBits);
+  return length;
+}
+
+/**
+ * @brief Drops the lines not yet written, used when the machine is stopped and queued
+ * motions must not follow the reset.
+ *
+ */
+void SerialTx::Discard()
+{
+  if(_task == NULL) return;
+  size_t size;
+  void *item;
+  while((item = xRingbufferReceive(_lines, &size, 0)) != nullptr)
+  {
+    _depth.fetch_sub(size - sizeof(line_header_t));
+    vRingbufferReturnItem(_lines, item);
+    _lines_discarded++;
+  }
+  xTaskNotify(_task, SERIAL_TX_NOTIFY_DISCARD, eSetBits);
+    // the rest of the line the task is writing
+}
+
+/**
+ * @brief Waits until both lanes are written to the port
+ *
+ * @param timeout_ms - the time to wait
+ * @return true if everything was written
+ */
+bool SerialTx::Flush(uint32_t timeout_ms)
+{
+  uint32_t start = millis();
+  while(_task != NULL && !(_idle && _realtime_head == _realtime_tail && _depth.load() == 0))
+  {
+    if(millis() - start > timeout_ms) return false;
+    vTaskDelay(1);
+  }
+  _port->flush();
+  return true;
+}
+
+/**
+ * @brief Changes the baud rate once the queued lines are written at the old rate
+ *
+ * @param baud - the new baud rate
+ */
+void SerialTx::SetBaudRate(uint32_t baud)
+{
+  this->Flush();
+  _port->updateBaudRate(baud);
+  this->set_fifo_limit(baud);
+}
+
+/**
+ * @brief Writes the queue depth and latency statistics
+ *
+ * @param out - the output to write to
+ */
+void SerialTx::Print(::Print &out)
+{
+  uint32_t depth = _depth.load();
+  out.printf("Realtime:    %u bytes, latency avg %u us, max %u us, %u dropped\n", _realtime_latency.count,
+    _realtime_latency.count ? (uint32_t)(_realtime_latency.total_us / _realtime_latency.count) : 0, _realtime_latency.max_us, _realtime_dropped);
+  out.printf("Lines:       %u, latency avg %u us, max %u us, %u dropped, %u discarded\n", _line_latency.count,
+    _line_latency.count ? (uint32_t)(_line_latency.total_us / _line_latency.count) : 0, _line_latency.max_us, _lines_dropped, _lines_discarded);
+  out.printf("Line queue:  %u bytes, max %u of %u\n", depth, _depth_max, SERIAL_TX_LINE_BUFFER_SIZE);
+  out.printf("UART:        %u bytes in %u chunks, %u lines preempted, FIFO limit %u\n", _bytes, _chunks, _preempted, _fifo_limit);
+  out.printf("Interrupts:  %u bytes, %u dropped\n", _isr_bytes, _isr_dropped);
+}
+
+/**
+ * @brief Clears the statistics
+ *
+ */
+void SerialTx::Reset()
+{
+  _realtime_latency = {};
+  _line_latency = {};
+  _bytes = _chunks = _preempted = _depth_max = 0;
+  _realtime_dropped = _lines_dropped = _lines_discarded = 0;
+  _isr_bytes = _isr_dropped = 0;
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Task function writing both lanes to the port
+ *
+ * @param args - pointer to the SerialTx instance
+ */
+void SerialTx::tx_runner(void *args)
+{
+  SerialTx *_this = reinterpret_cast<SerialTx *>(args);
+  uint8_t *line = nullptr;
+  size_t size = 0;
+  size_t offset = 0;
+  for(;;)
+  {
+    uint32_t events = ulTaskNotifyValueClear(NULL, 0xffffffff);
+    if((events & SERIAL_TX_NOTIFY_DISCARD) && line != nullptr)
+    {
+      _this->_depth.fetch_sub(size - offset);
+      vRingbufferReturnItem(_this->_lines, line);
+      line = nullptr;
+      _this->_lines_discarded++;
+    }
+    if(_this->_realtime_head != _this->_realtime_tail)
+    {
+      if(line != nullptr && offset > sizeof(line_header_t)) _this->_preempted++;
+      _this->write_realtime();
+    }
+
+    if(line == nullptr)
+    {
+      line = (uint8_t *)xRingbufferReceive(_this->_lines, &size, 0);
+      offset = sizeof(line_header_t);
+    }
+    if(line == nullptr)
+    {
+      _this->_idle = true;
+      xTaskNotifyWait(0, 0, NULL, portMAX_DELAY);
+        // the bits are taken at the top of the loop
+      _this->_idle = false;
+      continue;
+    }
+
+    size_t room = _this->fifo_room();
+    if(room == 0)
+    {
+      // a realtime byte ends the wait early, otherwise look again once some of the FIFO is out
+      xTaskNotifyWait(0, 0, NULL, 1);
+      continue;
+    }
+    size_t chunk = min(room, size - offset);
+    _this->_port->write(line + offset, chunk);
+    _this->_depth.fetch_sub(chunk);
+    _this->_bytes += chunk;
+    _this->_chunks++;
+    offset += chunk;
+    if(offset == size)
+    {
+      record(_this->_line_latency, micros() - reinterpret_cast<line_header_t *>(line)->queued_us);
+      vRingbufferReturnItem(_this->_lines, line);
+      line = nullptr;
+    }
+  }
+}
+
+/**
+ * @brief Writes the pending realtime bytes
+ *
+ */
+void SerialTx::write_realtime()
+{
+  while(_realtime_head != _realtime_tail)
+  {
+    uint32_t i = _realtime_tail & (SERIAL_TX_REALTIME_SIZE - 1);
+    _port->write(_realtime[i]);
+    record(_realtime_latency, micros() - _realtime_at[i]);
+    portENTER_CRITICAL(&_realtime_lock);
+    _realtime_tail++;
+    portEXIT_CRITICAL(&_realtime_lock);
+  }
+}
+
+/**
+ * @brief Gets the number of line bytes that may be handed to the FIFO
+ *
+ * @return the number of bytes
+ */
+size_t SerialTx::fifo_room()
+{
+  int available = _port->availableForWrite() - (SERIAL_TX_FIFO_SIZE - _fifo_limit);
+  return available > 0 ? available : 0;
+}
+
+/**
+ * @brief Sizes the part of the FIFO line traffic may use to the realtime budget
+ *
+ * @param baud - the baud rate of the port
+ */
+void SerialTx::set_fifo_limit(uint32_t baud)
+{
+  uint32_t limit = (uint64_t)baud * SERIAL_TX_REALTIME_BUDGET_US / 10 / 1000000;
+    // 10 bits per byte with start and stop bit
+  _fifo_limit = limit < SERIAL_TX_FIFO_MIN ? SERIAL_TX_FIFO_MIN : (limit > SERIAL_TX_FIFO_SIZE ? SERIAL_TX_FIFO_SIZE : limit);
+}
+
+/**
+ * @brief Records a latency
+ *
+ * @param latency - the statistics to update
+ * @param us - the latency
+ */
+void SerialTx::record(latency_t &latency, uint32_t us)
+{
+  latency.count++;
+  latency.total_us += us;
+  if(us > latency.max_us) latency.max_us = us;
+}
+#pragma endregion
+
+#pragma region SerialTxPrint
+size_t SerialTxPrint::write(uint8_t c)
+{
+  _line[_length++] = c;
+  if(c == '\n' || _length == sizeof(_line)) this->flush();
+  return 1;
+}
+
+/**
+ * @brief Queues the collected partial line
+ *
+ */
+void SerialTxPrint::flush()
+{
+  if(_length == 0) return;
+  Tx.Write(_line, _length, portMAX_DELAY);
+  _length = 0;
+}
+#pragma endregion
@@ -0,0 +1,236 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef SERIAL_TX_H_
+#define SERIAL_TX_H_
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <atomic>
+#include <freertos/ringbuf.h>
+
+#ifndef SERIAL_TX_LINE_BUFFER_SIZE
+#define SERIAL_TX_LINE_BUFFER_SIZE 2048
+    // lines waiting for the UART, a line that does not fit waits for room or is dropped
+#endif
+
+#define SERIAL_TX_REALTIME_SIZE 16
+    // must be a power of two
+
+#define SERIAL_TX_FIFO_SIZE 128
+#define SERIAL_TX_UART_NUM 0
+    // the UART of the G-code link, written directly by RealtimeFromISR
+#ifndef SERIAL_TX_REALTIME_BUDGET_US
+#define SERIAL_TX_REALTIME_BUDGET_US 600
+    // line traffic never fills the hardware FIFO beyond what goes out in this time, so a byte
+    // written from an interrupt waits for at most this long: 6 bytes at 115200, 13 at 230400 baud
+#endif
+#define SERIAL_TX_FIFO_MIN 4
+
+#define SERIAL_TX_LINE_SIZE 160
+    // buffer of SerialTxPrint, longer lines are split
+
+/**
+ * @brief Owns the transmit side of the G-code link. Everybody sending to the host goes through
+ * one of two lanes, and a single task writes them to the UART:
+ *
+ *   realtime lane  single bytes such as feed hold (!), cycle start (~), reset (0x18) or the
+ *                  override bytes (0x85, 0x90 to 0x9d); they are written ahead of any line
+ *                  traffic, in between two bytes of a line if need be, as grbl expects.
+ *                  Interrupt handlers bypass the task and write to the FIFO directly.
+ *   line lane      whole lines, each written without being interleaved with another line;
+ *                  lines are handed to the UART in chunks as the FIFO drains.
+ *
+ * The port is expected to run without a software transmit buffer (the default), so the
+ * room reported by the port is the room in the hardware FIFO.
+ */
+class SerialTx
+{
+public:
+  /**
+   * @brief Construct a new SerialTx object
+   *
+   */
+  SerialTx();
+
+  /**
+   * @brief Starts the transmit task. Until then writes go to Serial directly.
+   *
+   * @param port - the port of the G-code link, already started
+   */
+  void Begin(HardwareSerial &port);
+
+  /**
+   * @brief Queues a realtime byte. Safe to call from any task.
+   *
+   * @param c - the byte
+   * @return true if the byte was queued, false if the realtime lane is full
+   */
+  bool Realtime(uint8_t c);
+
+  /**
+   * @brief Writes a realtime byte straight into the hardware FIFO, ahead of the transmit task.
+   * Callable from interrupt handlers; the byte may land in between two bytes of a line.
+   *
+   * @param c - the byte
+   * @return the number of bytes ahead of it in the FIFO, -1 if the FIFO was full
+   */
+  int IRAM_ATTR RealtimeFromISR(uint8_t c);
+
+  /**
+   * @brief Queues a line. The line is written as a whole, including its line ending.
+   *
+   * @param data - the line
+   * @param length - the length of the line
+   * @param ticks - the time to wait for room in the line lane
+   * @return the number of bytes queued, 0 if the line was dropped
+   */
+  size_t Write(const char *data, size_t length, TickType_t ticks = pdMS_TO_TICKS(100));
+
+  /**
+   * @brief Drops the lines not yet written, used when the machine is stopped and queued
+   * motions must not follow the reset.
+   *
+   */
+  void Discard();
+
+  /**
+   * @brief Waits until both lanes are written to the port
+   *
+   * @param timeout_ms - the time to wait
+   * @return true if everything was written
+   */
+  bool Flush(uint32_t timeout_ms = 1000);
+
+  /**
+   * @brief Changes the baud rate once the queued lines are written at the old rate
+   *
+   * @param baud - the new baud rate
+   */
+  void SetBaudRate(uint32_t baud);
+
+  /**
+   * @brief Writes the queue depth and latency statistics
+   *
+   * @param out - the output to write to
+   */
+  void Print(::Print &out);
+
+  /**
+   * @brief Clears the statistics
+   *
+   */
+  void Reset();
+
+private:
+  /**
+   * @brief Task function writing both lanes to the port
+   *
+   * @param args - pointer to the SerialTx instance
+   */
+  static void tx_runner(void *args);
+
+  /**
+   * @brief Writes the pending realtime bytes
+   *
+   */
+  void write_realtime();
+
+  /**
+   * @brief Gets the number of line bytes that may be handed to the FIFO
+   *
+   * @return the number of bytes
+   */
+  size_t fifo_room();
+
+  /**
+   * @brief Sizes the part of the FIFO line traffic may use to the realtime budget
+   *
+   * @param baud - the baud rate of the port
+   */
+  void set_fifo_limit(uint32_t baud);
+
+  /**
+   * @brief Header of a queued line
+   *
+   */
+  typedef struct
+  {
+    uint32_t queued_us;
+  } line_header_t;
+
+  /**
+   * @brief Latency statistics of a lane
+   *
+   */
+  typedef struct
+  {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+  } latency_t;
+
+  /**
+   * @brief Records a latency
+   *
+   * @param latency - the statistics to update
+   * @param us - the latency
+   */
+  static void record(latency_t &latency, uint32_t us);
+
+  HardwareSerial *_port = &Serial;
+  TaskHandle_t _task = NULL;
+  RingbufHandle_t _lines = NULL;
+  portMUX_TYPE _realtime_lock = portMUX_INITIALIZER_UNLOCKED;
+  uint8_t _realtime[SERIAL_TX_REALTIME_SIZE];
+  uint32_t _realtime_at[SERIAL_TX_REALTIME_SIZE];
+  volatile uint32_t _realtime_head = 0;
+  volatile uint32_t _realtime_tail = 0;
+  volatile bool _idle = true;
+  uint32_t _fifo_limit = SERIAL_TX_FIFO_MIN;
+  std::atomic<uint32_t> _depth;
+
+  latency_t _realtime_latency = {};
+  latency_t _line_latency = {};
+  uint32_t _bytes = 0;
+  uint32_t _chunks = 0;
+  uint32_t _preempted = 0;
+  uint32_t _depth_max = 0;
+  uint32_t _realtime_dropped = 0;
+  volatile uint32_t _isr_bytes = 0;
+  volatile uint32_t _isr_dropped = 0;
+  uint32_t _lines_dropped = 0;
+  uint32_t _lines_discarded = 0;
+};
+
+/**
+ * @brief Print adapter collecting output into lines for the line lane, so report output
+ * written one byte at a time is not interleaved with other lines
+ *
+ */
+class SerialTxPrint : public Print
+{
+public:
+  ~SerialTxPrint() { this->flush(); }
+
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  /**
+   * @brief Queues the collected partial line
+   *
+   */
+  void flush() override;
+
+private:
+  char _line[SERIAL_TX_LINE_SIZE];
+  size_t _length = 0;
+};
+
+/**
+ * @brief Global instance of the transmit arbiter
+ *
+ */
+extern SerialTx Tx;
+
+#endif /* SERIAL_TX_H_ */
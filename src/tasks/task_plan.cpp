@@ -0,0 +1,276 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <algorithm>
+#include <esp_timer.h>
+#include "task_plan.h"
+#include "../logging/SerialLogger.h"
+
+#define TASK_BENCH_LOAD_US 20000
+    // the load task spins this long and then sleeps for a tick, about a full frame of the display
+
+TaskPlan Tasks;
+
+/**
+ * @brief The task table. Each row gives the name of a task and its placement in the shared and
+ * the realtime profile as {core, priority, stack}.
+ *
+ */
+static const struct
+{
+  const char *name;
+  task_spec_t spec[TASK_PROFILE_COUNT];
+} plan[TASK_ROLE_COUNT] = {
+  //                          shared           realtime
+  {"wheelRunner",         {{0, 1, 2048},   {1, 4, 2048}}},
+  {"emsRunner",           {{0, 1, 2048},   {1, 6, 2048}}},
+  {"serialTx",            {{0, 2, 2048},   {1, 5, 2048}}},
+    // the transmit task only ever waits for the UART, so it can sit above the tasks feeding it
+  {"buttonSampler",       {{0, 1, 2048},   {1, 3, 2048}}},
+  {"extendedGPIOWatcher", {{0, 1, 3072},   {1, 3, 3072}}},
+  {"axisSelector",        {{0, 1, 2048},   {1, 3, 2048}}},
+  {"macroRunner",         {{0, 1, 4096},   {1, 2, 4096}}},
+  {"displayRunner",       {{0, 1, 8192},   {0, 1, 8192}}},
+  {"liveState",           {{0, 0, 3072},   {0, 0, 3072}}},
+  {"network",             {{1, 1, 4096},   {0, 1, 4096}}},
+  {"startup",             {{1, 1, 6144},   {0, 1, 6144}}},
+};
+
+static TaskHandle_t bench_task = NULL;
+static volatile int64_t *bench_fired_us = nullptr;
+
+#pragma region public methods
+/**
+ * @brief Selects the profile. Call before the first task is created.
+ *
+ * @param profile - the profile, see task_profile_t
+ */
+void TaskPlan::Select(uint8_t profile)
+{
+  if(profile >= TASK_PROFILE_COUNT)
+  {
+    Logger.Error_f(F("Unknown task profile %u, using %s"), profile, ProfileName(TASK_PROFILE_DEFAULT));
+    profile = TASK_PROFILE_DEFAULT;
+  }
+  _profile = profile;
+  Logger.Info_f(F("Task profile: %s"), ProfileName(_profile));
+}
+
+/**
+ * @brief Gets the placement of a task in the selected profile
+ *
+ * @param role - the task
+ * @return the placement
+ */
+const task_spec_t &TaskPlan::Spec(task_role_t role)
+{
+  return plan[role].spec[_profile];
+}
+
+/**
+ * @brief Creates a task as placed by the selected profile
+ *
+ * @param role - the task
+ * @param function - the task function
+ * @param args - the argument of the task function
+ * @param handle - receives the task handle, may be NULL
+ * @return pdPASS if the task was created
+ */
+BaseType_t TaskPlan::Create(task_role_t role, TaskFunction_t function, void *args, TaskHandle_t *handle)
+{
+  const task_spec_t &spec = this->Spec(role);
+  TaskHandle_t task = NULL;
+  BaseType_t result = xTaskCreatePinnedToCore(function, plan[role].name, spec.stack, args, spec.priority, &task, spec.core);
+  if(result != pdPASS)
+  {
+    Logger.Error_f(F("Unable to create task %s"), plan[role].name);
+    return result;
+  }
+  if(handle != NULL)
+  {
+    *handle = task;
+    _handles[role] = task;
+      // tasks created without a handle may delete themselves, their stack is not reported
+  }
+  return result;
+}
+
+/**
+ * @brief Gets the name of a profile
+ *
+ * @param profile - the profile
+ * @return the name, "unknown" for an invalid profile
+ */
+const char *TaskPlan::ProfileName(uint8_t profile)
+{
+  switch(profile)
+  {
+    case TASK_PROFILE_SHARED: return "shared";
+    case TASK_PROFILE_REALTIME: return "realtime";
+    default: return "unknown";
+  }
+}
+
+/**
+ * @brief Writes the placement of the tasks in the selected profile and their stack use
+ *
+ * @param out - the output to write to
+ */
+void TaskPlan::Print(::Print &out)
+{
+  out.printf("Profile:     %s\n", ProfileName(_profile));
+  for(int i=0; i<TASK_ROLE_COUNT; i++)
+  {
+    const task_spec_t &spec = plan[i].spec[_profile];
+    out.printf("  %-20s core %d, priority %u, stack %5u", plan[i].name, spec.core, spec.priority, spec.stack);
+    if(_handles[i] != NULL) out.printf(", %5u unused\n", uxTaskGetStackHighWaterMark(_handles[i]));
+    else out.println();
+  }
+}
+
+/**
+ * @brief Measures the wakeup latency and jitter of the real-time tasks in every profile. A
+ * probe task is placed like the measured task and woken from a timer interrupt on the core
+ * the input interrupts run on; the real tasks keep running, so the numbers include their load.
+ * Blocks the calling task for the duration of the benchmark.
+ *
+ * @param out - the output to write to
+ * @param ms - the duration of each run, at most TASK_BENCH_MAX_MS
+ * @param load - true to add a task spinning like a busy display task
+ */
+void TaskPlan::Bench(::Print &out, uint32_t ms, bool load)
+{
+  static const task_role_t measured[] = {TASK_WHEEL, TASK_EMS, TASK_SERIAL_TX};
+  if(ms > TASK_BENCH_MAX_MS) ms = TASK_BENCH_MAX_MS;
+  out.printf("Wakeup from a timer interrupt on core %d every %u us, %u ms per run%s, active profile %s\n",
+    xPortGetCoreID(), TASK_BENCH_PERIOD_US, ms, load ? ", display task busy" : "", ProfileName(_profile));
+  out.println(F("profile   task                core prio      n  missed   min   avg   p99   max  jitter (us)"));
+  uint16_t *samples = (uint16_t *)malloc(TASK_BENCH_SAMPLES * sizeof(uint16_t));
+  if(samples == nullptr)
+  {
+    out.println(F("Not enough memory for the benchmark"));
+    return;
+  }
+
+  for(uint8_t profile=0; profile<TASK_PROFILE_COUNT; profile++)
+  {
+    TaskHandle_t load_task = NULL;
+    if(load)
+    {
+      const task_spec_t &display = plan[TASK_DISPLAY].spec[profile];
+      xTaskCreatePinnedToCore(TaskPlan::bench_load, "benchLoad", 2048, NULL, display.priority, &load_task, display.core);
+    }
+    for(task_role_t role : measured)
+    {
+      const task_spec_t &spec = plan[role].spec[profile];
+      bench_run_t run = {};
+      run.samples = samples;
+      this->bench_run(spec, ms, run);
+      if(run.count == 0)
+      {
+        out.printf("%-9s %-20s  no samples\n", ProfileName(profile), plan[role].name);
+        continue;
+      }
+      uint32_t kept = std::min(run.count, (uint32_t)TASK_BENCH_SAMPLES);
+      std::sort(samples, samples + kept);
+      out.printf("%-9s %-20s %4d %4u %6u %7u %5u %5u %5u %5u %7u\n", ProfileName(profile), plan[role].name, spec.core, spec.priority,
+        run.count, run.missed, run.min_us, (uint32_t)(run.total_us / run.count), samples[std::min(kept - 1, kept * 99 / 100)], run.max_us, run.jitter_us);
+    }
+    if(load_task != NULL) vTaskDelete(load_task);
+  }
+  free(samples);
+  out.println(F("missed: timer periods that passed before the probe ran, jitter: largest deviation of the wake interval from the period"));
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Runs the probe of one task in one profile
+ *
+ * @param spec - the placement of the probe
+ * @param ms - the duration of the run
+ * @param run - receives the statistics
+ */
+void TaskPlan::bench_run(const task_spec_t &spec, uint32_t ms, bench_run_t &run)
+{
+  run.owner = xTaskGetCurrentTaskHandle();
+  run.target = ms * 1000 / TASK_BENCH_PERIOD_US;
+  run.min_us = UINT32_MAX;
+  bench_fired_us = &run.fired_us;
+  ulTaskNotifyTake(pdTRUE, 0);
+
+  TaskHandle_t probe = NULL;
+  if(xTaskCreatePinnedToCore(TaskPlan::bench_probe, "benchProbe", 2048, &run, spec.priority, &probe, spec.core) != pdPASS) return;
+  bench_task = probe;
+  hw_timer_t *timer = timerBegin(1000000);
+  timerAttachInterrupt(timer, TaskPlan::bench_timer);
+  timerAlarm(timer, TASK_BENCH_PERIOD_US, true, 0);
+
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms * 2 + 100));
+  timerEnd(timer);
+  bench_task = NULL;
+  vTaskDelete(probe);
+}
+
+/**
+ * @brief Timer interrupt of the benchmark waking the probe
+ *
+ */
+void IRAM_ATTR TaskPlan::bench_timer()
+{
+  TaskHandle_t task = bench_task;
+  if(task == NULL) return;
+  *bench_fired_us = esp_timer_get_time();
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(task, &xHigherPriorityTaskWoken);
+  portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief Task function of the benchmark probe
+ *
+ * @param args - pointer to the bench_run_t
+ */
+void TaskPlan::bench_probe(void *args)
+{
+  bench_run_t *run = reinterpret_cast<bench_run_t *>(args);
+  for(;;)
+  {
+    uint32_t notifications = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    if(run->count >= run->target) continue;
+    run->missed += notifications - 1;
+      // notifications given while the probe did not run are coalesced
+    uint32_t us = now - run->fired_us;
+    if(us < run->min_us) run->min_us = us;
+    if(us > run->max_us) run->max_us = us;
+    run->total_us += us;
+    if(run->count < TASK_BENCH_SAMPLES) run->samples[run->count] = us > UINT16_MAX ? UINT16_MAX : us;
+    if(run->last_us != 0)
+    {
+      int64_t deviation = now - run->last_us - (int64_t)TASK_BENCH_PERIOD_US * notifications;
+      uint32_t jitter = deviation < 0 ? -deviation : deviation;
+      if(jitter > run->jitter_us) run->jitter_us = jitter;
+    }
+    run->last_us = now;
+    if(++run->count == run->target) xTaskNotifyGive(run->owner);
+  }
+}
+
+/**
+ * @brief Task function loading a core during the benchmark
+ *
+ * @param args - unused
+ */
+void TaskPlan::bench_load(void *args)
+{
+  for(;;)
+  {
+    int64_t until = esp_timer_get_time() + TASK_BENCH_LOAD_US;
+    while(esp_timer_get_time() < until);
+    vTaskDelay(1);
+      // lets the idle task feed the watchdog
+  }
+}
+#pragma endregion
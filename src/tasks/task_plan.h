@@ -0,0 +1,196 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef TASK_PLAN_H_
+#define TASK_PLAN_H_
+
+#include <Arduino.h>
+
+#ifndef TASK_PROFILE_DEFAULT
+#define TASK_PROFILE_DEFAULT TASK_PROFILE_REALTIME
+#endif
+
+#define TASK_BENCH_PERIOD_US 997
+    // not a multiple of the tick, so the timer drifts across the tick interrupt
+#define TASK_BENCH_SAMPLES 1000
+    // samples kept per run for the percentiles, longer runs only update min, max and average
+#define TASK_BENCH_MAX_MS 5000
+    // longest run, the benchmark makes six runs and blocks the caller for all of them
+
+/**
+ * @brief The tasks placed by the plan. The log drain and the journal run unpinned at idle
+ * priority in every profile and are not part of it.
+ *
+ */
+typedef enum : uint8_t
+{
+  TASK_WHEEL = 0,
+  TASK_EMS,
+  TASK_SERIAL_TX,
+  TASK_BUTTONS,
+  TASK_GPIO_WATCHER,
+  TASK_SELECTOR,
+  TASK_MACRO,
+  TASK_DISPLAY,
+  TASK_LIVE_STATE,
+  TASK_NETWORK,
+  TASK_STARTUP,
+  TASK_ROLE_COUNT
+} task_role_t;
+
+/**
+ * @brief The task placement profiles
+ *
+ *   shared    the original placement: the wheel, its inputs and the display share core 0 at
+ *             priority 1, the network runs on core 1 next to the loop task.
+ *   realtime  the tasks between the inputs and the serial link run on core 1 above the loop
+ *             task, the display, the network and the web socket on core 0 next to the WiFi
+ *             stack.
+ */
+typedef enum : uint8_t
+{
+  TASK_PROFILE_SHARED = 0,
+  TASK_PROFILE_REALTIME,
+  TASK_PROFILE_COUNT
+} task_profile_t;
+
+/**
+ * @brief Placement of a task
+ *
+ */
+typedef struct
+{
+  BaseType_t core;
+  UBaseType_t priority;
+  uint32_t stack;
+} task_spec_t;
+
+/**
+ * @brief Creates the tasks of the firmware from a declarative table, one row per task and one
+ * column per profile. The profile is selected once at startup, before the first task is created;
+ * a change takes effect with the next boot.
+ *
+ */
+class TaskPlan
+{
+public:
+  /**
+   * @brief Selects the profile. Call before the first task is created.
+   *
+   * @param profile - the profile, see task_profile_t
+   */
+  void Select(uint8_t profile);
+
+  /**
+   * @brief Gets the selected profile
+   *
+   * @return the profile
+   */
+  uint8_t Profile() { return _profile; }
+
+  /**
+   * @brief Gets the placement of a task in the selected profile
+   *
+   * @param role - the task
+   * @return the placement
+   */
+  const task_spec_t &Spec(task_role_t role);
+
+  /**
+   * @brief Creates a task as placed by the selected profile
+   *
+   * @param role - the task
+   * @param function - the task function
+   * @param args - the argument of the task function
+   * @param handle - receives the task handle, may be NULL
+   * @return pdPASS if the task was created
+   */
+  BaseType_t Create(task_role_t role, TaskFunction_t function, void *args, TaskHandle_t *handle = NULL);
+
+  /**
+   * @brief Gets the name of a profile
+   *
+   * @param profile - the profile
+   * @return the name, "unknown" for an invalid profile
+   */
+  static const char *ProfileName(uint8_t profile);
+
+  /**
+   * @brief Writes the placement of the tasks in the selected profile and their stack use
+   *
+   * @param out - the output to write to
+   */
+  void Print(::Print &out);
+
+  /**
+   * @brief Measures the wakeup latency and jitter of the real-time tasks in every profile. A
+   * probe task is placed like the measured task and woken from a timer interrupt on the core
+   * the input interrupts run on; the real tasks keep running, so the numbers include their load.
+   * Blocks the calling task for the duration of the benchmark.
+   *
+   * @param out - the output to write to
+   * @param ms - the duration of each run, at most TASK_BENCH_MAX_MS
+   * @param load - true to add a task spinning like a busy display task
+   */
+  void Bench(::Print &out, uint32_t ms, bool load);
+
+private:
+  /**
+   * @brief Statistics of a benchmark run
+   *
+   */
+  typedef struct
+  {
+    TaskHandle_t owner;
+    volatile int64_t fired_us;
+    uint32_t count;
+    uint32_t target;
+    uint32_t missed;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    int64_t last_us;
+    uint32_t jitter_us;
+    uint16_t *samples;
+  } bench_run_t;
+
+  /**
+   * @brief Runs the probe of one task in one profile
+   *
+   * @param spec - the placement of the probe
+   * @param ms - the duration of the run
+   * @param run - receives the statistics
+   */
+  void bench_run(const task_spec_t &spec, uint32_t ms, bench_run_t &run);
+
+  /**
+   * @brief Timer interrupt of the benchmark waking the probe
+   *
+   */
+  static void IRAM_ATTR bench_timer();
+
+  /**
+   * @brief Task function of the benchmark probe
+   *
+   * @param args - pointer to the bench_run_t
+   */
+  static void bench_probe(void *args);
+
+  /**
+   * @brief Task function loading a core during the benchmark
+   *
+   * @param args - unused
+   */
+  static void bench_load(void *args);
+
+  uint8_t _profile = TASK_PROFILE_DEFAULT;
+  TaskHandle_t _handles[TASK_ROLE_COUNT] = {};
+};
+
+/**
+ * @brief Global instance of the task plan
+ *
+ */
+extern TaskPlan Tasks;
+
+#endif /* TASK_PLAN_H_ */
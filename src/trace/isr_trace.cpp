@@ -0,0 +1,110 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include "isr_trace.h"
+
+static_assert((ISR_TRACE_SIZE & (ISR_TRACE_SIZE - 1)) == 0, "ISR_TRACE_SIZE must be a power of two");
+static_assert(sizeof(trace_record_t) == 8, "trace records must be 8 bytes");
+
+DRAM_ATTR trace_record_t IsrTrace::_ring[ISR_TRACE_SIZE];
+  // internal RAM, so interrupt handlers can record while the flash cache is disabled
+
+static volatile uint32_t remote_ccount;
+
+static void read_ccount(void *args)
+{
+  remote_ccount = esp_cpu_get_cycle_count();
+}
+
+static const char *source_name(uint8_t source)
+{
+  switch(source)
+  {
+    case TRACE_ENCODER: return "encoder";
+    case TRACE_EMS: return "ems";
+    case TRACE_AXIS: return "axis";
+    case TRACE_PCF8575: return "pcf8575";
+    case TRACE_EMS_HOLD: return "ems_hold";
+    case TRACE_WAKE_WHEEL: return "wake_wheel";
+    case TRACE_WAKE_EMS: return "wake_ems";
+    case TRACE_WAKE_GPIO: return "wake_gpio";
+    case TRACE_PCF8575_READ: return "pcf8575_read";
+    default: return "unknown";
+  }
+}
+
+/**
+ * @brief Construct a new IsrTrace object
+ *
+ */
+IsrTrace::IsrTrace()
+{
+  _head.store(0, std::memory_order_relaxed);
+}
+
+#pragma region public methods
+/**
+ * @brief Writes the trace, oldest record first. Recording is paused while the ring is read.
+ *
+ * @param out - the output to write to
+ */
+void IsrTrace::Dump(Print &out)
+{
+  _paused = true;
+  vTaskDelay(1);
+    // lets handlers that passed the pause check finish their record
+  uint32_t head = _head.load(std::memory_order_acquire);
+  uint32_t count = head < ISR_TRACE_SIZE ? head : ISR_TRACE_SIZE;
+  out.printf("# isr trace: cpu_hz %u, records %u, total %u\n", (unsigned)getCpuFrequencyMhz() * 1000000u, count, head);
+  out.printf("# core_offset %d\n", core_offset());
+  out.println(F("# ccount core source flags pins"));
+  for(uint32_t i = head - count; i != head; i++)
+  {
+    const trace_record_t &r = _ring[i & (ISR_TRACE_SIZE - 1)];
+    out.printf("%u %u %s %02x %04x\n", r.ccount, r.flags & TRACE_FLAG_CORE ? 1 : 0, source_name(r.source), r.flags, r.pins);
+  }
+  _paused = false;
+}
+
+/**
+ * @brief Discards all records
+ *
+ */
+void IsrTrace::Clear()
+{
+  _head.store(0, std::memory_order_release);
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Estimates the difference between the cycle counters of the two cores
+ *
+ * @return int32_t ccount of core 1 minus ccount of core 0
+ */
+int32_t IsrTrace::core_offset()
+{
+  // reads the other core's counter through an IPC call and assumes it was read halfway through
+  // the round trip. The fastest of a few round trips gives the tightest bound.
+  uint32_t best = UINT32_MAX;
+  int32_t offset = 0;
+  uint32_t core = xPortGetCoreID();
+  for(uint8_t i = 0; i < 8; i++)
+  {
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    if(esp_ipc_call_blocking(!core, read_ccount, NULL) != ESP_OK) break;
+    uint32_t t1 = esp_cpu_get_cycle_count();
+    if(t1 - t0 >= best) continue;
+    best = t1 - t0;
+    offset = (int32_t)(remote_ccount - (t0 + best / 2));
+  }
+  return core == 0 ? offset : -offset;
+}
+#pragma endregion
+
+/**
+ * @brief Global instance of the interrupt trace
+ *
+ */
+IsrTrace Trace;
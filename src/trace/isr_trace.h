@@ -0,0 +1,136 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef ISR_TRACE_H
+#define ISR_TRACE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_cpu.h>
+#include <esp_ipc.h>
+
+#ifndef ISR_TRACE_ENABLED
+#define ISR_TRACE_ENABLED 1
+#endif
+
+#ifndef ISR_TRACE_SIZE
+#define ISR_TRACE_SIZE 1024
+    // number of records in the trace ring, must be a power of two
+#endif
+
+/**
+ * @brief Trace record sources. Interrupt sources are below TRACE_WAKE_WHEEL, task wakeups above.
+ * Wakeup records carry the number of notifications consumed in the pins field.
+ *
+ */
+typedef enum : uint8_t
+{
+  TRACE_ENCODER = 1,
+  TRACE_EMS,
+  TRACE_AXIS,
+  TRACE_PCF8575,
+  TRACE_EMS_HOLD,           // pins: the bytes ahead of the feed hold in the UART FIFO, 0xffff if it was full
+  TRACE_WAKE_WHEEL = 0x10,
+  TRACE_WAKE_EMS,
+  TRACE_WAKE_GPIO,
+  TRACE_PCF8575_READ,       // pins: the 16 inputs of the expander as read by the watcher task
+} trace_source_t;
+
+#define TRACE_FLAG_CORE   0x01
+    // the record was taken on core 1. The cycle counters of the two cores are not synchronized.
+#define TRACE_FLAG_NOTIFY 0x02
+    // the interrupt handler notified its task
+
+#define TRACE_PIN_WHEEL_A 0x0001
+#define TRACE_PIN_WHEEL_B 0x0002
+#define TRACE_PIN_EMS     0x0004
+#define TRACE_PIN_AXIS_X  0x0008
+#define TRACE_PIN_AXIS_Y  0x0010
+#define TRACE_PIN_AXIS_Z  0x0020
+#define TRACE_PIN_PCF_INT 0x0040
+
+/**
+ * @brief A trace record
+ *
+ */
+typedef struct
+{
+  uint32_t ccount;
+  uint8_t source;
+  uint8_t flags;
+  uint16_t pins;
+} trace_record_t;
+
+/**
+ * @brief Lock-free trace ring for the input interrupt handlers and the tasks they wake. Recording
+ * costs a cycle counter read, an atomic increment and an 8 byte store, so it is safe to leave enabled
+ * in production. The ring is dumped with the "trace" diagnostic report and analyzed on the host
+ * with tools/isr_trace.
+ *
+ */
+class IsrTrace
+{
+public:
+  /**
+   * @brief Construct a new IsrTrace object
+   *
+   */
+  IsrTrace();
+
+  /**
+   * @brief Appends a record. Callable from interrupt handlers on either core.
+   *
+   * @param source - the record source
+   * @param flags - TRACE_FLAG_NOTIFY if the handler notified its task
+   * @param pins - the raw pin state, see TRACE_PIN_*
+   */
+  inline void IRAM_ATTR record(uint8_t source, uint8_t flags, uint16_t pins)
+  {
+    uint32_t ccount = esp_cpu_get_cycle_count();
+    if(_paused) return;
+    trace_record_t &r = _ring[_head.fetch_add(1, std::memory_order_relaxed) & (ISR_TRACE_SIZE - 1)];
+    r.ccount = ccount;
+    r.source = source;
+    r.flags = flags | (xPortGetCoreID() ? TRACE_FLAG_CORE : 0);
+    r.pins = pins;
+  }
+
+  /**
+   * @brief Writes the trace, oldest record first. Recording is paused while the ring is read.
+   *
+   * @param out - the output to write to
+   */
+  void Dump(Print &out);
+
+  /**
+   * @brief Discards all records
+   *
+   */
+  void Clear();
+
+private:
+  /**
+   * @brief Estimates the difference between the cycle counters of the two cores
+   *
+   * @return int32_t ccount of core 1 minus ccount of core 0
+   */
+  static int32_t core_offset();
+
+  static trace_record_t _ring[ISR_TRACE_SIZE];
+  std::atomic<uint32_t> _head;
+  volatile bool _paused = false;
+};
+
+/**
+ * @brief Global instance of the interrupt trace
+ *
+ */
+extern IsrTrace Trace;
+
+#if ISR_TRACE_ENABLED
+#define ISR_TRACE(source, flags, pins) Trace.record(source, flags, pins)
+#else
+#define ISR_TRACE(source, flags, pins)
+#endif
+
+#endif // ISR_TRACE_H
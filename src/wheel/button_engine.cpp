@@ -0,0 +1,203 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "button_engine.h"
+#include "../logging/SerialLogger.h"
+#include "../trace/isr_trace.h"
+#include "../tasks/task_plan.h"
+
+static const char *event_names[BUTTON_EVENT_COUNT] = {"press", "release", "long press", "chord", "inputs"};
+
+/**
+ * @brief Creates a new button engine
+ * @param address - the I2C address of the expander
+ */
+ButtonEngine::ButtonEngine(uint8_t address)
+{
+    _address = address;
+}
+
+/**
+ * @brief Configures the expander and reads the initial state of the inputs
+ * @returns The inputs, 1 = active (low)
+ */
+uint16_t ButtonEngine::begin()
+{
+    Wire.begin();
+    Wire.setClock(BUTTON_I2C_FREQUENCY);
+
+    // the expander has no direction register, a pin written high is a weakly pulled up input
+    Wire.beginTransmission(_address);
+    Wire.write(0xff);
+    Wire.write(0xff);
+    if(Wire.endTransmission() != 0) Logger.Error_f(F("No answer from the GPIO expander at 0x%02x"), _address);
+
+    uint16_t inputs = 0;
+    this->read(inputs);
+    _state = _raw = inputs;
+    _queue = xQueueCreate(BUTTON_QUEUE_LENGTH, sizeof(button_event_t));
+    return inputs;
+}
+
+/**
+ * @brief Starts the sampling task
+ */
+void ButtonEngine::start()
+{
+    Tasks.Create(TASK_BUTTONS, ButtonEngine::sampler, this, &_task);
+}
+
+/**
+ * @brief Wakes the sampling task. Called from the interrupt of the expander.
+ */
+void IRAM_ATTR ButtonEngine::notify_from_isr()
+{
+    if(_task == NULL) return;
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(_task, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief Waits for the next event
+ * @param event - receives the event
+ * @param ticks - the time to wait
+ * @returns true if an event was received
+ */
+bool ButtonEngine::receive(button_event_t &event, TickType_t ticks)
+{
+    return _queue != NULL && xQueueReceive(_queue, &event, ticks) == pdTRUE;
+}
+
+/**
+ * @brief Writes the sampling statistics
+ * @param out - the output to write to
+ */
+void ButtonEngine::print(Print &out) const
+{
+    out.printf("Inputs:      0x%04x (1 = active)\n", _state);
+    out.printf("Reads:       %u, %u failed, slowest %u us at %u Hz\n", _reads, _read_errors, _read_us, BUTTON_I2C_FREQUENCY);
+    out.printf("Events:      %u, %u dropped\n", _events, _dropped);
+}
+
+/**
+ * @brief Task function sampling the expander
+ * @param args - pointer to the ButtonEngine instance
+ */
+void ButtonEngine::sampler(void* args)
+{
+    ButtonEngine *_this = reinterpret_cast<ButtonEngine *>(args);
+    for (;;)
+    {
+        uint16_t held = _this->_state & BUTTON_MASK & ~_this->_long & ~_this->_chorded;
+        if(_this->_raw != _this->_state || held != 0)
+        {
+            // sample at a fixed rate while an input settles or a long press may come up, the
+            // interrupts of a bouncing contact would otherwise count as samples
+            vTaskDelay(pdMS_TO_TICKS(BUTTON_SAMPLE_MS));
+            ulTaskNotifyTake(pdTRUE, 0);
+        }
+        else
+        {
+            uint32_t notifications = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            ISR_TRACE(TRACE_WAKE_GPIO, 0, notifications);
+        }
+
+        uint16_t inputs;
+        if(_this->read(inputs)) _this->sample(inputs, millis());
+    }
+}
+
+/**
+ * @brief Reads the inputs of the expander
+ * @param inputs - receives the inputs, 1 = active (low)
+ * @returns true if the read succeeded
+ */
+bool ButtonEngine::read(uint16_t &inputs)
+{
+    uint32_t start = micros();
+    _reads++;
+    if(Wire.requestFrom(_address, (uint8_t)2) != 2)
+    {
+        _read_errors++;
+        return false;
+    }
+    uint16_t pins = Wire.read();
+    pins |= Wire.read() << 8;
+    uint32_t elapsed = micros() - start;
+    if(elapsed > _read_us) _read_us = elapsed;
+    ISR_TRACE(TRACE_PCF8575_READ, 0, pins);
+    inputs = ~pins;
+    return true;
+}
+
+/**
+ * @brief Debounces a sample and queues the resulting events
+ * @param inputs - the sampled inputs, 1 = active (low)
+ * @param now - the time of the sample in ms
+ */
+void ButtonEngine::sample(uint16_t inputs, uint32_t now)
+{
+    // each input has a two bit counter, held in the same bit of _ct0 and _ct1. The counter is
+    // reset while the input matches the debounced state and counts down while it differs; the
+    // input toggles when the counter wraps, after four samples in a row
+    uint16_t delta = inputs ^ _state;
+    _ct0 = ~(_ct0 & delta);
+    _ct1 = _ct0 ^ (_ct1 & delta);
+    uint16_t toggled = delta & _ct0 & _ct1;
+    _state ^= toggled;
+    _raw = inputs;
+
+    if(toggled & ~BUTTON_MASK) this->emit(BUTTON_INPUTS, 0);
+
+    uint16_t released = toggled & ~_state & BUTTON_MASK;
+    for(uint8_t i=0; released != 0; i++, released >>= 1)
+    {
+        if(!(released & 1)) continue;
+        this->emit(BUTTON_RELEASE, i);
+        _long &= ~(1 << i);
+        _chorded &= ~(1 << i);
+    }
+
+    uint16_t pressed = toggled & _state & BUTTON_MASK;
+    uint16_t held = (_state & BUTTON_MASK) & ~pressed;
+    for(uint8_t i=0; pressed != 0; i++, pressed >>= 1)
+    {
+        if(!(pressed & 1)) continue;
+        _pressed_at[i] = now;
+        this->emit(BUTTON_PRESS, i);
+        if(held != 0 && (held & (held - 1)) == 0)
+        {
+            this->emit(BUTTON_CHORD, __builtin_ctz(held), i);
+            _chorded |= held | (1 << i);
+        }
+        held |= 1 << i;
+    }
+
+    uint16_t waiting = _state & BUTTON_MASK & ~_long & ~_chorded;
+    for(uint8_t i=0; waiting != 0; i++, waiting >>= 1)
+    {
+        if(!(waiting & 1) || now - _pressed_at[i] < BUTTON_LONG_PRESS_MS) continue;
+        this->emit(BUTTON_LONG_PRESS, i);
+        _long |= 1 << i;
+    }
+}
+
+/**
+ * @brief Queues an event
+ * @param type - the type of the event
+ * @param button - the button
+ * @param second - the second button of a chord
+ */
+void ButtonEngine::emit(button_event_type_t type, uint8_t button, uint8_t second)
+{
+    button_event_t event = {type, button, second, _state};
+    _events++;
+    if(xQueueSend(_queue, &event, 0) != pdTRUE)
+    {
+        _dropped++;
+        Logger.Error_f(F("Button event queue full, %s of button %d dropped"), event_names[type], button + 1);
+    }
+}
@@ -0,0 +1,145 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef _BUTTON_ENGINE_H_
+#define _BUTTON_ENGINE_H_
+
+#include "Arduino.h"
+
+#define BUTTON_COUNT 12
+#define BUTTON_MASK ((1 << BUTTON_COUNT) - 1)
+    // the buttons are on P0 to P11 of the expander, the remaining inputs are reported as a whole
+#define BUTTON_QUEUE_LENGTH 16
+
+#ifndef BUTTON_I2C_FREQUENCY
+#define BUTTON_I2C_FREQUENCY 400000
+    // fast mode, a read of the expander takes about 70us instead of 280us at the default 100kHz
+#endif
+
+#ifndef BUTTON_SAMPLE_MS
+#define BUTTON_SAMPLE_MS 5
+    // an input has to read the same for four samples in a row to change, so about 20ms
+#endif
+
+#ifndef BUTTON_LONG_PRESS_MS
+#define BUTTON_LONG_PRESS_MS 800
+#endif
+
+/**
+ * @brief Types of button events
+ */
+typedef enum : uint8_t
+{
+    BUTTON_PRESS = 0,
+    BUTTON_RELEASE,
+    BUTTON_LONG_PRESS,      // the button has been held for BUTTON_LONG_PRESS_MS
+    BUTTON_CHORD,           // a second button was pressed while exactly one other was held
+    BUTTON_INPUTS,          // one of the other inputs of the expander changed
+    BUTTON_EVENT_COUNT
+} button_event_type_t;
+
+/**
+ * @brief A button event
+ */
+typedef struct
+{
+    button_event_type_t type;
+    uint8_t button;         // the zero based button, for a chord the one held first
+    uint8_t second;         // the button completing a chord
+    uint16_t inputs;        // the debounced inputs of the expander, 1 = active (low)
+} button_event_t;
+
+/**
+ * @brief Reads the buttons on the PCF8575 expander as one 16 bit word and turns them into events.
+ * The inputs are debounced with a two bit vertical counter per input, which handles all 16 inputs
+ * with a handful of bitwise operations per sample. The expander is only read while an input is
+ * settling or a button is held; otherwise the task sleeps until the expander interrupt fires.
+ */
+class ButtonEngine
+{
+    public:
+        /**
+         * @brief Creates a new button engine
+         * @param address - the I2C address of the expander
+         */
+        ButtonEngine(uint8_t address);
+
+        /**
+         * @brief Configures the expander and reads the initial state of the inputs
+         * @returns The inputs, 1 = active (low)
+         */
+        uint16_t begin();
+
+        /**
+         * @brief Starts the sampling task
+         */
+        void start();
+
+        /**
+         * @brief Wakes the sampling task. Called from the interrupt of the expander.
+         */
+        void IRAM_ATTR notify_from_isr();
+
+        /**
+         * @brief Waits for the next event
+         * @param event - receives the event
+         * @param ticks - the time to wait
+         * @returns true if an event was received
+         */
+        bool receive(button_event_t &event, TickType_t ticks = portMAX_DELAY);
+
+        /**
+         * @brief Writes the sampling statistics
+         * @param out - the output to write to
+         */
+        void print(Print &out) const;
+
+    private:
+        /**
+         * @brief Task function sampling the expander
+         * @param args - pointer to the ButtonEngine instance
+         */
+        static void sampler(void* args);
+
+        /**
+         * @brief Reads the inputs of the expander
+         * @param inputs - receives the inputs, 1 = active (low)
+         * @returns true if the read succeeded
+         */
+        bool read(uint16_t &inputs);
+
+        /**
+         * @brief Debounces a sample and queues the resulting events
+         * @param inputs - the sampled inputs, 1 = active (low)
+         * @param now - the time of the sample in ms
+         */
+        void sample(uint16_t inputs, uint32_t now);
+
+        /**
+         * @brief Queues an event
+         * @param type - the type of the event
+         * @param button - the button
+         * @param second - the second button of a chord
+         */
+        void emit(button_event_type_t type, uint8_t button, uint8_t second = 0);
+
+        uint8_t _address;
+        TaskHandle_t _task = NULL;
+        QueueHandle_t _queue = NULL;
+
+        uint16_t _state = 0;        // debounced inputs
+        uint16_t _raw = 0;          // last sample
+        uint16_t _ct0 = 0xffff;     // vertical counter, low bits
+        uint16_t _ct1 = 0xffff;     // vertical counter, high bits
+        uint16_t _long = 0;         // held buttons that have reported a long press
+        uint16_t _chorded = 0;      // held buttons that took part in a chord
+        uint32_t _pressed_at[BUTTON_COUNT] = {};
+
+        uint32_t _reads = 0;
+        uint32_t _read_errors = 0;
+        uint32_t _read_us = 0;
+        uint32_t _events = 0;
+        uint32_t _dropped = 0;
+};
+
+#endif
@@ -0,0 +1,159 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include "command_store.h"
+
+#pragma region CommandSet
+/**
+ * @brief Packs command slots into the arena
+ * @param slots - array of COMMAND_COUNT slots
+ */
+void CommandSet::Load(const command_slot_t *slots)
+{
+    uint16_t used = 0;
+    for(uint8_t i = 0; i < COMMAND_COUNT; i++)
+    {
+        const char *fields[4] = {slots[i].name_on, slots[i].command_on, slots[i].name_off, slots[i].command_off};
+        const size_t sizes[4] = {COMMAND_NAME_SIZE, COMMAND_SIZE, COMMAND_NAME_SIZE, COMMAND_SIZE};
+        for(uint8_t f = 0; f < 4; f++)
+        {
+            size_t length = strnlen(fields[f], sizes[f] - 1);
+            if(length == 0 && f >= 2)
+            {
+                // an empty alternate shares the primary string
+                _offset[i][f] = _offset[i][f - 2];
+                _length[i][f] = _length[i][f - 2];
+                continue;
+            }
+            size_t extra = (f & 1) ? sizeof(COMMAND_LINE_ENDING) - 1 : 0;
+            // the slot sizes bound the arena use, see COMMAND_ARENA_SIZE
+            memcpy(_arena + used, fields[f], length);
+            memcpy(_arena + used + length, COMMAND_LINE_ENDING, extra);
+            _offset[i][f] = used;
+            _length[i][f] = (uint8_t)length;
+            used += length + extra;
+        }
+    }
+}
+#pragma endregion
+
+static_assert(COMMAND_COUNT * (2 * (COMMAND_NAME_SIZE - 1) + 2 * (COMMAND_SIZE - 1 + sizeof(COMMAND_LINE_ENDING) - 1)) <= COMMAND_ARENA_SIZE, 
+    "the command arena must hold all slots filled to capacity");
+
+#pragma region CommandStore
+/**
+ * @brief Creates a new command store
+ * @param slots - array of COMMAND_COUNT slots with the initial commands
+ */
+CommandStore::CommandStore(const command_slot_t *slots) : _active(&_sets[0]), _in_use(nullptr)
+{
+    _sets[0].Load(slots);
+}
+
+/**
+ * @brief Gets the active set. Only one reader may hold the set at a time and it must 
+ * call Release when done.
+ * @returns The command set
+ */
+const CommandSet *CommandStore::Acquire()
+{
+    CommandSet *set = _active.load();
+    for(;;)
+    {
+        // announce the set before using it, then make sure it was not replaced in between.
+        // A writer never reloads the set announced here. 
+        _in_use.store(set);
+        CommandSet *active = _active.load();
+        if(active == set) return set;
+        set = active;
+    }
+}
+
+/**
+ * @brief Releases the set obtained with Acquire
+ */
+void CommandStore::Release()
+{
+    _in_use.store(nullptr);
+}
+
+/**
+ * @brief Publishes a new set of commands. Blocks while the reader still holds the 
+ * set that is to be reused. 
+ * @param slots - array of COMMAND_COUNT slots
+ */
+void CommandStore::Publish(const command_slot_t *slots)
+{
+    if(_publish_mutex == NULL) _publish_mutex = xSemaphoreCreateMutex();
+        // created on first use, the store is constructed before the scheduler runs
+    if(xSemaphoreTake(_publish_mutex, portMAX_DELAY) != pdTRUE) return;
+    CommandSet *next = _active.load() == &_sets[0] ? &_sets[1] : &_sets[0];
+    while(_in_use.load() == next) vTaskDelay(1);
+    next->Load(slots);
+    _active.store(next);
+    xSemaphoreGive(_publish_mutex);
+}
+#pragma endregion
+
+/**
+ * @brief Replaces the control characters 0x01 to 0x1a with [CTRL]+<letter> for display in the 
+ * config page. Runs in linear time and does not allocate; the output is always terminated and a 
+ * truncated output never ends in a partial sequence. 
+ * @param s - the command
+ * @param out - receives the escaped command
+ * @param size - the size of the output buffer, COMMAND_ESCAPED_SIZE holds any command
+ * @returns The length of the complete escaped command, a value of size or more indicates truncation
+ */
+size_t escape_ctrl_characters(const char *s, char *out, size_t size)
+{
+    const size_t prefix = sizeof(COMMAND_CTRL_PREFIX) - 1;
+    size_t length = 0;
+    size_t written = 0;
+    for (; *s != '\0'; ++s)
+    {
+        bool ctrl = *s >= 1 && *s <= 26;
+        size_t n = ctrl ? prefix + 1 : 1;
+        if (length == written && written + n < size)
+        {
+            if (ctrl)
+            {
+                memcpy(out + written, COMMAND_CTRL_PREFIX, prefix);
+                out[written + prefix] = *s + 64;
+            }
+            else out[written] = *s;
+            written += n;
+        }
+        length += n;
+    }
+    if (size > 0) out[written] = '\0';
+    return length;
+}
+
+/**
+ * @brief Replaces [CTRL]+<letter> sequences with the control character. A sequence not followed
+ * by a letter is copied as is. Runs in linear time and does not allocate.
+ * @param s - the escaped command
+ * @param out - receives the command, may be the same buffer as s
+ * @param size - the size of the output buffer
+ * @returns The length of the complete command, a value of size or more indicates truncation
+ */
+size_t unescape_ctrl_characters(const char *s, char *out, size_t size)
+{
+    const size_t prefix = sizeof(COMMAND_CTRL_PREFIX) - 1;
+    size_t length = 0;
+    while (*s != '\0')
+    {
+        char c = *s++;
+        if (c == '[' && strncmp(s, COMMAND_CTRL_PREFIX + 1, prefix - 1) == 0 && isalpha((unsigned char)s[prefix - 1]))
+        {
+            c = toupper((unsigned char)s[prefix - 1]) - 64;
+            s += prefix;
+                // the output never gets ahead of the input, so decoding in place is safe
+        }
+        if (length + 1 < size) out[length] = c;
+        length++;
+    }
+    if (size > 0) out[length < size ? length : size - 1] = '\0';
+    return length;
+}
@@ -0,0 +1,148 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef _COMMAND_STORE_H_
+#define _COMMAND_STORE_H_
+
+#include <atomic>
+#include <string_view>
+#include "Arduino.h"
+
+#define COMMAND_COUNT 12
+#define COMMAND_NAME_SIZE 25
+#define COMMAND_SIZE 129
+    // sizes include the terminating zero and match the input limits of the config page
+#define COMMAND_ARENA_SIZE 4096
+#define COMMAND_LINE_ENDING "\r\n"
+#define COMMAND_CTRL_PREFIX "[CTRL]+"
+#define COMMAND_ESCAPED_SIZE ((COMMAND_SIZE - 1) * (sizeof(COMMAND_CTRL_PREFIX) - 1 + 1) + 1)
+
+/**
+ * @brief The editable strings of a command slot. This is also the layout persisted in the config record.
+ */
+typedef struct
+{
+    char name_on[COMMAND_NAME_SIZE];
+    char command_on[COMMAND_SIZE];
+    char name_off[COMMAND_NAME_SIZE];
+    char command_off[COMMAND_SIZE];
+} command_slot_t;
+
+/**
+ * @brief Immutable set of commands packed into one arena. The alternate (off) strings fall back to 
+ * the primary ones when empty, which is resolved when the set is loaded, and every command is 
+ * stored with its line ending so a button press sends a single contiguous buffer. 
+ */
+class CommandSet
+{
+    public:
+        /**
+         * @brief Packs command slots into the arena
+         * @param slots - array of COMMAND_COUNT slots
+         */
+        void Load(const command_slot_t *slots);
+
+        /**
+         * @brief Gets the name shown for a command
+         * @param slot - the button index
+         * @param on - true for the primary command, false for the alternate one
+         * @returns The name
+         */
+        std::string_view Name(uint8_t slot, bool on) const { return view(slot, on ? 0 : 2, 0); }
+
+        /**
+         * @brief Gets a command without the line ending
+         * @param slot - the button index
+         * @param on - true for the primary command, false for the alternate one
+         * @returns The command
+         */
+        std::string_view Command(uint8_t slot, bool on) const { return view(slot, on ? 1 : 3, 0); }
+
+        /**
+         * @brief Gets a command including the line ending, ready to be sent
+         * @param slot - the button index
+         * @param on - true for the primary command, false for the alternate one
+         * @returns The command line
+         */
+        std::string_view Line(uint8_t slot, bool on) const { return view(slot, on ? 1 : 3, sizeof(COMMAND_LINE_ENDING) - 1); }
+
+    private:
+        /**
+         * @brief Gets a string of the arena
+         * @param slot - the button index
+         * @param field - the field, 0 to 3 in the order of command_slot_t
+         * @param extra - number of bytes following the string to include
+         * @returns The string
+         */
+        std::string_view view(uint8_t slot, uint8_t field, uint8_t extra) const 
+        { 
+            return std::string_view(_arena + _offset[slot][field], _length[slot][field] + extra); 
+        }
+
+        uint16_t _offset[COMMAND_COUNT][4] = {};
+        uint8_t _length[COMMAND_COUNT][4] = {};
+        char _arena[COMMAND_ARENA_SIZE] = {};
+};
+
+/**
+ * @brief Double buffered command store. The reader (the button task) acquires the active set 
+ * without taking a lock; a writer loads the inactive set and publishes it with a pointer swap,
+ * so new commands take effect with the next button press. 
+ */
+class CommandStore
+{
+    public:
+        /**
+         * @brief Creates a new command store
+         * @param slots - array of COMMAND_COUNT slots with the initial commands
+         */
+        CommandStore(const command_slot_t *slots);
+
+        /**
+         * @brief Gets the active set. Only one reader may hold the set at a time and it must 
+         * call Release when done.
+         * @returns The command set
+         */
+        const CommandSet *Acquire();
+
+        /**
+         * @brief Releases the set obtained with Acquire
+         */
+        void Release();
+
+        /**
+         * @brief Publishes a new set of commands. Blocks while the reader still holds the 
+         * set that is to be reused. 
+         * @param slots - array of COMMAND_COUNT slots
+         */
+        void Publish(const command_slot_t *slots);
+
+    private:
+        CommandSet _sets[2];
+        std::atomic<CommandSet *> _active;
+        std::atomic<CommandSet *> _in_use;
+        SemaphoreHandle_t _publish_mutex = NULL;
+};
+
+/**
+ * @brief Replaces the control characters 0x01 to 0x1a with [CTRL]+<letter> for display in the 
+ * config page. Runs in linear time and does not allocate; the output is always terminated and a 
+ * truncated output never ends in a partial sequence. 
+ * @param s - the command
+ * @param out - receives the escaped command
+ * @param size - the size of the output buffer, COMMAND_ESCAPED_SIZE holds any command
+ * @returns The length of the complete escaped command, a value of size or more indicates truncation
+ */
+size_t escape_ctrl_characters(const char *s, char *out, size_t size);
+
+/**
+ * @brief Replaces [CTRL]+<letter> sequences with the control character. A sequence not followed
+ * by a letter is copied as is. Runs in linear time and does not allocate.
+ * @param s - the escaped command
+ * @param out - receives the command, may be the same buffer as s
+ * @param size - the size of the output buffer
+ * @returns The length of the complete command, a value of size or more indicates truncation
+ */
+size_t unescape_ctrl_characters(const char *s, char *out, size_t size);
+
+#endif
@@ -0,0 +1,191 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <Arduino.h>
+#include "selector.h"
+#include "wheel.h"
+#include "../logging/SerialLogger.h"
+#include "../tasks/task_plan.h"
+
+static const Axis axes[] = {Axis::X, Axis::Y, Axis::Z};
+static const float feeds[] = {Feed::NANO, Feed::MICRO, Feed::MILLI, Feed::FULL};
+
+/**
+ * @brief Reads the initial position of both switches
+ * @param inputs - the debounced inputs of the expander, 1 = active
+ * @returns The initial state
+ */
+selector_state_t Selector::begin(uint16_t inputs)
+{
+    int axis = read_axis();
+    int feed = resolve_feed(inputs);
+    _packed.store((feed < 0 ? 0 : feed) << 2 | (axis < 0 ? 0 : axis));
+        // a switch between two positions starts out at X and the finest feed
+    return this->get();
+}
+
+/**
+ * @brief Starts the task debouncing the axis switch
+ */
+void Selector::start()
+{
+    Tasks.Create(TASK_SELECTOR, Selector::sampler, this, &_task);
+}
+
+/**
+ * @brief Wakes the selector task. Called from the interrupt of the axis switch pins.
+ */
+void IRAM_ATTR Selector::notify_from_isr()
+{
+    if(_task == NULL) return;
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(_task, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+/**
+ * @brief Updates the feed from the debounced inputs of the expander
+ * @param inputs - the inputs, 1 = active
+ */
+void Selector::set_inputs(uint16_t inputs)
+{
+    int feed = resolve_feed(inputs);
+    if(feed < 0) _invalid++;
+    else this->publish(-1, feed);
+}
+
+/**
+ * @brief Registers a handler for selection changes. Handlers run on the task that
+ * detected the change and must not block. Register before start.
+ * @param handler - the handler
+ */
+void Selector::on_change(selector_handler_t handler)
+{
+    if(_handler_count == SELECTOR_HANDLERS)
+    {
+        Logger.Error(F("Too many selector handlers"));
+        return;
+    }
+    _handlers[_handler_count++] = handler;
+}
+
+/**
+ * @brief Gets the current selection
+ * @returns The selection
+ */
+selector_state_t Selector::get() const
+{
+    return unpack(_packed.load());
+}
+
+/**
+ * @brief Writes the selection and the debounce statistics
+ * @param out - the output to write to
+ */
+void Selector::print(Print &out) const
+{
+    selector_state_t state = this->get();
+    out.printf("Selection:   axis %c, feed %.3f, %u changes\n", (char)state.axis, state.feed, state.sequence);
+    out.printf("Debounce:    %u wakeups, %u samples settling, %u times between positions\n", _wakeups, _settle_samples, _invalid);
+}
+
+/**
+ * @brief Task function debouncing the axis switch
+ * @param args - pointer to the Selector instance
+ */
+void Selector::sampler(void* args)
+{
+    Selector *_this = reinterpret_cast<Selector *>(args);
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        _this->_wakeups++;
+        int axis = read_axis();
+        for(int stable=1; stable < SELECTOR_STABLE_SAMPLES; )
+        {
+            vTaskDelay(pdMS_TO_TICKS(SELECTOR_SAMPLE_MS));
+            int sample = read_axis();
+            _this->_settle_samples++;
+            if(sample == axis) stable++;
+            else
+            {
+                axis = sample;
+                stable = 1;
+            }
+        }
+
+        // the edges of the bounce are covered by the samples, an edge after the last
+        // sample starts another round
+        ulTaskNotifyTake(pdTRUE, 0);
+        if(read_axis() != axis) xTaskNotifyGive(_this->_task);
+
+        if(axis < 0) _this->_invalid++;
+        else _this->publish(axis, -1);
+    }
+}
+
+/**
+ * @brief Reads the axis switch
+ * @returns The index of the selected axis, -1 if not exactly one position is active
+ */
+int Selector::read_axis()
+{
+    int x = digitalRead(AXIS_X) == LOW;
+    int y = digitalRead(AXIS_Y) == LOW;
+    int z = digitalRead(AXIS_Z) == LOW;
+    if(x + y + z != 1) return -1;
+    return x ? 0 : (y ? 1 : 2);
+}
+
+/**
+ * @brief Resolves the feed switch
+ * @param inputs - the inputs of the expander, 1 = active
+ * @returns The index of the selected feed, -1 if several positions are active
+ */
+int Selector::resolve_feed(uint16_t inputs)
+{
+    switch((inputs & SELECTOR_FEED_MASK) >> SELECTOR_FEED_SHIFT)
+    {
+        case 0x0: return 0;
+        case 0x4: return 1;
+        case 0x2: return 2;
+        case 0x1: return 3;
+        default: return -1;
+    }
+}
+
+/**
+ * @brief Stores a new selection and calls the handlers if it changed
+ * @param axis - the index of the axis, -1 to keep it
+ * @param feed - the index of the feed, -1 to keep it
+ */
+void Selector::publish(int axis, int feed)
+{
+    uint32_t packed = _packed.load();
+    uint32_t next;
+    do
+    {
+        uint32_t a = axis < 0 ? (packed & 0x3) : axis;
+        uint32_t f = feed < 0 ? (packed >> 2 & 0x3) : feed;
+        if(a == (packed & 0x3) && f == (packed >> 2 & 0x3)) return;
+        next = ((packed >> 16) + 1) << 16 | f << 2 | a;
+    } while(!_packed.compare_exchange_weak(packed, next));
+        // the axis and the feed are published from different tasks
+
+    selector_state_t state = unpack(next);
+    for(uint8_t i=0; i < _handler_count; i++) _handlers[i](state);
+}
+
+/**
+ * @brief Unpacks a selection word
+ * @param packed - the word
+ * @returns The selection
+ */
+selector_state_t Selector::unpack(uint32_t packed)
+{
+    selector_state_t state;
+    state.axis = axes[packed & 0x3];
+    state.feed = feeds[packed >> 2 & 0x3];
+    state.sequence = packed >> 16;
+    return state;
+}
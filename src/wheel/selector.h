@@ -0,0 +1,141 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef _SELECTOR_H_
+#define _SELECTOR_H_
+
+#include <atomic>
+#include <functional>
+#include "Arduino.h"
+#include "../display/display_wheel.h"
+
+#define SELECTOR_HANDLERS 4
+#define SELECTOR_FEED_SHIFT 12
+    // the feed switch is on P12 to P14 of the expander, none active selects the finest feed
+#define SELECTOR_FEED_MASK (0x7 << SELECTOR_FEED_SHIFT)
+
+#ifndef SELECTOR_SAMPLE_MS
+#define SELECTOR_SAMPLE_MS 5
+#endif
+
+#ifndef SELECTOR_STABLE_SAMPLES
+#define SELECTOR_STABLE_SAMPLES 4
+    // the axis switch has to read the same position this many samples in a row, so about 20ms
+#endif
+
+/**
+ * @brief A consistent snapshot of both selector switches
+ */
+typedef struct
+{
+    Axis axis;
+    float feed;
+    uint16_t sequence;      // counts the changes, wraps
+} selector_state_t;
+
+typedef std::function<void(const selector_state_t &state)> selector_handler_t;
+
+/**
+ * @brief Owns the axis and the feed selector switches. The axis switch is on three GPIOs and is
+ * debounced by the selector task, the feed switch is on the expander and arrives debounced by
+ * the button engine. A switch between two positions reads as no or several positions and keeps
+ * the last valid state. Both switches are kept in a single word, so readers always see an axis
+ * and a feed that belong together, and every change is handed to the registered handlers.
+ */
+class Selector
+{
+    public:
+        /**
+         * @brief Reads the initial position of both switches
+         * @param inputs - the debounced inputs of the expander, 1 = active
+         * @returns The initial state
+         */
+        selector_state_t begin(uint16_t inputs);
+
+        /**
+         * @brief Starts the task debouncing the axis switch
+         */
+        void start();
+
+        /**
+         * @brief Wakes the selector task. Called from the interrupt of the axis switch pins.
+         */
+        void IRAM_ATTR notify_from_isr();
+
+        /**
+         * @brief Updates the feed from the debounced inputs of the expander
+         * @param inputs - the inputs, 1 = active
+         */
+        void set_inputs(uint16_t inputs);
+
+        /**
+         * @brief Registers a handler for selection changes. Handlers run on the task that
+         * detected the change and must not block. Register before start.
+         * @param handler - the handler
+         */
+        void on_change(selector_handler_t handler);
+
+        /**
+         * @brief Gets the current selection
+         * @returns The selection
+         */
+        selector_state_t get() const;
+
+        /**
+         * @brief Gets the sequence of the current selection. Callable from interrupt handlers.
+         * @returns The sequence
+         */
+        inline uint16_t sequence() const { return _packed.load() >> 16; }
+
+        /**
+         * @brief Writes the selection and the debounce statistics
+         * @param out - the output to write to
+         */
+        void print(Print &out) const;
+
+    private:
+        /**
+         * @brief Task function debouncing the axis switch
+         * @param args - pointer to the Selector instance
+         */
+        static void sampler(void* args);
+
+        /**
+         * @brief Reads the axis switch
+         * @returns The index of the selected axis, -1 if not exactly one position is active
+         */
+        static int read_axis();
+
+        /**
+         * @brief Resolves the feed switch
+         * @param inputs - the inputs of the expander, 1 = active
+         * @returns The index of the selected feed, -1 if several positions are active
+         */
+        static int resolve_feed(uint16_t inputs);
+
+        /**
+         * @brief Stores a new selection and calls the handlers if it changed
+         * @param axis - the index of the axis, -1 to keep it
+         * @param feed - the index of the feed, -1 to keep it
+         */
+        void publish(int axis, int feed);
+
+        /**
+         * @brief Unpacks a selection word
+         * @param packed - the word
+         * @returns The selection
+         */
+        static selector_state_t unpack(uint32_t packed);
+
+        TaskHandle_t _task = NULL;
+        std::atomic<uint32_t> _packed{0};
+            // bits 0-1 axis, bits 2-3 feed, bits 16-31 sequence
+        selector_handler_t _handlers[SELECTOR_HANDLERS];
+        uint8_t _handler_count = 0;
+
+        uint32_t _wakeups = 0;
+        uint32_t _settle_samples = 0;
+        uint32_t _invalid = 0;
+};
+
+#endif
@@ -26,79 +26,72 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <FunctionalInterrupt.h>
 #include "wheel.h"
 #include "../logging/SerialLogger.h"
+#include "../diagnostics/diagnostics.h"
+#include "../diagnostics/boot_profiler.h"
+#include "../journal/event_journal.h"
+#include "../trace/isr_trace.h"
+#include "../config/live_state.h"
+#include "../macro/macro_engine.h"
+#include "../serial/serial_tx.h"
+#include "../tasks/task_plan.h"
+#include "soc/gpio_reg.h"
 
 bool Wheel::_key_changed = false;
 static Wheel *_instance = nullptr;
 
 /**
- * @brief Map containing the available commands for the CNC router 
+ * @brief Copies a string of the command set into a terminated buffer for the display
+ * @param s - the string
+ * @param buf - receives the string
+ * @param size - the size of the buffer, longer strings are cut
+ * @returns The buffer
  */
-std::unordered_map<uint8_t, Command_t>Wheel::Commands = {
-    {0, {"Zero Z", "G92 Z0 ; Zero Z Axis", "", ""}},
-    {1, {"Zero XY", "G92 X0Y0 ; Zero XY", "", ""}},
-    {2, {"Probe Z", "G4 P3;G21G91G38.2Z-30F80; G0Z1; G38.2Z-2F10;\n    G92 Z0; G0Z5M30 ; Probe Z", "", ""}},
-    {3, {"Homing", "$H ; Homing cycle", "", ""}},
-    {4, {"Restore Origin", "G21 G53G90G0X1.204Y18.879Z-14.3 G92X236.57Y169.408Z22.725 G0X0Y0; Rstore and go to WCS origin", "", ""}},
-    {5, {"Start Spindle", "M3 S6000 ; Start the spindle", "Stop Spindle", "M5; Stop the spindle"}},
-    {6, {"Reset", String((char)0x18) + "; Reset the machine", "", ""}},
-    {7, {"Unlock", "$X; Unlock the machine", "", ""}},
-    {8, {"NA", "; Command 9 not defined", "", ""}},
-    {9, {"NA", "; Command 10 not defined", "", ""}},
-    {10, {"NA", "; Command 11 not defined", "", ""}},
-    {11, {"NA", "; Command 12 not defined", "", ""}}    
-};
-
-String Command_t::escape_ctrl_characters(const String& s)
+static const char *terminated(std::string_view s, char *buf, size_t size)
 {
-    String result = ""; 
-    int length = s.length(); 
-    for (int i = 0; i < length; ++i) 
-    { 
-        if (s[i] >= 1 && s[i] <= 26) 
-        { 
-            char cc = s[i] + 64; 
-            result += "[CTRL]+" + String(cc); 
-        }
-        else 
-        { 
-            result += s[i]; 
-        } 
-    } 
-    return result;
-}
-    
-String Command_t::unescape_ctrl_characters(const String& s)
-{
-    String result = ""; 
-    int length = s.length(); 
-    for (int i = 0; i < length; ++i) 
-    { 
-        if (s[i] == '[' && s.substring(i, i + 7) == "[CTRL]+") 
-        { 
-            char ctrlChar = toupper(s[i + 7]) - 64; 
-            result += ctrlChar; 
-            i += 7;                 // Skip over "[CTRL]+" sequence 
-        } 
-        else 
-        { 
-            result += s[i]; 
-        } 
-    } 
-    return result; 
+    size_t n = s.size() < size ? s.size() : size - 1;
+    memcpy(buf, s.data(), n);
+    buf[n] = '\0';
+    return buf;
 }
 
+/**
+ * @brief The commands used until the configuration is loaded
+ */
+const command_slot_t Wheel::DefaultCommands[COMMAND_COUNT] = {
+    {"Zero Z", "G92 Z0 ; Zero Z Axis", "", ""},
+    {"Zero XY", "G92 X0Y0 ; Zero XY", "", ""},
+    {"Probe Z", "G4 P3;G21G91G38.2Z-30F80; G0Z1; G38.2Z-2F10;\n    G92 Z0; G0Z5M30 ; Probe Z", "", ""},
+    {"Homing", "$H ; Homing cycle", "", ""},
+    {"Restore Origin", "G21 G53G90G0X1.204Y18.879Z-14.3 G92X236.57Y169.408Z22.725 G0X0Y0; Rstore and go to WCS origin", "", ""},
+    {"Start Spindle", "M3 S6000 ; Start the spindle", "Stop Spindle", "M5; Stop the spindle"},
+    {"Reset", "\x18; Reset the machine", "", ""},
+    {"Unlock", "$X; Unlock the machine", "", ""},
+    {"NA", "; Command 9 not defined", "", ""},
+    {"NA", "; Command 10 not defined", "", ""},
+    {"NA", "; Command 11 not defined", "", ""},
+    {"NA", "; Command 12 not defined", "", ""}
+};
+
+/**
+ * @brief The commands for the CNC router, replaced at runtime when the configuration changes
+ */
+CommandStore Wheel::Commands(Wheel::DefaultCommands);
 
 /**
  * @brief Creates a new instance of Wheel
+ * @param spi_write_frequency - the display SPI write clock, 0 to calibrate the bus
+ * @param spi_read_frequency - the display SPI read clock, 0 to calibrate the bus
  */
-Wheel::Wheel()
+Wheel::Wheel(uint32_t spi_write_frequency, uint32_t spi_read_frequency)
 {
+    // the inputs and the tasks sending to the host come up first, the display is initialized
+    // by the display task in the background.
+    int64_t start = Boot.Now();
     Logger.Info(F("Startup"));
-    Logger.Info(F("....Initialize Display"));
+    _instance = this;
     _display = new DISPLAY_Wheel();
+    _display->set_bus_frequency(spi_write_frequency, spi_read_frequency);
     _display->set_rotation(3);
-    _display->init();
-    _instance = this;
 
     Logger.Info(F("....Inititialize GPIO pins"));
     pinMode(AXIS_Z, INPUT_PULLUP);
@@ -110,143 +103,181 @@ Wheel::Wheel()
     pinMode(TOUCH_CS, OUTPUT);
     digitalWrite(TOUCH_CS, HIGH);
 
+    Logger.Info(F("....Initialize GPIO Multiplexer"));
+    pinMode(PCF8575_INT_PIN, INPUT_PULLUP);
+    _buttons = new ButtonEngine(PCF8575_ADDRESS);
+    uint16_t inputs = _buttons->begin();
+
+    Logger.Info("....Initializing Axis and Feed Values");  
+    _selector = new Selector();
+    _selector->begin(inputs);
+    _selector->on_change([this](const selector_state_t &state) { this->on_selection(state); });
+    _has_emergency = _feed_hold = digitalRead(EMS);
+    Boot.Phase("inputs", start);
+
+    Logger.Info(F("....Generating Mutexes"));
+    _display_mutex = xSemaphoreCreateBinary();
+        // given by the display task once the display is initialized
+
+    start = Boot.Now();
+    Logger.Info("....Create various tasks");
+    _buttons->start();
+    Tasks.Create(TASK_GPIO_WATCHER, extended_GPIO_watcher, this, &_extendedGPIOWatcher);
+    Tasks.Create(TASK_WHEEL, wheel_runner, this, &_wheelRunner);
+    Tasks.Create(TASK_EMS, ems_change_runner, this, &_emsChangeRunner);
+    Tasks.Create(TASK_DISPLAY, display_runner, this, &_displayRunner);
+    _selector->start();
+#if BOOT_SEQUENTIAL
+    this->wait_for_display();
+        // the baseline order, the inputs only went live once the display was initialized
+#endif
+
     Logger.Info(F("....Attach event receivers for GPIO"));
-    attachInterrupt(digitalPinToInterrupt(AXIS_X), std::bind(&Wheel::handle_axis_change, this), FALLING);
-    attachInterrupt(digitalPinToInterrupt(AXIS_Y), std::bind(&Wheel::handle_axis_change, this), FALLING);
-    attachInterrupt(digitalPinToInterrupt(AXIS_Z), std::bind(&Wheel::handle_axis_change, this), FALLING);
+    attachInterrupt(digitalPinToInterrupt(PCF8575_INT_PIN), Wheel::on_PCF8575_input_changed, FALLING);
+    attachInterrupt(digitalPinToInterrupt(AXIS_X), std::bind(&Wheel::handle_axis_change, this), CHANGE);
+    attachInterrupt(digitalPinToInterrupt(AXIS_Y), std::bind(&Wheel::handle_axis_change, this), CHANGE);
+    attachInterrupt(digitalPinToInterrupt(AXIS_Z), std::bind(&Wheel::handle_axis_change, this), CHANGE);
     attachInterrupt(digitalPinToInterrupt(EMS), std::bind(&Wheel::handle_ems_change, this), CHANGE);
     attachInterrupt(digitalPinToInterrupt(WHEEL_A), std::bind(&Wheel::handle_encoder_change, this), CHANGE); 
     attachInterrupt(digitalPinToInterrupt(WHEEL_B), std::bind(&Wheel::handle_encoder_change, this), CHANGE);
+    Boot.Phase("wheel tasks", start);
+    Boot.Milestone("jog ready");
 
-    Logger.Info(F("....Initialize GPIO Multiplexer"));
-    _pcf8575 = new PCF8575(PCF8575_ADDRESS, PCF8575_INT_PIN, Wheel::on_PCF8575_input_changed);
-    for(int i=0; i<16; i++) _pcf8575->pinMode(i, INPUT);
-    _pcf8575->begin();
-    PCF8575::DigitalInput di = _pcf8575->digitalReadAll();
-    if(!di.p12) _selected_feed = Feed::FULL;
-    else if(!di.p13) _selected_feed = Feed::MILLI;
-    else if(!di.p14) _selected_feed = Feed::MICRO;
-    else _selected_feed = Feed::NANO;
+    Diag.Register("display", "Display bus statistics and frame time histogram, 'reset' to clear", [](Print &out, const String &args) {
+        if(args == "reset") 
+        {
+            DisplayMetrics.reset();
+            out.println(F("Display statistics reset"));
+        }
+        else DisplayMetrics.print(out);
+    });
 
-    Logger.Info("....Initializing Axis and Feed Values");  
-    if(!digitalRead(AXIS_X)) _selected_axis = Axis::X;
-    else if(!digitalRead(AXIS_Y)) _selected_axis = Axis::Y;
-    else if(!digitalRead(AXIS_Z)) _selected_axis = Axis::Z;  
-    _has_emergency = digitalRead(EMS);
+    Diag.Register("buttons", "Button expander reads and events", [](Print &out, const String &args) {
+        _instance->_buttons->print(out);
+    });
 
-    Logger.Info(F("....Generating Mutexes"));
-    _display_mutex = xSemaphoreCreateBinary();  xSemaphoreGive(_display_mutex);
+    Diag.Register("selector", "Axis and feed selection and switch debouncing", [](Print &out, const String &args) {
+        _instance->_selector->print(out);
+    });
 
-    Logger.Info("....Create various tasks");
-    xTaskCreatePinnedToCore(extended_GPIO_watcher, "extendedGPIOWatcher", 2048, this, 1, &_extendedGPIOWatcher, 0);
-    xTaskCreatePinnedToCore(display_runner, "displayRunner", 8192, this, 1, &_displayRunner, 0);
-    xTaskCreatePinnedToCore(wheel_runner, "wheelRunner", 2048, this, 1, &_wheelRunner, 0);
-    xTaskCreatePinnedToCore(ems_change_runner, "emsRunner", 2048, this, 1, &_emsChangeRunner, 0);
+    Diag.Register("trace", "Interrupt trace for tools/isr_trace, 'clear' to discard", [](Print &out, const String &args) {
+        if(args == "clear") 
+        {
+            Trace.Clear();
+            out.println(F("Interrupt trace cleared"));
+        }
+        else Trace.Dump(out);
+    });
 
     Logger.Info("Startup done");
 }
 
+/**
+ * @brief Gets the SPI clock used to read from the display
+ * @returns The read clock in Hz
+ */
+uint32_t Wheel::get_display_read_frequency() const
+{
+    return _display->get_read_frequency();
+}
+
+/**
+ * @brief Gets the SPI clock used to write to the display
+ * @returns The write clock in Hz
+ */
+uint32_t Wheel::get_display_write_frequency() const
+{
+    return _display->get_write_frequency();
+}
+
+/**
+ * @brief Gets the current wheel state
+ * @param state - receives the state
+ */
+void Wheel::get_state(wheel_state_t &state) const
+{
+    selector_state_t selection = _selector->get();
+    state.axis = selection.axis;
+    state.feed = selection.feed;
+    state.x = _x;
+    state.y = _y;
+    state.z = _z;
+    state.emergency = _has_emergency;
+}
+
+/**
+ * @brief Waits until the display task has initialized the display
+ */
+void Wheel::wait_for_display()
+{
+    if (xSemaphoreTake(_display_mutex, portMAX_DELAY) == pdTRUE) xSemaphoreGive(_display_mutex);
+}
+
 /**
  * @brief Event handler handling input change events on the PCF8575 
  */
 void Wheel::on_PCF8575_input_changed()
 {
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    vTaskNotifyGiveFromISR(_instance->_extendedGPIOWatcher, &xHigherPriorityTaskWoken); 
-    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    ISR_TRACE(TRACE_PCF8575, TRACE_FLAG_NOTIFY, trace_pins());
+    _instance->_buttons->notify_from_isr();
 }
 
 /**
- * @brief Task function to process changes to the inputs on the PCF8575
- * GPIO extender. This funtions runs an endless blocking loop, waiting for notification 
- * from on_PCF8575_input_changed upon which it evaluates the inputs and performs
- * the appropriate actions. 
+ * @brief Task function processing the events of the buttons and the feed selector on the 
+ * PCF8575 GPIO extender. This funtions runs an endless blocking loop, waiting for events 
+ * from the button engine upon which it performs the appropriate actions. 
  * @param args - pointer to task arguments
  */
 void Wheel::extended_GPIO_watcher(void* args)
 {
     Wheel *_this = reinterpret_cast<Wheel *>(args);
+    uint16_t pending = 0;
+        // pressed buttons with a long press or chord program, they act when released unless
+        // the long press or chord ran a program
+    button_event_t event;
     for (;;) 
     { 
-        // Wait for the notification to come from the event handler
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        PCF8575::DigitalInput di = _this->_pcf8575->digitalReadAll();
-        if(!di.p12) _this->_selected_feed = Feed::FULL;
-        else if(!di.p13) _this->_selected_feed = Feed::MILLI;
-        else if(!di.p14) _this->_selected_feed = Feed::MICRO;
-        else _this->_selected_feed = Feed::NANO;
-
-        if(!(di.p0 & di.p1 & di.p2 & di.p3 & di.p4 & di.p5 & di.p6 & di.p7 & di.p8 & di.p9 & di.p10 & di.p11))
+        if(!_this->_buttons->receive(event)) continue;
+        uint16_t bit = 1 << event.button;
+        switch(event.type)
         {
-            uint16_t button_state = 0xf000;
-            button_state |= (di.p0 & 0x01) << 0; 
-            button_state |= (di.p1 & 0x01) << 1; 
-            button_state |= (di.p2 & 0x01) << 2; 
-            button_state |= (di.p3 & 0x01) << 3; 
-            button_state |= (di.p4 & 0x01) << 4; 
-            button_state |= (di.p5 & 0x01) << 5; 
-            button_state |= (di.p6 & 0x01) << 6; 
-            button_state |= (di.p7 & 0x01) << 7; 
-            button_state |= (di.p8 & 0x01) << 8; 
-            button_state |= (di.p9 & 0x01) << 9; 
-            button_state |= (di.p10 & 0x01) << 10; 
-            button_state |= (di.p11 & 0x01) << 11; 
-            if(button_state != _this->_button_state)
+            case BUTTON_INPUTS:
+                _this->_selector->set_inputs(event.inputs);
+                break;
+            case BUTTON_PRESS:
+                if(Macros.Binds(event.button)) pending |= bit;
+                else _this->on_button(event.button);
+                break;
+            case BUTTON_RELEASE:
+                if(!(pending & bit)) break;
+                pending &= ~bit;
+                _this->on_button(event.button);
+                break;
+            case BUTTON_LONG_PRESS:
+                if(!(pending & bit) || !Macros.Has(MACRO_PROGRAM_LONG(event.button))) break;
+                pending &= ~bit;
+                _this->on_program(MACRO_PROGRAM_LONG(event.button), event.button);
+                break;
+            case BUTTON_CHORD:
             {
-                _this->_button_state = button_state;
-                for(int i=0; i<12; i++)
-                {
-                    if(!(button_state & (1<<i)))
-                    {
-                        String n, c;
-                        if(_this->_command_state & (1<<i))
-                        {
-                            n = Commands[i]._name_off == "" ? Commands[i]._name_on : Commands[i]._name_off;
-                            c = Commands[i]._command_off == "" ? Commands[i]._command_on : Commands[i]._command_off;
-                        }
-                        else
-                        {
-                            n = Commands[i]._name_on;
-                            c = Commands[i]._command_on;
-                        }
-                        _this->_button_state |= (1 << i); 
-
-                        if(!_this->_has_emergency)
-                        {
-                            // write command to serial
-                            Serial.println(c);
-                            Serial.flush();
-                            _this->_command_state ^= (1 << i);
-
-                            // update display
-                            if (xSemaphoreTake(_this->_display_mutex, portMAX_DELAY) == pdTRUE) 
-                            {
-                                _this->_display->w_area_print(c, 0xffff, true); 
-                                _this->_display->write_command(n); 
-                                xSemaphoreGive(_this->_display_mutex);
-                            }
-                        }
-                        else
-                        {
-                            // update display
-                            if (xSemaphoreTake(_this->_display_mutex, portMAX_DELAY) == pdTRUE) 
-                            {
-                                _this->_display->w_area_print("Handwheel in Emergency Shutdown. Release \n     EMS button to continue operations.", 0xf800 ,true); 
-                                _this->_display->write_command("Emergency Shutdown Engaged"); 
-                                xSemaphoreGive(_this->_display_mutex);
-                            }
-                        }
-                    }
-                } 
+                int program = event.button < event.second ? 
+                    MACRO_PROGRAM_CHORD(event.button, event.second) : MACRO_PROGRAM_CHORD(event.second, event.button);
+                if(!Macros.Has(program)) break;
+                pending &= ~(bit | 1 << event.second);
+                _this->on_program(program, event.button);
+                break;
             }
+            default:
+                break;
         }
     }
 }
 
 /**
  * @brief Task function managing changes from the EMS button. This task runs an endless 
- * blocking loop, waiting for notification from handle_ems_change for perform the appropriate
- * action
+ * blocking loop, waiting for notification from handle_ems_change. The interrupt has already
+ * sent the feed hold; once the switch has settled the task either resets the machine or, 
+ * if the edge was a glitch, releases the hold again.
  * @param args - pointer to task arguments 
  */
 void Wheel::ems_change_runner(void* args)
@@ -255,20 +286,45 @@ void Wheel::ems_change_runner(void* args)
     for (;;)
     { 
         // Wait for the notification to come from the event handler
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        vTaskDelay(100);
-        if(digitalRead(EMS) == _this->_has_emergency) continue;
-                // I have found the debouncing of the emergency switch
-                // to be not fully reliable, so this will ensure we do 
-                // not have a bounce....
+        uint32_t notifications = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        ISR_TRACE(TRACE_WAKE_EMS, 0, notifications);
+        vTaskDelay(pdMS_TO_TICKS(EMS_CONFIRM_MS));
+        if(ulTaskNotifyTake(pdTRUE, 0) != 0) 
+        {
+            // the switch is still bouncing, wait for it to settle
+            xTaskNotifyGive(_this->_emsChangeRunner);
+            continue;
+        }
+
+        bool engaged = digitalRead(EMS);
+        if(engaged == _this->_has_emergency)
+        {
+            if(!engaged && _this->_feed_hold)
+            {
+                // a glitch on the line, the hold sent by the interrupt is released again
+                Tx.Realtime('~');
+                _this->_feed_hold = false;
+                Logger.Error(F("Emergency stop glitch, feed hold released"));
+            }
+            continue;
+        }
         
-        _this->_has_emergency = !_this->_has_emergency;
+        _this->_has_emergency = engaged;
+        Journal.Record(JOURNAL_EMS, _this->_has_emergency ? 1 : 0);
+        Live.Notify();
+        xTaskNotify(_this->_displayRunner, DISPLAY_NOTIFY_EMERGENCY, eSetBits);
         if(_this->_has_emergency)
         {
-            Serial.write("!");
-            Serial.write(0x18); // [Ctrl+X]
-            Serial.write("\n");
-            if (xSemaphoreTake(_this->_display_mutex, portMAX_DELAY) == pdTRUE) 
+            // the interrupt normally sent the feed hold already, another one does no harm.
+            // queued jog lines must not follow the reset
+            _this->_feed_hold = true;
+            Macros.Cancel();
+                // before the discard, so the program does not queue its next line into the emptied lane
+            Tx.Discard();
+            Tx.Realtime('!');
+            Tx.Realtime(0x18); // [Ctrl+X]
+            Tx.Write("\n", 1);
+            if (_this->_display_ready && xSemaphoreTake(_this->_display_mutex, portMAX_DELAY) == pdTRUE) 
             {
                 _this->_display->w_area_print("Emergency Shutdown has been engaged.", 0xf800 ,true); 
                 xSemaphoreGive(_this->_display_mutex);
@@ -276,7 +332,8 @@ void Wheel::ems_change_runner(void* args)
         }
         else
         {
-            if (xSemaphoreTake(_this->_display_mutex, portMAX_DELAY) == pdTRUE) 
+            _this->_feed_hold = false;
+            if (_this->_display_ready && xSemaphoreTake(_this->_display_mutex, portMAX_DELAY) == pdTRUE) 
             {
                 _this->_display->w_area_print("Emergency shutdown has been released.", 0x07f0 ,true);
                 xSemaphoreGive(_this->_display_mutex); 
@@ -286,39 +343,61 @@ void Wheel::ems_change_runner(void* args)
 }
 
 /**
- * @brief Task function managing the display
+ * @brief Task function managing the display. After initializing the display the task sleeps
+ * until the selection, the position or the emergency state changes and redraws what changed.
  * @param args - pointer to task arguments
  */
 void Wheel::display_runner(void* args)
 {
     Wheel *_this = reinterpret_cast<Wheel *>(args);
+    int64_t start = Boot.Now();
+    Logger.Info(F("....Initialize Display"));
+    _this->_display->init();
+    char status[STATUS_MESSAGE_SIZE];
+    portENTER_CRITICAL(&_this->_status_lock);
+    _this->_display_ready = true;
+    memcpy(status, _this->_pending_status, sizeof(status));
+    portEXIT_CRITICAL(&_this->_status_lock);
+    if(status[0] != '\0') _this->_display->write_status("%s", status);
+    Boot.Phase("display", start);
+    xSemaphoreGive(_this->_display_mutex);
+
+    uint32_t events = DISPLAY_NOTIFY_ALL;
     for (;;) 
     { 
         if (xSemaphoreTake(_this->_display_mutex, portMAX_DELAY) == pdTRUE) 
         {
+            uint32_t frame_start = micros();
             int16_t cf = _this->_display->RGB_to_565(0x00, 0xff, 0x00);
             int16_t cb = _this->_display->RGB_to_565(0xff, 0x00, 0x00);
             int16_t cn = _this->_display->RGB_to_565(177,0,254);
             int16_t cback = _this->_display->RGB_to_565(177,0,254);
+            selector_state_t selection = _this->_selector->get();
             
-            _this->_display->write_axis(_this->_selected_axis);
-            _this->_display->write_feed(_this->_selected_feed);
-            _this->_display->write_emergency(_this->_has_emergency);
-            _this->_display->write_x(_this->_x);
-            _this->_display->write_y(_this->_y);
-            _this->_display->write_z(_this->_z);
+            if(events & DISPLAY_NOTIFY_SELECTION)
+            {
+                _this->_display->write_axis(selection.axis);
+                _this->_display->write_feed(selection.feed);
+            }
+            if(events & DISPLAY_NOTIFY_EMERGENCY) _this->_display->write_emergency(_this->_has_emergency);
+            if(events & DISPLAY_NOTIFY_POSITION)
+            {
+                _this->_display->write_x(_this->_x);
+                _this->_display->write_y(_this->_y);
+                _this->_display->write_z(_this->_z);
+            }
 
             if(_this->_direction == 1)
             {
-                _this->_display->draw_arrow(185, 14, Direction::RIGHT, 3, _this->_selected_axis == Axis::X ? cf : cn, cback);
-                _this->_display->draw_arrow(305, 14, Direction::DOWN, 3, _this->_selected_axis == Axis::Y ? cb : cn, cback);
-                _this->_display->draw_arrow(415, 14, Direction::UP, 3, _this->_selected_axis == Axis::Z ? cf : cn, cback);
+                _this->_display->draw_arrow(185, 14, Direction::RIGHT, 3, selection.axis == Axis::X ? cf : cn, cback);
+                _this->_display->draw_arrow(305, 14, Direction::DOWN, 3, selection.axis == Axis::Y ? cb : cn, cback);
+                _this->_display->draw_arrow(415, 14, Direction::UP, 3, selection.axis == Axis::Z ? cf : cn, cback);
             }
             else if(_this->_direction == -1)
             {
-                _this->_display->draw_arrow(185, 14, Direction::LEFT, 3, _this->_selected_axis == Axis::X ? cb : cn, cback);
-                _this->_display->draw_arrow(305, 14, Direction::UP, 3, _this->_selected_axis == Axis::Y ? cf : cn, cback);
-                _this->_display->draw_arrow(415, 14, Direction::DOWN, 3, _this->_selected_axis == Axis::Z ? cb : cn, cback);
+                _this->_display->draw_arrow(185, 14, Direction::LEFT, 3, selection.axis == Axis::X ? cb : cn, cback);
+                _this->_display->draw_arrow(305, 14, Direction::UP, 3, selection.axis == Axis::Y ? cf : cn, cback);
+                _this->_display->draw_arrow(415, 14, Direction::DOWN, 3, selection.axis == Axis::Z ? cb : cn, cback);
             }
             else
             {
@@ -326,20 +405,37 @@ void Wheel::display_runner(void* args)
                 _this->_display->draw_arrow(305, 14, Direction::UP, 3, cn, cback);
                 _this->_display->draw_arrow(415, 14, Direction::UP, 3, cn, cback);
             }
+            DISPLAY_STATS(record_frame(micros() - frame_start));
             xSemaphoreGive(_this->_display_mutex);
         }
-        vTaskDelay(10);
+
+        // changes arriving while a frame is drawn are collected into the next frame
+        xTaskNotifyWait(0, DISPLAY_NOTIFY_ALL, &events, portMAX_DELAY);
     }
 }
 
 /**
- * @brief Writes a status message to the display
+ * @brief Writes a status message to the display. Does not wait for the display while
+ * it initializes, the latest message is kept and shown once it is up.
  * @param format - the format string
  * @param ... - variable argument list  
  */
 void Wheel::write_status_message(const String &format, ...)
 {
     va_list args, copy;
+    if(this->_display != nullptr && !this->_display_ready)
+    {
+        // the network and macro tasks must not stall on the deferred display init
+        char status[STATUS_MESSAGE_SIZE];
+        va_start(args, format);
+        vsnprintf(status, sizeof(status), format.c_str(), args);
+        va_end(args);
+        portENTER_CRITICAL(&this->_status_lock);
+        bool ready = this->_display_ready;
+        if(!ready) memcpy(this->_pending_status, status, sizeof(status));
+        portEXIT_CRITICAL(&this->_status_lock);
+        if(!ready) return;
+    }
     if(this->_display != nullptr)
     { 
         if (xSemaphoreTake(this->_display_mutex, portMAX_DELAY) == pdTRUE) 
@@ -377,6 +473,116 @@ void Wheel::write_status_message(const String &format, ...)
     } 
 };
 
+/**
+ * @brief Sends the command of a button, or runs its program, and toggles the button
+ * @param slot - the zero based button
+ */
+void Wheel::on_button(uint8_t slot)
+{
+    const CommandSet *commands = Commands.Acquire();
+    // the alternate command is sent while the command is toggled on
+    bool on = !(_command_state & (1 << slot));
+    if(this->is_halted()) this->show_blocked(slot);
+    else if(Macros.Has(MACRO_PROGRAM(slot, on)))
+    {
+        // the program runs on the macro task, a press while it runs is ignored
+        bool started = Macros.Run(MACRO_PROGRAM(slot, on));
+        if(started) _command_state ^= (1 << slot);
+        Journal.Record(JOURNAL_COMMAND, slot, !started ? JOURNAL_COMMAND_BLOCKED : 
+            (_command_state & (1 << slot)) ? JOURNAL_COMMAND_ON : JOURNAL_COMMAND_OFF);
+        char name[COMMAND_NAME_SIZE];
+        this->show_program(MACRO_PROGRAM(slot, on), started, terminated(commands->Name(slot, on), name, sizeof(name)));
+    }
+    else
+    {
+        // write command to serial
+        std::string_view line = commands->Line(slot, on);
+        Tx.Write(line.data(), line.size());
+        _command_state ^= (1 << slot);
+        Journal.Record(JOURNAL_COMMAND, slot, (_command_state & (1 << slot)) ? JOURNAL_COMMAND_ON : JOURNAL_COMMAND_OFF);
+
+        // update display
+        if (_display_ready && xSemaphoreTake(_display_mutex, portMAX_DELAY) == pdTRUE) 
+        {
+            char command[COMMAND_SIZE];
+            char name[COMMAND_NAME_SIZE];
+            _display->w_area_print(terminated(commands->Command(slot, on), command, sizeof(command)), 0xffff, true); 
+            _display->write_command(terminated(commands->Name(slot, on), name, sizeof(name))); 
+            xSemaphoreGive(_display_mutex);
+        }
+    }
+    Commands.Release();
+}
+
+/**
+ * @brief Runs a long press or chord program
+ * @param program - the program
+ * @param slot - the zero based button, recorded in the journal
+ */
+void Wheel::on_program(int program, uint8_t slot)
+{
+    if(this->is_halted()) 
+    {
+        this->show_blocked(slot);
+        return;
+    }
+    bool started = Macros.Run(program);
+    if(!started) Journal.Record(JOURNAL_COMMAND, slot, JOURNAL_COMMAND_BLOCKED);
+    char name[MACRO_NAME_SIZE];
+    char text[MACRO_NAME_SIZE + 8];
+    MacroEngine::Name(program, name);
+    snprintf(text, sizeof(text), "Program %s", name);
+    this->show_program(program, started, text);
+}
+
+/**
+ * @brief Shows a started program, or that another program is still running
+ * @param program - the program
+ * @param started - true if the program was started
+ * @param name - the name shown as the command
+ */
+void Wheel::show_program(int program, bool started, const char *name)
+{
+    if (_display_ready && xSemaphoreTake(_display_mutex, portMAX_DELAY) == pdTRUE) 
+    {
+        char path[MACRO_PATH_SIZE];
+        MacroEngine::Path(program, path);
+        _display->w_area_print(started ? path : "Another program is running.", started ? 0xffff : 0xf800, true); 
+        _display->write_command(name); 
+        xSemaphoreGive(_display_mutex);
+    }
+}
+
+/**
+ * @brief Shows that a button is blocked by the emergency stop
+ * @param slot - the zero based button, recorded in the journal
+ */
+void Wheel::show_blocked(uint8_t slot)
+{
+    Journal.Record(JOURNAL_COMMAND, slot, JOURNAL_COMMAND_BLOCKED);
+    if (_display_ready && xSemaphoreTake(_display_mutex, portMAX_DELAY) == pdTRUE) 
+    {
+        _display->w_area_print("Handwheel in Emergency Shutdown. Release \n     EMS button to continue operations.", 0xf800 ,true); 
+        _display->write_command("Emergency Shutdown Engaged"); 
+        xSemaphoreGive(_display_mutex);
+    }
+}
+
+/**
+ * @brief Handles a change of the axis or feed selection: drops the partial encoder
+ * step and the direction taken for the previous selection and updates the display
+ * @param state - the new selection
+ */
+void Wheel::on_selection(const selector_state_t &state)
+{
+    portENTER_CRITICAL(&_encoder_lock);
+    _direction = 0;
+    _encoder_count = 0;
+    portEXIT_CRITICAL(&_encoder_lock);
+    Live.Notify();
+    if(_displayRunner != NULL) xTaskNotify(_displayRunner, DISPLAY_NOTIFY_SELECTION, eSetBits);
+}
+
 /**
  * @brief Formats a string, essentially a wrapper for vnsprintf
  * @param format - format string
@@ -412,75 +618,80 @@ void Wheel::wheel_runner(void* args)
     Wheel *_this = reinterpret_cast<Wheel *>(args);
     for (;;) 
     { 
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t notifications = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        ISR_TRACE(TRACE_WAKE_WHEEL, 0, notifications);
+
+        // the step is only taken for the selection it was made with, a step made before
+        // the axis or feed changed is dropped
+        portENTER_CRITICAL(&_this->_encoder_lock);
+        int8_t direction = _this->_direction;
+        uint16_t sequence = _this->_direction_sequence;
+        portEXIT_CRITICAL(&_this->_encoder_lock);
+        selector_state_t selection = _this->_selector->get();
+        if(direction == 0 || selection.sequence != sequence) continue;
 
         // this section is executed for every wheel position change.
         // To tranlsate into the CNC command, we need to use feed and axis
-        switch(_this->_selected_axis)
+        switch(selection.axis)
         {
             case Axis::X:
-                _this->_x += _this->_selected_feed * _this->_direction;
+                _this->_x += selection.feed * direction;
                 break;
             case Axis::Y:
-                _this->_y += _this->_selected_feed * _this->_direction;
+                _this->_y += selection.feed * direction;
                 break;
             case Axis::Z:
-                _this->_z += _this->_selected_feed * _this->_direction;
+                _this->_z += selection.feed * direction;
                 break;             
         }
+        Live.Notify();
+        xTaskNotify(_this->_displayRunner, DISPLAY_NOTIFY_POSITION, eSetBits);
         
-        if(!_this->_has_emergency)
+        // the feed hold may still be unconfirmed, a jog sent now would run if it is released
+        if(!_this->_has_emergency && !_this->_feed_hold)
         {
-            String s = _this->format_string("G21G91%c%c%fF2000", 
-                (char)_this->_selected_axis,
-                _this->_direction == -1 ? '-': '+' ,
-                _this->_selected_feed);
-            Serial.println(s);
+            char line[48];
+            int length = snprintf(line, sizeof(line), "G21G91%c%c%fF2000\r\n", 
+                (char)selection.axis,
+                direction == -1 ? '-': '+' ,
+                selection.feed);
+            Tx.Write(line, length);
+            Boot.FirstJog();
         }
     }
 }
 
 /**
- * @brief Event handler monitoring the Emergency Shutdown Button 
+ * @brief Event handler monitoring the Emergency Shutdown Button. An engaging edge writes
+ * the feed hold straight into the UART, the EMS task confirms or releases it.
  */
 void IRAM_ATTR Wheel::handle_ems_change()
 {
-    volatile unsigned long lastDebounceTime = 0; // Last debounce time volatile 
-    int static lastState = LOW; // Last stable state of the GPIO
-    unsigned long currentTime = millis(); 
-    int currentState = digitalRead(EMS); 
-
-    // Check if enough time has passed since the last interrupt 
-    if ((currentTime - lastDebounceTime) > 100) 
-    { 
-        // Check if the state has changed 
-        if (currentState != lastState) 
-        { 
-            lastState = currentState; 
-
-            // we are not setting the _has_emergency property here
-            // as the debouncing is not entirely reliable.
-            // we therefore read the state again in the change runner.
-            
-            // Signal our job to run the axis....
-            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-            vTaskNotifyGiveFromISR(_instance->_emsChangeRunner, &xHigherPriorityTaskWoken); 
-            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-        } 
-        // Update the last debounce time 
-        lastDebounceTime = currentTime; 
+    uint16_t pins = trace_pins();
+    ISR_TRACE(TRACE_EMS, TRACE_FLAG_NOTIFY, pins);
+    if((pins & TRACE_PIN_EMS) && !_feed_hold)
+    {
+        // the switch opened: the feed hold goes out now, ahead of anything the transmit task
+        // has queued. Whether this is the emergency stop or a glitch is decided by the EMS 
+        // task once the switch has settled.
+        int ahead = Tx.RealtimeFromISR('!');
+        if(ahead >= 0) _feed_hold = true;
+        ISR_TRACE(TRACE_EMS_HOLD, 0, ahead >= 0 ? ahead : 0xffff);
     }
+
+    // every edge restarts the confirmation in the task
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(_instance->_emsChangeRunner, &xHigherPriorityTaskWoken); 
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
 /**
- * @brief Event handler monitoring the Axus GPIOs 
+ * @brief Event handler monitoring the Axus GPIOs. The selector task debounces the switch.
  */
 void IRAM_ATTR Wheel::handle_axis_change()
 {    
-    if(!digitalRead(AXIS_X)) _selected_axis = Axis::X;
-    if(!digitalRead(AXIS_Y)) _selected_axis = Axis::Y;
-    else if(!digitalRead(AXIS_Z)) _selected_axis = Axis::Z;
-    _direction = 0;
+    ISR_TRACE(TRACE_AXIS, TRACE_FLAG_NOTIFY, trace_pins());
+    _selector->notify_from_isr();
 }
 
 /**
@@ -488,32 +699,58 @@ void IRAM_ATTR Wheel::handle_axis_change()
  */
 void IRAM_ATTR Wheel::handle_encoder_change()
 {
-    static int8_t c = 0;
-    if(_has_emergency) return;
+    uint16_t pins = trace_pins();
+    uint8_t trace_flags = 0;
+    if(_has_emergency || _feed_hold) 
+    {
+        ISR_TRACE(TRACE_ENCODER, 0, pins);
+        return;
+    }
 
     static const int8_t enconder_state_table[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
     int MSB = digitalRead(WHEEL_A); // Most significant bit 
     int LSB = digitalRead(WHEEL_B); // Least significant bit 
     int encoded = (MSB << 1) | LSB; // Combine the two signals 
+    portENTER_CRITICAL_ISR(&_encoder_lock);
     if(encoded != _wheel_encoded)
     {
         int sum = (_wheel_encoded << 2) | encoded;  // Add the two previous bits 
-        c += enconder_state_table[sum];
-        if(c == 4 || c == -4)
-        {
-            _wheel_position += c == 4 ? 1 : -1;
-            _direction = c > 0 ? 1 : -1;
-            c = 0x0;
-            _wheel_encoded = encoded;   // Update the last encoded value
-
-            // Signal our job to run the axis....
-            BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-            vTaskNotifyGiveFromISR(_instance->_wheelRunner, &xHigherPriorityTaskWoken); 
-            portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-        }
-        else
+        _encoder_count += enconder_state_table[sum];
+        if(_encoder_count == 4 || _encoder_count == -4)
         {
-            _wheel_encoded = encoded;   // Update the last encoded value  
+            _wheel_position += _encoder_count == 4 ? 1 : -1;
+            _direction = _encoder_count > 0 ? 1 : -1;
+            _direction_sequence = _selector->sequence();
+            _encoder_count = 0x0;
+            trace_flags = TRACE_FLAG_NOTIFY;
         }
+        _wheel_encoded = encoded;   // Update the last encoded value
     }
+    portEXIT_CRITICAL_ISR(&_encoder_lock);
+
+    if(trace_flags & TRACE_FLAG_NOTIFY)
+    {
+        // Signal our job to run the axis....
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(_instance->_wheelRunner, &xHigherPriorityTaskWoken); 
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }
+    ISR_TRACE(TRACE_ENCODER, trace_flags, pins);
+}
+
+/**
+ * @brief Reads the raw state of the wheel inputs for the interrupt trace
+ * @returns The pin state, see TRACE_PIN_*
+ */
+inline uint16_t IRAM_ATTR Wheel::trace_pins()
+{
+    uint32_t in = REG_READ(GPIO_IN_REG);
+    uint32_t in1 = REG_READ(GPIO_IN1_REG);
+    return (in >> WHEEL_A & 1 ? TRACE_PIN_WHEEL_A : 0) |
+        (in >> WHEEL_B & 1 ? TRACE_PIN_WHEEL_B : 0) |
+        (in >> EMS & 1 ? TRACE_PIN_EMS : 0) |
+        (in >> AXIS_X & 1 ? TRACE_PIN_AXIS_X : 0) |
+        (in >> AXIS_Y & 1 ? TRACE_PIN_AXIS_Y : 0) |
+        (in1 >> (AXIS_Z - 32) & 1 ? TRACE_PIN_AXIS_Z : 0) |
+        (in >> PCF8575_INT_PIN & 1 ? TRACE_PIN_PCF_INT : 0);
 }
\ No newline at end of file
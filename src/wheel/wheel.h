@@ -6,8 +6,10 @@
 
 #include <unordered_map>
 #include "Arduino.h"
-#include "PCF8575.h"
 #include "../display/display_wheel.h"
+#include "command_store.h"
+#include "button_engine.h"
+#include "selector.h"
 
 #define PCF8575_ADDRESS 0x20
 #define PCF8575_INT_PIN 4
@@ -21,24 +23,37 @@
     // and hnags up the ESP32....
 
 #define EMS 19
+#ifndef EMS_CONFIRM_MS
+#define EMS_CONFIRM_MS 100
+    // the feed hold goes out from the interrupt right away, the switch has to read the same
+    // this long after the edge before the machine is reset or the hold released again
+#endif
 #define WHEEL_A 23
 #define WHEEL_B 27
 
 #define TOUCH_CS 33
 
+#define DISPLAY_NOTIFY_SELECTION 0x01
+#define DISPLAY_NOTIFY_POSITION 0x02
+#define DISPLAY_NOTIFY_EMERGENCY 0x04
+#define DISPLAY_NOTIFY_ALL 0x07
+    // the parts of the display the display task redraws, given as task notification bits
+
+#define STATUS_MESSAGE_SIZE 80
+    // the status line arriving before the display is up, longer ones are cut
+
 /**
- * @brief This structure contains information for a particular command. 
+ * @brief Snapshot of the wheel state as shown on the display
  */
-typedef struct Command
+typedef struct
 {
-    String _name_on; 
-    String _command_on;
-    String _name_off;
-    String _command_off;
-
-    static String escape_ctrl_characters(const String& s);
-    static String unescape_ctrl_characters(const String& s);
-} Command_t;
+    Axis axis;
+    float feed;
+    float x;
+    float y;
+    float z;
+    bool emergency;
+} wheel_state_t;
 
 /**
  * @brief Implements the basic wheel functionality
@@ -48,16 +63,55 @@ class Wheel
     public:
         /**
          * @brief Creates a new instance of Wheel
+         * @param spi_write_frequency - the display SPI write clock, 0 to calibrate the bus
+         * @param spi_read_frequency - the display SPI read clock, 0 to calibrate the bus
+         */
+        Wheel(uint32_t spi_write_frequency=0, uint32_t spi_read_frequency=0);
+
+        /**
+         * @brief Gets the SPI clock used to read from the display
+         * @returns The read clock in Hz
+         */
+        uint32_t get_display_read_frequency() const;
+
+        /**
+         * @brief Gets the SPI clock used to write to the display
+         * @returns The write clock in Hz
+         */
+        uint32_t get_display_write_frequency() const;
+
+        /**
+         * @brief Gets the current wheel state
+         * @param state - receives the state
+         */
+        void get_state(wheel_state_t &state) const;
+
+        /**
+         * @brief Checks whether the emergency stop holds the machine. This is already the case
+         * when the interrupt has sent the feed hold, before the EMS task confirms the switch.
+         * @returns true while nothing may be sent to the host
          */
-        Wheel();
+        bool is_halted() const { return _has_emergency || _feed_hold; }
 
         /**
-         * @brief Map containing the available commands for the CNC router 
+         * @brief Waits until the display task has initialized the display. The display is
+         * initialized in the background so the inputs are live right after construction.
          */
-        static std::unordered_map<uint8_t, Command_t> Commands;
+        void wait_for_display();
+
+        /**
+         * @brief The commands used until the configuration is loaded
+         */
+        static const command_slot_t DefaultCommands[COMMAND_COUNT];
+
+        /**
+         * @brief The commands for the CNC router, replaced at runtime when the configuration changes
+         */
+        static CommandStore Commands;
         
         /**
-         * @brief Writes a status message to the display
+         * @brief Writes a status message to the display. Does not wait for the display while
+         * it initializes, the latest message is kept and shown once it is up.
          * @param format - the format string
          * @param ... - variable argument list  
          */
@@ -71,16 +125,16 @@ class Wheel
         static void on_PCF8575_input_changed();
 
         /**
-         * @brief Task function to process changes to the inputs on the PCF8575
-         * GPIO extender. This funtions runs an endless blocking loop, waiting for notification 
-         * from on_PCF8575_input_changed upon which it evaluates the inputs and performs
-         * the appropriate actions. 
+         * @brief Task function processing the events of the buttons and the feed selector on the 
+         * PCF8575 GPIO extender. This funtions runs an endless blocking loop, waiting for events 
+         * from the button engine upon which it performs the appropriate actions. 
          * @param args - pointer to task arguments
          */
         static void extended_GPIO_watcher(void* args);
 
         /**
-         * @brief Task function managing the display
+         * @brief Task function managing the display. After initializing the display the task sleeps
+         * until the selection, the position or the emergency state changes and redraws what changed.
          * @param args - pointer to task arguments
          */
         static void display_runner(void* args);
@@ -102,12 +156,13 @@ class Wheel
         static void ems_change_runner(void* args);
 
         /**
-         * @brief Event handler monitoring the Axus GPIOs 
+         * @brief Event handler monitoring the Axus GPIOs. The selector task debounces the switch.
          */
         void IRAM_ATTR handle_axis_change(); 
 
         /**
-         * @brief Event handler monitoring the Emergency Shutdown Button 
+         * @brief Event handler monitoring the Emergency Shutdown Button. An engaging edge writes
+         * the feed hold straight into the UART, the EMS task confirms or releases it.
          */
         void IRAM_ATTR handle_ems_change(); 
 
@@ -118,6 +173,46 @@ class Wheel
 
     private: 
 
+        /**
+         * @brief Sends the command of a button, or runs its program, and toggles the button
+         * @param slot - the zero based button
+         */
+        void on_button(uint8_t slot);
+
+        /**
+         * @brief Runs a long press or chord program
+         * @param program - the program
+         * @param slot - the zero based button, recorded in the journal
+         */
+        void on_program(int program, uint8_t slot);
+
+        /**
+         * @brief Shows a started program, or that another program is still running
+         * @param program - the program
+         * @param started - true if the program was started
+         * @param name - the name shown as the command
+         */
+        void show_program(int program, bool started, const char *name);
+
+        /**
+         * @brief Shows that a button is blocked by the emergency stop
+         * @param slot - the zero based button, recorded in the journal
+         */
+        void show_blocked(uint8_t slot);
+
+        /**
+         * @brief Handles a change of the axis or feed selection: drops the partial encoder
+         * step and the direction taken for the previous selection and updates the display
+         * @param state - the new selection
+         */
+        void on_selection(const selector_state_t &state);
+
+        /**
+         * @brief Reads the raw state of the wheel inputs for the interrupt trace
+         * @returns The pin state, see TRACE_PIN_*
+         */
+        static inline uint16_t IRAM_ATTR trace_pins();
+
         /**
          * @brief Formats a string, essentially a wrapper for vnsprintf
          * @param format - format string
@@ -127,28 +222,37 @@ class Wheel
 
         static bool _key_changed;      
         DISPLAY_Wheel *_display = nullptr;
-        PCF8575 *_pcf8575 = nullptr;
+        ButtonEngine *_buttons = nullptr;
+        Selector *_selector = nullptr;
     
         TaskHandle_t _extendedGPIOWatcher;
-        TaskHandle_t _displayRunner;
+        TaskHandle_t _displayRunner = NULL;
         TaskHandle_t _encoderWatcher;
         TaskHandle_t _wheelRunner;
         TaskHandle_t _emsChangeRunner;
 
         SemaphoreHandle_t _display_mutex;
+        volatile bool _display_ready = false;
+            // until then the button and emergency tasks skip their display updates
+        char _pending_status[STATUS_MESSAGE_SIZE] = "";
+        portMUX_TYPE _status_lock = portMUX_INITIALIZER_UNLOCKED;
+            // the latest status message written before the display was ready
         
         float _x = 0.0;
         float _y = 0.0;
         float _z = 0.0;
-        float _selected_feed = Feed::NANO;
         bool _has_emergency = false;
-        uint16_t _button_state = 0xff;
+        volatile bool _feed_hold = false;
+            // set by the EMS interrupt once the feed hold is in the UART, blocks jogging
         uint16_t _command_state = 0x00;
 
+        portMUX_TYPE _encoder_lock = portMUX_INITIALIZER_UNLOCKED;
         int8_t _direction = 0;
+        int8_t _encoder_count = 0;
+        uint16_t _direction_sequence = 0;
+            // the selection the last step was taken for
         int16_t _wheel_encoded = 0x0;
         int16_t _wheel_position = 0x0;
-        Axis _selected_axis = Axis::X;
 };
 
 #endif
\ No newline at end of file
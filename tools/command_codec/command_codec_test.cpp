@@ -0,0 +1,240 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host test of the control character codec of the command store: escape_ctrl_characters and
+ * unescape_ctrl_characters. Covers the round trip, truncation at the buffer limit, decoding in
+ * place and escapes that are not complete sequences.
+ *
+ *   make test
+ */
+
+#include <string>
+#include "../../src/wheel/command_store.h"
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { failures++; printf("  FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+#pragma region host services
+// the command store publishes under a mutex, the test runs on one thread
+SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t)1; }
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) { return pdTRUE; }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
+void vTaskDelay(TickType_t ticks) {}
+#pragma endregion
+
+/**
+ * @brief Makes control characters and non printable bytes readable in failure messages
+ */
+static std::string show(const std::string &s)
+{
+	std::string out;
+	char buf[8];
+	for(unsigned char c : s)
+	{
+		if(c >= 0x20 && c < 0x7f) out += c;
+		else
+		{
+			snprintf(buf, sizeof(buf), "\\x%02x", c);
+			out += buf;
+		}
+	}
+	return out;
+}
+
+/**
+ * @brief Escapes into a buffer of the given size
+ * @param s - the command
+ * @param size - the size of the output buffer
+ * @param length - receives the return value
+ * @returns The output
+ */
+static std::string escape(const std::string &s, size_t size, size_t &length)
+{
+	std::string out(size + 1, '#');
+	length = escape_ctrl_characters(s.c_str(), &out[0], size);
+	CHECK(out[size] == '#', "escape of \"%s\" wrote past %zu bytes", show(s).c_str(), size);
+	if(size == 0) return std::string();
+	CHECK(out.find('\0') < size, "escape of \"%s\" not terminated", show(s).c_str());
+	return out.c_str();
+}
+
+/**
+ * @brief Unescapes into a buffer of the given size
+ */
+static std::string unescape(const std::string &s, size_t size, size_t &length)
+{
+	std::string out(size + 1, '#');
+	length = unescape_ctrl_characters(s.c_str(), &out[0], size);
+	CHECK(out[size] == '#', "unescape of \"%s\" wrote past %zu bytes", show(s).c_str(), size);
+	if(size == 0) return std::string();
+	CHECK(out.find('\0') < size, "unescape of \"%s\" not terminated", show(s).c_str());
+	return out.c_str();
+}
+
+static void check_escape(const std::string &s, const std::string &expected)
+{
+	size_t length;
+	std::string out = escape(s, COMMAND_ESCAPED_SIZE, length);
+	CHECK(out == expected, "escape of \"%s\" is \"%s\", expected \"%s\"", show(s).c_str(), show(out).c_str(), show(expected).c_str());
+	CHECK(length == expected.size(), "escape of \"%s\" returned %zu", show(s).c_str(), length);
+}
+
+static void check_unescape(const std::string &s, const std::string &expected)
+{
+	size_t length;
+	std::string out = unescape(s, COMMAND_SIZE, length);
+	CHECK(out == expected, "unescape of \"%s\" is \"%s\", expected \"%s\"", show(s).c_str(), show(out).c_str(), show(expected).c_str());
+	CHECK(length == expected.size(), "unescape of \"%s\" returned %zu", show(s).c_str(), length);
+}
+
+static void encoding()
+{
+	printf("encoding\n");
+	check_escape("", "");
+	check_escape("$J=G91 X-0.100 F2000", "$J=G91 X-0.100 F2000");
+	check_escape("\x18", "[CTRL]+X");
+	check_escape("\x01\x1a", "[CTRL]+A[CTRL]+Z");
+	check_escape("G0 X0\x18!~", "G0 X0[CTRL]+X!~");
+	check_escape("\x1b\x1f\x7f", "\x1b\x1f\x7f");
+		// only 0x01 to 0x1a have a letter
+	check_unescape("[CTRL]+X", "\x18");
+	check_unescape("[CTRL]+x", "\x18");
+	check_unescape("a[CTRL]+A[CTRL]+Zb", "a\x01\x1a" "b");
+}
+
+static void round_trip()
+{
+	printf("round trip\n");
+	std::string all;
+	for(char c=1; c<=26; c++) all += std::string("g") + c;
+	std::string cases[] = {"", "?", "\x18", "$X\x18", all, std::string(COMMAND_SIZE - 1, '\x18'), std::string(COMMAND_SIZE - 1, 'G')};
+
+	srand(1);
+	std::string random[50];
+	for(std::string &s : random)
+	{
+		size_t length = rand() % COMMAND_SIZE;
+		for(size_t i=0; i<length; i++) s += rand() % 4 == 0 ? (char)(1 + rand() % 26) : (char)(' ' + rand() % 95);
+	}
+
+	for(const std::string *set : {cases, random})
+	{
+		size_t n = set == cases ? sizeof(cases) / sizeof(cases[0]) : sizeof(random) / sizeof(random[0]);
+		for(size_t i=0; i<n; i++)
+		{
+			const std::string &s = set[i];
+			if(s.find("[CTRL]+") != std::string::npos) continue;
+				// the literal text is ambiguous by design
+			size_t escaped_length, length;
+			std::string escaped = escape(s, COMMAND_ESCAPED_SIZE, escaped_length);
+			CHECK(escaped_length < COMMAND_ESCAPED_SIZE, "COMMAND_ESCAPED_SIZE too small for \"%s\"", show(s).c_str());
+			std::string decoded = unescape(escaped, COMMAND_SIZE, length);
+			CHECK(decoded == s, "\"%s\" came back as \"%s\"", show(s).c_str(), show(decoded).c_str());
+			CHECK(length == s.size(), "unescape returned %zu for %zu characters", length, s.size());
+		}
+	}
+
+	size_t length;
+	escape(std::string(COMMAND_SIZE - 1, '\x01'), COMMAND_ESCAPED_SIZE, length);
+	CHECK(length == COMMAND_ESCAPED_SIZE - 1, "a full command of control characters escapes to %zu, the buffer holds %zu", length, (size_t)COMMAND_ESCAPED_SIZE - 1);
+}
+
+static void truncation()
+{
+	printf("truncation at the buffer limit\n");
+	const std::string s = "ab\x18" "cd\x01";
+	size_t full;
+	const std::string escaped = escape(s, COMMAND_ESCAPED_SIZE, full);
+	for(size_t size=0; size<=escaped.size() + 1; size++)
+	{
+		size_t length;
+		std::string out = escape(s, size, length);
+		CHECK(length == full, "size %zu: returned %zu, the full length is %zu", size, length, full);
+		CHECK(out.size() < size || size == 0, "size %zu: %zu characters written", size, out.size());
+		CHECK(escaped.compare(0, out.size(), out) == 0, "size %zu: \"%s\" is not a prefix", size, show(out).c_str());
+
+		// the output is the escape of a prefix of the input, never a partial sequence
+		bool whole = false;
+		for(size_t n=0; n<=s.size() && !whole; n++)
+		{
+			size_t l;
+			whole = escape(s.substr(0, n), COMMAND_ESCAPED_SIZE, l) == out;
+		}
+		CHECK(whole, "size %zu: \"%s\" ends in a partial sequence", size, show(out).c_str());
+		if(size > escaped.size()) CHECK(out == escaped, "size %zu: output truncated", size);
+	}
+
+	const std::string encoded = "ab[CTRL]+Xcd[CTRL]+A";
+	const std::string decoded = "ab\x18" "cd\x01";
+	for(size_t size=0; size<=decoded.size() + 1; size++)
+	{
+		size_t length;
+		std::string out = unescape(encoded, size, length);
+		CHECK(length == decoded.size(), "size %zu: returned %zu", size, length);
+		if(size > 0) CHECK(out == decoded.substr(0, size - 1), "size %zu: \"%s\"", size, show(out).c_str());
+	}
+
+	size_t length;
+	std::string out = unescape(std::string(COMMAND_SIZE + 10, 'G'), COMMAND_SIZE, length);
+	CHECK(length == COMMAND_SIZE + 10 && out.size() == COMMAND_SIZE - 1, "an overlong command is cut to %zu, returned %zu", out.size(), length);
+}
+
+static void in_place()
+{
+	printf("decoding in place\n");
+	const char *cases[][2] = {
+		{"[CTRL]+X", "\x18"},
+		{"ab[CTRL]+Xcd[CTRL]+a", "ab\x18" "cd\x01"},
+		{"[CTRL]+A[CTRL]+B[CTRL]+C", "\x01\x02\x03"},
+		{"no sequence", "no sequence"},
+		{"[CTRL]+", "[CTRL]+"},
+		{"[CTRL]+[CTRL]+Z", "[CTRL]+\x1a"},
+	};
+	for(auto &c : cases)
+	{
+		char buf[COMMAND_SIZE];
+		snprintf(buf, sizeof(buf), "%s", c[0]);
+		size_t length = unescape_ctrl_characters(buf, buf, sizeof(buf));
+		CHECK(strcmp(buf, c[1]) == 0, "\"%s\" decoded in place to \"%s\"", c[0], show(buf).c_str());
+		CHECK(length == strlen(c[1]), "\"%s\" returned %zu", c[0], length);
+	}
+
+	char buf[COMMAND_SIZE];
+	std::string full(COMMAND_SIZE - 1, 'G');
+	full.replace(0, 8, "[CTRL]+X");
+	snprintf(buf, sizeof(buf), "%s", full.c_str());
+	unescape_ctrl_characters(buf, buf, sizeof(buf));
+	CHECK(buf[0] == '\x18' && strlen(buf) == COMMAND_SIZE - 1 - 7, "a full buffer decoded in place to %zu characters", strlen(buf));
+}
+
+static void malformed()
+{
+	printf("malformed escapes\n");
+	check_unescape("[CTRL]+", "[CTRL]+");
+	check_unescape("G0[CTRL]+", "G0[CTRL]+");
+	check_unescape("[CTRL]+1", "[CTRL]+1");
+	check_unescape("[CTRL]+ X", "[CTRL]+ X");
+	check_unescape("[CTRL]X", "[CTRL]X");
+	check_unescape("[CTRL+X", "[CTRL+X");
+	check_unescape("[ctrl]+X", "[ctrl]+X");
+	check_unescape("[CTR", "[CTR");
+	check_unescape("[", "[");
+	check_unescape("[[CTRL]+X", "[\x18");
+	check_unescape("[CTRL][CTRL]+X", "[CTRL]\x18");
+	check_unescape("[CTRL]+[CTRL]+X", "[CTRL]+\x18");
+	check_unescape("[CTRL]+XY", "\x18Y");
+		// one letter per sequence
+}
+
+int main()
+{
+	encoding();
+	round_trip();
+	truncation();
+	in_place();
+	malformed();
+	printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+	return failures ? 1 : 0;
+}
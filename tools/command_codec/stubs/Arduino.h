@@ -0,0 +1,33 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host replacement of the parts of the ESP32 Arduino core and FreeRTOS the command store uses.
+ * The test is single threaded, command_codec_test.cpp implements the mutex as no-ops.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef void *SemaphoreHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+void vTaskDelay(TickType_t ticks);
+
+#endif
@@ -0,0 +1,455 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Runs the display stack of the wheel (DISPLAY_Wheel on DISPLAY_SPI on DISPLAY_GUI, built from
+ * the firmware sources unchanged) against an emulated ILI9488 and reports the bus cost of each
+ * display operation, or checks the rendering against golden images and bus budgets.
+ *
+ *   display_emulator [-o dir] [-w write_hz] [-r read_hz] [-s] [-v]
+ *   display_emulator -t golden_dir [-u] [-n scenario] [-o dir] [-v]
+ *
+ *   -o dir       writes the panel after each operation as dir/<nn>_<operation>.ppm, with -t
+ *                the image and a difference image of each failing scenario
+ *   -w, -r       fastest write and read clock the emulated panel follows, faster clocks corrupt
+ *                the data; the bus calibration of the driver settles below them
+ *   -s           also writes the display statistics the firmware collects (#display report)
+ *   -t dir       renders the scenarios of display_scenarios.cpp and compares each pixel by pixel
+ *                with dir/<scenario>.ppm.gz and its bus cost with the budget in dir/budgets.txt;
+ *                exits with 1 if a pixel differs or a budget is exceeded
+ *   -u           with -t, writes the images and the costs as the new golden images and budgets
+ *   -n scenario  with -t, runs only this scenario
+ *   -v           writes the log lines of the display stack to stderr
+ *
+ * The operations of the report follow the display task of the wheel: bring up with bus
+ * calibration, background and splash, then the DRO, selector, arrow, emergency and status
+ * updates and enough lines in the work area to scroll it. Per operation the report shows the
+ * bytes sent and read, CS transactions, CS level changes and pin writes, D/C changes, commands,
+ * address windows, pixels written, read and clipped, and the time the bytes take at the SPI clock.
+ *
+ * Each scenario starts on a freshly powered panel. The budget of a scenario covers the bytes
+ * sent and read, CS transactions and level changes, address windows and clipped pixels of the
+ * scenario after the bring up; the boot scenario covers the bring up itself. A cost below the
+ * budget passes and is reported, so the budget can be tightened with -u once the change is in.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <zlib.h>
+#include "display_host.h"
+#include "display_scenarios.h"
+#include "../../src/display/display_wheel.h"
+
+#define BUDGET_FIELDS 6
+
+/**
+ * @brief Writes to stdout, for the reports of the display stack
+ */
+class StdoutPrint : public Print
+{
+	public:
+		size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+};
+
+static const char *image_dir = nullptr;
+static int operation_count = 0;
+static const char *budget_names[BUDGET_FIELDS] = {"bytes", "read", "trans", "cs", "windows", "clip"};
+
+/**
+ * @brief Gets the budgeted counters of a scenario
+ * @param before - the counters at the start
+ * @param after - the counters at the end
+ * @param cost - receives bytes sent, bytes read, transactions, CS changes, windows and clipped pixels
+ */
+static void get_cost(const bus_counters_t &before, const bus_counters_t &after, uint64_t cost[BUDGET_FIELDS])
+{
+	cost[0] = after.bytes_out - before.bytes_out;
+	cost[1] = after.bytes_in - before.bytes_in;
+	cost[2] = after.transactions - before.transactions;
+	cost[3] = after.cs_toggles - before.cs_toggles;
+	cost[4] = after.windows - before.windows;
+	cost[5] = after.pixels_clipped - before.pixels_clipped;
+}
+
+/**
+ * @brief Creates the display and brings it up like the wheel does
+ * @returns The display
+ */
+static DISPLAY_Wheel *boot()
+{
+	DISPLAY_Wheel *display = new DISPLAY_Wheel();
+	display->set_bus_frequency(0, 0);
+	display->set_rotation(3);
+	display->init();
+	return display;
+}
+
+/**
+ * @brief Writes an image as a binary PPM, gzip compressed if the path ends in .gz
+ * @param path - the file to write
+ * @param width - the width of the image
+ * @param height - the height of the image
+ * @param image - the image as 8 bit RGB triplets
+ * @returns true if the image was written
+ */
+static bool write_ppm(const std::string &path, int width, int height, const std::vector<uint8_t> &image)
+{
+	bool compress = path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+	gzFile f = gzopen(path.c_str(), compress ? "wb9" : "wbT");
+	if(f == nullptr) return false;
+	bool ok = gzprintf(f, "P6\n%d %d\n255\n", width, height) > 0
+		&& gzwrite(f, image.data(), image.size()) == (int)image.size();
+	return gzclose(f) == Z_OK && ok;
+}
+
+/**
+ * @brief Reads a whitespace separated number of a PPM header
+ * @param f - the file
+ * @param value - receives the number
+ * @returns true if a number was read
+ */
+static bool read_ppm_number(gzFile f, int &value)
+{
+	int c;
+	while((c = gzgetc(f)) == ' ' || c == '\n' || c == '\r' || c == '\t');
+	if(c < '0' || c > '9') return false;
+	value = 0;
+	for(; c >= '0' && c <= '9'; c = gzgetc(f)) value = value * 10 + c - '0';
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+		// the single whitespace after the maximum value ends the header
+}
+
+/**
+ * @brief Reads a binary PPM with 8 bits per color, plain or gzip compressed
+ * @param path - the file to read
+ * @param width - receives the width of the image
+ * @param height - receives the height of the image
+ * @param image - receives the image as RGB triplets
+ * @returns true if the image was read
+ */
+static bool read_ppm(const std::string &path, int &width, int &height, std::vector<uint8_t> &image)
+{
+	gzFile f = gzopen(path.c_str(), "rb");
+	if(f == nullptr) return false;
+	int max = 0;
+	bool ok = gzgetc(f) == 'P' && gzgetc(f) == '6' && read_ppm_number(f, width) && read_ppm_number(f, height)
+		&& read_ppm_number(f, max) && max == 255 && width > 0 && height > 0;
+	if(ok)
+	{
+		image.resize((size_t)width * height * 3);
+		ok = gzread(f, image.data(), image.size()) == (int)image.size();
+	}
+	gzclose(f);
+	return ok;
+}
+
+/**
+ * @brief Reads the budgets of the scenarios
+ * @param path - the budget file, one scenario per line with its name and the BUDGET_FIELDS limits
+ * @returns The budgets by scenario
+ */
+static std::map<std::string, std::vector<uint64_t>> read_budgets(const std::string &path)
+{
+	std::map<std::string, std::vector<uint64_t>> budgets;
+	FILE *f = fopen(path.c_str(), "r");
+	if(f == nullptr) return budgets;
+	char line[256];
+	while(fgets(line, sizeof(line), f))
+	{
+		if(line[0] == '#') continue;
+		char name[64];
+		unsigned long long v[BUDGET_FIELDS];
+		if(sscanf(line, "%63s %llu %llu %llu %llu %llu %llu", name, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 1 + BUDGET_FIELDS) continue;
+		budgets[name] = std::vector<uint64_t>(v, v + BUDGET_FIELDS);
+	}
+	fclose(f);
+	return budgets;
+}
+
+/**
+ * @brief Runs a display operation and writes its bus cost
+ * @param name - the name of the operation
+ * @param operation - the operation
+ */
+static void run(const char *name, std::function<void()> operation)
+{
+	bus_counters_t before = Panel.counters();
+	operation();
+	const bus_counters_t &after = Panel.counters();
+	printf("%-16s %9llu %7llu %6llu %6llu %6llu %6llu %6llu %6llu %7llu %7llu %5llu %9.1f\n", name,
+		(unsigned long long)(after.bytes_out - before.bytes_out),
+		(unsigned long long)(after.bytes_in - before.bytes_in),
+		(unsigned long long)(after.transactions - before.transactions),
+		(unsigned long long)(after.cs_toggles - before.cs_toggles),
+		(unsigned long long)(after.cs_writes - before.cs_writes),
+		(unsigned long long)(after.dc_toggles - before.dc_toggles),
+		(unsigned long long)(after.commands - before.commands),
+		(unsigned long long)(after.windows - before.windows),
+		(unsigned long long)(after.pixels_written - before.pixels_written),
+		(unsigned long long)(after.pixels_read - before.pixels_read),
+		(unsigned long long)(after.pixels_clipped - before.pixels_clipped),
+		(after.bus_ns - before.bus_ns) / 1000.0);
+	operation_count++;
+	if(image_dir != nullptr)
+	{
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%02d_%s.ppm", image_dir, operation_count, name);
+		if(!Panel.dump_ppm(path)) fprintf(stderr, "Unable to write %s\n", path);
+	}
+}
+
+/**
+ * @brief Replays the operations of the display task and writes the bus cost of each
+ * @param stats - true to also write the display statistics of the firmware
+ */
+static void report(bool stats)
+{
+	printf("%-16s %9s %7s %6s %6s %6s %6s %6s %6s %7s %7s %5s %9s\n", "operation",
+		"bytes", "read", "trans", "cs", "cs_wr", "dc", "cmds", "window", "px_w", "px_r", "clip", "bus_us");
+
+	DISPLAY_Wheel *display = nullptr;
+	run("construct", [&] {
+		display = new DISPLAY_Wheel();
+		display->set_bus_frequency(0, 0);
+		display->set_rotation(3);
+	});
+	run("init", [&] { display->init(); });
+
+	int16_t cf = display->RGB_to_565(0x00, 0xff, 0x00);
+	int16_t cn = display->RGB_to_565(177, 0, 254);
+	int16_t cback = display->RGB_to_565(177, 0, 254);
+	run("selection", [&] {
+		display->write_axis(Axis::X);
+		display->write_feed(Feed::MILLI);
+	});
+	run("emergency_off", [&] { display->write_emergency(false); });
+	run("dro", [&] {
+		display->write_x(123.456f);
+		display->write_y(-7.5f);
+		display->write_z(0.0f);
+	});
+	run("arrows", [&] {
+		display->draw_arrow(185, 14, Direction::RIGHT, 3, cf, cback);
+		display->draw_arrow(305, 14, Direction::UP, 3, cn, cback);
+		display->draw_arrow(415, 14, Direction::UP, 3, cn, cback);
+	});
+	run("status", [&] { display->write_status("%s", "Idle"); });
+	run("command", [&] { display->write_command("$J=G91 X0.100 F2000"); });
+	run("emergency_on", [&] {
+		display->write_emergency(true);
+		display->w_area_print("Emergency Shutdown has been engaged.", 0xf800, true);
+	});
+	run("work_area", [&] {
+		char line[48];
+		for(int i=0; i<30; i++)
+		{
+			snprintf(line, sizeof(line), "ok %d", i);
+			display->w_area_print(line, 0xffff, true);
+		}
+	});
+
+	const bus_counters_t &total = Panel.counters();
+	printf("total: %llu bytes sent, %llu read, %llu transactions, %llu CS changes, %.1f ms on the bus at %u/%u Hz write/read\n",
+		(unsigned long long)total.bytes_out, (unsigned long long)total.bytes_in, (unsigned long long)total.transactions,
+		(unsigned long long)total.cs_toggles, total.bus_ns / 1e6, display->get_write_frequency(), display->get_read_frequency());
+	if(total.bytes_idle != 0) printf("warning: %llu bytes clocked without CS asserted\n", (unsigned long long)total.bytes_idle);
+	if(stats)
+	{
+		StdoutPrint out;
+		DisplayMetrics.print(out);
+	}
+}
+
+/**
+ * @brief Renders the scenarios and checks them against the golden images and budgets
+ * @param golden_dir - the directory of the golden images and budgets.txt
+ * @param update - true to write the results as the new golden images and budgets
+ * @param only - the only scenario to run, nullptr for all
+ * @returns The number of failed scenarios
+ */
+static int suite(const std::string &golden_dir, bool update, const char *only)
+{
+	std::string budget_path = golden_dir + "/budgets.txt";
+	std::map<std::string, std::vector<uint64_t>> budgets = read_budgets(budget_path);
+	int failed = 0;
+	int ran = 0;
+	for(int s=0; s<ScenarioCount; s++)
+	{
+		const scenario_t &scenario = Scenarios[s];
+		if(only != nullptr && strcmp(only, scenario.name) != 0) continue;
+		ran++;
+		host_reset();
+		DisplayMetrics.reset();
+
+		bus_counters_t before = Panel.counters();
+		DISPLAY_Wheel *display = boot();
+		if(scenario.run != nullptr)
+		{
+			before = Panel.counters();
+			scenario.run(*display);
+		}
+		uint64_t cost[BUDGET_FIELDS];
+		get_cost(before, Panel.counters(), cost);
+			// the display is not freed, the driver never releases its bus, as on the device
+
+		int width, height;
+		std::vector<uint8_t> image = Panel.render(width, height);
+		std::string golden_path = golden_dir + "/" + scenario.name + ".ppm.gz";
+		if(update)
+		{
+			if(!write_ppm(golden_path, width, height, image))
+			{
+				fprintf(stderr, "Unable to write %s\n", golden_path.c_str());
+				failed++;
+			}
+			budgets[scenario.name] = std::vector<uint64_t>(cost, cost + BUDGET_FIELDS);
+			printf("updated %-16s %s\n", scenario.name, scenario.description);
+			continue;
+		}
+
+		std::string problems;
+		int golden_width, golden_height;
+		std::vector<uint8_t> golden;
+		long differ = 0;
+		int x1 = width, y1 = height, x2 = -1, y2 = -1;
+		if(!read_ppm(golden_path, golden_width, golden_height, golden)) problems += " no golden image;";
+		else if(golden_width != width || golden_height != height) problems += " golden image has a different size;";
+		else
+		{
+			for(int y=0; y<height; y++)
+			{
+				for(int x=0; x<width; x++)
+				{
+					size_t i = ((size_t)y * width + x) * 3;
+					if(memcmp(&image[i], &golden[i], 3) == 0) continue;
+					differ++;
+					if(x < x1) x1 = x;
+					if(y < y1) y1 = y;
+					if(x > x2) x2 = x;
+					if(y > y2) y2 = y;
+				}
+			}
+			if(differ != 0)
+			{
+				char msg[96];
+				snprintf(msg, sizeof(msg), " %ld pixels differ in (%d,%d)-(%d,%d);", differ, x1, y1, x2, y2);
+				problems += msg;
+			}
+		}
+
+		std::string costs;
+		bool under = false;
+		auto budget = budgets.find(scenario.name);
+		if(budget == budgets.end()) problems += " no budget;";
+		for(int i=0; i<BUDGET_FIELDS; i++)
+		{
+			char field[64];
+			if(budget == budgets.end())
+			{
+				snprintf(field, sizeof(field), " %s %llu", budget_names[i], (unsigned long long)cost[i]);
+			}
+			else
+			{
+				uint64_t limit = budget->second[i];
+				snprintf(field, sizeof(field), " %s %llu/%llu%s", budget_names[i], (unsigned long long)cost[i],
+					(unsigned long long)limit, cost[i] > limit ? "!" : "");
+				if(cost[i] > limit) problems += std::string(" ") + budget_names[i] + " over budget;";
+				if(cost[i] < limit) under = true;
+			}
+			costs += field;
+		}
+
+		printf("%s %-16s%s%s\n", problems.empty() ? "PASS" : "FAIL", scenario.name, costs.c_str(), under && problems.empty() ? "  (under budget)" : "");
+		if(problems.empty()) continue;
+		failed++;
+		printf("     %s:%s\n", scenario.description, problems.c_str());
+		if(image_dir != nullptr)
+		{
+			std::string actual_path = std::string(image_dir) + "/" + scenario.name + ".ppm";
+			write_ppm(actual_path, width, height, image);
+			if(differ != 0)
+			{
+				// differing pixels in red over the dimmed image
+				std::vector<uint8_t> diff(image.size());
+				for(size_t i=0; i<image.size(); i+=3)
+				{
+					bool same = memcmp(&image[i], &golden[i], 3) == 0;
+					diff[i] = same ? image[i] / 4 : 0xFF;
+					diff[i + 1] = same ? image[i + 1] / 4 : 0x00;
+					diff[i + 2] = same ? image[i + 2] / 4 : 0x00;
+				}
+				write_ppm(std::string(image_dir) + "/" + scenario.name + "_diff.ppm", width, height, diff);
+			}
+		}
+	}
+
+	if(ran == 0)
+	{
+		fprintf(stderr, "No scenario %s\n", only);
+		return 1;
+	}
+	if(update)
+	{
+		FILE *f = fopen(budget_path.c_str(), "w");
+		if(f == nullptr)
+		{
+			fprintf(stderr, "Unable to write %s\n", budget_path.c_str());
+			return failed + 1;
+		}
+		fprintf(f, "# bus budget per scenario, written by display_emulator -t %s -u\n# scenario", golden_dir.c_str());
+		for(int i=0; i<BUDGET_FIELDS; i++) fprintf(f, " %s", budget_names[i]);
+		fprintf(f, "\n");
+		for(int s=0; s<ScenarioCount; s++)
+		{
+			auto budget = budgets.find(Scenarios[s].name);
+			if(budget == budgets.end()) continue;
+			fprintf(f, "%s", budget->first.c_str());
+			for(uint64_t v : budget->second) fprintf(f, " %llu", (unsigned long long)v);
+			fprintf(f, "\n");
+		}
+		fclose(f);
+	}
+	else printf("%d of %d scenarios passed\n", ran - failed, ran);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t write_hz = 0;
+	uint32_t read_hz = 0;
+	bool stats = false;
+	const char *golden_dir = nullptr;
+	bool update = false;
+	const char *only = nullptr;
+	int opt;
+	while((opt = getopt(argc, argv, "o:w:r:st:un:v")) != -1)
+	{
+		switch(opt)
+		{
+			case 'o': image_dir = optarg; break;
+			case 'w': write_hz = strtoul(optarg, nullptr, 0); break;
+			case 'r': read_hz = strtoul(optarg, nullptr, 0); break;
+			case 's': stats = true; break;
+			case 't': golden_dir = optarg; break;
+			case 'u': update = true; break;
+			case 'n': only = optarg; break;
+			case 'v': HostVerbose = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-o dir] [-w write_hz] [-r read_hz] [-s] [-v]\n"
+					"       %s -t golden_dir [-u] [-n scenario] [-o dir] [-v]\n", argv[0], argv[0]);
+				return 2;
+		}
+	}
+
+	if(golden_dir != nullptr) return suite(golden_dir, update, only) == 0 ? 0 : 1;
+		// the scenarios run on a panel without clock limits, so the budgets do not depend on them
+	Panel.set_limits(write_hz, read_hz);
+	report(stats);
+	return 0;
+}
@@ -0,0 +1,217 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host implementation of the Arduino, SPI and firmware services the display stack links against.
+ * The display pins and the SPI bus drive the emulated controller. Time is virtual: it advances
+ * with the bytes on the bus at the current SPI clock and with delays, so the timings in the
+ * display statistics are the bus time of the device without the CPU time.
+ */
+
+#include <SPI.h>
+#include "display_host.h"
+#include "../../src/display_spi/mcu_spi_magic.h"
+#include "../../src/logging/SerialLogger.h"
+#include "../../src/diagnostics/boot_profiler.h"
+
+Ili9488 Panel;
+bool HostVerbose = false;
+
+static uint64_t delay_ns = 0;
+static uint32_t spi_clock_hz = SPI_DEFAULT_FREQUENCY;
+static uint8_t reset_level = HIGH;
+
+/**
+ * @brief Powers the emulated board up again: a new controller with cleared frame memory, the
+ * virtual time at zero and the random numbers restarted
+ */
+void host_reset()
+{
+	Panel = Ili9488();
+	delay_ns = 0;
+	spi_clock_hz = SPI_DEFAULT_FREQUENCY;
+	reset_level = HIGH;
+	srand(1);
+}
+
+#pragma region Arduino core
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	switch(pin)
+	{
+		case CS: Panel.chip_select(val); break;
+		case RS: Panel.data_command(val); break;
+		case RESET:
+			if(reset_level == LOW && val == HIGH) Panel.reset();
+			reset_level = val;
+			break;
+		default: break;
+	}
+}
+
+int digitalRead(uint8_t pin)
+{
+	return HIGH;
+}
+
+void delay(uint32_t ms)
+{
+	delay_ns += (uint64_t)ms * 1000000;
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	delay_ns += (uint64_t)us * 1000;
+}
+
+unsigned long micros()
+{
+	return (Panel.counters().bus_ns + delay_ns) / 1000;
+}
+
+unsigned long millis()
+{
+	return micros() / 1000;
+}
+
+int64_t esp_timer_get_time()
+{
+	return micros();
+}
+
+long random(long max)
+{
+	return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+	return min + random(max - min);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+	return malloc(size);
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+	return 110592;
+		// what the device typically reports once the WiFi stack is up
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+	return 180000;
+}
+
+EspClass ESP;
+#pragma endregion
+
+#pragma region SPI
+uint32_t spiFrequencyToClockDiv(uint32_t freq)
+{
+	if(freq == 0 || freq >= APB_CLK_FREQ) return 1;
+	return (APB_CLK_FREQ + freq - 1) / freq;
+}
+
+void SPIClass::setFrequency(uint32_t freq)
+{
+	setClockDivider(spiFrequencyToClockDiv(freq));
+}
+
+void SPIClass::setClockDivider(uint32_t div)
+{
+	spi_clock_hz = APB_CLK_FREQ / (div ? div : 1);
+	Panel.set_clock(spi_clock_hz);
+}
+
+uint32_t SPIClass::getClockDivider()
+{
+	return spiFrequencyToClockDiv(spi_clock_hz);
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	return Panel.transfer(data);
+}
+
+void SPIClass::transferBytes(const uint8_t *data, uint8_t *out, uint32_t size)
+{
+	for(uint32_t i=0; i<size; i++)
+	{
+		uint8_t d = Panel.transfer(data ? data[i] : 0xFF);
+		if(out) out[i] = d;
+	}
+}
+#pragma endregion
+
+#pragma region firmware services
+// Only the parts of the logger and the boot profiler the display stack calls. Log lines go to
+// stderr with -v.
+
+SerialLogger Logger;
+BootProfiler Boot;
+
+LogTimestamp::LogTimestamp() {}
+SerialLogger::SerialLogger() {}
+
+static size_t host_log(const char *level, const char *format, va_list args)
+{
+	if(!HostVerbose) return 0;
+	fprintf(stderr, "%s: ", level);
+	int len = vfprintf(stderr, format, args);
+	fputc('\n', stderr);
+	return len < 0 ? 0 : len;
+}
+
+void SerialLogger::Info(const char *message) { if(HostVerbose) fprintf(stderr, "Info: %s\n", message); }
+void SerialLogger::Info(const __FlashStringHelper *message) { Info(reinterpret_cast<const char *>(message)); }
+void SerialLogger::Info(const String &message) { Info(message.c_str()); }
+void SerialLogger::Error(const char *message) { if(HostVerbose) fprintf(stderr, "Error: %s\n", message); }
+void SerialLogger::Error(const __FlashStringHelper *message) { Error(reinterpret_cast<const char *>(message)); }
+void SerialLogger::Error(const String &message) { Error(message.c_str()); }
+
+size_t SerialLogger::Info_f(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	size_t len = host_log("Info", format, args);
+	va_end(args);
+	return len;
+}
+
+size_t SerialLogger::Info_f(const __FlashStringHelper *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	size_t len = host_log("Info", reinterpret_cast<const char *>(format), args);
+	va_end(args);
+	return len;
+}
+
+size_t SerialLogger::Error_f(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	size_t len = host_log("Error", format, args);
+	va_end(args);
+	return len;
+}
+
+size_t SerialLogger::Error_f(const __FlashStringHelper *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	size_t len = host_log("Error", reinterpret_cast<const char *>(format), args);
+	va_end(args);
+	return len;
+}
+
+void BootProfiler::Phase(const char *name, int64_t start_us)
+{
+	if(HostVerbose) fprintf(stderr, "Boot: %s %lld us\n", name, (long long)(Now() - start_us));
+}
+#pragma endregion
@@ -0,0 +1,25 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef DISPLAY_HOST_H
+#define DISPLAY_HOST_H
+
+#include "ili9488.h"
+
+/**
+ * @brief The emulated controller behind the display pins and the SPI bus
+ */
+extern Ili9488 Panel;
+
+/**
+ * @brief true to write the log lines of the display stack to stderr
+ */
+extern bool HostVerbose;
+
+/**
+ * @brief Powers the emulated board up again: a new controller with cleared frame memory, the
+ * virtual time at zero and the random numbers restarted
+ */
+void host_reset();
+
+#endif
@@ -0,0 +1,164 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include "display_scenarios.h"
+
+/**
+ * @brief Draws the jog arrows like the display task of the wheel
+ * @param display - the display
+ * @param axis - the selected axis
+ * @param direction - the last jog direction, 1, -1 or 0
+ */
+static void draw_arrows(DISPLAY_Wheel &display, Axis axis, int direction)
+{
+	int16_t cf = display.RGB_to_565(0x00, 0xff, 0x00);
+	int16_t cb = display.RGB_to_565(0xff, 0x00, 0x00);
+	int16_t cn = display.RGB_to_565(177, 0, 254);
+	int16_t cback = display.RGB_to_565(177, 0, 254);
+	if(direction == 1)
+	{
+		display.draw_arrow(185, 14, Direction::RIGHT, 3, axis == Axis::X ? cf : cn, cback);
+		display.draw_arrow(305, 14, Direction::DOWN, 3, axis == Axis::Y ? cb : cn, cback);
+		display.draw_arrow(415, 14, Direction::UP, 3, axis == Axis::Z ? cf : cn, cback);
+	}
+	else if(direction == -1)
+	{
+		display.draw_arrow(185, 14, Direction::LEFT, 3, axis == Axis::X ? cb : cn, cback);
+		display.draw_arrow(305, 14, Direction::UP, 3, axis == Axis::Y ? cf : cn, cback);
+		display.draw_arrow(415, 14, Direction::DOWN, 3, axis == Axis::Z ? cb : cn, cback);
+	}
+	else
+	{
+		display.draw_arrow(185, 14, Direction::LEFT, 3, cn, cback);
+		display.draw_arrow(305, 14, Direction::UP, 3, cn, cback);
+		display.draw_arrow(415, 14, Direction::UP, 3, cn, cback);
+	}
+}
+
+static void selection(DISPLAY_Wheel &display)
+{
+	display.write_axis(Axis::X);
+	display.write_feed(Feed::FULL);
+	display.write_axis(Axis::Y);
+	display.write_feed(Feed::NANO);
+	display.write_axis(Axis::Z);
+	display.write_feed(Feed::MICRO);
+}
+
+static void dro_values(DISPLAY_Wheel &display)
+{
+	display.write_x(888.888f);
+	display.write_y(888.888f);
+	display.write_z(888.888f);
+	display.write_x(0.0f);
+	display.write_y(12.345f);
+	display.write_z(345.678f);
+		// shorter values have to erase the digits of the longer ones
+}
+
+static void dro_negative(DISPLAY_Wheel &display)
+{
+	display.write_x(-0.001f);
+	display.write_y(-999.999f);
+	display.write_z(-45.0f);
+}
+
+static void arrows_forward(DISPLAY_Wheel &display)
+{
+	draw_arrows(display, Axis::X, 1);
+	draw_arrows(display, Axis::Y, 1);
+}
+
+static void arrows_reverse(DISPLAY_Wheel &display)
+{
+	draw_arrows(display, Axis::Y, -1);
+	draw_arrows(display, Axis::Z, -1);
+}
+
+static void arrows_idle(DISPLAY_Wheel &display)
+{
+	draw_arrows(display, Axis::X, 1);
+	draw_arrows(display, Axis::X, 0);
+}
+
+static void arrow_shapes(DISPLAY_Wheel &display)
+{
+	static const Direction directions[] = {Direction::LEFT, Direction::RIGHT, Direction::UP, Direction::DOWN};
+	display.fill_rect(210, 140, 270, 176, 0x0000);
+	for(uint8_t size=1; size<=4; size++)
+	{
+		for(int d=0; d<4; d++)
+		{
+			display.draw_arrow(215 + d * 64, 145 + (size - 1) * 42, directions[d], size, 0xffff, 0x39e7);
+		}
+	}
+}
+
+static void ems_on(DISPLAY_Wheel &display)
+{
+	display.write_emergency(true);
+	display.w_area_print("Emergency Shutdown has been engaged.", 0xf800, true);
+	display.w_area_print("Handwheel in Emergency Shutdown. Release \n     EMS button to continue operations.", 0xf800, true);
+	display.write_command("Emergency Shutdown Engaged");
+}
+
+static void ems_off(DISPLAY_Wheel &display)
+{
+	ems_on(display);
+	display.write_emergency(false);
+	display.w_area_print("Emergency shutdown has been released.", 0x07f0, true);
+}
+
+static void log_scroll(DISPLAY_Wheel &display)
+{
+	char line[64];
+	for(int i=1; i<=50; i++)
+	{
+		snprintf(line, sizeof(line), "[MSG:line %d of the scroll test] ok", i);
+		display.w_area_print(line, i % 7 ? 0xffff : 0x07e0, true);
+	}
+}
+
+static void status(DISPLAY_Wheel &display)
+{
+	display.write_status("%s", "Attempting to connect to Wifi workshop");
+	display.write_status("%s: %s", "Wifi connected to workshop", "192.168.1.42");
+	display.write_command("$J=G91 X-0.100 F2000");
+}
+
+static void edges(DISPLAY_Wheel &display)
+{
+	int16_t w = display.get_width();
+	int16_t h = display.get_height();
+	display.fill_rect(0, 0, w, h, 0x0000);
+	display.set_draw_color(0xffff);
+	display.draw_rectangle(0, 0, w - 1, h - 1);
+	for(int16_t i=-2; i<=2; i++)
+	{
+		// the pixels on and beyond the right and bottom edge
+		display.draw_pixel(w - 1 + i, h / 2, 0xf800);
+		display.draw_pixel(w / 2, h - 1 + i, 0xf800);
+		display.draw_pixel(i, i, 0x07e0);
+	}
+	display.set_draw_color(0x001f);
+	display.draw_line(w - 20, h - 20, w + 20, h + 20);
+	display.draw_line(-20, h / 2, 20, h / 2);
+}
+
+const scenario_t Scenarios[] = {
+	{"boot", "bring up, bus calibration, background and splash", nullptr},
+	{"selection", "axis and feed selector through all positions", selection},
+	{"dro_values", "DRO overwritten with shorter values", dro_values},
+	{"dro_negative", "DRO with negative values", dro_negative},
+	{"arrows_forward", "jog arrows in the forward direction", arrows_forward},
+	{"arrows_reverse", "jog arrows in the reverse direction", arrows_reverse},
+	{"arrows_idle", "jog arrows back to idle", arrows_idle},
+	{"arrow_shapes", "all arrow directions in sizes 1 to 4", arrow_shapes},
+	{"ems_on", "emergency stop engaged", ems_on},
+	{"ems_off", "emergency stop engaged and released", ems_off},
+	{"log_scroll", "50 lines scrolling through the work area", log_scroll},
+	{"status", "status and command lines", status},
+	{"edges", "pixels and lines on and beyond the screen edges", edges},
+};
+const int ScenarioCount = sizeof(Scenarios) / sizeof(Scenarios[0]);
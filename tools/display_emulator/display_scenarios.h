@@ -0,0 +1,26 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef DISPLAY_SCENARIOS_H
+#define DISPLAY_SCENARIOS_H
+
+#include "../../src/display/display_wheel.h"
+
+/**
+ * @brief A scripted screen of the wheel checked against a golden image and a bus budget
+ */
+struct scenario_t
+{
+	const char *name;
+	const char *description;
+	void (*run)(DISPLAY_Wheel &display);
+		// runs on a display that has completed init, nullptr to measure the bring up itself
+};
+
+/**
+ * @brief The scenarios of the rendering regression suite
+ */
+extern const scenario_t Scenarios[];
+extern const int ScenarioCount;
+
+#endif
@@ -0,0 +1,368 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include "ili9488.h"
+#include "../../src/display_spi/lcd_spi_registers.h"
+
+#define CMD_NOP      0x00
+#define CMD_RDDID    0x04
+#define CMD_RDDST    0x09
+#define CMD_PTLON    0x12
+#define CMD_RAMRD    0x2E
+#define CMD_VSCRDEF  0x33
+#define CMD_VSCRSADD 0x37
+#define CMD_RAMWRC   0x3C
+#define CMD_RAMRDC   0x3E
+#define CMD_RDID4    0xD3
+
+Ili9488::Ili9488() : _gram(ILI9488_COLUMNS * ILI9488_ROWS * 3, 0)
+{
+	reset();
+}
+
+#pragma region public methods
+/**
+ * @brief Resets the controller, as the RESET pin or SWRESET do
+ */
+void Ili9488::reset()
+{
+	_cmd = CMD_NOP;
+	_param_count = 0;
+	_pixel_count = 0;
+	_reading = false;
+	_sc = 0;
+	_ec = ILI9488_COLUMNS - 1;
+	_sp = 0;
+	_ep = ILI9488_ROWS - 1;
+	_col = 0;
+	_page = 0;
+	_madctl = 0x00;
+	_colmod = 0x66;
+	_inverted = false;
+	_display_on = false;
+	_sleeping = true;
+	_scrolling = false;
+	_tfa = 0;
+	_vsa = ILI9488_ROWS;
+	_bfa = 0;
+	_vsp = 0;
+		// the frame memory keeps its content, like on the panel
+}
+
+/**
+ * @brief Drives the CS pin
+ * @param level - the pin level, 0 selects the controller
+ */
+void Ili9488::chip_select(int level)
+{
+	bool selected = level == 0;
+	_counters.cs_writes++;
+	if(selected == _selected) return;
+	_counters.cs_toggles++;
+	_selected = selected;
+	if(selected) _counters.transactions++;
+	else _reading = false;
+		// releasing CS ends a read, the pixel address stays for RAMWRC and RAMRDC
+}
+
+/**
+ * @brief Drives the D/C pin
+ * @param level - the pin level, 0 for commands, 1 for data
+ */
+void Ili9488::data_command(int level)
+{
+	level = level ? 1 : 0;
+	if(level != _dc) _counters.dc_toggles++;
+	_dc = level;
+}
+
+/**
+ * @brief Clocks a byte in both directions
+ * @param mosi - the byte sent by the host
+ * @returns The byte sent by the controller
+ */
+uint8_t Ili9488::transfer(uint8_t mosi)
+{
+	if(_clock_hz != 0) _counters.bus_ns += 8000000000ULL / _clock_hz;
+	if(!_selected)
+	{
+		_counters.bytes_idle++;
+		return 0xFF;
+	}
+	if(_reading)
+	{
+		// the controller drives the bus until CS is released, whatever the host sends
+		_counters.bytes_in++;
+		return read_byte();
+	}
+	_counters.bytes_out++;
+	if(_dc == 0) command(mosi);
+	else parameter(mosi);
+	return 0xFF;
+}
+
+/**
+ * @brief Renders the panel as the driver sees it, in the orientation selected by MADCTL,
+ * with vertical scrolling, inversion and the display state applied
+ * @param width - receives the width of the image
+ * @param height - receives the height of the image
+ * @returns The image as 8 bit RGB triplets, row by row
+ */
+std::vector<uint8_t> Ili9488::render(int &width, int &height) const
+{
+	bool exchange = _madctl & ILI9488_MADCTL_MV;
+	width = exchange ? ILI9488_ROWS : ILI9488_COLUMNS;
+	height = exchange ? ILI9488_COLUMNS : ILI9488_ROWS;
+	std::vector<uint8_t> image(width * height * 3, 0);
+	if(!_display_on || _sleeping) return image;
+
+	bool bgr = _madctl & ILI9488_MADCTL_BGR;
+		// the panel has BGR subpixels, the driver sets BGR so the bytes arrive as red, green, blue
+	for(int page=0; page<height; page++)
+	{
+		for(int col=0; col<width; col++)
+		{
+			long screen = map(col, page);
+			unsigned x = (screen / 3) % ILI9488_COLUMNS;
+			unsigned line = (screen / 3) / ILI9488_COLUMNS;
+			const uint8_t *src = &_gram[(scan_row(line) * ILI9488_COLUMNS + x) * 3];
+			uint8_t *dst = &image[(page * width + col) * 3];
+			for(int i=0; i<3; i++)
+			{
+				uint8_t v = src[bgr ? i : 2 - i];
+				if(_inverted) v = ~v & 0xFC;
+				dst[i] = v | v >> 6;
+			}
+		}
+	}
+	return image;
+}
+
+/**
+ * @brief Writes the rendered panel as a binary PPM image
+ * @param path - the file to write
+ * @returns true if the image was written
+ */
+bool Ili9488::dump_ppm(const std::string &path) const
+{
+	int width, height;
+	std::vector<uint8_t> image = render(width, height);
+	FILE *f = fopen(path.c_str(), "wb");
+	if(f == nullptr) return false;
+	fprintf(f, "P6\n%d %d\n255\n", width, height);
+	bool ok = fwrite(image.data(), 1, image.size(), f) == image.size();
+	return fclose(f) == 0 && ok;
+}
+#pragma endregion
+
+#pragma region private methods
+/**
+ * @brief Starts a command
+ * @param cmd - the command
+ */
+void Ili9488::command(uint8_t cmd)
+{
+	_counters.commands++;
+	_cmd = cmd;
+	_param_count = 0;
+	switch(cmd)
+	{
+		case ILI9488_SOFTRESET: reset(); break;
+		case ILI9488_SLEEPIN: _sleeping = true; break;
+		case ILI9488_SLEEPOUT: _sleeping = false; break;
+		case CMD_PTLON: _scrolling = false; break;
+		case ILI9488_NORMALDISP: _scrolling = false; break;
+		case ILI9488_INVERTOFF: _inverted = false; break;
+		case ILI9488_INVERTON: _inverted = true; break;
+		case ILI9488_DISPLAYOFF: _display_on = false; break;
+		case ILI9488_DISPLAYON: _display_on = true; break;
+		case ILI9488_MEMORYWRITE:
+			_col = _sc;
+			_page = _sp;
+			_pixel_count = 0;
+			break;
+		case CMD_RAMWRC:
+			_pixel_count = 0;
+			break;
+		case CMD_RAMRD:
+			_col = _sc;
+			_page = _sp;
+			// fall through
+		case CMD_RAMRDC:
+		case CMD_RDDID:
+		case CMD_RDDST:
+		case CMD_RDID4:
+			_reading = true;
+			_read_count = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief Takes a parameter or pixel byte of the current command
+ * @param d - the byte
+ */
+void Ili9488::parameter(uint8_t d)
+{
+	if(_cmd == ILI9488_MEMORYWRITE || _cmd == CMD_RAMWRC)
+	{
+		if(_max_write_hz != 0 && _clock_hz > _max_write_hz) d >>= 1;
+			// a clock the panel cannot follow slips a bit
+		_pixel[_pixel_count++] = d;
+		if((_colmod & 0x07) == 0x05)
+		{
+			// 16 bit 565 pixels, expanded to 6 bits per color like the panel does
+			if(_pixel_count < 2) return;
+			uint16_t c = _pixel[0] << 8 | _pixel[1];
+			_pixel[0] = (c >> 8) & 0xF8;
+			_pixel[1] = (c >> 3) & 0xFC;
+			_pixel[2] = (c << 3) & 0xF8;
+		}
+		else if(_pixel_count < 3) return;
+		_pixel_count = 0;
+		long offset = next_address();
+		_counters.pixels_written++;
+		if(offset < 0) _counters.pixels_clipped++;
+		else for(int i=0; i<3; i++) _gram[offset + i] = _pixel[i] & 0xFC;
+		return;
+	}
+
+	if(_param_count < sizeof(_params)) _params[_param_count] = d;
+	_param_count++;
+	switch(_cmd)
+	{
+		case ILI9488_COLADDRSET:
+			if(_param_count == 4)
+			{
+				_sc = _params[0] << 8 | _params[1];
+				_ec = _params[2] << 8 | _params[3];
+			}
+			break;
+		case ILI9488_PAGEADDRSET:
+			if(_param_count == 4)
+			{
+				_sp = _params[0] << 8 | _params[1];
+				_ep = _params[2] << 8 | _params[3];
+				_counters.windows++;
+			}
+			break;
+		case ILI9488_MADCTL:
+			if(_param_count == 1) _madctl = d;
+			break;
+		case ILI9488_PIXELFORMAT:
+			if(_param_count == 1) _colmod = d;
+			break;
+		case CMD_VSCRDEF:
+			if(_param_count == 6)
+			{
+				_tfa = _params[0] << 8 | _params[1];
+				_vsa = _params[2] << 8 | _params[3];
+				_bfa = _params[4] << 8 | _params[5];
+			}
+			break;
+		case CMD_VSCRSADD:
+			if(_param_count == 2)
+			{
+				_vsp = _params[0] << 8 | _params[1];
+				_scrolling = true;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief Gets the next byte of a read command
+ * @returns The byte
+ */
+uint8_t Ili9488::read_byte()
+{
+	unsigned n = _read_count++;
+	uint8_t d;
+	switch(_cmd)
+	{
+		case CMD_RAMRD:
+		case CMD_RAMRDC:
+			if(n == 0) return 0x00;
+				// dummy byte
+			if((n - 1) % 3 == 0)
+			{
+				long offset = next_address();
+				_counters.pixels_read++;
+				if(offset < 0)
+				{
+					_counters.pixels_clipped++;
+					_pixel[0] = _pixel[1] = _pixel[2] = 0;
+				}
+				else for(int i=0; i<3; i++) _pixel[i] = _gram[offset + i];
+			}
+			d = _pixel[(n - 1) % 3] >> 1;
+				// the panel shifts the read data out one clock late
+			break;
+		case CMD_RDID4:
+		{
+			static const uint8_t id4[] = {0x00, 0x00, 0x94, 0x88};
+			d = n < sizeof(id4) ? id4[n] : 0x00;
+			break;
+		}
+		default:
+			d = 0x00;
+			break;
+	}
+	if(_max_read_hz != 0 && _clock_hz > _max_read_hz) d >>= 1;
+	return d;
+}
+
+/**
+ * @brief Gets the frame memory offset of the current address and advances the address
+ * through the window
+ * @returns The offset, -1 if the address is outside the frame memory
+ */
+long Ili9488::next_address()
+{
+	long offset = map(_col, _page);
+	if(++_col > _ec)
+	{
+		_col = _sc;
+		if(++_page > _ep) _page = _sp;
+	}
+	return offset;
+}
+
+/**
+ * @brief Maps a column and page address to a frame memory offset through MADCTL
+ * @param col - the column address
+ * @param page - the page address
+ * @returns The offset, -1 if the address is outside the frame memory
+ */
+long Ili9488::map(unsigned col, unsigned page) const
+{
+	unsigned x = col, y = page;
+	if(_madctl & ILI9488_MADCTL_MV)
+	{
+		x = page;
+		y = col;
+	}
+	if(x >= ILI9488_COLUMNS || y >= ILI9488_ROWS) return -1;
+	if(_madctl & ILI9488_MADCTL_MX) x = ILI9488_COLUMNS - 1 - x;
+	if(_madctl & ILI9488_MADCTL_MY) y = ILI9488_ROWS - 1 - y;
+	return ((long)y * ILI9488_COLUMNS + x) * 3;
+}
+
+/**
+ * @brief Gets the frame memory row shown on a line of the panel
+ * @param line - the line
+ * @returns The frame memory row
+ */
+unsigned Ili9488::scan_row(unsigned line) const
+{
+	if(!_scrolling || _vsa == 0 || _tfa + _vsa > ILI9488_ROWS) return line;
+	if(line < _tfa || line >= _tfa + _vsa) return line;
+	unsigned start = _vsp < _tfa || _vsp >= _tfa + _vsa ? _tfa : _vsp;
+	return _tfa + (line - _tfa + start - _tfa) % _vsa;
+}
+#pragma endregion
@@ -0,0 +1,182 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef ILI9488_H
+#define ILI9488_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define ILI9488_COLUMNS 320
+#define ILI9488_ROWS    480
+
+/**
+ * @brief Bus counters of the emulated controller
+ */
+struct bus_counters_t
+{
+	uint64_t bytes_out;			// bytes clocked in while selected, commands, parameters and pixels
+	uint64_t bytes_in;			// bytes clocked out by the controller, including the dummy byte
+	uint64_t bytes_idle;		// bytes clocked while not selected, lost on a real panel
+	uint64_t transactions;		// CS asserted
+	uint64_t cs_toggles;		// CS level changes in either direction
+	uint64_t cs_writes;			// writes to the CS pin, including those not changing the level
+	uint64_t dc_toggles;		// D/C level changes
+	uint64_t commands;
+	uint64_t windows;			// CASET and PASET pairs
+	uint64_t pixels_written;
+	uint64_t pixels_read;
+	uint64_t pixels_clipped;	// pixels addressed outside the frame memory
+	uint64_t bus_ns;			// time the bytes take at the SPI clock
+};
+
+/**
+ * @brief Emulates an ILI9488 on the 4-wire SPI interface. Decodes the commands the display
+ * driver sends into a frame memory of 320x480 pixels with 6 bits per color:
+ *
+ *   0x01 SWRESET                   0x2A CASET, 0x2B PASET    column and page address window
+ *   0x10/0x11 SLPIN/SLPOUT         0x2C RAMWR, 0x3C RAMWRC   memory write
+ *   0x12/0x13 PTLON/NORON          0x2E RAMRD, 0x3E RAMRDC   memory read
+ *   0x20/0x21 INVOFF/INVON         0x33 VSCRDEF, 0x37 VSCRSADD  vertical scrolling
+ *   0x28/0x29 DISPOFF/DISPON       0x36 MADCTL, 0x3A COLMOD
+ *
+ * Other commands are counted and their parameters dropped. Reads return the frame memory
+ * delayed by one bit, as the panel does on this interface, after a dummy byte. A read or write
+ * clock above the configured limit corrupts the data, which lets the bus calibration of the
+ * driver be exercised.
+ */
+class Ili9488
+{
+	public:
+		Ili9488();
+
+		/**
+		 * @brief Resets the controller, as the RESET pin or SWRESET do
+		 */
+		void reset();
+
+		/**
+		 * @brief Drives the CS pin
+		 * @param level - the pin level, 0 selects the controller
+		 */
+		void chip_select(int level);
+
+		/**
+		 * @brief Drives the D/C pin
+		 * @param level - the pin level, 0 for commands, 1 for data
+		 */
+		void data_command(int level);
+
+		/**
+		 * @brief Clocks a byte in both directions
+		 * @param mosi - the byte sent by the host
+		 * @returns The byte sent by the controller
+		 */
+		uint8_t transfer(uint8_t mosi);
+
+		/**
+		 * @brief Sets the SPI clock used for the following transfers
+		 * @param hz - the clock in Hz
+		 */
+		void set_clock(uint32_t hz) { _clock_hz = hz; }
+
+		/**
+		 * @brief Sets the fastest clocks the controller reads and writes reliably
+		 * @param write_hz - the write limit, 0 for none
+		 * @param read_hz - the read limit, 0 for none
+		 */
+		void set_limits(uint32_t write_hz, uint32_t read_hz) { _max_write_hz = write_hz; _max_read_hz = read_hz; }
+
+		/**
+		 * @brief Gets the bus counters since the start
+		 * @returns The counters
+		 */
+		const bus_counters_t &counters() const { return _counters; }
+
+		/**
+		 * @brief Renders the panel as the driver sees it, in the orientation selected by MADCTL,
+		 * with vertical scrolling, inversion and the display state applied
+		 * @param width - receives the width of the image
+		 * @param height - receives the height of the image
+		 * @returns The image as 8 bit RGB triplets, row by row
+		 */
+		std::vector<uint8_t> render(int &width, int &height) const;
+
+		/**
+		 * @brief Writes the rendered panel as a binary PPM image
+		 * @param path - the file to write
+		 * @returns true if the image was written
+		 */
+		bool dump_ppm(const std::string &path) const;
+
+	private:
+		/**
+		 * @brief Starts a command
+		 * @param cmd - the command
+		 */
+		void command(uint8_t cmd);
+
+		/**
+		 * @brief Takes a parameter or pixel byte of the current command
+		 * @param d - the byte
+		 */
+		void parameter(uint8_t d);
+
+		/**
+		 * @brief Gets the next byte of a read command
+		 * @returns The byte
+		 */
+		uint8_t read_byte();
+
+		/**
+		 * @brief Gets the frame memory offset of the current address and advances the address
+		 * through the window
+		 * @returns The offset, -1 if the address is outside the frame memory
+		 */
+		long next_address();
+
+		/**
+		 * @brief Maps a column and page address to a frame memory offset through MADCTL
+		 * @param col - the column address
+		 * @param page - the page address
+		 * @returns The offset, -1 if the address is outside the frame memory
+		 */
+		long map(unsigned col, unsigned page) const;
+
+		/**
+		 * @brief Gets the frame memory row shown on a line of the panel
+		 * @param line - the line
+		 * @returns The frame memory row
+		 */
+		unsigned scan_row(unsigned line) const;
+
+		std::vector<uint8_t> _gram;
+		bus_counters_t _counters = {};
+
+		bool _selected = false;
+		int _dc = 1;
+		uint8_t _cmd = 0x00;
+		uint8_t _params[16];
+		unsigned _param_count = 0;
+		bool _reading = false;
+		unsigned _read_count = 0;
+		uint8_t _pixel[3];
+		unsigned _pixel_count = 0;
+
+		unsigned _sc, _ec, _sp, _ep;
+		unsigned _col, _page;
+		uint8_t _madctl;
+		uint8_t _colmod;
+		bool _inverted;
+		bool _display_on;
+		bool _sleeping;
+		bool _scrolling;
+		unsigned _tfa, _vsa, _bfa, _vsp;
+
+		uint32_t _clock_hz = 0;
+		uint32_t _max_write_hz = 0;
+		uint32_t _max_read_hz = 0;
+};
+
+#endif
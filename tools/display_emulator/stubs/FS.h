@@ -0,0 +1,9 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+class File {};
+
+#endif
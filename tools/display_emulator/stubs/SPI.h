@@ -0,0 +1,40 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host replacement of the ESP32 SPIClass. Every byte is clocked through the emulated display
+ * controller; the clock only advances the virtual time. Clock dividers are the division of the
+ * 80MHz APB clock, which is all the display driver relies on.
+ */
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define HSPI 2
+#define VSPI 3
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+#define APB_CLK_FREQ 80000000
+
+uint32_t spiFrequencyToClockDiv(uint32_t freq);
+
+class SPIClass
+{
+	public:
+		SPIClass(uint8_t spi_bus = HSPI) {}
+		void begin() {}
+		void end() {}
+		void setBitOrder(uint8_t order) {}
+		void setDataMode(uint8_t mode) {}
+		void setFrequency(uint32_t freq);
+		void setClockDivider(uint32_t div);
+		uint32_t getClockDivider();
+		uint8_t transfer(uint8_t data);
+		void transferBytes(const uint8_t *data, uint8_t *out, uint32_t size);
+		void writeBytes(const uint8_t *data, uint32_t size) { transferBytes(data, nullptr, size); }
+};
+
+#endif
@@ -0,0 +1,281 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host side analyzer for the interrupt trace dumped with the "trace" diagnostic report
+ * (#trace over the serial link or /diag/trace over HTTP).
+ *
+ *   isr_trace_analyzer [-b bounce_us] [-r baud] [-f fifo_limit] [-l limit_us] [trace file]
+ *                                                      reads stdin if no file is given
+ *
+ * Reports per source edge rates and minimum intervals, bounce counts, encoder glitches, the
+ * latency from an interrupt notifying its task to the task waking up and the time from an
+ * emergency stop edge to the feed hold being on the wire. The latter counts the interrupt, the
+ * bytes ahead of the feed hold in the UART FIFO and the feed hold itself at the given baud rate;
+ * the worst case assumes a FIFO holding the full line budget of the transmit task. With -l the
+ * analyzer exits with 1 if the worst case exceeds the limit. Core 1 timestamps are
+ * moved onto the core 0 time base with the core offset measured by the device, which is good
+ * to a few microseconds.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define TRACE_FLAG_CORE   0x01
+#define TRACE_FLAG_NOTIFY 0x02
+
+#define TRACE_PIN_WHEEL_A 0x0001
+#define TRACE_PIN_WHEEL_B 0x0002
+
+#define SERIAL_TX_REALTIME_BUDGET_US 600
+#define SERIAL_TX_FIFO_MIN 4
+	// as in src/serial/serial_tx.h, the default of -f
+
+/**
+ * @brief A decoded trace record
+ */
+struct record_t
+{
+	double us;
+	int core;
+	std::string source;
+	unsigned flags;
+	unsigned pins;
+};
+
+/**
+ * @brief Interval statistics
+ */
+struct stats_t
+{
+	std::vector<double> samples;
+
+	void add(double v) { samples.push_back(v); }
+
+	void print(const char *name, const char *unit)
+	{
+		if(samples.empty())
+		{
+			printf("  %-24s n/a\n", name);
+			return;
+		}
+		std::sort(samples.begin(), samples.end());
+		double sum = 0;
+		for(double v : samples) sum += v;
+		printf("  %-24s n=%zu min %.1f avg %.1f p99 %.1f max %.1f %s\n", name, samples.size(), samples.front(),
+			sum / samples.size(), samples[std::min(samples.size() - 1, (size_t)(samples.size() * 0.99))], samples.back(), unit);
+	}
+};
+
+/**
+ * @brief Reads a trace dump
+ * @param in - the input stream
+ * @param records - receives the records in trace order
+ * @return true if a trace header was found
+ */
+static bool read_trace(std::istream &in, std::vector<record_t> &records)
+{
+	std::string line;
+	double cpu_hz = 0;
+	int32_t offset = 0;
+	bool first = true;
+	uint32_t prev = 0;
+	double ticks = 0;
+	while(std::getline(in, line))
+	{
+		if(line.compare(0, 2, "; ") == 0) line.erase(0, 2);
+			// lines read over the serial link are commented out
+		if(!line.empty() && line.back() == '\r') line.pop_back();
+		if(line.empty()) continue;
+		if(line[0] == '#')
+		{
+			const char *p;
+			if((p = strstr(line.c_str(), "cpu_hz ")) != nullptr) cpu_hz = atof(p + 7);
+			if((p = strstr(line.c_str(), "core_offset ")) != nullptr) offset = atoi(p + 12);
+			continue;
+		}
+		std::istringstream fields(line);
+		uint32_t ccount;
+		record_t r;
+		if(!(fields >> ccount >> r.core >> r.source >> std::hex >> r.flags >> r.pins)) continue;
+		if(r.core) ccount -= (uint32_t)offset;
+		// the 32 bit counter wraps every few seconds, accumulating signed deltas unwraps it
+		// and tolerates the slight reordering between records taken on different cores.
+		if(!first) ticks += (int32_t)(ccount - prev);
+		first = false;
+		prev = ccount;
+		r.us = ticks;
+		records.push_back(r);
+	}
+	if(cpu_hz <= 0) return false;
+	for(record_t &r : records) r.us = r.us * 1e6 / cpu_hz;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	double bounce_us = 5000;
+	double baud = 115200;
+	double limit_us = 0;
+	int fifo_limit = -1;
+	const char *path = nullptr;
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) bounce_us = atof(argv[++i]);
+		else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) baud = atof(argv[++i]);
+		else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) fifo_limit = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-l") == 0 && i + 1 < argc) limit_us = atof(argv[++i]);
+		else if(argv[i][0] != '-') path = argv[i];
+		else
+		{
+			fprintf(stderr, "usage: %s [-b bounce_us] [-r baud] [-f fifo_limit] [-l limit_us] [trace file]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(baud <= 0)
+	{
+		fprintf(stderr, "invalid baud rate\n");
+		return 2;
+	}
+	if(fifo_limit < 0) fifo_limit = std::max(SERIAL_TX_FIFO_MIN, (int)(baud * SERIAL_TX_REALTIME_BUDGET_US / 10 / 1e6));
+
+	std::vector<record_t> records;
+	bool ok;
+	if(path != nullptr)
+	{
+		std::ifstream in(path);
+		if(!in)
+		{
+			fprintf(stderr, "unable to read %s\n", path);
+			return 1;
+		}
+		ok = read_trace(in, records);
+	}
+	else ok = read_trace(std::cin, records);
+	if(!ok || records.empty())
+	{
+		fprintf(stderr, "no trace found\n");
+		return 1;
+	}
+
+	double span = records.back().us - records.front().us;
+	printf("%zu records over %.3f s\n\n", records.size(), span / 1e6);
+
+	// edge rates and bounces per source
+	std::map<std::string, std::vector<const record_t *>> by_source;
+	for(const record_t &r : records) by_source[r.source].push_back(&r);
+	printf("sources:\n");
+	for(auto &kv : by_source)
+	{
+		const std::vector<const record_t *> &list = kv.second;
+		double min_interval = 0;
+		size_t bounces = 0;
+		for(size_t i = 1; i < list.size(); i++)
+		{
+			double d = list[i]->us - list[i - 1]->us;
+			if(i == 1 || d < min_interval) min_interval = d;
+			if(d < bounce_us) bounces++;
+		}
+		double window = list.back()->us - list.front()->us;
+		printf("  %-14s %7zu events  %9.1f /s  min interval %9.1f us  within %.0f us: %zu\n", kv.first.c_str(), list.size(),
+			window > 0 ? list.size() * 1e6 / window : 0.0, min_interval, bounce_us, bounces);
+	}
+
+	// encoder glitches: interrupts without a level change and transitions skipping a state
+	auto enc = by_source.find("encoder");
+	if(enc != by_source.end())
+	{
+		size_t unchanged = 0, skipped = 0, reversals = 0;
+		int last_dir = 0;
+		static const int8_t table[16] = {0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0};
+		for(size_t i = 1; i < enc->second.size(); i++)
+		{
+			unsigned a = enc->second[i - 1]->pins & (TRACE_PIN_WHEEL_A | TRACE_PIN_WHEEL_B);
+			unsigned b = enc->second[i]->pins & (TRACE_PIN_WHEEL_A | TRACE_PIN_WHEEL_B);
+			auto code = [](unsigned p) { return ((p & TRACE_PIN_WHEEL_A) ? 2 : 0) | ((p & TRACE_PIN_WHEEL_B) ? 1 : 0); };
+			if(a == b) unchanged++;
+			else if((a ^ b) == (TRACE_PIN_WHEEL_A | TRACE_PIN_WHEEL_B)) skipped++;
+			else
+			{
+				int dir = table[code(a) << 2 | code(b)];
+				if(last_dir != 0 && dir != last_dir) reversals++;
+				last_dir = dir;
+			}
+		}
+		printf("\nencoder:\n  unchanged level %zu, skipped state %zu, direction reversals %zu\n", unchanged, skipped, reversals);
+	}
+
+	// interrupt to task wakeup latency
+	static const std::pair<const char *, const char *> wakes[] = {
+		{"encoder", "wake_wheel"}, {"ems", "wake_ems"}, {"pcf8575", "wake_gpio"}
+	};
+	printf("\nwakeup latency:\n");
+	for(const auto &w : wakes)
+	{
+		stats_t latency;
+		size_t lost = 0;
+		for(size_t i = 0; i < records.size(); i++)
+		{
+			if(records[i].source != w.first || !(records[i].flags & TRACE_FLAG_NOTIFY)) continue;
+			size_t j = i + 1;
+			while(j < records.size() && records[j].source != w.second) j++;
+			if(j == records.size())
+			{
+				lost++;
+				continue;
+			}
+			// notifications arriving before the task ran are coalesced into one wakeup, so
+			// only the first notification after the previous wakeup is measured.
+			size_t k = i;
+			while(k > 0 && records[k - 1].source != w.second && !(records[k - 1].source == w.first && (records[k - 1].flags & TRACE_FLAG_NOTIFY))) k--;
+			if(k > 0 && records[k - 1].source == w.first) continue;
+			latency.add(records[j].us - records[i].us);
+		}
+		std::string name = std::string(w.first) + " -> " + w.second;
+		latency.print(name.c_str(), "us");
+		if(lost > 0) printf("  %-24s %zu notifications without a wakeup in the trace\n", "", lost);
+	}
+
+	// emergency stop edge to feed hold on the wire, 10 bits per byte with start and stop bit
+	double byte_us = 10 * 1e6 / baud;
+	stats_t isr, ahead, wire;
+	size_t full = 0;
+	for(size_t i = 0; i < records.size(); i++)
+	{
+		if(records[i].source != "ems_hold") continue;
+		size_t k = i;
+		while(k > 0 && !(records[k - 1].source == "ems" && records[k - 1].core == records[i].core)) k--;
+		if(k == 0) continue;
+		if(records[i].pins == 0xffff)
+		{
+			full++;
+			continue;
+		}
+		double latency = records[i].us - records[k - 1].us;
+		isr.add(latency);
+		ahead.add(records[i].pins);
+		wire.add(latency + (records[i].pins + 1) * byte_us);
+	}
+	printf("\nemergency stop at %.0f baud, FIFO limit %d bytes:\n", baud, fifo_limit);
+	isr.print("edge -> fifo", "us");
+	ahead.print("bytes ahead", "bytes");
+	wire.print("edge -> on the wire", "us");
+	if(full > 0) printf("  %-24s %zu feed holds not written, FIFO full\n", "", full);
+	double isr_max = isr.samples.empty() ? 0 : isr.samples.back();
+	double worst = std::max(wire.samples.empty() ? 0 : wire.samples.back(), isr_max + (fifo_limit + 1) * byte_us);
+	printf("  %-24s %.1f us\n", "worst case", worst);
+	if(limit_us > 0 && (worst > limit_us || full > 0))
+	{
+		printf("  worst case exceeds %.0f us\n", limit_us);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,350 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host implementation of the services the serial transmit task links against. Tasks are threads
+ * with the notification value of their task control block, time is the real clock and Serial is
+ * a 128 byte FIFO draining at the baud rate, shared with the direct FIFO access of the
+ * interrupt handlers.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <HardwareSerial.h>
+#include <hal/uart_ll.h>
+#include <freertos/ringbuf.h>
+#include "serial_tx_host.h"
+#include "../../src/tasks/task_plan.h"
+
+TaskPlan Tasks;
+HardwareSerial Serial;
+
+#pragma region Arduino core
+static const auto start = std::chrono::steady_clock::now();
+
+/**
+ * @brief Gets the time since start
+ * @returns The time in microseconds
+ */
+static double now_us()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(uint32_t ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+unsigned long micros()
+{
+	return (uint32_t)now_us();
+}
+
+unsigned long millis()
+{
+	return (uint32_t)(now_us() / 1000);
+}
+#pragma endregion
+
+#pragma region UART
+#define UART_FIFO_SIZE 128
+
+/**
+ * @brief The transmit FIFO. A byte is in the FIFO until its stop bit is out, so the fill level
+ * follows from the time the last byte written leaves the wire.
+ */
+static struct
+{
+	std::mutex lock;
+	double byte_us = 10 * 1e6 / 115200;
+	double idle_at = 0;
+		// the time the last byte written is out
+	uint32_t line_bytes = 0;
+	double direct_wire_us = 0;
+} uart;
+
+/**
+ * @brief Gets the bytes in the FIFO, called with the lock held
+ * @param now - the current time
+ * @returns The bytes
+ */
+static uint32_t fifo_level(double now)
+{
+	if(uart.idle_at <= now) return 0;
+	double level = (uart.idle_at - now) / uart.byte_us;
+	uint32_t bytes = (uint32_t)level;
+	return bytes < level ? bytes + 1 : bytes;
+}
+
+/**
+ * @brief Puts a byte into the FIFO, called with the lock held and room in the FIFO
+ * @param now - the current time
+ */
+static void fifo_put(double now)
+{
+	uart.idle_at = std::max(uart.idle_at, now) + uart.byte_us;
+}
+
+void HardwareSerial::updateBaudRate(uint32_t baud)
+{
+	std::lock_guard<std::mutex> guard(uart.lock);
+	_baud = baud;
+	uart.byte_us = 10 * 1e6 / baud;
+		// 10 bits per byte with start and stop bit
+}
+
+int HardwareSerial::availableForWrite()
+{
+	std::lock_guard<std::mutex> guard(uart.lock);
+	return UART_FIFO_SIZE - fifo_level(now_us());
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+	// without a software buffer a write waits for room like the Arduino core does
+	for(size_t i = 0; i < size; i++)
+	{
+		for(;;)
+		{
+			{
+				std::lock_guard<std::mutex> guard(uart.lock);
+				double now = now_us();
+				if(fifo_level(now) < UART_FIFO_SIZE)
+				{
+					fifo_put(now);
+					uart.line_bytes++;
+					break;
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(10));
+		}
+	}
+	return size;
+}
+
+void HardwareSerial::flush()
+{
+	double wait;
+	{
+		std::lock_guard<std::mutex> guard(uart.lock);
+		wait = uart.idle_at - now_us();
+	}
+	if(wait > 0) std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(wait));
+}
+
+struct uart_dev_s
+{
+	int num;
+};
+
+uart_dev_t *host_uart_hw(int uart_num)
+{
+	static uart_dev_t hw = {0};
+	return &hw;
+}
+
+uint32_t uart_ll_get_txfifo_len(uart_dev_t *hw)
+{
+	std::lock_guard<std::mutex> guard(uart.lock);
+	return UART_FIFO_SIZE - fifo_level(now_us());
+}
+
+void uart_ll_write_txfifo(uart_dev_t *hw, const uint8_t *buf, uint32_t len)
+{
+	std::lock_guard<std::mutex> guard(uart.lock);
+	double now = now_us();
+	for(uint32_t i = 0; i < len; i++) fifo_put(now);
+	uart.direct_wire_us = uart.idle_at - now;
+}
+
+/**
+ * @brief Gets the time from the last direct FIFO write to its last byte being on the wire
+ * @returns The time in microseconds
+ */
+double host_uart_direct_wire_us()
+{
+	std::lock_guard<std::mutex> guard(uart.lock);
+	return uart.direct_wire_us;
+}
+
+/**
+ * @brief Gets the bytes written through the port, not counting the direct FIFO writes
+ * @returns The bytes
+ */
+uint32_t host_uart_line_bytes()
+{
+	std::lock_guard<std::mutex> guard(uart.lock);
+	return uart.line_bytes;
+}
+#pragma endregion
+
+#pragma region FreeRTOS
+/**
+ * @brief A task: a thread with the notification state of its task control block
+ */
+typedef struct
+{
+	std::mutex lock;
+	std::condition_variable notified;
+	uint32_t value = 0;
+	bool pending = false;
+} host_task_t;
+
+static thread_local host_task_t *current_task = nullptr;
+static std::mutex critical;
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	host_task_t *t = reinterpret_cast<host_task_t *>(task);
+	std::lock_guard<std::mutex> guard(t->lock);
+	if(action == eSetBits) t->value |= value;
+	t->pending = true;
+	t->notified.notify_one();
+	return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+	host_task_t *t = current_task;
+	std::unique_lock<std::mutex> guard(t->lock);
+	if(!t->pending) t->value &= ~clear_on_entry;
+	if(ticks == portMAX_DELAY) t->notified.wait(guard, [t] { return t->pending; });
+	else t->notified.wait_for(guard, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), [t] { return t->pending; });
+	if(value != NULL) *value = t->value;
+	if(!t->pending) return pdFALSE;
+	t->pending = false;
+	t->value &= ~clear_on_exit;
+	return pdTRUE;
+}
+
+uint32_t ulTaskNotifyValueClear(TaskHandle_t task, uint32_t bits)
+{
+	host_task_t *t = task != NULL ? reinterpret_cast<host_task_t *>(task) : current_task;
+	std::lock_guard<std::mutex> guard(t->lock);
+	uint32_t value = t->value;
+	t->value &= ~bits;
+	return value;
+}
+
+void portENTER_CRITICAL(portMUX_TYPE *mux)
+{
+	critical.lock();
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE *mux)
+{
+	critical.unlock();
+}
+
+BaseType_t TaskPlan::Create(task_role_t role, TaskFunction_t function, void *args, TaskHandle_t *handle)
+{
+	host_task_t *task = new host_task_t();
+	if(handle != NULL) *handle = task;
+	std::thread([task, function, args] {
+		current_task = task;
+		function(args);
+	}).detach();
+	return pdPASS;
+}
+
+/**
+ * @brief A ring buffer of items that are not split, released in the order they were received
+ */
+typedef struct
+{
+	std::mutex lock;
+	std::condition_variable changed;
+	size_t size;
+	size_t used = 0;
+	std::deque<uint8_t *> items;
+} host_ringbuf_t;
+
+/**
+ * @brief Header in front of an item
+ */
+typedef struct
+{
+	size_t size;
+	bool complete;
+	bool received;
+} host_item_t;
+
+/**
+ * @brief Gets the space an item takes, with the 8 byte header and the alignment of the device
+ * @param size - the size of the item
+ * @returns The space in bytes
+ */
+static size_t item_space(size_t size)
+{
+	return 8 + ((size + 3) & ~(size_t)3);
+}
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type)
+{
+	host_ringbuf_t *buffer = new host_ringbuf_t();
+	buffer->size = size;
+	return buffer;
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t buffer, void **item, size_t size, TickType_t ticks)
+{
+	host_ringbuf_t *b = reinterpret_cast<host_ringbuf_t *>(buffer);
+	std::unique_lock<std::mutex> guard(b->lock);
+	auto fits = [b, size] { return b->used + item_space(size) <= b->size; };
+	if(ticks == portMAX_DELAY) b->changed.wait(guard, fits);
+	else if(!b->changed.wait_for(guard, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), fits)) return pdFALSE;
+	host_item_t *header = reinterpret_cast<host_item_t *>(new uint8_t[sizeof(host_item_t) + size]);
+	header->size = size;
+	header->complete = false;
+	header->received = false;
+	b->used += item_space(size);
+	b->items.push_back(reinterpret_cast<uint8_t *>(header + 1));
+	*item = header + 1;
+	return pdTRUE;
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t buffer, void *item)
+{
+	host_ringbuf_t *b = reinterpret_cast<host_ringbuf_t *>(buffer);
+	std::lock_guard<std::mutex> guard(b->lock);
+	(reinterpret_cast<host_item_t *>(item) - 1)->complete = true;
+	return pdTRUE;
+}
+
+void *xRingbufferReceive(RingbufHandle_t buffer, size_t *size, TickType_t ticks)
+{
+	host_ringbuf_t *b = reinterpret_cast<host_ringbuf_t *>(buffer);
+	std::lock_guard<std::mutex> guard(b->lock);
+	for(uint8_t *item : b->items)
+	{
+		host_item_t *header = reinterpret_cast<host_item_t *>(item) - 1;
+		if(header->received) continue;
+			// not yet returned
+		if(!header->complete) return nullptr;
+		header->received = true;
+		*size = header->size;
+		return item;
+	}
+	return nullptr;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t buffer, void *item)
+{
+	host_ringbuf_t *b = reinterpret_cast<host_ringbuf_t *>(buffer);
+	std::lock_guard<std::mutex> guard(b->lock);
+	for(auto i = b->items.begin(); i != b->items.end(); i++)
+	{
+		if(*i != item) continue;
+		b->items.erase(i);
+		break;
+	}
+	host_item_t *header = reinterpret_cast<host_item_t *>(item) - 1;
+	b->used -= item_space(header->size);
+	delete[] reinterpret_cast<uint8_t *>(header);
+	b->changed.notify_all();
+}
+#pragma endregion
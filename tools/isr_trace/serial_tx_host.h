@@ -0,0 +1,21 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef SERIAL_TX_HOST_H
+#define SERIAL_TX_HOST_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Gets the time from the last direct FIFO write to its last byte being on the wire
+ * @returns The time in microseconds
+ */
+double host_uart_direct_wire_us();
+
+/**
+ * @brief Gets the bytes written through the port, not counting the direct FIFO writes
+ * @returns The bytes
+ */
+uint32_t host_uart_line_bytes();
+
+#endif
@@ -0,0 +1,116 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host test of the emergency stop latency through the serial link. The firmware's SerialTx runs
+ * against an emulated UART whose 128 byte FIFO drains at the baud rate while a task floods the
+ * line lane with jog lines. In between the test writes feed holds with RealtimeFromISR as the
+ * EMS interrupt does and checks that line traffic never has more than the FIFO limit ahead of
+ * one, so it is on the wire within SERIAL_TX_REALTIME_BUDGET_US and one byte time. The samples
+ * are written as interrupt traces, serial_tx_<baud>.trace, which make test passes to the
+ * analyzer with its limit.
+ *
+ *   make test
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "serial_tx_host.h"
+#include "../../src/serial/serial_tx.h"
+
+#define SAMPLES 200
+#define SAMPLE_INTERVAL_US 7300
+	// longer than the FIFO takes to drain and not a multiple of the 1 ms tick of the transmit task
+#define CPU_HZ 240000000
+#define TRACE_PIN_EMS 0x0004
+	// as in src/trace/isr_trace.h
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { failures++; printf("  FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+static std::atomic<bool> flooding(false);
+
+/**
+ * @brief Task queueing jog lines as fast as the line lane takes them
+ */
+static void flood()
+{
+	static const char line[] = "$J=G91 G21 X0.010 F1000\n";
+	for(;;)
+	{
+		if(flooding.load()) Tx.Write(line, sizeof(line) - 1, pdMS_TO_TICKS(10));
+		else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+/**
+ * @brief Gets the cycle count of a 240 MHz core
+ * @returns The cycle count, wrapping like the device's
+ */
+static uint32_t ccount()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return (uint32_t)(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * CPU_HZ);
+}
+
+/**
+ * @brief Writes feed holds while the line lane is flooded and checks the bytes ahead of them
+ * @param baud - the baud rate
+ */
+static void run(uint32_t baud)
+{
+	uint32_t fifo_limit = std::max<uint32_t>(SERIAL_TX_FIFO_MIN, (uint64_t)baud * SERIAL_TX_REALTIME_BUDGET_US / 10 / 1000000);
+	double byte_us = 10 * 1e6 / baud;
+	printf("%u baud, FIFO limit %u bytes\n", baud, fifo_limit);
+
+	char path[32];
+	snprintf(path, sizeof(path), "serial_tx_%u.trace", baud);
+	FILE *trace = fopen(path, "w");
+	CHECK(trace != nullptr, "unable to write %s", path);
+	if(trace == nullptr) return;
+	fprintf(trace, "# isr trace: cpu_hz %u, records %u, total %u\n", CPU_HZ, SAMPLES * 2, SAMPLES * 2);
+	fprintf(trace, "# core_offset 0\n# ccount core source flags pins\n");
+
+	uint32_t line_bytes = host_uart_line_bytes();
+	flooding = true;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	int ahead_max = 0;
+	double wire_max = 0;
+	for(int i = 0; i < SAMPLES; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(SAMPLE_INTERVAL_US));
+		uint32_t edge = ccount();
+		int ahead = Tx.RealtimeFromISR('!');
+		uint32_t written = ccount();
+		double wire = host_uart_direct_wire_us();
+		fprintf(trace, "%u 0 ems 00 %04x\n", edge, TRACE_PIN_EMS);
+		fprintf(trace, "%u 0 ems_hold 00 %04x\n", written, ahead >= 0 ? ahead : 0xffff);
+		CHECK(ahead >= 0, "feed hold %d not written, FIFO full", i);
+		CHECK(ahead <= (int)fifo_limit, "feed hold %d behind %d bytes", i, ahead);
+		ahead_max = std::max(ahead_max, ahead);
+		if(ahead >= 0) wire_max = std::max(wire_max, wire);
+	}
+	flooding = false;
+	fclose(trace);
+	Tx.Flush();
+
+	printf("  %u line bytes, bytes ahead max %d, on the wire after %.1f us max\n", host_uart_line_bytes() - line_bytes, ahead_max, wire_max);
+	CHECK(host_uart_line_bytes() - line_bytes > SAMPLES * SAMPLE_INTERVAL_US / byte_us / 2, "line lane not flooded");
+	CHECK(ahead_max > 0, "no feed hold met line traffic in the FIFO");
+	CHECK(wire_max <= SERIAL_TX_REALTIME_BUDGET_US + byte_us, "feed hold on the wire after %.1f us", wire_max);
+	CHECK((fifo_limit + 1) * byte_us <= SERIAL_TX_REALTIME_BUDGET_US + byte_us, "FIFO limit %u exceeds the budget", fifo_limit);
+}
+
+int main()
+{
+	std::thread(flood).detach();
+	Serial.begin(115200);
+	Tx.Begin(Serial);
+	run(115200);
+	Tx.SetBaudRate(230400);
+	run(230400);
+	printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+	return failures ? 1 : 0;
+}
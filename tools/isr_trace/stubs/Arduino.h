@@ -0,0 +1,89 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host replacement of the parts of the ESP32 Arduino core and FreeRTOS the serial transmit task
+ * needs. Tasks are threads and time is the real clock, see serial_tx_host.cpp.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#define IRAM_ATTR
+
+using std::min;
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+/**
+ * @brief Minimal Arduino Print
+ */
+class Print
+{
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t c) = 0;
+		virtual size_t write(const uint8_t *buffer, size_t size)
+		{
+			size_t n = 0;
+			while(size--) n += write(*buffer++);
+			return n;
+		}
+		virtual void flush() {}
+		size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+		size_t println(const char *s = "") { return print(s) + print("\n"); }
+		size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+		{
+			char buf[256];
+			va_list args;
+			va_start(args, format);
+			int len = vsnprintf(buf, sizeof(buf), format, args);
+			va_end(args);
+			if(len < 0) return 0;
+			return write((const uint8_t *)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+		}
+};
+
+void delay(uint32_t ms);
+unsigned long micros();
+unsigned long millis();
+
+// FreeRTOS, only what the transmit task and the task plan use
+typedef void *TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+inline void vTaskDelay(TickType_t ticks) { delay(ticks * portTICK_PERIOD_MS); }
+
+typedef enum
+{
+	eNoAction = 0,
+	eSetBits
+} eNotifyAction;
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks);
+uint32_t ulTaskNotifyValueClear(TaskHandle_t task, uint32_t bits);
+
+typedef struct { uint32_t owner; uint32_t count; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+void portENTER_CRITICAL(portMUX_TYPE *mux);
+void portEXIT_CRITICAL(portMUX_TYPE *mux);
+
+#endif
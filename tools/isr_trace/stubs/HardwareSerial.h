@@ -0,0 +1,30 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_HARDWARESERIAL_H
+#define HOST_HARDWARESERIAL_H
+
+#include "Arduino.h"
+
+/**
+ * @brief The port of the G-code link: a 128 byte transmit FIFO without a software buffer,
+ * draining at the baud rate in real time, see serial_tx_host.cpp
+ */
+class HardwareSerial : public Print
+{
+	public:
+		void begin(uint32_t baud) { updateBaudRate(baud); }
+		uint32_t baudRate() const { return _baud; }
+		void updateBaudRate(uint32_t baud);
+		int availableForWrite();
+		size_t write(uint8_t c) override { return write(&c, 1); }
+		size_t write(const uint8_t *buffer, size_t size) override;
+		void flush() override;
+
+	private:
+		uint32_t _baud = 115200;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,22 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_RINGBUF_H
+#define HOST_RINGBUF_H
+
+#include "Arduino.h"
+
+typedef void *RingbufHandle_t;
+
+typedef enum
+{
+	RINGBUF_TYPE_NOSPLIT = 0
+} RingbufferType_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t buffer, void **item, size_t size, TickType_t ticks);
+BaseType_t xRingbufferSendComplete(RingbufHandle_t buffer, void *item);
+void *xRingbufferReceive(RingbufHandle_t buffer, size_t *size, TickType_t ticks);
+void vRingbufferReturnItem(RingbufHandle_t buffer, void *item);
+
+#endif
@@ -0,0 +1,21 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Direct FIFO access as used by interrupt handlers, on the host the FIFO of Serial
+ */
+
+#ifndef HOST_UART_LL_H
+#define HOST_UART_LL_H
+
+#include <cstdint>
+
+typedef struct uart_dev_s uart_dev_t;
+
+uart_dev_t *host_uart_hw(int uart_num);
+uint32_t uart_ll_get_txfifo_len(uart_dev_t *hw);
+void uart_ll_write_txfifo(uart_dev_t *hw, const uint8_t *buf, uint32_t len);
+
+#define UART_LL_GET_HW(num) host_uart_hw(num)
+
+#endif
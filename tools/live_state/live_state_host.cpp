@@ -0,0 +1,112 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host implementation of the services the live state channel links against. Tasks are threads
+ * with a notification counter, time is the real clock, and the wheel is a state the test sets.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "live_state_host.h"
+#include "../../src/tasks/task_plan.h"
+
+TaskPlan Tasks;
+
+static std::mutex wheel_lock;
+static wheel_state_t wheel_state = {Axis::X, Feed::FULL, 0.0f, 0.0f, 0.0f, false};
+
+/**
+ * @brief Sets the state the wheel reports
+ * @param state - the new state
+ */
+void host_set_wheel_state(const wheel_state_t &state)
+{
+	std::lock_guard<std::mutex> guard(wheel_lock);
+	wheel_state = state;
+}
+
+/**
+ * @brief Gets the state the wheel reports
+ * @returns The state
+ */
+wheel_state_t host_wheel_state()
+{
+	std::lock_guard<std::mutex> guard(wheel_lock);
+	return wheel_state;
+}
+
+void Wheel::get_state(wheel_state_t &state) const
+{
+	state = host_wheel_state();
+}
+
+#pragma region Arduino core
+static const auto start = std::chrono::steady_clock::now();
+
+void delay(uint32_t ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+unsigned long millis()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+#pragma endregion
+
+#pragma region FreeRTOS
+/**
+ * @brief A task: a thread with the notification counter of its task control block
+ */
+typedef struct
+{
+	std::mutex lock;
+	std::condition_variable notified;
+	uint32_t count = 0;
+} host_task_t;
+
+static thread_local host_task_t *current_task = nullptr;
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+	host_task_t *t = reinterpret_cast<host_task_t *>(task);
+	std::lock_guard<std::mutex> guard(t->lock);
+	t->count++;
+	t->notified.notify_one();
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+	xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+	host_task_t *t = current_task;
+	std::unique_lock<std::mutex> guard(t->lock);
+	if(ticks == portMAX_DELAY) t->notified.wait(guard, [t] { return t->count > 0; });
+	else t->notified.wait_for(guard, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), [t] { return t->count > 0; });
+	uint32_t count = t->count;
+	if(count > 0) t->count = clear_on_exit ? 0 : count - 1;
+	return count;
+}
+
+BaseType_t xPortInIsrContext()
+{
+	return pdFALSE;
+}
+
+BaseType_t TaskPlan::Create(task_role_t role, TaskFunction_t function, void *args, TaskHandle_t *handle)
+{
+	host_task_t *task = new host_task_t();
+	if(handle != NULL) *handle = task;
+	std::thread([task, function, args] {
+		current_task = task;
+		function(args);
+	}).detach();
+	return pdPASS;
+}
+#pragma endregion
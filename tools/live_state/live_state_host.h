@@ -0,0 +1,21 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef LIVE_STATE_HOST_H
+#define LIVE_STATE_HOST_H
+
+#include "../../src/wheel/wheel.h"
+
+/**
+ * @brief Sets the state the wheel reports
+ * @param state - the new state
+ */
+void host_set_wheel_state(const wheel_state_t &state);
+
+/**
+ * @brief Gets the state the wheel reports
+ * @returns The state
+ */
+wheel_state_t host_wheel_state();
+
+#endif
@@ -0,0 +1,338 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host test of the live state channel. The firmware's LiveState runs against a WebSocket server
+ * on the loopback interface; the test connects as a WebSocket client, changes the wheel state
+ * and checks the frames: the full state on connect, deltas holding exactly the changed fields,
+ * consecutive sequence numbers, no frame without a change and at most LIVE_STATE_MAX_RATE frames
+ * per second while the wheel spins. Applying the frames in order has to give the wheel state. A
+ * delta too large for the frame buffer is dropped, not sent truncated.
+ *
+ *   make test
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include "live_state_host.h"
+#include "../../src/config/live_state.h"
+
+#define WAIT_MS 1000
+	// a frame is expected well within this, the channel sends at least every 1000 / LIVE_STATE_MAX_RATE ms
+#define QUIET_MS 300
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { if(!(condition)) { failures++; printf("  FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+typedef std::map<std::string, std::string> frame_t;
+
+/**
+ * @brief WebSocket client on the loopback interface
+ */
+class Client
+{
+	public:
+		~Client() { if(_fd >= 0) close(_fd); }
+
+		/**
+		 * @brief Connects and runs the opening handshake
+		 * @param port - the server port
+		 * @param path - the requested path
+		 * @returns true if the server switched to WebSocket with the expected accept key
+		 */
+		bool connect(uint16_t port, const char *path)
+		{
+			_fd = socket(AF_INET, SOCK_STREAM, 0);
+			sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addr.sin_port = htons(port);
+			if(::connect(_fd, (sockaddr *)&addr, sizeof(addr)) != 0) return false;
+
+			// the sample nonce of RFC 6455 section 1.3 and the accept value given there
+			std::string request = std::string("GET ") + path + " HTTP/1.1\r\n"
+				"Host: 127.0.0.1\r\n"
+				"Upgrade: websocket\r\n"
+				"Connection: Upgrade\r\n"
+				"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+				"Sec-WebSocket-Version: 13\r\n\r\n";
+			if(send(_fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) return false;
+			std::string response;
+			char c;
+			while(response.find("\r\n\r\n") == std::string::npos && recv(_fd, &c, 1, 0) == 1) response += c;
+			return response.compare(0, 12, "HTTP/1.1 101") == 0 &&
+				response.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos;
+		}
+
+		/**
+		 * @brief Receives the next text frame
+		 * @param text - receives the payload
+		 * @param timeout_ms - how long to wait for the frame to start
+		 * @returns true if a text frame was received
+		 */
+		bool receive(std::string &text, int timeout_ms)
+		{
+			pollfd p = {_fd, POLLIN, 0};
+			if(poll(&p, 1, timeout_ms) <= 0) return false;
+			uint8_t header[2];
+			if(!read(header, 2)) return false;
+			CHECK(header[0] == 0x81, "single text frame expected, got 0x%02x", header[0]);
+			CHECK(!(header[1] & 0x80), "server frames must not be masked");
+			size_t len = header[1] & 0x7f;
+			if(len == 126)
+			{
+				uint8_t ext[2];
+				if(!read(ext, 2)) return false;
+				len = ext[0] << 8 | ext[1];
+			}
+			CHECK(len < 127, "frame length %zu", len);
+			text.assign(len, '\0');
+			return len == 0 || read(&text[0], len);
+		}
+
+		/**
+		 * @brief Sends a masked close frame and waits for the server to answer it
+		 */
+		void close_handshake()
+		{
+			const uint8_t frame[] = {0x88, 0x80, 0x12, 0x34, 0x56, 0x78};
+			send(_fd, frame, sizeof(frame), MSG_NOSIGNAL);
+			uint8_t header[2];
+			CHECK(read(header, 2) && (header[0] & 0x0f) == 0x8, "close frame expected");
+		}
+
+	private:
+		bool read(void *data, size_t size)
+		{
+			char *p = (char *)data;
+			while(size > 0)
+			{
+				ssize_t n = recv(_fd, p, size, 0);
+				if(n <= 0) return false;
+				p += n;
+				size -= n;
+			}
+			return true;
+		}
+
+		int _fd = -1;
+};
+
+/**
+ * @brief Parses a flat JSON object as written by the channel
+ * @param text - the frame
+ * @returns The fields, string values without the quotes
+ */
+static frame_t parse(const std::string &text)
+{
+	frame_t frame;
+	CHECK(text.size() >= 2 && text.front() == '{' && text.back() == '}', "not an object: %s", text.c_str());
+	size_t pos = 1;
+	while(pos < text.size() - 1)
+	{
+		size_t colon = text.find(':', pos);
+		size_t end = text.find(',', colon);
+		if(colon == std::string::npos) break;
+		if(end == std::string::npos) end = text.size() - 1;
+		std::string key = text.substr(pos, colon - pos);
+		std::string value = text.substr(colon + 1, end - colon - 1);
+		CHECK(key.size() >= 2 && key.front() == '"' && key.back() == '"', "key not quoted: %s", text.c_str());
+		key = key.substr(1, key.size() - 2);
+		if(value.size() >= 2 && value.front() == '"') value = value.substr(1, value.size() - 2);
+		CHECK(frame.count(key) == 0, "duplicate key %s", key.c_str());
+		frame[key] = value;
+		pos = end + 1;
+	}
+	return frame;
+}
+
+/**
+ * @brief The view of a client: the state rebuilt from the frames it received
+ */
+class View
+{
+	public:
+		View(const char *name) : _name(name) {}
+
+		/**
+		 * @brief Receives and applies the next frame
+		 * @param client - the connection
+		 * @param timeout_ms - how long to wait
+		 * @param fields - receives the fields of the frame, may be nullptr
+		 * @returns true if a frame was received
+		 */
+		bool next(Client &client, int timeout_ms, frame_t *fields = nullptr)
+		{
+			std::string text;
+			if(!client.receive(text, timeout_ms)) return false;
+			frame_t frame = parse(text);
+			CHECK(frame.count("seq") == 1, "%s: frame without seq: %s", _name, text.c_str());
+			uint32_t seq = strtoul(frame["seq"].c_str(), nullptr, 10);
+			if(_frames > 0) CHECK(seq == _seq + 1, "%s: seq %u after %u", _name, seq, _seq);
+			_seq = seq;
+			_frames++;
+			for(auto &kv : frame)
+			{
+				if(kv.first == "seq") continue;
+				CHECK(kv.first == "axis" || kv.first == "feed" || kv.first == "x" || kv.first == "y" || kv.first == "z" || kv.first == "ems",
+					"%s: unknown field %s", _name, kv.first.c_str());
+				_state[kv.first] = kv.second;
+			}
+			if(fields) *fields = frame;
+			return true;
+		}
+
+		/**
+		 * @brief Checks that the rebuilt state equals the state of the wheel
+		 */
+		void check(const wheel_state_t &expected)
+		{
+			CHECK(_state.size() == 6, "%s: %zu fields known", _name, _state.size());
+			CHECK(_state["axis"] == std::string(1, (char)expected.axis), "%s: axis %s", _name, _state["axis"].c_str());
+			check_number("feed", expected.feed);
+			check_number("x", expected.x);
+			check_number("y", expected.y);
+			check_number("z", expected.z);
+			CHECK(_state["ems"] == (expected.emergency ? "true" : "false"), "%s: ems %s", _name, _state["ems"].c_str());
+		}
+
+		uint32_t seq() const { return _seq; }
+		int frames() const { return _frames; }
+
+	private:
+		void check_number(const char *key, float expected)
+		{
+			float value = strtof(_state[key].c_str(), nullptr);
+			CHECK(fabsf(value - expected) < 0.0005f, "%s: %s is %s, expected %.3f", _name, key, _state[key].c_str(), expected);
+		}
+
+		const char *_name;
+		frame_t _state;
+		uint32_t _seq = 0;
+		int _frames = 0;
+};
+
+/**
+ * @brief Changes the wheel state and notifies the channel like the wheel does
+ */
+static void change(void (*update)(wheel_state_t &))
+{
+	wheel_state_t state = host_wheel_state();
+	update(state);
+	host_set_wheel_state(state);
+	Live.Notify();
+}
+
+/**
+ * @brief Checks that a frame holds exactly the given fields besides seq
+ */
+static void check_fields(const char *name, const frame_t &frame, std::initializer_list<const char *> fields)
+{
+	CHECK(frame.size() == fields.size() + 1, "%s: %zu fields, expected %zu", name, frame.size() - 1, fields.size());
+	for(const char *field : fields) CHECK(frame.count(field) == 1, "%s: %s missing", name, field);
+}
+
+int main()
+{
+	// the channel only calls get_state, which the host implements, the wheel itself is never constructed
+	alignas(Wheel) static uint8_t wheel[sizeof(Wheel)];
+	host_set_wheel_state({Axis::X, Feed::FULL, 1.0f, 2.0f, 3.0f, false});
+
+	AsyncWebServer server(0);
+	Live.Attach(server);
+	server.begin();
+	Live.Begin(reinterpret_cast<Wheel *>(wheel));
+
+	Client a;
+	View view_a("a");
+	frame_t frame;
+
+	printf("handshake\n");
+	Client unknown;
+	CHECK(!unknown.connect(server.port(), "/other"), "only %s upgrades", LIVE_STATE_URI);
+	CHECK(a.connect(server.port(), LIVE_STATE_URI), "handshake failed");
+
+	printf("full state on connect\n");
+	CHECK(view_a.next(a, WAIT_MS, &frame), "no frame on connect");
+	check_fields("connect", frame, {"axis", "feed", "x", "y", "z", "ems"});
+	view_a.check(host_wheel_state());
+
+	printf("single field delta\n");
+	change([](wheel_state_t &s) { s.x = 1.25f; });
+	CHECK(view_a.next(a, WAIT_MS, &frame), "no frame for x");
+	check_fields("x", frame, {"x"});
+	view_a.check(host_wheel_state());
+
+	printf("several fields\n");
+	change([](wheel_state_t &s) { s.axis = Axis::Y; s.feed = Feed::MILLI; s.emergency = true; });
+	CHECK(view_a.next(a, WAIT_MS, &frame), "no frame for the selection");
+	check_fields("selection", frame, {"axis", "feed", "ems"});
+	view_a.check(host_wheel_state());
+
+	printf("no change, no frame\n");
+	Live.Notify();
+	CHECK(!view_a.next(a, QUIET_MS), "frame without a change");
+
+	printf("spin coalesced to %d frames per second\n", LIVE_STATE_MAX_RATE);
+	int before = view_a.frames();
+	auto start = std::chrono::steady_clock::now();
+	for(int i=1; i<=500; i++)
+	{
+		change([](wheel_state_t &s) { s.y += 0.001f; });
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		while(view_a.next(a, 0, &frame)) check_fields("spin", frame, {"y"});
+	}
+	while(view_a.next(a, QUIET_MS, &frame)) check_fields("spin", frame, {"y"});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	int frames = view_a.frames() - before;
+	printf("  500 changes in %.2fs sent as %d frames\n", seconds, frames);
+	CHECK(frames >= 2, "the spin was not reported");
+	CHECK(frames <= seconds * LIVE_STATE_MAX_RATE + 2, "%d frames in %.2fs", frames, seconds);
+	view_a.check(host_wheel_state());
+
+	printf("second client\n");
+	Client b;
+	View view_b("b");
+	CHECK(b.connect(server.port(), LIVE_STATE_URI), "handshake failed");
+	CHECK(view_b.next(b, WAIT_MS, &frame), "no frame on connect");
+	check_fields("connect", frame, {"axis", "feed", "x", "y", "z", "ems"});
+	CHECK(view_b.seq() == view_a.seq(), "full state seq %u, last sent %u", view_b.seq(), view_a.seq());
+	view_b.check(host_wheel_state());
+	change([](wheel_state_t &s) { s.z = -45.0f; s.emergency = false; });
+	CHECK(view_a.next(a, WAIT_MS, &frame), "a: no frame for z");
+	check_fields("a", frame, {"z", "ems"});
+	CHECK(view_b.next(b, WAIT_MS, &frame), "b: no frame for z");
+	check_fields("b", frame, {"z", "ems"});
+	CHECK(view_a.seq() == view_b.seq(), "a at seq %u, b at seq %u", view_a.seq(), view_b.seq());
+	view_a.check(host_wheel_state());
+	view_b.check(host_wheel_state());
+
+	printf("client leaves\n");
+	b.close_handshake();
+	change([](wheel_state_t &s) { s.axis = Axis::Z; });
+	CHECK(view_a.next(a, WAIT_MS, &frame), "no frame after the other client left");
+	check_fields("axis", frame, {"axis"});
+	view_a.check(host_wheel_state());
+
+	printf("frame too large for the buffer\n");
+	wheel_state_t last = host_wheel_state();
+	change([](wheel_state_t &s) { s.x = s.y = s.z = -3e38f; s.emergency = !s.emergency; });
+		// the delta takes more than LIVE_STATE_FRAME_SIZE characters
+	CHECK(!view_a.next(a, QUIET_MS, &frame), "a frame past LIVE_STATE_FRAME_SIZE was sent");
+	host_set_wheel_state(last);
+	change([](wheel_state_t &s) { s.x = 5.0f; });
+	CHECK(view_a.next(a, WAIT_MS, &frame), "no frame after the oversized state");
+	check_fields("x", frame, {"x"});
+	view_a.check(host_wheel_state());
+
+	printf(failures ? "%d checks failed\n" : "all checks passed\n", failures);
+	fflush(stdout);
+	_exit(failures ? 1 : 0);
+		// the channel task runs forever like on the device, leave without the static destructors
+}
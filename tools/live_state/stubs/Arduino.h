@@ -0,0 +1,137 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host replacement of the parts of the ESP32 Arduino core the live state channel and the headers
+ * it includes need. Tasks are threads and time is the real clock, see live_state_host.cpp.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define PROGMEM
+#define IRAM_ATTR
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+/**
+ * @brief Minimal Arduino String, enough for the display and logging interfaces
+ */
+class String
+{
+	public:
+		String(const char *s = "") : _s(s ? s : "") {}
+		String(const __FlashStringHelper *s) : _s(reinterpret_cast<const char *>(s)) {}
+		const char *c_str() const { return _s.c_str(); }
+		unsigned int length() const { return _s.length(); }
+		bool isEmpty() const { return _s.empty(); }
+		bool operator==(const char *s) const { return _s == s; }
+		String &operator+=(const String &s) { _s += s._s; return *this; }
+
+	private:
+		std::string _s;
+};
+
+/**
+ * @brief Minimal Arduino Print
+ */
+class Print
+{
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t c) = 0;
+		virtual size_t write(const uint8_t *buffer, size_t size)
+		{
+			size_t n = 0;
+			while(size--) n += write(*buffer++);
+			return n;
+		}
+		size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+		size_t print(const String &s) { return print(s.c_str()); }
+		size_t println(const char *s = "") { return print(s) + print("\n"); }
+		size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+		{
+			char buf[256];
+			va_list args;
+			va_start(args, format);
+			int len = vsnprintf(buf, sizeof(buf), format, args);
+			va_end(args);
+			if(len < 0) return 0;
+			return write((const uint8_t *)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+		}
+};
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+unsigned long micros();
+unsigned long millis();
+long random(long max);
+long random(long min, long max);
+
+inline char *dtostrf(double number, signed char width, unsigned char prec, char *s)
+{
+	sprintf(s, "%*.*f", width, prec, number);
+	return s;
+}
+
+// FreeRTOS and ESP-IDF, only the declarations the wheel, display and logging headers need
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+inline void vTaskDelay(TickType_t ticks) { delay(ticks * portTICK_PERIOD_MS); }
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef void *QueueHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+
+void xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+BaseType_t xPortInIsrContext();
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+typedef struct { uint32_t owner; uint32_t count; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+
+#define MALLOC_CAP_8BIT (1 << 2)
+void *heap_caps_malloc(size_t size, uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+class EspClass
+{
+	public:
+		uint32_t getFreeHeap();
+};
+extern EspClass ESP;
+
+#endif
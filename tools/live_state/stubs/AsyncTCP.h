@@ -0,0 +1,4 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+// Nothing needed on the host, the web server stub talks to the sockets directly.
@@ -0,0 +1,134 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host replacement of the parts of ESPAsyncWebServer the live state channel uses. The server
+ * listens on the loopback interface and speaks real WebSocket (RFC 6455), so the test talks to
+ * the channel through a socket like a browser would. Implemented in ws_host.cpp.
+ */
+
+#ifndef HOST_ESP_ASYNC_WEB_SERVER_H
+#define HOST_ESP_ASYNC_WEB_SERVER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef enum
+{
+	WS_EVT_CONNECT,
+	WS_EVT_DISCONNECT,
+	WS_EVT_PONG,
+	WS_EVT_ERROR,
+	WS_EVT_DATA
+} AwsEventType;
+
+class AsyncWebSocket;
+class AsyncWebSocketClient;
+
+typedef std::function<void(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)> AwsEventHandler;
+
+/**
+ * @brief Base of the handlers registered with the server
+ */
+class AsyncWebHandler
+{
+	public:
+		virtual ~AsyncWebHandler() {}
+
+		/**
+		 * @brief Takes over a connection after the HTTP request was read
+		 * @param fd - the socket
+		 * @param path - the requested path
+		 * @param key - the Sec-WebSocket-Key of the request, empty if none
+		 * @returns true if the handler took the connection, false to answer 404
+		 */
+		virtual bool handle(int fd, const std::string &path, const std::string &key) = 0;
+};
+
+/**
+ * @brief A connected WebSocket client
+ */
+class AsyncWebSocketClient
+{
+	public:
+		AsyncWebSocketClient(AsyncWebSocket *server, int fd, uint32_t id);
+		~AsyncWebSocketClient();
+		uint32_t id() const { return _id; }
+		bool connected() const { return _connected; }
+		void text(const char *message);
+		void text(const char *message, size_t len);
+
+	private:
+		friend class AsyncWebSocket;
+
+		/**
+		 * @brief Reads the frames of the client until it closes the connection
+		 */
+		void reader();
+
+		AsyncWebSocket *_server;
+		int _fd;
+		uint32_t _id;
+		std::atomic<bool> _connected;
+		std::mutex _send_lock;
+		std::thread _reader;
+};
+
+/**
+ * @brief WebSocket endpoint
+ */
+class AsyncWebSocket : public AsyncWebHandler
+{
+	public:
+		AsyncWebSocket(const String &url) : _url(url.c_str()) {}
+		void onEvent(AwsEventHandler handler) { _handler = handler; }
+		size_t count();
+		void cleanupClients(uint16_t maxClients = 8);
+		void textAll(const char *message);
+		void textAll(const char *message, size_t len);
+		bool handle(int fd, const std::string &path, const std::string &key) override;
+
+	private:
+		friend class AsyncWebSocketClient;
+
+		std::string _url;
+		AwsEventHandler _handler;
+		std::mutex _lock;
+		std::vector<AsyncWebSocketClient *> _clients;
+		uint32_t _next_id = 1;
+};
+
+/**
+ * @brief HTTP server on the loopback interface
+ */
+class AsyncWebServer
+{
+	public:
+		/**
+		 * @param port - the port, 0 to pick a free one, see port()
+		 */
+		AsyncWebServer(uint16_t port) : _port(port) {}
+		void addHandler(AsyncWebHandler *handler) { _handlers.push_back(handler); }
+		void begin();
+
+		/**
+		 * @brief Gets the port the server listens on, host only
+		 */
+		uint16_t port() const { return _port; }
+
+	private:
+		/**
+		 * @brief Accepts connections and hands them to the handlers
+		 */
+		void acceptor();
+
+		uint16_t _port;
+		int _fd = -1;
+		std::vector<AsyncWebHandler *> _handlers;
+};
+
+#endif
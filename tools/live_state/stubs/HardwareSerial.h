@@ -0,0 +1,15 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_HARDWARESERIAL_H
+#define HOST_HARDWARESERIAL_H
+
+#include "Arduino.h"
+
+class HardwareSerial : public Print
+{
+	public:
+		size_t write(uint8_t c) override { return fputc(c, stderr) == EOF ? 0 : 1; }
+};
+
+#endif
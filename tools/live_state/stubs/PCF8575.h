@@ -0,0 +1,10 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_PCF8575_H
+#define HOST_PCF8575_H
+
+// the wheel only holds a pointer to the expander
+class PCF8575;
+
+#endif
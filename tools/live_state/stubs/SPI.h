@@ -0,0 +1,16 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+// the display driver is only compiled against the declarations, the channel never draws
+class SPIClass
+{
+	public:
+		SPIClass(uint8_t spi_bus = 2) {}
+};
+
+#endif
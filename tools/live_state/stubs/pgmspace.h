@@ -0,0 +1,9 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_PGMSPACE_H
+#define HOST_PGMSPACE_H
+
+// nothing needed on the host, the display sources include it for the ESP32 core
+
+#endif
@@ -0,0 +1,9 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_PINS_ARDUINO_H
+#define HOST_PINS_ARDUINO_H
+
+// nothing needed on the host, the display sources include it for the ESP32 core
+
+#endif
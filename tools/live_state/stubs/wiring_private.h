@@ -0,0 +1,9 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+#ifndef HOST_WIRING_PRIVATE_H
+#define HOST_WIRING_PRIVATE_H
+
+// nothing needed on the host, the display sources include it for the ESP32 core
+
+#endif
@@ -0,0 +1,311 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Minimal WebSocket server behind the ESPAsyncWebServer stub: the opening handshake, unmasked
+ * text frames to the clients and the close handshake. Frames from the clients other than close
+ * are read and dropped, the live state channel does not take input.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <ESPAsyncWebServer.h>
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_CLOSE 0x8
+
+#pragma region handshake
+/**
+ * @brief Computes the SHA-1 digest of a string
+ * @param s - the string
+ * @param digest - receives the 20 byte digest
+ */
+static void sha1(const std::string &s, uint8_t digest[20])
+{
+	uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	std::string m = s;
+	uint64_t bits = (uint64_t)s.size() * 8;
+	m += (char)0x80;
+	while(m.size() % 64 != 56) m += (char)0;
+	for(int i=7; i>=0; i--) m += (char)(bits >> (i * 8));
+
+	auto rol = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+	for(size_t block=0; block<m.size(); block+=64)
+	{
+		uint32_t w[80];
+		for(int i=0; i<16; i++)
+		{
+			const uint8_t *p = (const uint8_t *)m.data() + block + i * 4;
+			w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+		}
+		for(int i=16; i<80; i++) w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for(int i=0; i<80; i++)
+		{
+			uint32_t f, k;
+			if(i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+			else if(i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+			else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+			uint32_t t = rol(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = rol(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+	for(int i=0; i<20; i++) digest[i] = h[i / 4] >> (24 - (i % 4) * 8);
+}
+
+/**
+ * @brief Encodes bytes as base64
+ * @param data - the bytes
+ * @param size - the number of bytes
+ * @returns The encoded string
+ */
+static std::string base64(const uint8_t *data, size_t size)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	for(size_t i=0; i<size; i+=3)
+	{
+		uint32_t v = (uint32_t)data[i] << 16;
+		if(i + 1 < size) v |= (uint32_t)data[i + 1] << 8;
+		if(i + 2 < size) v |= data[i + 2];
+		out += alphabet[(v >> 18) & 0x3f];
+		out += alphabet[(v >> 12) & 0x3f];
+		out += i + 1 < size ? alphabet[(v >> 6) & 0x3f] : '=';
+		out += i + 2 < size ? alphabet[v & 0x3f] : '=';
+	}
+	return out;
+}
+
+/**
+ * @brief Writes all bytes to a socket
+ * @returns true if all bytes were written
+ */
+static bool send_all(int fd, const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+	while(size > 0)
+	{
+		ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+		if(n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * @brief Reads exactly size bytes from a socket
+ * @returns true if all bytes were read, false on error or end of stream
+ */
+static bool recv_all(int fd, void *data, size_t size)
+{
+	char *p = (char *)data;
+	while(size > 0)
+	{
+		ssize_t n = recv(fd, p, size, 0);
+		if(n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * @brief Writes a frame without mask, as a server does
+ */
+static bool send_frame(int fd, uint8_t opcode, const char *payload, size_t len)
+{
+	uint8_t header[10];
+	size_t n = 0;
+	header[n++] = 0x80 | opcode;
+	if(len < 126) header[n++] = (uint8_t)len;
+	else if(len < 65536)
+	{
+		header[n++] = 126;
+		header[n++] = len >> 8;
+		header[n++] = len & 0xff;
+	}
+	else
+	{
+		header[n++] = 127;
+		for(int i=7; i>=0; i--) header[n++] = (uint8_t)((uint64_t)len >> (i * 8));
+	}
+	return send_all(fd, header, n) && (len == 0 || send_all(fd, payload, len));
+}
+#pragma endregion
+
+#pragma region AsyncWebSocketClient
+AsyncWebSocketClient::AsyncWebSocketClient(AsyncWebSocket *server, int fd, uint32_t id) :
+	_server(server), _fd(fd), _id(id), _connected(true)
+{
+}
+
+AsyncWebSocketClient::~AsyncWebSocketClient()
+{
+	if(_reader.joinable()) _reader.join();
+	close(_fd);
+}
+
+void AsyncWebSocketClient::text(const char *message)
+{
+	text(message, strlen(message));
+}
+
+void AsyncWebSocketClient::text(const char *message, size_t len)
+{
+	if(!_connected) return;
+	std::lock_guard<std::mutex> guard(_send_lock);
+	send_frame(_fd, WS_OPCODE_TEXT, message, len);
+}
+
+void AsyncWebSocketClient::reader()
+{
+	for(;;)
+	{
+		uint8_t header[2];
+		if(!recv_all(_fd, header, 2)) break;
+		uint64_t len = header[1] & 0x7f;
+		if(len >= 126)
+		{
+			uint8_t ext[8];
+			size_t n = len == 126 ? 2 : 8;
+			if(!recv_all(_fd, ext, n)) break;
+			len = 0;
+			for(size_t i=0; i<n; i++) len = len << 8 | ext[i];
+		}
+		uint8_t mask[4] = {};
+		if((header[1] & 0x80) && !recv_all(_fd, mask, 4)) break;
+		std::string payload(len, '\0');
+		if(len > 0 && !recv_all(_fd, &payload[0], len)) break;
+		if((header[0] & 0x0f) == WS_OPCODE_CLOSE)
+		{
+			std::lock_guard<std::mutex> guard(_send_lock);
+			send_frame(_fd, WS_OPCODE_CLOSE, nullptr, 0);
+			break;
+		}
+	}
+	if(_server->_handler) _server->_handler(_server, this, WS_EVT_DISCONNECT, nullptr, nullptr, 0);
+	_connected = false;
+		// last access, cleanupClients may delete the client from here on
+}
+#pragma endregion
+
+#pragma region AsyncWebSocket
+size_t AsyncWebSocket::count()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	size_t n = 0;
+	for(AsyncWebSocketClient *client : _clients) if(client->connected()) n++;
+	return n;
+}
+
+void AsyncWebSocket::cleanupClients(uint16_t maxClients)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	for(auto it = _clients.begin(); it != _clients.end();)
+	{
+		if((*it)->connected()) { ++it; continue; }
+		delete *it;
+		it = _clients.erase(it);
+	}
+}
+
+void AsyncWebSocket::textAll(const char *message)
+{
+	textAll(message, strlen(message));
+}
+
+void AsyncWebSocket::textAll(const char *message, size_t len)
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	for(AsyncWebSocketClient *client : _clients) client->text(message, len);
+}
+
+bool AsyncWebSocket::handle(int fd, const std::string &path, const std::string &key)
+{
+	if(path != _url || key.empty()) return false;
+	uint8_t digest[20];
+	sha1(key + WS_GUID, digest);
+	std::string response =
+		"HTTP/1.1 101 Switching Protocols\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Accept: " + base64(digest, sizeof(digest)) + "\r\n\r\n";
+	if(!send_all(fd, response.data(), response.size()))
+	{
+		close(fd);
+		return true;
+	}
+
+	// like the library the client is listed before the connect event
+	AsyncWebSocketClient *client;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		client = new AsyncWebSocketClient(this, fd, _next_id++);
+		_clients.push_back(client);
+	}
+	if(_handler) _handler(this, client, WS_EVT_CONNECT, nullptr, nullptr, 0);
+	client->_reader = std::thread(&AsyncWebSocketClient::reader, client);
+	return true;
+}
+#pragma endregion
+
+#pragma region AsyncWebServer
+void AsyncWebServer::begin()
+{
+	_fd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(_port);
+	if(bind(_fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(_fd, 4) != 0)
+	{
+		perror("web server");
+		exit(2);
+	}
+	socklen_t len = sizeof(addr);
+	getsockname(_fd, (sockaddr *)&addr, &len);
+	_port = ntohs(addr.sin_port);
+	std::thread(&AsyncWebServer::acceptor, this).detach();
+}
+
+void AsyncWebServer::acceptor()
+{
+	for(;;)
+	{
+		int fd = accept(_fd, nullptr, nullptr);
+		if(fd < 0) continue;
+
+		// the request line and the headers, byte by byte so nothing of a frame is consumed
+		std::string request;
+		char c;
+		while(request.find("\r\n\r\n") == std::string::npos && request.size() < 4096 && recv(fd, &c, 1, 0) == 1) request += c;
+		std::string path, key;
+		size_t start = request.find(' ');
+		if(start != std::string::npos) path = request.substr(start + 1, request.find(' ', start + 1) - start - 1);
+		size_t k = request.find("Sec-WebSocket-Key:");
+		if(k != std::string::npos)
+		{
+			k += strlen("Sec-WebSocket-Key:");
+			while(k < request.size() && request[k] == ' ') k++;
+			key = request.substr(k, request.find("\r\n", k) - k);
+		}
+
+		bool handled = false;
+		for(AsyncWebHandler *handler : _handlers) if(!handled) handled = handler->handle(fd, path, key);
+		if(!handled)
+		{
+			const char *response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+			send_all(fd, response, strlen(response));
+			close(fd);
+		}
+	}
+}
+#pragma endregion
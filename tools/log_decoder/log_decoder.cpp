@@ -0,0 +1,434 @@
+// Copyright (c) Thor Schueler. All rights reserved.
+// SPDX-License-Identifier: MIT
+
+/*
+ * Host side decoder for the binary log records written by SerialLogger in binary mode.
+ *
+ *   log_decoder scan <source dir or file>...     writes the format string table to stdout
+ *   log_decoder decode <table> [capture file]    decodes a capture (stdin if omitted) to stdout
+ *
+ * The string table is produced from the firmware sources, so it has to be regenerated whenever
+ * log messages change (the Makefile does that as part of the default target). Bytes in the capture
+ * that are not part of a valid record, for example text lines written before binary mode was
+ * enabled, are passed through unchanged.
+ *
+ * Record layout (see SerialLogger.h):
+ *   sync (0xA5) | length | level | format id (4) | millis (4) | arguments... | xor checksum
+ */
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define LOG_RECORD_SYNC 0xA5
+#define LOG_RECORD_TRUNCATED 0x80
+#define LOG_RECORD_HEADER 9
+
+static const char *level_tags[] = {" [INFO] ", " [ERROR] "};
+static const char *log_calls[] = {"Info_f(", "Error_f(", "Info(", "Error(", "log_f("};
+
+/**
+ * @brief Computes the id of a format string. Must match SerialLogger::format_id.
+ * @param format - the format string
+ * @return the FNV-1a hash of the format string
+ */
+static uint32_t format_id(const std::string &format)
+{
+	uint32_t id = 2166136261u;
+	for(unsigned char c : format)
+	{
+		id ^= c;
+		id *= 16777619u;
+	}
+	return id;
+}
+
+#pragma region string table
+/**
+ * @brief Parses a C string literal, including adjacent literals
+ * @param src - the source text
+ * @param pos - position of the opening quote, receives the position after the literal
+ * @param out - receives the literal value
+ * @return true if a literal was parsed
+ */
+static bool parse_literal(const std::string &src, size_t &pos, std::string &out)
+{
+	if(pos >= src.size() || src[pos] != '"') return false;
+	out.clear();
+	while(pos < src.size() && src[pos] == '"')
+	{
+		pos++;
+		while(pos < src.size() && src[pos] != '"')
+		{
+			char c = src[pos++];
+			if(c != '\\' || pos >= src.size())
+			{
+				out += c;
+				continue;
+			}
+			c = src[pos++];
+			switch(c)
+			{
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case '0': out += '\0'; break;
+				case 'x':
+				{
+					int v = 0;
+					while(pos < src.size() && isxdigit((unsigned char)src[pos])) v = v * 16 + std::stoi(std::string(1, src[pos++]), nullptr, 16);
+					out += (char)v;
+					break;
+				}
+				default: out += c; break;
+			}
+		}
+		pos++;
+		size_t next = pos;
+		while(next < src.size() && isspace((unsigned char)src[next])) next++;
+		if(next < src.size() && src[next] == '"') pos = next;
+	}
+	return true;
+}
+
+/**
+ * @brief Escapes a format string for the table file
+ * @param s - the format string
+ * @return the escaped string
+ */
+static std::string escape(const std::string &s)
+{
+	std::string out;
+	for(char c : s)
+	{
+		if(c == '\\') out += "\\\\";
+		else if(c == '\n') out += "\\n";
+		else if(c == '\r') out += "\\r";
+		else if(c == '\t') out += "\\t";
+		else out += c;
+	}
+	return out;
+}
+
+/**
+ * @brief Reverses escape()
+ * @param s - the escaped string
+ * @return the format string
+ */
+static std::string unescape(const std::string &s)
+{
+	std::string out;
+	for(size_t i = 0; i < s.size(); i++)
+	{
+		if(s[i] != '\\' || i + 1 == s.size())
+		{
+			out += s[i];
+			continue;
+		}
+		char c = s[++i];
+		out += c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c;
+	}
+	return out;
+}
+
+/**
+ * @brief Collects the format strings passed to the logger in a source file
+ * @param path - the source file
+ * @param table - receives the format strings by id
+ */
+static void scan_file(const std::filesystem::path &path, std::map<uint32_t, std::string> &table)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::string src((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	for(const char *call : log_calls)
+	{
+		size_t pos = 0;
+		while((pos = src.find(call, pos)) != std::string::npos)
+		{
+			if(pos > 0 && (isalnum((unsigned char)src[pos - 1]) || src[pos - 1] == '_'))
+			{
+				pos++;
+				continue;
+			}
+			pos += strlen(call);
+			if(strcmp(call, "log_f(") == 0)
+			{
+				// the logger's internal calls pass the level first
+				size_t comma = src.find(',', pos);
+				if(comma == std::string::npos) continue;
+				pos = comma + 1;
+			}
+			while(pos < src.size() && isspace((unsigned char)src[pos])) pos++;
+			if(src.compare(pos, 2, "F(") == 0) pos += 2;
+			while(pos < src.size() && isspace((unsigned char)src[pos])) pos++;
+			std::string format;
+			if(!parse_literal(src, pos, format)) continue;
+			uint32_t id = format_id(format);
+			auto it = table.find(id);
+			if(it != table.end() && it->second != format)
+				std::cerr << "warning: id collision " << std::hex << id << " between \"" << escape(it->second) << "\" and \"" << escape(format) << "\"\n";
+			table[id] = format;
+		}
+	}
+}
+
+/**
+ * @brief Writes the string table for the given sources
+ * @param dirs - the source files and directories
+ * @return process exit code
+ */
+static int scan(const std::vector<std::string> &dirs)
+{
+	std::map<uint32_t, std::string> table;
+	table[format_id("%s")] = "%s";
+	for(const std::string &dir : dirs)
+	{
+		if(std::filesystem::is_regular_file(dir))
+		{
+			scan_file(dir, table);
+			continue;
+		}
+		for(const auto &entry : std::filesystem::recursive_directory_iterator(dir))
+		{
+			std::string ext = entry.path().extension().string();
+			if(entry.is_regular_file() && (ext == ".cpp" || ext == ".h" || ext == ".ino")) scan_file(entry.path(), table);
+		}
+	}
+	for(const auto &kv : table) printf("%08x\t%s\n", kv.first, escape(kv.second).c_str());
+	return 0;
+}
+
+/**
+ * @brief Loads a string table written by scan()
+ * @param path - the table file
+ * @param table - receives the format strings by id
+ * @return true on success
+ */
+static bool load_table(const std::string &path, std::map<uint32_t, std::string> &table)
+{
+	std::ifstream in(path);
+	if(!in) return false;
+	std::string line;
+	while(std::getline(in, line))
+	{
+		size_t tab = line.find('\t');
+		if(tab == std::string::npos) continue;
+		table[(uint32_t)std::stoul(line.substr(0, tab), nullptr, 16)] = unescape(line.substr(tab + 1));
+	}
+	return true;
+}
+#pragma endregion
+
+#pragma region decoding
+/**
+ * @brief Cursor over the argument bytes of a record
+ */
+struct reader_t
+{
+	const uint8_t *p;
+	const uint8_t *end;
+
+	bool get(void *v, size_t n)
+	{
+		if(p + n > end) return false;
+		memcpy(v, p, n);
+		p += n;
+		return true;
+	}
+};
+
+/**
+ * @brief Formats a record's arguments with its format string
+ * @param format - the format string
+ * @param args - the argument bytes
+ * @return the message
+ */
+static std::string format_record(const std::string &format, reader_t args)
+{
+	std::string out;
+	char buf[512];
+	for(size_t i = 0; i < format.size(); i++)
+	{
+		if(format[i] != '%')
+		{
+			out += format[i];
+			continue;
+		}
+		if(i + 1 < format.size() && format[i + 1] == '%')
+		{
+			out += '%';
+			i++;
+			continue;
+		}
+
+		// rebuild the conversion for the host, resolving '*' and dropping the length modifiers as
+		// the argument width is given by the record
+		std::string spec = "%";
+		size_t j = i + 1;
+		int longs = 0;
+		bool ok = true;
+		while(j < format.size() && strchr("-+ #0", format[j])) spec += format[j++];
+		for(int field = 0; field < 2; field++)
+		{
+			if(field == 1)
+			{
+				if(j >= format.size() || format[j] != '.') break;
+				spec += format[j++];
+			}
+			if(j < format.size() && format[j] == '*')
+			{
+				int32_t v = 0;
+				ok = ok && args.get(&v, 4);
+				spec += std::to_string(v);
+				j++;
+			}
+			while(j < format.size() && isdigit((unsigned char)format[j])) spec += format[j++];
+		}
+		for(; j < format.size() && strchr("hlzjtL", format[j]); j++)
+		{
+			if(format[j] == 'l') longs++;
+			if(format[j] == 'j') longs = 2;
+		}
+		if(j >= format.size()) break;
+		char conv = format[j];
+		i = j;
+
+		switch(conv)
+		{
+			case 'd': case 'i':
+				if(longs >= 2) { int64_t v = 0; ok = ok && args.get(&v, 8); snprintf(buf, sizeof(buf), (spec + "lld").c_str(), (long long)v); }
+				else { int32_t v = 0; ok = ok && args.get(&v, 4); snprintf(buf, sizeof(buf), (spec + conv).c_str(), (int)v); }
+				break;
+			case 'u': case 'x': case 'X': case 'o':
+				if(longs >= 2) { uint64_t v = 0; ok = ok && args.get(&v, 8); snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(), (unsigned long long)v); }
+				else { uint32_t v = 0; ok = ok && args.get(&v, 4); snprintf(buf, sizeof(buf), (spec + conv).c_str(), (unsigned)v); }
+				break;
+			case 'c':
+			{
+				int32_t v = 0;
+				ok = ok && args.get(&v, 4);
+				snprintf(buf, sizeof(buf), (spec + conv).c_str(), (int)v);
+				break;
+			}
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			{
+				double v = 0;
+				ok = ok && args.get(&v, 8);
+				snprintf(buf, sizeof(buf), (spec + conv).c_str(), v);
+				break;
+			}
+			case 's':
+			{
+				uint8_t n = 0;
+				ok = ok && args.get(&n, 1) && args.p + n <= args.end;
+				std::string s = ok ? std::string((const char *)args.p, n) : std::string();
+				if(ok) args.p += n;
+				snprintf(buf, sizeof(buf), (spec + conv).c_str(), s.c_str());
+				break;
+			}
+			case 'p':
+			{
+				uint32_t v = 0;
+				ok = ok && args.get(&v, 4);
+				snprintf(buf, sizeof(buf), "0x%08x", v);
+				break;
+			}
+			default:
+				buf[0] = '\0';
+				break;
+		}
+		if(!ok)
+		{
+			out += "<?>";
+			break;
+		}
+		out += buf;
+	}
+	return out;
+}
+
+/**
+ * @brief Decodes a capture
+ * @param table_path - the string table
+ * @param capture_path - the capture file, empty for stdin
+ * @return process exit code
+ */
+static int decode(const std::string &table_path, const std::string &capture_path)
+{
+	std::map<uint32_t, std::string> table;
+	if(!load_table(table_path, table))
+	{
+		std::cerr << "unable to read string table " << table_path << "\n";
+		return 1;
+	}
+	std::vector<uint8_t> data;
+	if(capture_path.empty()) data.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+	else
+	{
+		std::ifstream in(capture_path, std::ios::binary);
+		if(!in)
+		{
+			std::cerr << "unable to read capture " << capture_path << "\n";
+			return 1;
+		}
+		data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	size_t records = 0, unknown = 0;
+	for(size_t i = 0; i < data.size(); )
+	{
+		size_t length = i + 1 < data.size() ? data[i + 1] : 0;
+		if(data[i] != LOG_RECORD_SYNC || length < LOG_RECORD_HEADER || i + 2 + length >= data.size())
+		{
+			putchar(data[i++]);
+			continue;
+		}
+		const uint8_t *payload = &data[i + 2];
+		uint8_t sum = 0;
+		for(size_t k = 0; k < length; k++) sum ^= payload[k];
+		if(sum != data[i + 2 + length])
+		{
+			putchar(data[i++]);
+			continue;
+		}
+
+		uint8_t level = payload[0];
+		uint32_t id, ms;
+		memcpy(&id, payload + 1, 4);
+		memcpy(&ms, payload + 5, 4);
+		const char *tag = level_tags[(level & ~LOG_RECORD_TRUNCATED) ? 1 : 0];
+		printf("; +%u.%03u%s", ms / 1000, ms % 1000, tag);
+		auto it = table.find(id);
+		if(it == table.end())
+		{
+			printf("<unknown format %08x>", id);
+			for(size_t k = LOG_RECORD_HEADER; k < length; k++) printf(" %02x", payload[k]);
+			unknown++;
+		}
+		else fputs(format_record(it->second, reader_t{payload + LOG_RECORD_HEADER, payload + length}).c_str(), stdout);
+		if(level & LOG_RECORD_TRUNCATED) fputs(" <truncated>", stdout);
+		fputs("\r\n", stdout);
+		records++;
+		i += 2 + length + 1;
+	}
+	std::cerr << records << " records decoded, " << unknown << " with unknown format\n";
+	return 0;
+}
+#pragma endregion
+
+int main(int argc, char **argv)
+{
+	if(argc >= 3 && strcmp(argv[1], "scan") == 0) return scan(std::vector<std::string>(argv + 2, argv + argc));
+	if(argc >= 3 && strcmp(argv[1], "decode") == 0) return decode(argv[2], argc > 3 ? argv[3] : "");
+	fprintf(stderr, "usage: %s scan <source dir or file>...\n       %s decode <table> [capture]\n", argv[0], argv[0]);
+	return 2;
+}